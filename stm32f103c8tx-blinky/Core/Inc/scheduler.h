@@ -0,0 +1,90 @@
+/*!
+ * @file   scheduler.h
+ * @brief  Cooperative run-to-completion scheduler with a hashed timer wheel
+ *
+ * Callbacks run one at a time from Scheduler_Run(), never from interrupts.
+ * Interrupt handlers hand work over with Scheduler_Post(), delayed work is
+ * kept in a timer wheel driven by the HAL tick, and the core sleeps (WFI)
+ * whenever there is nothing left to run for the current tick.
+ */
+#ifndef INC_SCHEDULER_H_
+#define INC_SCHEDULER_H_
+
+#include <stdint.h>
+
+/**
+ * Number of wheel slots (power of two). Timers whose expiry tick hashes to the
+ * same slot share a list, so delays longer than the wheel just take more laps.
+ */
+#ifndef SCHEDULER_WHEEL_SIZE
+#define SCHEDULER_WHEEL_SIZE  32
+#endif
+
+/**
+ * Maximum number of pending timers.
+ */
+#ifndef SCHEDULER_MAX_TIMERS
+#define SCHEDULER_MAX_TIMERS  8
+#endif
+
+/**
+ * Maximum number of callbacks posted and not yet run (power of two).
+ */
+#ifndef SCHEDULER_QUEUE_SIZE
+#define SCHEDULER_QUEUE_SIZE  16
+#endif
+
+/**
+ * Tick source in milliseconds and idle hook. Both can be overridden, e.g. to
+ * run the scheduler against a virtual tick.
+ */
+#ifndef SCHEDULER_GET_TICK
+#define SCHEDULER_GET_TICK()  HAL_GetTick()
+#endif
+
+#ifndef SCHEDULER_IDLE
+#define SCHEDULER_IDLE()      __WFI()
+#endif
+
+/**
+ * Scheduler callback.
+ */
+typedef void (*SchedulerCallback)(void* arg);
+
+/*!
+ * @brief Initialize the scheduler. Must be called after HAL_Init().
+ * @return None.
+ */
+void Scheduler_Init(void);
+
+/*!
+ * @brief Queue a callback to run as soon as possible. Safe to call from
+ *        interrupt handlers.
+ *
+ * @param[in] callback Function to run.
+ * @param[in] arg      Argument passed to the callback.
+ * @return    True (1) in case of success, otherwise false (0) if the queue is full.
+ */
+int Scheduler_Post(SchedulerCallback callback, void* arg);
+
+/*!
+ * @brief Run a callback after the given delay. Must not be called from
+ *        interrupt handlers.
+ *
+ * Delays are counted from the tick being processed, so a callback that
+ * re-arms itself with a fixed delay runs periodically without drift.
+ *
+ * @param[in] callback Function to run.
+ * @param[in] arg      Argument passed to the callback.
+ * @param[in] delay    Delay in milliseconds (at least 1).
+ * @return    True (1) in case of success, otherwise false (0) if no timer is free.
+ */
+int Scheduler_PostDelayed(SchedulerCallback callback, void* arg, uint32_t delay);
+
+/*!
+ * @brief Run posted callbacks and expired timers forever, sleeping when idle.
+ * @return Never returns.
+ */
+void Scheduler_Run(void);
+
+#endif // INC_SCHEDULER_H_
@@ -1,4 +1,5 @@
 #include "main.h"
+#include "scheduler.h"
 
 /**
  * @brief System clock configuration.
@@ -12,6 +13,13 @@ void SystemClock_Config(void);
  */
 static void MX_GPIO_Init(void);
 
+/*!
+ * @brief Toggle the led and schedule the next toggle.
+ * @param[in] arg Unused.
+ * @return None.
+ */
+static void blink(void* arg);
+
 /**
  * @brief Application entry point.
  * @return Execution final status.
@@ -27,12 +35,10 @@ int main(void) {
   // Initialize all configured peripherals.
   MX_GPIO_Init();
 
-  // Infinite loop.
-  while (1) {
-    // Blink STM32 Blue Pill's led at 1 Hz.
-    HAL_GPIO_TogglePin(GPIOC, GPIO_PIN_13);
-    HAL_Delay(500);
-  }
+  // Blink STM32 Blue Pill's led at 1 Hz.
+  Scheduler_Init();
+  Scheduler_PostDelayed(blink, NULL, 500);
+  Scheduler_Run();
 }
 
 void SystemClock_Config(void) {
@@ -84,6 +90,11 @@ static void MX_GPIO_Init(void) {
   HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
 }
 
+static void blink(void* arg) {
+  HAL_GPIO_TogglePin(GPIOC, GPIO_PIN_13);
+  Scheduler_PostDelayed(blink, NULL, 500);
+}
+
 void Error_Handler(void) {
   __disable_irq();
   while (1) {
@@ -0,0 +1,157 @@
+/*!
+ * @file   scheduler.c
+ * @brief  Cooperative run-to-completion scheduler with a hashed timer wheel
+ */
+#include "scheduler.h"
+#include "main.h"
+
+#include <stddef.h>
+
+#define WHEEL_MASK (SCHEDULER_WHEEL_SIZE - 1)
+#define QUEUE_MASK (SCHEDULER_QUEUE_SIZE - 1)
+
+/**
+ * Timer wheel entry.
+ */
+typedef struct Timer {
+  SchedulerCallback callback;
+  void* arg;
+  uint32_t expiry;
+  struct Timer* next;
+} Timer;
+
+/**
+ * Posted callback.
+ */
+typedef struct {
+  SchedulerCallback callback;
+  void* arg;
+} Event;
+
+static Timer timers[SCHEDULER_MAX_TIMERS];
+static Timer* free_timers;
+static Timer* wheel[SCHEDULER_WHEEL_SIZE];
+
+// Last tick whose wheel slot has been processed.
+static uint32_t wheel_tick;
+
+// Posted callbacks, written from any context with interrupts masked.
+static Event queue[SCHEDULER_QUEUE_SIZE];
+static volatile uint32_t queue_head;
+static volatile uint32_t queue_tail;
+
+/*!
+ * @brief Run every posted callback.
+ * @return None.
+ */
+static void run_posted(void);
+
+/*!
+ * @brief Process the wheel slots of every tick elapsed since the last call.
+ * @return None.
+ */
+static void run_timers(void);
+
+void Scheduler_Init(void) {
+  int i;
+
+  free_timers = NULL;
+  for (i = 0; i < SCHEDULER_MAX_TIMERS; i++) {
+    timers[i].next = free_timers;
+    free_timers = &timers[i];
+  }
+  for (i = 0; i < SCHEDULER_WHEEL_SIZE; i++) {
+    wheel[i] = NULL;
+  }
+  queue_head = 0;
+  queue_tail = 0;
+  wheel_tick = SCHEDULER_GET_TICK();
+}
+
+int Scheduler_Post(SchedulerCallback callback, void* arg) {
+  uint32_t primask = __get_PRIMASK();
+  int posted = 0;
+
+  __disable_irq();
+  if ((queue_head - queue_tail) < SCHEDULER_QUEUE_SIZE) {
+    queue[queue_head & QUEUE_MASK].callback = callback;
+    queue[queue_head & QUEUE_MASK].arg = arg;
+    queue_head++;
+    posted = 1;
+  }
+  __set_PRIMASK(primask);
+  return posted;
+}
+
+int Scheduler_PostDelayed(SchedulerCallback callback, void* arg, uint32_t delay) {
+  Timer* timer = free_timers;
+
+  if (timer == NULL) {
+    return 0;
+  }
+  free_timers = timer->next;
+
+  timer->callback = callback;
+  timer->arg = arg;
+  timer->expiry = wheel_tick + ((delay != 0) ? delay : 1);
+  timer->next = wheel[timer->expiry & WHEEL_MASK];
+  wheel[timer->expiry & WHEEL_MASK] = timer;
+  return 1;
+}
+
+void Scheduler_Run(void) {
+  while (1) {
+    // Timers first: posted callbacks then count their delays from the
+    // current tick.
+    run_timers();
+    run_posted();
+
+    // Sleep until the next interrupt if nothing is left for this tick. WFI
+    // still wakes up on an interrupt that became pending while masked.
+    __disable_irq();
+    if ((queue_head == queue_tail) && (wheel_tick == SCHEDULER_GET_TICK())) {
+      SCHEDULER_IDLE();
+    }
+    __enable_irq();
+  }
+}
+
+static void run_posted(void) {
+  SchedulerCallback callback;
+  void* arg;
+
+  while (queue_tail != queue_head) {
+    callback = queue[queue_tail & QUEUE_MASK].callback;
+    arg = queue[queue_tail & QUEUE_MASK].arg;
+    queue_tail++;
+    callback(arg);
+  }
+}
+
+static void run_timers(void) {
+  Timer** link;
+  Timer* timer;
+  SchedulerCallback callback;
+  void* arg;
+
+  while (wheel_tick != SCHEDULER_GET_TICK()) {
+    wheel_tick++;
+
+    // Entries of other laps stay in the slot. A callback may re-arm into this
+    // very slot, its entry is pushed at the head with a later expiry.
+    link = &wheel[wheel_tick & WHEEL_MASK];
+    while (*link != NULL) {
+      timer = *link;
+      if (timer->expiry != wheel_tick) {
+        link = &timer->next;
+        continue;
+      }
+      *link = timer->next;
+      callback = timer->callback;
+      arg = timer->arg;
+      timer->next = free_timers;
+      free_timers = timer;
+      callback(arg);
+    }
+  }
+}
@@ -0,0 +1,77 @@
+/*!
+ * @file   matrix.h
+ * @brief  Key matrix scanner with per-key integrator debouncing
+ *
+ * Rows are driven low one at a time on PA0 upwards (open drain) from the TIM2
+ * interrupt, and the columns are read back on PB0 upwards (pulled up) with a
+ * single port read per row. Each row is read one timer period after being
+ * selected, which leaves the lines time to settle. Keys need a diode from
+ * column to row to avoid ghosting.
+ *
+ * Every key has a 2-bit integrator counting up while it reads pressed and down
+ * while it reads released. A key is reported pressed when its integrator
+ * saturates high and released when it reaches zero, so bounces shorter than
+ * MATRIX_DEBOUNCE_SAMPLES scans are filtered out. The integrators of a row are
+ * kept as two 16-bit planes and updated together.
+ *
+ * Key events are passed from the interrupt to the scheduler, which presses and
+ * releases the keys with the keyboard module.
+ */
+#ifndef INC_MATRIX_H_
+#define INC_MATRIX_H_
+
+#include <stdint.h>
+
+/**
+ * Matrix size: up to 8 rows (PA0 to PA7) and 16 columns (PB0 to PB15).
+ */
+#ifndef MATRIX_ROWS
+#define MATRIX_ROWS  8
+#endif
+
+#ifndef MATRIX_COLS
+#define MATRIX_COLS  16
+#endif
+
+/**
+ * Rows scanned per second. The whole matrix is scanned MATRIX_ROW_RATE_HZ /
+ * MATRIX_ROWS times per second (every 250 us by default).
+ */
+#ifndef MATRIX_ROW_RATE_HZ
+#define MATRIX_ROW_RATE_HZ  32000
+#endif
+
+/*
+ * Consecutive scans a key must read the same for its state to change, from
+ * a settled state (integrator range).
+ */
+#define MATRIX_DEBOUNCE_SAMPLES  3
+
+/*!
+ * @brief Configure the row and column pins and start scanning.
+ *
+ * @param[in] keymap Key pressed by each key (see usb_hid_keyboard.h), row by
+ *                   row, MATRIX_ROWS * MATRIX_COLS entries. 0 for no key.
+ * @return    None.
+ */
+void Matrix_Init(const uint8_t* keymap);
+
+/*!
+ * @brief Called from the scheduler for each debounced key event. Presses or
+ *        releases the key from the keymap by default, the application may
+ *        override it (e.g. for layers).
+ *
+ * @param[in] row     Key row.
+ * @param[in] col     Key column.
+ * @param[in] pressed True (1) if the key was pressed, otherwise false (0).
+ * @return    None.
+ */
+void Matrix_KeyCallback(uint8_t row, uint8_t col, int pressed);
+
+/*!
+ * @brief Scan the next row. Called from the TIM2 interrupt.
+ * @return None.
+ */
+void Matrix_IRQHandler(void);
+
+#endif // INC_MATRIX_H_
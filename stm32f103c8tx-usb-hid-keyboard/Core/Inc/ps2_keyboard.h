@@ -0,0 +1,59 @@
+/*!
+ * @file   ps2_keyboard.h
+ * @brief  PS/2 keyboard to USB converter
+ *
+ * The keyboard clock is wired to PA8 and its data to PA9 (both 5 V tolerant,
+ * pulled up). Each falling clock edge raises an EXTI interrupt that samples
+ * the data line and shifts the bit into the current frame (start bit, 8 data
+ * bits LSB first, odd parity, stop bit). The interrupt has the highest
+ * priority and does nothing else, so no edge is missed, even while the USB
+ * interrupt runs. A frame left incomplete for over a millisecond is dropped
+ * and reception restarts on the next start bit.
+ *
+ * Complete scan codes go through a lock-free queue to the scheduler, which
+ * translates the scan code set 2 sequences (including the E0 and E1 extended
+ * sequences) to keyboard, consumer and system control usages. Typematic
+ * repeats are filtered out, the host repeats keys itself. Frames received
+ * with errors and queue overruns are handled like the keyboard's own overrun
+ * code: all keys held are released, rather than risking a stuck key.
+ *
+ * Only the keyboard to host direction is implemented, so the keyboard LEDs
+ * do not follow the host.
+ */
+#ifndef INC_PS2_KEYBOARD_H_
+#define INC_PS2_KEYBOARD_H_
+
+#include <stdint.h>
+
+/**
+ * Usage pages of the translated keys.
+ */
+#define PS2_PAGE_KEYBOARD  0  // Key as defined in usb_hid_keyboard.h.
+#define PS2_PAGE_CONSUMER  1  // Consumer usage (see CONSUMER_* usages).
+#define PS2_PAGE_SYSTEM    2  // System usage (see SYSTEM_* usages).
+
+/*!
+ * @brief Configure the clock and data pins and start receiving scan codes.
+ * @return None.
+ */
+void PS2_Keyboard_Init(void);
+
+/*!
+ * @brief Called from the scheduler for each key pressed or released. Presses or
+ *        releases the key on the USB keyboard by default, the application may
+ *        override it (e.g. to remap keys).
+ *
+ * @param[in] page    Usage page of the key (PS2_PAGE_*).
+ * @param[in] usage   Key or usage in this page.
+ * @param[in] pressed True (1) if the key was pressed, otherwise false (0).
+ * @return    None.
+ */
+void PS2_Keyboard_KeyCallback(uint8_t page, uint16_t usage, int pressed);
+
+/*!
+ * @brief Sample the next bit. Called from the EXTI9_5 interrupt.
+ * @return None.
+ */
+void PS2_Keyboard_IRQHandler(void);
+
+#endif // INC_PS2_KEYBOARD_H_
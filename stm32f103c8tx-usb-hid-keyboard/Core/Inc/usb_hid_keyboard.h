@@ -11,6 +11,8 @@
 
 #include <stdint.h>
 
+#include "usb_hid_keyboard_layout.h"
+
 /**
  * Modifier and non-printable keys.
  */
@@ -65,9 +67,52 @@
 #define KEY_F23          0xFA
 #define KEY_F24          0xFB
 
+/**
+ * Any other key by its HID usage (0x04 to 0x77), independent of the layout.
+ */
+#define KEY_USAGE(usage) (0x88 + (usage))
+
+/**
+ * Keyboard LEDs.
+ */
+#define LED_NUM_LOCK     0x01
+#define LED_CAPS_LOCK    0x02
+#define LED_SCROLL_LOCK  0x04
+#define LED_COMPOSE      0x08
+#define LED_KANA         0x10
+
+/**
+ * Consumer control usages (media keys).
+ */
+#define CONSUMER_SCAN_NEXT        0x00B5
+#define CONSUMER_SCAN_PREVIOUS    0x00B6
+#define CONSUMER_STOP             0x00B7
+#define CONSUMER_PLAY_PAUSE       0x00CD
+#define CONSUMER_MUTE             0x00E2
+#define CONSUMER_VOLUME_UP        0x00E9
+#define CONSUMER_VOLUME_DOWN      0x00EA
+#define CONSUMER_MEDIA_SELECT     0x0183
+#define CONSUMER_MAIL             0x018A
+#define CONSUMER_CALCULATOR       0x0192
+#define CONSUMER_BROWSER_SEARCH   0x0221
+#define CONSUMER_BROWSER_HOME     0x0223
+#define CONSUMER_BROWSER_BACK     0x0224
+#define CONSUMER_BROWSER_FORWARD  0x0225
+
+/**
+ * System control usages.
+ */
+#define SYSTEM_POWER_DOWN  0x81
+#define SYSTEM_SLEEP       0x82
+#define SYSTEM_WAKE_UP     0x83
+
 /*!
  * @brief Press and release the given key.
  *
+ * The keyboard functions never wait for the host: when the report queue is
+ * full they fail without changing the keys held, and the caller tries again
+ * later (see USB_HID_Keyboard_QueueSpace()).
+ *
  * @param[in] key Key to tap.
  * @return    True (1) in case of success, otherwise false (0).
  */
@@ -96,12 +141,134 @@ int USB_HID_Keyboard_Release(uint8_t key);
 int USB_HID_Keyboard_ReleaseAll(void);
 
 /*!
- * @brief Tap multiple keys one after another.
+ * @brief Type UTF-8 text with the current layout.
+ *
+ * Each key takes a single report when it differs from the previous one and
+ * needs the same modifiers. A release report is only inserted between repeated
+ * keys, modifier changes and after the last key, which roughly halves the
+ * reports needed for ordinary text. Characters behind a dead key are typed as
+ * the dead key followed by the base character. Letters keep their case when
+ * the host has Caps Lock on. Modifier and non-printing keys must be sent with
+ * USB_HID_Keyboard_Tap().
  *
- * @param[in] keys Keys to tap.
+ * @param[in] keys UTF-8 text to type.
  * @param[in] size Buffer length in bytes.
- * @return    Bytes sent.
+ * @return    Bytes sent, up to the first character that can't be typed or
+ *            doesn't fit in the report queue.
  */
 int USB_HID_Keyboard_Write(uint8_t* keys, int size);
 
+/*!
+ * @brief Type part of a text, like USB_HID_Keyboard_Write() but leaving the
+ *        last key pressed. The next part goes on as if typed in the same call,
+ *        so a text typed in parts takes no more reports than typed at once.
+ *
+ * @param[in] keys UTF-8 text to type.
+ * @param[in] size Buffer length in bytes.
+ * @return    Bytes sent, up to the first character that can't be typed or
+ *            doesn't fit in the report queue.
+ */
+int USB_HID_Keyboard_WritePart(uint8_t* keys, int size);
+
+/*!
+ * @brief Release the last key of a text typed with USB_HID_Keyboard_WritePart().
+ *        A slot is always left free for it, unless other keys took it since.
+ * @return True (1) in case of success, otherwise false (0).
+ */
+int USB_HID_Keyboard_WriteEnd(void);
+
+/*!
+ * @brief Get the number of keyboard reports that can be queued without
+ *        waiting for the host.
+ * @return Free report queue slots.
+ */
+int USB_HID_Keyboard_QueueSpace(void);
+
+/*!
+ * @brief Press a consumer control (media) key. Only one consumer key is held
+ *        at a time, pressing another one replaces it.
+ *
+ * Consumer and system keys have their own queues and are sent ahead of
+ * pending keyboard reports, so they are not delayed by text being typed.
+ * They are dropped while the host uses the boot protocol.
+ *
+ * @param[in] usage Consumer usage to press (see CONSUMER_* usages).
+ * @return    True (1) in case of success, otherwise false (0).
+ */
+int USB_HID_Keyboard_ConsumerPress(uint16_t usage);
+
+/*!
+ * @brief Release the consumer control key.
+ * @return True (1) in case of success, otherwise false (0).
+ */
+int USB_HID_Keyboard_ConsumerRelease(void);
+
+/*!
+ * @brief Press and release a consumer control key.
+ *
+ * @param[in] usage Consumer usage to tap (see CONSUMER_* usages).
+ * @return    True (1) in case of success, otherwise false (0).
+ */
+int USB_HID_Keyboard_ConsumerTap(uint16_t usage);
+
+/*!
+ * @brief Get the number of consumer key changes that can be queued without
+ *        waiting for the host.
+ * @return Free consumer queue slots.
+ */
+int USB_HID_Keyboard_ConsumerQueueSpace(void);
+
+/*!
+ * @brief Press a system control key, replacing any one held.
+ *
+ * @param[in] usage System usage to press (see SYSTEM_* usages).
+ * @return    True (1) in case of success, otherwise false (0).
+ */
+int USB_HID_Keyboard_SystemPress(uint8_t usage);
+
+/*!
+ * @brief Release the system control key.
+ * @return True (1) in case of success, otherwise false (0).
+ */
+int USB_HID_Keyboard_SystemRelease(void);
+
+/*!
+ * @brief Press and release a system control key.
+ *
+ * @param[in] usage System usage to tap (see SYSTEM_* usages).
+ * @return    True (1) in case of success, otherwise false (0).
+ */
+int USB_HID_Keyboard_SystemTap(uint8_t usage);
+
+/*!
+ * @brief Get the number of system key changes that can be queued without
+ *        waiting for the host.
+ * @return Free system queue slots.
+ */
+int USB_HID_Keyboard_SystemQueueSpace(void);
+
+/*!
+ * @brief Get the LED states last set by the host.
+ * @return LEDs bitwise OR combination.
+ */
+uint8_t USB_HID_Keyboard_GetLeds(void);
+
+/*!
+ * @brief Called from the USB interrupt each time the host sets the LEDs. Does
+ *        nothing by default, the application may override it.
+ *
+ * @param[in] leds LEDs bitwise OR combination.
+ * @return    None.
+ */
+void USB_HID_Keyboard_LedsCallback(uint8_t leds);
+
+/*!
+ * @brief Select the layout used to type printing keys and text. It must
+ *        match the layout configured on the host.
+ *
+ * @param[in] layout Keyboard layout (KEYBOARD_LAYOUT_US by default).
+ * @return    True (1) in case of success, otherwise false (0).
+ */
+int USB_HID_Keyboard_SetLayout(uint8_t layout);
+
 #endif // INC_USB_HID_KEYBOARD_H_
@@ -0,0 +1,44 @@
+/*!
+ * @file   usb_hid_keyboard_layout.h
+ * @brief  Keyboard layouts, mapping Unicode code points to HID key strokes
+ *
+ * Each layout is a constant table indexed by code point (U+0000 to U+00FF),
+ * built at compile time from designated initializers, so a lookup is a single
+ * array access. Characters typed with a dead key (e.g. circumflex vowels on a
+ * German layout) resolve to the dead key stroke followed by the base stroke.
+ */
+#ifndef INC_USB_HID_KEYBOARD_LAYOUT_H_
+#define INC_USB_HID_KEYBOARD_LAYOUT_H_
+
+#include <stdint.h>
+
+/*
+ * Keyboard layouts.
+ */
+#define KEYBOARD_LAYOUT_US     0
+#define KEYBOARD_LAYOUT_UK     1
+#define KEYBOARD_LAYOUT_DE     2
+#define KEYBOARD_LAYOUT_FR     3
+#define KEYBOARD_LAYOUT_ES     4
+#define KEYBOARD_LAYOUT_COUNT  5
+
+/*
+ * Key stroke: HID usage and the modifiers held with it.
+ */
+typedef struct {
+  uint8_t usage;
+  uint8_t modifiers;
+} KeyStroke;
+
+/*!
+ * @brief Find the key strokes typing a code point on a layout.
+ *
+ * @param[in]  layout     Keyboard layout.
+ * @param[in]  code_point Unicode code point.
+ * @param[out] strokes    Key strokes to type, in order (room for 2).
+ * @return     Number of strokes (1, or 2 with a dead key), otherwise 0 if the
+ *             code point can't be typed on this layout.
+ */
+int USB_HID_Keyboard_LayoutLookup(uint8_t layout, uint32_t code_point, KeyStroke* strokes);
+
+#endif // INC_USB_HID_KEYBOARD_LAYOUT_H_
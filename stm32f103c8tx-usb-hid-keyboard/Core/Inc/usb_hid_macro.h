@@ -0,0 +1,91 @@
+/*!
+ * @file   usb_hid_macro.h
+ * @brief  Keystroke macros, run from a compact bytecode
+ *
+ * A macro is a sequence of instructions, each an opcode byte followed by its
+ * operands (multi-byte operands are little endian):
+ *
+ *   MACRO_OP_END                               End of the macro.
+ *   MACRO_OP_PRESS       key                   Press a key (see usb_hid_keyboard.h).
+ *   MACRO_OP_RELEASE     key                   Release a key.
+ *   MACRO_OP_TAP         key                   Press and release a key.
+ *   MACRO_OP_RELEASE_ALL                       Release all keys.
+ *   MACRO_OP_STRING      length, text[length]  Type UTF-8 text with the current layout.
+ *   MACRO_OP_DELAY       frames (16 bits)      Wait for the given number of USB frames (1 ms).
+ *   MACRO_OP_REPEAT      count (16 bits)       Run the instructions up to the matching
+ *                                              MACRO_OP_LOOP count times (at least 1).
+ *   MACRO_OP_LOOP                              End of a repeated block.
+ *   MACRO_OP_MOUSE_MOVE  x, y (16 bits), wheel Move the mouse pointer and wheel (signed).
+ *
+ * Macros run from the scheduler and only queue as many reports as the keyboard
+ * report queue can take, so they never block the caller or other tasks.
+ *
+ * Stored macros live in the MACROS flash region (see the linker script), as
+ * an image flashed separately from the firmware:
+ *
+ *   magic (32 bits, MACRO_IMAGE_MAGIC), count (16 bits),
+ *   offset of each macro from the image start (16 bits each), macros.
+ */
+#ifndef INC_USB_HID_MACRO_H_
+#define INC_USB_HID_MACRO_H_
+
+#include <stdint.h>
+
+/*
+ * Opcodes.
+ */
+#define MACRO_OP_END          0x00
+#define MACRO_OP_PRESS        0x01
+#define MACRO_OP_RELEASE      0x02
+#define MACRO_OP_TAP          0x03
+#define MACRO_OP_RELEASE_ALL  0x04
+#define MACRO_OP_STRING       0x05
+#define MACRO_OP_DELAY        0x06
+#define MACRO_OP_REPEAT       0x07
+#define MACRO_OP_LOOP         0x08
+#define MACRO_OP_MOUSE_MOVE   0x09
+
+/*
+ * Magic number at the start of a stored macro image ("MCRO").
+ */
+#define MACRO_IMAGE_MAGIC  0x4F52434D
+
+/**
+ * Maximum nesting of repeated blocks.
+ */
+#ifndef MACRO_REPEAT_DEPTH
+#define MACRO_REPEAT_DEPTH  4
+#endif
+
+/*!
+ * @brief Start running a macro. The bytecode must stay valid until it ends.
+ *
+ * @param[in] code Macro bytecode.
+ * @param[in] size Bytecode size in bytes.
+ * @return    True (1) in case of success, otherwise false (0) if a macro is
+ *            already running.
+ */
+int USB_HID_Macro_Run(const uint8_t* code, uint32_t size);
+
+/*!
+ * @brief Start running a macro from the stored macro image.
+ *
+ * @param[in] index Macro index in the image.
+ * @return    True (1) in case of success, otherwise false (0) if there is no
+ *            such macro or a macro is already running.
+ */
+int USB_HID_Macro_RunStored(uint16_t index);
+
+/*!
+ * @brief Stop the running macro, if any, and release all keys.
+ * @return None.
+ */
+void USB_HID_Macro_Stop(void);
+
+/*!
+ * @brief Check whether a macro is running.
+ * @return True (1) if a macro is running, otherwise false (0).
+ */
+int USB_HID_Macro_IsRunning(void);
+
+#endif // INC_USB_HID_MACRO_H_
@@ -0,0 +1,92 @@
+/*!
+ * @file   usb_hid_mouse.h
+ * @brief  Module to use the microcontroller as an USB Mouse
+ * @author Javier Balloffet <javier.balloffet@gmail.com>
+ * @date   Jul 9, 2020
+ *
+ * Note: Based on Arduino's Mouse library (see https://github.com/arduino-libraries/Mouse).
+ */
+#ifndef INC_USB_HID_MOUSE_H_
+#define INC_USB_HID_MOUSE_H_
+
+#include <stdint.h>
+
+/*
+ * Mouse buttons.
+ */
+#define BUTTON_LEFT    0x01
+#define BUTTON_RIGHT   0x02
+#define BUTTON_MIDDLE  0x04
+
+/*
+ * Motion source. Called from the USB interrupt when no other motion is queued,
+ * to fill one report. Returns true (1) with the motion to send, otherwise
+ * false (0) when it has nothing to send.
+ */
+typedef int (*USB_HID_Mouse_MotionSource)(int32_t* x, int32_t* y);
+
+/*!
+ * @brief Press and release the given buttons.
+ *
+ * The mouse functions never wait for the host: when the segment queue is full
+ * they fail without changing the buttons held, and the caller tries again
+ * later (see USB_HID_Mouse_QueueSpace()). Moves with the same buttons are
+ * added to the last segment and always fit.
+ *
+ * @param[in] buttons Buttons to click (buttons bitwise OR combination).
+ * @return    True (1) in case of success, otherwise false (0).
+ */
+int USB_HID_Mouse_Click(uint8_t buttons);
+
+/*!
+ * @brief Press the given buttons.
+ *
+ * @param[in] buttons Buttons to press (buttons bitwise OR combination).
+ * @return    True (1) in case of success, otherwise false (0).
+ */
+int USB_HID_Mouse_Press(uint8_t buttons);
+
+/*!
+ * @brief Release the given buttons.
+ *
+ * @param[in] buttons Buttons to release (buttons bitwise OR combination).
+ * @return    True (1) in case of success, otherwise false (0).
+ */
+int USB_HID_Mouse_Release(uint8_t buttons);
+
+/*!
+ * @brief Release all buttons.
+ * @return True (1) in case of success, otherwise false (0).
+ */
+int USB_HID_Mouse_ReleaseAll(void);
+
+/*!
+ * @brief Move mouse pointer and wheel (relative movement from current position).
+ *
+ * Moves are accumulated until the host polls and large moves are split over
+ * several reports, so any distance can be given and never blocks.
+ *
+ * @param[in] x Indicates the pointer movement along the x axis (Positive values move the pointer to the right).
+ * @param[in] y Indicates the pointer movement along the y axis (Positive values move the pointer downwards).
+ * @param[in] wheel Indicates the wheel rotation (Positive values rotate the wheel away from the user).
+ * @return    True (1) in case of success, otherwise false (0).
+ */
+int USB_HID_Mouse_Move(int32_t x, int32_t y, int32_t wheel);
+
+/*!
+ * @brief Get the number of button changes that can be queued without waiting
+ *        for the host.
+ * @return Free segment queue slots.
+ */
+int USB_HID_Mouse_QueueSpace(void);
+
+/*!
+ * @brief Set the source pulled for motion whenever the host polls and nothing
+ *        else is queued, and start polling it.
+ *
+ * @param[in] source Motion source, or NULL to remove it.
+ * @return    None.
+ */
+void USB_HID_Mouse_SetMotionSource(USB_HID_Mouse_MotionSource source);
+
+#endif // INC_USB_HID_MOUSE_H_
@@ -0,0 +1,98 @@
+/*!
+ * @file   usb_hid_recorder.h
+ * @brief  Recording and frame-accurate replay of the reports sent to the host
+ *
+ * The recorder logs every keyboard and mouse report handed to the USB
+ * endpoints, timestamped with the USB frame (1 ms) it was sent in, into a RAM
+ * ring that keeps the latest reports. A recording can then be flushed to the
+ * RECORDING flash region (see the linker script) and replayed: the replayer
+ * sends each report from the start of frame interrupt, the same number of
+ * frames after the previous one as when it was recorded.
+ *
+ * Each recorded report is stored as:
+ *
+ *   frames since the previous report (unsigned LEB128, 1 byte below 128),
+ *   endpoint number, report length, report bytes.
+ *
+ * A flushed recording starts with RECORDING_MAGIC and the size of the
+ * recorded reports (32 bits each, little endian).
+ */
+#ifndef INC_USB_HID_RECORDER_H_
+#define INC_USB_HID_RECORDER_H_
+
+#include <stdint.h>
+
+/*
+ * Magic number at the start of a flushed recording ("HREC").
+ */
+#define RECORDING_MAGIC  0x43455248
+
+/**
+ * Size of the RAM ring in bytes (power of two).
+ */
+#ifndef RECORDER_BUFFER_SIZE
+#define RECORDER_BUFFER_SIZE  2048
+#endif
+
+/*!
+ * @brief Start a new recording, discarding the reports in the RAM ring.
+ * @return True (1) in case of success, otherwise false (0) while replaying.
+ */
+int USB_HID_Recorder_Start(void);
+
+/*!
+ * @brief Stop recording.
+ * @return None.
+ */
+void USB_HID_Recorder_Stop(void);
+
+/*!
+ * @brief Get the size of the recorded reports in the RAM ring.
+ * @return Size in bytes.
+ */
+uint32_t USB_HID_Recorder_GetSize(void);
+
+/*!
+ * @brief Write the recorded reports to the RECORDING flash region.
+ *
+ * The CPU stalls while the flash is erased and programmed (about 20 ms per
+ * KB), so the host may see a few late polls.
+ *
+ * @return True (1) in case of success, otherwise false (0) while recording or
+ *         if the flash can't be written.
+ */
+int USB_HID_Recorder_Flush(void);
+
+/*!
+ * @brief Start replaying recorded reports.
+ *
+ * Replayed reports bypass the keyboard and mouse modules, which should stay
+ * idle meanwhile. The host must use the same protocol as when recording.
+ *
+ * @param[in] data Recorded reports. Must stay valid until the replay ends.
+ * @param[in] size Size in bytes.
+ * @return    True (1) in case of success, otherwise false (0) while recording
+ *            or replaying.
+ */
+int USB_HID_Replayer_Start(const uint8_t* data, uint32_t size);
+
+/*!
+ * @brief Start replaying the recording flushed to flash.
+ * @return True (1) in case of success, otherwise false (0) if there is no
+ *         recording or it can't be replayed now.
+ */
+int USB_HID_Replayer_StartStored(void);
+
+/*!
+ * @brief Stop replaying.
+ * @return None.
+ */
+void USB_HID_Replayer_Stop(void);
+
+/*!
+ * @brief Check whether a replay is running.
+ * @return True (1) if replaying, otherwise false (0).
+ */
+int USB_HID_Replayer_IsRunning(void);
+
+#endif // INC_USB_HID_RECORDER_H_
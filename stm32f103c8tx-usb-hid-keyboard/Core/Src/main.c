@@ -1,6 +1,11 @@
 #include "main.h"
 #include "usb_device.h"
 #include "usb_hid_keyboard.h"
+#include "usb_hid_mouse.h"
+#include "usb_hid_macro.h"
+#include "matrix.h"
+#include "ps2_keyboard.h"
+#include "scheduler.h"
 
 /**
  * @brief System clock configuration.
@@ -14,11 +19,57 @@ void SystemClock_Config(void);
  */
 static void MX_GPIO_Init(void);
 
+/*
+ * Macro typed by test_keyboard() when no macro image has been flashed.
+ */
+static const uint8_t test_macro[] = {
+  MACRO_OP_STRING, 14, 'H', 'e', 'l', 'l', 'o', ',', ' ', 'w', 'o', 'r', 'l', 'd', '!', '\n',
+  MACRO_OP_STRING, 10, 'S', 'e', 'n', 't', ' ', 'f', 'r', 'o', 'm', ' ',
+  MACRO_OP_PRESS, KEY_LEFT_SHIFT,
+  MACRO_OP_STRING, 3, 's', 't', 'm',
+  MACRO_OP_RELEASE, KEY_LEFT_SHIFT,
+  MACRO_OP_STRING, 4, '3', '2', '.', '\n',
+  MACRO_OP_RELEASE_ALL,
+  // Move the pointer 100 counts right and back.
+  MACRO_OP_MOUSE_MOVE, 0x64, 0x00, 0x00, 0x00, 0x00,
+  MACRO_OP_MOUSE_MOVE, 0x9C, 0xFF, 0x00, 0x00, 0x00,
+  MACRO_OP_END
+};
+
+/*
+ * Keymap of the key matrix: a US ANSI style layout on the first six rows.
+ */
+static const uint8_t keymap[MATRIX_ROWS * MATRIX_COLS] = {
+  KEY_ESC, KEY_F1, KEY_F2, KEY_F3, KEY_F4, KEY_F5, KEY_F6, KEY_F7,
+  KEY_F8, KEY_F9, KEY_F10, KEY_F11, KEY_F12, KEY_INSERT, KEY_DELETE, KEY_HOME,
+  // ` 1 2 3 4 5 6 7 8 9 0 - =
+  KEY_USAGE(0x35), KEY_USAGE(0x1E), KEY_USAGE(0x1F), KEY_USAGE(0x20), KEY_USAGE(0x21), KEY_USAGE(0x22),
+  KEY_USAGE(0x23), KEY_USAGE(0x24), KEY_USAGE(0x25), KEY_USAGE(0x26), KEY_USAGE(0x27), KEY_USAGE(0x2D),
+  KEY_USAGE(0x2E), KEY_BACKSPACE, KEY_PAGE_UP, KEY_END,
+  // q w e r t y u i o p [ ] and backslash
+  KEY_TAB, KEY_USAGE(0x14), KEY_USAGE(0x1A), KEY_USAGE(0x08), KEY_USAGE(0x15), KEY_USAGE(0x17),
+  KEY_USAGE(0x1C), KEY_USAGE(0x18), KEY_USAGE(0x0C), KEY_USAGE(0x12), KEY_USAGE(0x13), KEY_USAGE(0x2F),
+  KEY_USAGE(0x30), KEY_USAGE(0x31), KEY_PAGE_DOWN, 0,
+  // a s d f g h j k l ; '
+  KEY_CAPS_LOCK, KEY_USAGE(0x04), KEY_USAGE(0x16), KEY_USAGE(0x07), KEY_USAGE(0x09), KEY_USAGE(0x0A),
+  KEY_USAGE(0x0B), KEY_USAGE(0x0D), KEY_USAGE(0x0E), KEY_USAGE(0x0F), KEY_USAGE(0x33), KEY_USAGE(0x34),
+  KEY_RETURN, 0, 0, 0,
+  // z x c v b n m , . /
+  KEY_LEFT_SHIFT, KEY_USAGE(0x1D), KEY_USAGE(0x1B), KEY_USAGE(0x06), KEY_USAGE(0x19), KEY_USAGE(0x05),
+  KEY_USAGE(0x11), KEY_USAGE(0x10), KEY_USAGE(0x36), KEY_USAGE(0x37), KEY_USAGE(0x38), KEY_RIGHT_SHIFT,
+  KEY_UP_ARROW, 0, 0, 0,
+  // Space
+  KEY_LEFT_CTRL, KEY_LEFT_GUI, KEY_LEFT_ALT, KEY_USAGE(0x2C), KEY_RIGHT_ALT, KEY_RIGHT_GUI,
+  KEY_RIGHT_CTRL, KEY_LEFT_ARROW, KEY_DOWN_ARROW, KEY_RIGHT_ARROW, 0, 0,
+  0, 0, 0, 0,
+};
+
 /*!
- * @brief Simple function to test USB HID keyboard behaviour.
+ * @brief Simple function to test USB HID keyboard and mouse behaviour, run every second.
+ * @param[in] arg Unused.
  * @return None.
  */
-static void test_keyboard(void);
+static void test_keyboard(void* arg);
 
 /**
  * @brief Application entry point.
@@ -36,11 +87,11 @@ int main(void) {
   MX_GPIO_Init();
   MX_USB_DEVICE_Init();
 
-  // Infinite loop.
-  while (1) {
-    test_keyboard();
-    HAL_Delay(1000);
-  }
+  Scheduler_Init();
+  Matrix_Init(keymap);
+  PS2_Keyboard_Init();
+  Scheduler_PostDelayed(test_keyboard, NULL, 1000);
+  Scheduler_Run();
 }
 
 void SystemClock_Config(void) {
@@ -91,19 +142,13 @@ void Error_Handler(void) {
   }
 }
 
-static void test_keyboard(void) {
-  USB_HID_Keyboard_Write((uint8_t*) "Hello, world!\n", 14);
-  USB_HID_Keyboard_Write((uint8_t*) "Sent from ", 10);
-  USB_HID_Keyboard_Press(KEY_LEFT_SHIFT);
-  USB_HID_Keyboard_Tap('s');
-  USB_HID_Keyboard_Tap('t');
-  USB_HID_Keyboard_Tap('m');
-  USB_HID_Keyboard_Release(KEY_LEFT_SHIFT);
-  USB_HID_Keyboard_Tap('3');
-  USB_HID_Keyboard_Tap('2');
-  USB_HID_Keyboard_Tap('.');
-  USB_HID_Keyboard_Tap('\n');
-  USB_HID_Keyboard_ReleaseAll();
+static void test_keyboard(void* arg) {
+  // Run the first stored macro, or the test macro if no image was flashed.
+  if (!USB_HID_Macro_IsRunning() && !USB_HID_Macro_RunStored(0)) {
+    USB_HID_Macro_Run(test_macro, sizeof(test_macro));
+  }
+
+  Scheduler_PostDelayed(test_keyboard, NULL, 1000);
 }
 
 #ifdef  USE_FULL_ASSERT
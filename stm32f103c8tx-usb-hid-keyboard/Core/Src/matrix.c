@@ -0,0 +1,215 @@
+/*!
+ * @file   matrix.c
+ * @brief  Key matrix scanner with per-key integrator debouncing
+ */
+#include "matrix.h"
+#include "main.h"
+#include "scheduler.h"
+#include "usb_hid_keyboard.h"
+
+#include <stddef.h>
+
+#if (MATRIX_ROWS < 1) || (MATRIX_ROWS > 8) || (MATRIX_COLS < 1) || (MATRIX_COLS > 16)
+#error "The matrix must have 1 to 8 rows and 1 to 16 columns"
+#endif
+
+#define ROW_PINS    ((1U << MATRIX_ROWS) - 1)
+#define COL_PINS    ((1U << MATRIX_COLS) - 1)
+
+/*
+ * Event queue size (must be a power of two).
+ */
+#define EVENT_QUEUE_SIZE 32
+
+/*
+ * Key event: pressed flag, row and column packed in a byte.
+ */
+#define EVENT(row, col, pressed)  ((uint8_t) (((pressed) << 7) | ((row) << 4) | (col)))
+#define EVENT_PRESSED(event)      (((event) >> 7) & 0x01)
+#define EVENT_ROW(event)          (((event) >> 4) & 0x07)
+#define EVENT_COL(event)          ((event) & 0x0F)
+
+/*
+ * Debouncer state of a row, one bit per column: integrator bit planes (0 to
+ * 3, low and high bits) and debounced state.
+ */
+typedef struct {
+  uint16_t count_low;
+  uint16_t count_high;
+  uint16_t state;
+} RowDebouncer;
+
+static RowDebouncer debouncers[MATRIX_ROWS];
+
+/*
+ * Row being strobed.
+ */
+static uint8_t current_row;
+
+/*
+ * Keymap given to Matrix_Init().
+ */
+static const uint8_t* matrix_keymap;
+
+/*
+ * Key events, written from the timer interrupt and read from the scheduler.
+ */
+static uint8_t event_queue[EVENT_QUEUE_SIZE];
+static volatile uint32_t event_queue_head;
+static volatile uint32_t event_queue_tail;
+static volatile uint8_t events_posted;
+
+/*!
+ * @brief Debounce a row and queue its key events. Called from the timer interrupt.
+ *
+ * @param[in] row     Row.
+ * @param[in] pressed Keys read pressed, one bit per column.
+ * @return    None.
+ */
+static void debounce_row(uint8_t row, uint16_t pressed);
+
+/*!
+ * @brief Hand the queued key events to Matrix_KeyCallback(). Scheduler callback.
+ *
+ * @param[in] arg Unused.
+ * @return    None.
+ */
+static void process_events(void* arg);
+
+void Matrix_Init(const uint8_t* keymap) {
+  GPIO_InitTypeDef GPIO_InitStruct = {0};
+  uint32_t timer_clock;
+
+  matrix_keymap = keymap;
+
+  // Rows: open drain, released (high) except the one being scanned.
+  __HAL_RCC_GPIOA_CLK_ENABLE();
+  __HAL_RCC_GPIOB_CLK_ENABLE();
+  GPIOA->BSRR = ROW_PINS;
+  GPIO_InitStruct.Pin = ROW_PINS;
+  GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_OD;
+  GPIO_InitStruct.Pull = GPIO_NOPULL;
+  GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+  HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
+
+  // Columns: pulled up, read low through a pressed key.
+  GPIO_InitStruct.Pin = COL_PINS;
+  GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+  GPIO_InitStruct.Pull = GPIO_PULLUP;
+  HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+  current_row = 0;
+  GPIOA->BSRR = (1U << 16);
+
+  // TIM2 runs at twice the APB1 clock when APB1 is divided.
+  timer_clock = HAL_RCC_GetPCLK1Freq();
+  if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1) {
+    timer_clock *= 2;
+  }
+
+  __HAL_RCC_TIM2_CLK_ENABLE();
+  TIM2->PSC = 0;
+  TIM2->ARR = (timer_clock / MATRIX_ROW_RATE_HZ) - 1;
+  TIM2->EGR = TIM_EGR_UG;
+  TIM2->SR = 0;
+  TIM2->DIER = TIM_DIER_UIE;
+  HAL_NVIC_SetPriority(TIM2_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(TIM2_IRQn);
+  TIM2->CR1 = TIM_CR1_CEN;
+}
+
+__weak void Matrix_KeyCallback(uint8_t row, uint8_t col, int pressed) {
+  uint8_t key;
+
+  if (matrix_keymap == NULL) {
+    return;
+  }
+  key = matrix_keymap[(row * MATRIX_COLS) + col];
+  if (key == 0) {
+    return;
+  }
+  if (pressed) {
+    USB_HID_Keyboard_Press(key);
+  } else {
+    USB_HID_Keyboard_Release(key);
+  }
+}
+
+void Matrix_IRQHandler(void) {
+  uint16_t pressed;
+
+  TIM2->SR = ~TIM_SR_UIF;
+
+  // The current row was selected one period ago and has settled.
+  pressed = (uint16_t) (~GPIOB->IDR & COL_PINS);
+  debounce_row(current_row, pressed);
+
+  // Release the row and select the next one.
+  GPIOA->BSRR = (1U << current_row);
+  current_row = (current_row + 1) % MATRIX_ROWS;
+  GPIOA->BSRR = (1U << (current_row + 16));
+}
+
+static void debounce_row(uint8_t row, uint16_t pressed) {
+  RowDebouncer* debouncer = &debouncers[row];
+  uint16_t low = debouncer->count_low;
+  uint16_t high = debouncer->count_high;
+  uint16_t up = pressed & ~(low & high);
+  uint16_t down = ~pressed & (low | high);
+  uint16_t state;
+  uint16_t changed;
+  uint32_t head;
+  int col;
+
+  // Count up or down, saturating at 3 and 0. The high bit flips on a carry
+  // (low bit set when counting up) or a borrow (low bit clear when counting down).
+  high ^= (up & low) | (down & ~low);
+  low ^= up | down;
+  debouncer->count_low = low;
+  debouncer->count_high = high;
+
+  // Pressed once saturated high, released once back to 0.
+  state = (debouncer->state | (low & high)) & (low | high);
+  changed = state ^ debouncer->state;
+  if (changed == 0) {
+    return;
+  }
+
+  head = event_queue_head;
+  for (col = 0; col < MATRIX_COLS; col++) {
+    if (!(changed & (1U << col))) {
+      continue;
+    }
+    if ((head - event_queue_tail) >= EVENT_QUEUE_SIZE) {
+      // Queue full, keep the old state so the change is seen on the next scan.
+      state ^= (1U << col);
+      continue;
+    }
+    event_queue[head & (EVENT_QUEUE_SIZE - 1)] = EVENT(row, col, (state >> col) & 0x01);
+    head++;
+  }
+  event_queue_head = head;
+  debouncer->state = state;
+
+  if (!events_posted) {
+    events_posted = Scheduler_Post(process_events, NULL);
+  }
+}
+
+static void process_events(void* arg) {
+  uint8_t event;
+
+  // Cleared first, so events queued from now on post again.
+  events_posted = 0;
+  while (event_queue_tail != event_queue_head) {
+    if (USB_HID_Keyboard_QueueSpace() == 0) {
+      // The host has not polled the pending reports yet. Leave the events
+      // queued and try again on the next frame, rather than wait here.
+      events_posted = Scheduler_PostDelayed(process_events, NULL, 1);
+      return;
+    }
+    event = event_queue[event_queue_tail & (EVENT_QUEUE_SIZE - 1)];
+    event_queue_tail++;
+    Matrix_KeyCallback(EVENT_ROW(event), EVENT_COL(event), EVENT_PRESSED(event));
+  }
+}
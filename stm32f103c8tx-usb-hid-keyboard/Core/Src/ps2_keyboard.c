@@ -0,0 +1,557 @@
+/*!
+ * @file   ps2_keyboard.c
+ * @brief  PS/2 keyboard to USB converter
+ */
+#include "ps2_keyboard.h"
+#include "main.h"
+#include "scheduler.h"
+#include "usb_hid_keyboard.h"
+
+#include <stddef.h>
+
+#define CLOCK_PORT  GPIOA
+#define CLOCK_PIN   GPIO_PIN_8
+#define DATA_PORT   GPIOA
+#define DATA_PIN    GPIO_PIN_9
+
+/*
+ * Frame: start bit, 8 data bits, parity bit and stop bit.
+ */
+#define FRAME_BITS  11
+
+/*
+ * Scan code queue size (must be a power of two).
+ */
+#define CODE_QUEUE_SIZE 16
+
+/*
+ * Scan codes and prefixes of scan code set 2.
+ */
+#define CODE_OVERRUN      0x00
+#define CODE_SELF_TEST    0xAA
+#define CODE_ECHO         0xEE
+#define CODE_EXTENDED     0xE0
+#define CODE_PAUSE        0xE1
+#define CODE_BREAK        0xF0
+#define CODE_ACK          0xFA
+#define CODE_FAILURE_1    0xFC
+#define CODE_FAILURE_2    0xFD
+#define CODE_RESEND       0xFE
+#define CODE_ERROR        0xFF
+
+/*
+ * Bytes following E1 in the Pause sequence (E1 14 77 E1 F0 14 F0 77). Pause
+ * has no break sequence, it is pressed and released at once.
+ */
+#define PAUSE_SEQUENCE_SIZE 7
+
+/*
+ * Key identifiers: scan code, plus 0x100 for E0 codes.
+ */
+#define KEY_ID_EXTENDED  0x100
+#define KEY_IDS          0x200
+
+/*
+ * Keyboard reports a scan code may take (the pause key press and release).
+ */
+#define REPORTS_PER_CODE 2
+
+/*
+ * Extended (E0) key translation.
+ */
+typedef struct {
+  uint8_t code;
+  uint8_t page;
+  uint16_t usage;
+} ExtendedKey;
+
+/*
+ * Keys of the single byte scan codes. Keys whose usage can't be sent by the
+ * keyboard module (above 0x77, e.g. the Japanese keys) are left out.
+ */
+static const uint8_t keys[] = {
+  [0x01] = KEY_F9,
+  [0x03] = KEY_F5,
+  [0x04] = KEY_F3,
+  [0x05] = KEY_F1,
+  [0x06] = KEY_F2,
+  [0x07] = KEY_F12,
+  [0x08] = KEY_F13,
+  [0x09] = KEY_F10,
+  [0x0A] = KEY_F8,
+  [0x0B] = KEY_F6,
+  [0x0C] = KEY_F4,
+  [0x0D] = KEY_TAB,
+  [0x0E] = KEY_USAGE(0x35),  // `
+  [0x0F] = KEY_F14,
+  [0x10] = KEY_F15,
+  [0x11] = KEY_LEFT_ALT,
+  [0x12] = KEY_LEFT_SHIFT,
+  [0x14] = KEY_LEFT_CTRL,
+  [0x15] = KEY_USAGE(0x14),  // Q
+  [0x16] = KEY_USAGE(0x1E),  // 1
+  [0x17] = KEY_F16,
+  [0x18] = KEY_F17,
+  [0x1A] = KEY_USAGE(0x1D),  // Z
+  [0x1B] = KEY_USAGE(0x16),  // S
+  [0x1C] = KEY_USAGE(0x04),  // A
+  [0x1D] = KEY_USAGE(0x1A),  // W
+  [0x1E] = KEY_USAGE(0x1F),  // 2
+  [0x1F] = KEY_F18,
+  [0x21] = KEY_USAGE(0x06),  // C
+  [0x22] = KEY_USAGE(0x1B),  // X
+  [0x23] = KEY_USAGE(0x07),  // D
+  [0x24] = KEY_USAGE(0x08),  // E
+  [0x25] = KEY_USAGE(0x21),  // 4
+  [0x26] = KEY_USAGE(0x20),  // 3
+  [0x27] = KEY_F19,
+  [0x28] = KEY_F20,
+  [0x29] = KEY_USAGE(0x2C),  // Space
+  [0x2A] = KEY_USAGE(0x19),  // V
+  [0x2B] = KEY_USAGE(0x09),  // F
+  [0x2C] = KEY_USAGE(0x17),  // T
+  [0x2D] = KEY_USAGE(0x15),  // R
+  [0x2E] = KEY_USAGE(0x22),  // 5
+  [0x2F] = KEY_F21,
+  [0x30] = KEY_F22,
+  [0x31] = KEY_USAGE(0x11),  // N
+  [0x32] = KEY_USAGE(0x05),  // B
+  [0x33] = KEY_USAGE(0x0B),  // H
+  [0x34] = KEY_USAGE(0x0A),  // G
+  [0x35] = KEY_USAGE(0x1C),  // Y
+  [0x36] = KEY_USAGE(0x23),  // 6
+  [0x37] = KEY_F23,
+  [0x38] = KEY_F24,
+  [0x3A] = KEY_USAGE(0x10),  // M
+  [0x3B] = KEY_USAGE(0x0D),  // J
+  [0x3C] = KEY_USAGE(0x18),  // U
+  [0x3D] = KEY_USAGE(0x24),  // 7
+  [0x3E] = KEY_USAGE(0x25),  // 8
+  [0x41] = KEY_USAGE(0x36),  // ,
+  [0x42] = KEY_USAGE(0x0E),  // K
+  [0x43] = KEY_USAGE(0x0C),  // I
+  [0x44] = KEY_USAGE(0x12),  // O
+  [0x45] = KEY_USAGE(0x27),  // 0
+  [0x46] = KEY_USAGE(0x26),  // 9
+  [0x49] = KEY_USAGE(0x37),  // .
+  [0x4A] = KEY_USAGE(0x38),  // /
+  [0x4B] = KEY_USAGE(0x0F),  // L
+  [0x4C] = KEY_USAGE(0x33),  // ;
+  [0x4D] = KEY_USAGE(0x13),  // P
+  [0x4E] = KEY_USAGE(0x2D),  // -
+  [0x52] = KEY_USAGE(0x34),  // '
+  [0x54] = KEY_USAGE(0x2F),  // [
+  [0x55] = KEY_USAGE(0x2E),  // =
+  [0x58] = KEY_CAPS_LOCK,
+  [0x59] = KEY_RIGHT_SHIFT,
+  [0x5A] = KEY_RETURN,
+  [0x5B] = KEY_USAGE(0x30),  // ]
+  [0x5D] = KEY_USAGE(0x31),  // Backslash (# on ISO keyboards)
+  [0x61] = KEY_USAGE(0x64),  // Backslash next to left shift on ISO keyboards
+  [0x66] = KEY_BACKSPACE,
+  [0x69] = KEY_USAGE(0x59),  // Keypad 1
+  [0x6B] = KEY_USAGE(0x5C),  // Keypad 4
+  [0x6C] = KEY_USAGE(0x5F),  // Keypad 7
+  [0x70] = KEY_USAGE(0x62),  // Keypad 0
+  [0x71] = KEY_USAGE(0x63),  // Keypad .
+  [0x72] = KEY_USAGE(0x5A),  // Keypad 2
+  [0x73] = KEY_USAGE(0x5D),  // Keypad 5
+  [0x74] = KEY_USAGE(0x5E),  // Keypad 6
+  [0x75] = KEY_USAGE(0x60),  // Keypad 8
+  [0x76] = KEY_ESC,
+  [0x77] = KEY_USAGE(0x53),  // Num Lock
+  [0x78] = KEY_F11,
+  [0x79] = KEY_USAGE(0x57),  // Keypad +
+  [0x7A] = KEY_USAGE(0x5B),  // Keypad 3
+  [0x7B] = KEY_USAGE(0x56),  // Keypad -
+  [0x7C] = KEY_USAGE(0x55),  // Keypad *
+  [0x7D] = KEY_USAGE(0x61),  // Keypad 9
+  [0x7E] = KEY_USAGE(0x47),  // Scroll Lock
+  [0x83] = KEY_F7,
+  [0x84] = KEY_USAGE(0x46),  // Alt + Print Screen (SysRq)
+};
+
+/*
+ * Keys of the E0 scan codes. The fake shifts the keyboard wraps around some
+ * keys (E0 12 and E0 59) are left out, so they are ignored.
+ */
+static const ExtendedKey extended_keys[] = {
+  {0x11, PS2_PAGE_KEYBOARD, KEY_RIGHT_ALT},
+  {0x14, PS2_PAGE_KEYBOARD, KEY_RIGHT_CTRL},
+  {0x1F, PS2_PAGE_KEYBOARD, KEY_LEFT_GUI},
+  {0x27, PS2_PAGE_KEYBOARD, KEY_RIGHT_GUI},
+  {0x2F, PS2_PAGE_KEYBOARD, KEY_USAGE(0x65)},  // Application
+  {0x4A, PS2_PAGE_KEYBOARD, KEY_USAGE(0x54)},  // Keypad /
+  {0x5A, PS2_PAGE_KEYBOARD, KEY_USAGE(0x58)},  // Keypad Enter
+  {0x69, PS2_PAGE_KEYBOARD, KEY_END},
+  {0x6B, PS2_PAGE_KEYBOARD, KEY_LEFT_ARROW},
+  {0x6C, PS2_PAGE_KEYBOARD, KEY_HOME},
+  {0x70, PS2_PAGE_KEYBOARD, KEY_INSERT},
+  {0x71, PS2_PAGE_KEYBOARD, KEY_DELETE},
+  {0x72, PS2_PAGE_KEYBOARD, KEY_DOWN_ARROW},
+  {0x74, PS2_PAGE_KEYBOARD, KEY_RIGHT_ARROW},
+  {0x75, PS2_PAGE_KEYBOARD, KEY_UP_ARROW},
+  {0x7A, PS2_PAGE_KEYBOARD, KEY_PAGE_DOWN},
+  {0x7C, PS2_PAGE_KEYBOARD, KEY_USAGE(0x46)},  // Print Screen
+  {0x7D, PS2_PAGE_KEYBOARD, KEY_PAGE_UP},
+  {0x7E, PS2_PAGE_KEYBOARD, KEY_USAGE(0x48)},  // Ctrl + Pause (Break)
+  {0x10, PS2_PAGE_CONSUMER, CONSUMER_BROWSER_SEARCH},
+  {0x15, PS2_PAGE_CONSUMER, CONSUMER_SCAN_PREVIOUS},
+  {0x18, PS2_PAGE_CONSUMER, 0x022A},  // Browser favorites
+  {0x20, PS2_PAGE_CONSUMER, 0x0227},  // Browser refresh
+  {0x21, PS2_PAGE_CONSUMER, CONSUMER_VOLUME_DOWN},
+  {0x23, PS2_PAGE_CONSUMER, CONSUMER_MUTE},
+  {0x28, PS2_PAGE_CONSUMER, 0x0226},  // Browser stop
+  {0x2B, PS2_PAGE_CONSUMER, CONSUMER_CALCULATOR},
+  {0x30, PS2_PAGE_CONSUMER, CONSUMER_BROWSER_FORWARD},
+  {0x32, PS2_PAGE_CONSUMER, CONSUMER_VOLUME_UP},
+  {0x34, PS2_PAGE_CONSUMER, CONSUMER_PLAY_PAUSE},
+  {0x38, PS2_PAGE_CONSUMER, CONSUMER_BROWSER_BACK},
+  {0x3A, PS2_PAGE_CONSUMER, CONSUMER_BROWSER_HOME},
+  {0x3B, PS2_PAGE_CONSUMER, CONSUMER_STOP},
+  {0x40, PS2_PAGE_CONSUMER, 0x0194},  // My computer
+  {0x48, PS2_PAGE_CONSUMER, CONSUMER_MAIL},
+  {0x4D, PS2_PAGE_CONSUMER, CONSUMER_SCAN_NEXT},
+  {0x50, PS2_PAGE_CONSUMER, CONSUMER_MEDIA_SELECT},
+  {0x37, PS2_PAGE_SYSTEM, SYSTEM_POWER_DOWN},
+  {0x3F, PS2_PAGE_SYSTEM, SYSTEM_SLEEP},
+  {0x5E, PS2_PAGE_SYSTEM, SYSTEM_WAKE_UP},
+};
+
+/*
+ * Frame being received: bits received so far, shifted in LSB first, and tick
+ * of the last clock edge.
+ */
+static uint16_t frame;
+static uint8_t frame_bits;
+static uint32_t last_edge_tick;
+
+/*
+ * Scan codes, written from the EXTI interrupt and read from the scheduler.
+ * Codes lost to a full queue are reported with an overrun code, queued ahead
+ * of the next code that fits.
+ */
+static uint8_t code_queue[CODE_QUEUE_SIZE];
+static volatile uint32_t code_queue_head;
+static volatile uint32_t code_queue_tail;
+static volatile uint8_t codes_posted;
+static uint8_t codes_lost;
+
+/*
+ * Translator state: prefixes received, Pause sequence bytes left to skip and
+ * keys held, one bit per key identifier.
+ */
+static uint8_t extended;
+static uint8_t released;
+static uint8_t pause_bytes;
+static uint8_t keys_held[KEY_IDS / 8];
+
+/*
+ * Keys held are being released, as room in the report queue allows.
+ */
+static uint8_t releasing;
+
+/*!
+ * @brief Queue a scan code. Called from the EXTI interrupt.
+ *
+ * @param[in] code Scan code.
+ * @return    None.
+ */
+static void queue_code(uint8_t code);
+
+/*!
+ * @brief Translate the queued scan codes. Scheduler callback.
+ *
+ * @param[in] arg Unused.
+ * @return    None.
+ */
+static void process_codes(void* arg);
+
+/*!
+ * @brief Run a scan code through the set 2 translator.
+ *
+ * @param[in] code Scan code.
+ * @return    None.
+ */
+static void translate(uint8_t code);
+
+/*!
+ * @brief Find the translation of an E0 scan code.
+ *
+ * @param[in] code Scan code following E0.
+ * @return    Extended key, or NULL if the code has none.
+ */
+static const ExtendedKey* find_extended_key(uint8_t code);
+
+/*!
+ * @brief Check the queue a key is reported through has room for it.
+ *
+ * @param[in] id Key identifier.
+ * @return    True (1) if the key can be reported now, otherwise false (0).
+ */
+static int key_fits(uint16_t id);
+
+/*!
+ * @brief Report a key pressed or released to PS2_Keyboard_KeyCallback().
+ *
+ * @param[in] id      Key identifier.
+ * @param[in] pressed True (1) if the key was pressed, otherwise false (0).
+ * @return    None.
+ */
+static void report_key(uint16_t id, int pressed);
+
+/*!
+ * @brief Release the keys held, as many as the report queue can take.
+ * @return True (1) once all keys are released, otherwise false (0).
+ */
+static int release_all(void);
+
+void PS2_Keyboard_Init(void) {
+  GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+  __HAL_RCC_GPIOA_CLK_ENABLE();
+
+  // Both lines are open collector on the keyboard side, only read here.
+  GPIO_InitStruct.Pin = DATA_PIN;
+  GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+  GPIO_InitStruct.Pull = GPIO_PULLUP;
+  HAL_GPIO_Init(DATA_PORT, &GPIO_InitStruct);
+  GPIO_InitStruct.Pin = CLOCK_PIN;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_FALLING;
+  HAL_GPIO_Init(CLOCK_PORT, &GPIO_InitStruct);
+
+  // Data is only valid for 30 us after the falling edge: preempt everything,
+  // including the USB interrupt.
+  HAL_NVIC_SetPriority(EXTI9_5_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(EXTI9_5_IRQn);
+}
+
+__weak void PS2_Keyboard_KeyCallback(uint8_t page, uint16_t usage, int pressed) {
+  switch (page) {
+    case PS2_PAGE_KEYBOARD:
+      if (pressed) {
+        USB_HID_Keyboard_Press((uint8_t) usage);
+      } else {
+        USB_HID_Keyboard_Release((uint8_t) usage);
+      }
+      break;
+    case PS2_PAGE_CONSUMER:
+      if (pressed) {
+        USB_HID_Keyboard_ConsumerPress(usage);
+      } else {
+        USB_HID_Keyboard_ConsumerRelease();
+      }
+      break;
+    case PS2_PAGE_SYSTEM:
+      if (pressed) {
+        USB_HID_Keyboard_SystemPress((uint8_t) usage);
+      } else {
+        USB_HID_Keyboard_SystemRelease();
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void PS2_Keyboard_IRQHandler(void) {
+  uint32_t bit = (DATA_PORT->IDR & DATA_PIN) ? 1 : 0;
+  uint32_t tick = HAL_GetTick();
+  uint8_t data;
+  uint8_t parity;
+
+  if (!(EXTI->PR & CLOCK_PIN)) {
+    return;
+  }
+  EXTI->PR = CLOCK_PIN;
+
+  // Bits are at most 100 us apart, a longer gap means bits were lost.
+  if ((tick - last_edge_tick) > 1) {
+    frame_bits = 0;
+  }
+  last_edge_tick = tick;
+
+  if (frame_bits == 0) {
+    if (bit) {
+      // Not a start bit, wait for one.
+      return;
+    }
+    frame = 0;
+  }
+  frame |= (uint16_t) (bit << frame_bits);
+  if (++frame_bits < FRAME_BITS) {
+    return;
+  }
+  frame_bits = 0;
+
+  // Odd parity over the data and parity bits, stop bit set.
+  data = (uint8_t) (frame >> 1);
+  parity = (uint8_t) (data ^ ((frame >> 9) & 0x01));
+  parity ^= parity >> 4;
+  parity ^= parity >> 2;
+  parity ^= parity >> 1;
+  if (!(parity & 0x01) || !(frame & (1U << 10))) {
+    data = CODE_OVERRUN;
+  }
+  queue_code(data);
+}
+
+static void queue_code(uint8_t code) {
+  uint32_t head = code_queue_head;
+
+  if (codes_lost) {
+    if ((head - code_queue_tail) >= CODE_QUEUE_SIZE) {
+      return;
+    }
+    code_queue[head & (CODE_QUEUE_SIZE - 1)] = CODE_OVERRUN;
+    head++;
+    codes_lost = 0;
+  }
+  if ((head - code_queue_tail) >= CODE_QUEUE_SIZE) {
+    codes_lost = 1;
+  } else {
+    code_queue[head & (CODE_QUEUE_SIZE - 1)] = code;
+    head++;
+  }
+  code_queue_head = head;
+
+  if (!codes_posted) {
+    codes_posted = Scheduler_Post(process_codes, NULL);
+  }
+}
+
+static void process_codes(void* arg) {
+  uint8_t code;
+
+  // Cleared first, so codes queued from now on post again.
+  codes_posted = 0;
+  for (;;) {
+    if (releasing) {
+      releasing = !release_all();
+    }
+    if (!releasing && (code_queue_tail == code_queue_head)) {
+      return;
+    }
+    code = code_queue[code_queue_tail & (CODE_QUEUE_SIZE - 1)];
+    if (releasing || !key_fits(extended ? (KEY_ID_EXTENDED | code) : code)) {
+      // The host has not polled the pending reports yet. Leave the codes
+      // queued and try again on the next frame, rather than wait here.
+      codes_posted = Scheduler_PostDelayed(process_codes, NULL, 1);
+      return;
+    }
+    code_queue_tail++;
+    translate(code);
+  }
+}
+
+static void translate(uint8_t code) {
+  uint16_t id;
+  uint8_t mask;
+
+  if (pause_bytes > 0) {
+    if (--pause_bytes == 0) {
+      report_key(KEY_ID_EXTENDED | 0x7E, 1);
+      report_key(KEY_ID_EXTENDED | 0x7E, 0);
+    }
+    return;
+  }
+
+  switch (code) {
+    case CODE_EXTENDED:
+      extended = 1;
+      return;
+    case CODE_BREAK:
+      released = 1;
+      return;
+    case CODE_PAUSE:
+      pause_bytes = PAUSE_SEQUENCE_SIZE;
+      extended = 0;
+      released = 0;
+      return;
+    case CODE_OVERRUN:
+    case CODE_SELF_TEST:
+    case CODE_FAILURE_1:
+    case CODE_FAILURE_2:
+    case CODE_ERROR:
+      // Codes were lost or the keyboard was reset (e.g. plugged in again).
+      extended = 0;
+      released = 0;
+      releasing = 1;
+      return;
+    case CODE_ACK:
+    case CODE_ECHO:
+    case CODE_RESEND:
+      // Replies to host commands, never sent here.
+      return;
+    default:
+      break;
+  }
+
+  id = extended ? (KEY_ID_EXTENDED | code) : code;
+  mask = (uint8_t) (1U << (id & 7));
+  if (!released && !(keys_held[id >> 3] & mask)) {
+    keys_held[id >> 3] |= mask;
+    report_key(id, 1);
+  } else if (released && (keys_held[id >> 3] & mask)) {
+    keys_held[id >> 3] &= ~mask;
+    report_key(id, 0);
+  }
+  extended = 0;
+  released = 0;
+}
+
+static const ExtendedKey* find_extended_key(uint8_t code) {
+  uint32_t i;
+
+  for (i = 0; i < (sizeof(extended_keys) / sizeof(extended_keys[0])); i++) {
+    if (extended_keys[i].code == code) {
+      return &extended_keys[i];
+    }
+  }
+  return NULL;
+}
+
+static int key_fits(uint16_t id) {
+  const ExtendedKey* key = (id & KEY_ID_EXTENDED) ? find_extended_key((uint8_t) id) : NULL;
+
+  // Consumer and system keys have their own queues. Anything else, prefixes
+  // included, is checked against the keyboard report queue.
+  if ((key != NULL) && (key->page == PS2_PAGE_CONSUMER)) {
+    return USB_HID_Keyboard_ConsumerQueueSpace() > 0;
+  }
+  if ((key != NULL) && (key->page == PS2_PAGE_SYSTEM)) {
+    return USB_HID_Keyboard_SystemQueueSpace() > 0;
+  }
+  return USB_HID_Keyboard_QueueSpace() >= REPORTS_PER_CODE;
+}
+
+static void report_key(uint16_t id, int pressed) {
+  uint8_t code = (uint8_t) id;
+  const ExtendedKey* key;
+
+  if (!(id & KEY_ID_EXTENDED)) {
+    if ((code < sizeof(keys)) && (keys[code] != 0)) {
+      PS2_Keyboard_KeyCallback(PS2_PAGE_KEYBOARD, keys[code], pressed);
+    }
+    return;
+  }
+  key = find_extended_key(code);
+  if (key != NULL) {
+    PS2_Keyboard_KeyCallback(key->page, key->usage, pressed);
+  }
+}
+
+static int release_all(void) {
+  uint16_t id;
+
+  for (id = 0; id < KEY_IDS; id++) {
+    if (keys_held[id >> 3] & (1U << (id & 7))) {
+      if (!key_fits(id)) {
+        return 0;
+      }
+      keys_held[id >> 3] &= ~(1U << (id & 7));
+      report_key(id, 0);
+    }
+  }
+  return 1;
+}
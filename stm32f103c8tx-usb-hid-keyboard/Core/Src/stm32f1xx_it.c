@@ -22,6 +22,8 @@
 #include "stm32f1xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "matrix.h"
+#include "ps2_keyboard.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -214,4 +216,22 @@ void USB_LP_CAN1_RX0_IRQHandler(void)
 
 /* USER CODE BEGIN 1 */
 
+/**
+  * @brief This function handles TIM2 global interrupt (key matrix scan). TIM2
+  *        is set up by Matrix_Init(), not by CubeMX.
+  */
+void TIM2_IRQHandler(void)
+{
+  Matrix_IRQHandler();
+}
+
+/**
+  * @brief This function handles EXTI line[9:5] interrupts (PS/2 clock on PA8).
+  *        The EXTI line is set up by PS2_Keyboard_Init(), not by CubeMX.
+  */
+void EXTI9_5_IRQHandler(void)
+{
+  PS2_Keyboard_IRQHandler();
+}
+
 /* USER CODE END 1 */
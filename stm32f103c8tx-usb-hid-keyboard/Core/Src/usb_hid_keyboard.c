@@ -7,8 +7,11 @@
  * Note: Based on Arduino's Keyboard library (see https://github.com/arduino-libraries/Keyboard).
  */
 #include "usb_hid_keyboard.h"
+#include "usb_hid_keyboard_layout.h"
 #include "usbd_hid.h"
 
+#include <string.h>
+
 /*
  * Keys ranges.
  */
@@ -29,161 +32,192 @@
 #define KEY_MOD_RALT   0x40
 #define KEY_MOD_RMETA  0x80
 
-/**
- * ASCII to HID conversion map.
- */
-#define SHIFT_FLAG 0x80
-
-const uint8_t ascii_to_hid_map[128] = {
-  0x00,             // NUL
-  0x00,             // SOH
-  0x00,             // STX
-  0x00,             // ETX
-  0x00,             // EOT
-  0x00,             // ENQ
-  0x00,             // ACK
-  0x00,             // BEL
-  0x2A,             // BS Backspace
-  0x2B,             // TAB Tab
-  0x28,             // LF Enter
-  0x00,             // VT
-  0x00,             // FF
-  0x00,             // CR
-  0x00,             // SO
-  0x00,             // SI
-  0x00,             // DEL
-  0x00,             // DC1
-  0x00,             // DC2
-  0x00,             // DC3
-  0x00,             // DC4
-  0x00,             // NAK
-  0x00,             // SYN
-  0x00,             // ETB
-  0x00,             // CAN
-  0x00,             // EM
-  0x00,             // SUB
-  0x00,             // ESC
-  0x00,             // FS
-  0x00,             // GS
-  0x00,             // RS
-  0x00,             // US
-  0x2C,             //  ' '
-  0x1E|SHIFT_FLAG,  // !
-  0x34|SHIFT_FLAG,  // "
-  0x20|SHIFT_FLAG,  // #
-  0x21|SHIFT_FLAG,  // $
-  0x22|SHIFT_FLAG,  // %
-  0x24|SHIFT_FLAG,  // &
-  0x34,             // '
-  0x26|SHIFT_FLAG,  // (
-  0x27|SHIFT_FLAG,  // )
-  0x25|SHIFT_FLAG,  // *
-  0x2E|SHIFT_FLAG,  // +
-  0x36,             // ,
-  0x2D,             // -
-  0x37,             // .
-  0x38,             // /
-  0x27,             // 0
-  0x1E,             // 1
-  0x1F,             // 2
-  0x20,             // 3
-  0x21,             // 4
-  0x22,             // 5
-  0x23,             // 6
-  0x24,             // 7
-  0x25,             // 8
-  0x26,             // 9
-  0x33|SHIFT_FLAG,  // :
-  0x33,             // ;
-  0x36|SHIFT_FLAG,  // <
-  0x2E,             // =
-  0x37|SHIFT_FLAG,  // >
-  0x38|SHIFT_FLAG,  // ?
-  0x1F|SHIFT_FLAG,  // @
-  0x04|SHIFT_FLAG,  // A
-  0x05|SHIFT_FLAG,  // B
-  0x06|SHIFT_FLAG,  // C
-  0x07|SHIFT_FLAG,  // D
-  0x08|SHIFT_FLAG,  // E
-  0x09|SHIFT_FLAG,  // F
-  0x0A|SHIFT_FLAG,  // G
-  0x0B|SHIFT_FLAG,  // H
-  0x0C|SHIFT_FLAG,  // I
-  0x0D|SHIFT_FLAG,  // J
-  0x0E|SHIFT_FLAG,  // K
-  0x0F|SHIFT_FLAG,  // L
-  0x10|SHIFT_FLAG,  // M
-  0x11|SHIFT_FLAG,  // N
-  0x12|SHIFT_FLAG,  // O
-  0x13|SHIFT_FLAG,  // P
-  0x14|SHIFT_FLAG,  // Q
-  0x15|SHIFT_FLAG,  // R
-  0x16|SHIFT_FLAG,  // S
-  0x17|SHIFT_FLAG,  // T
-  0x18|SHIFT_FLAG,  // U
-  0x19|SHIFT_FLAG,  // V
-  0x1A|SHIFT_FLAG,  // W
-  0x1B|SHIFT_FLAG,  // X
-  0x1C|SHIFT_FLAG,  // Y
-  0x1D|SHIFT_FLAG,  // Z
-  0x2F,             // [
-  0x31,             // bslash
-  0x30,             // ]
-  0x23|SHIFT_FLAG,  // ^
-  0x2D|SHIFT_FLAG,  // _
-  0x35,             // `
-  0x04,             // a
-  0x05,             // b
-  0x06,             // c
-  0x07,             // d
-  0x08,             // e
-  0x09,             // f
-  0x0A,             // g
-  0x0B,             // h
-  0x0C,             // i
-  0x0D,             // j
-  0x0E,             // k
-  0x0F,             // l
-  0x10,             // m
-  0x11,             // n
-  0x12,             // o
-  0x13,             // p
-  0x14,             // q
-  0x15,             // r
-  0x16,             // s
-  0x17,             // t
-  0x18,             // u
-  0x19,             // v
-  0x1A,             // w
-  0x1B,             // x
-  0x1C,             // y
-  0x1D,             // z
-  0x2F|SHIFT_FLAG,  // {
-  0x31|SHIFT_FLAG,  // |
-  0x30|SHIFT_FLAG,  // }
-  0x35|SHIFT_FLAG,  // ~
-  0x00              // DEL
-};
-
 /*
  * USB handler.
  */
 extern USBD_HandleTypeDef hUsbDeviceFS;
 
 /*
- * Keyboard report structure.
+ * Layout used to type printing keys and text.
+ */
+static uint8_t keyboard_layout = KEYBOARD_LAYOUT_US;
+
+/*
+ * LED states last set by the host.
+ */
+static volatile uint8_t leds_state;
+
+/*
+ * Streaming UTF-8 decoder state.
+ */
+typedef struct {
+  uint32_t code_point;
+  uint32_t minimum;
+  uint8_t remaining;
+} Utf8Decoder;
+
+/*
+ * Size of the usage bitmap, one bit per usage from 0x00 to 0x7F.
+ */
+#define KEY_BITMAP_SIZE 16
+
+/*
+ * Keys in a boot protocol report, and usage reported in every slot when more
+ * keys than that are held.
+ */
+#define BOOT_KEYS           6
+#define KEY_ERROR_ROLLOVER  0x01
+
+/*
+ * Keyboard report structure, as sent in report protocol (N-key rollover).
  */
 typedef struct {
   uint8_t modifiers;
   uint8_t reserved;
-  uint8_t keys[6];
+  uint8_t keys[KEY_BITMAP_SIZE];
 } KeyboardReport;
 
+/*
+ * Keyboard report structure, as sent in boot protocol (6-key rollover).
+ */
+typedef struct {
+  uint8_t modifiers;
+  uint8_t reserved;
+  uint8_t keys[BOOT_KEYS];
+} BootKeyboardReport;
+
+/*
+ * Keyboard report structure with its report ID, as sent in report protocol.
+ */
+typedef struct {
+  uint8_t report_id;
+  KeyboardReport keyboard;
+} KeyboardIdReport;
+
+/*
+ * Consumer and system control report structure (16-bit usage, little endian).
+ */
+typedef struct {
+  uint8_t report_id;
+  uint8_t usage[2];
+} UsageReport;
+
 /*
  * Keyboard report.
  */
 static KeyboardReport keyboard_report;
 
+/*
+ * Typing state of USB_HID_Keyboard_WritePart(): keys held before the text,
+ * and key stroke pressed by the last report, if any. Kept from one part of
+ * the text to the next.
+ */
+typedef struct {
+  KeyboardReport held;
+  KeyStroke last;
+  int pressed;
+} TypingState;
+
+static TypingState typing;
+
+/*
+ * Report being transmitted, in the format of the protocol selected by the host.
+ */
+static union {
+  KeyboardIdReport report;
+  BootKeyboardReport boot;
+  UsageReport usage;
+} tx_report;
+
+/*
+ * Report queue size (must be a power of two).
+ */
+#define REPORT_QUEUE_SIZE 32
+
+/*
+ * Report queue. Filled by the application and drained from the USB interrupt
+ * on each IN completion. The report at the tail is the one being transmitted,
+ * so it is only released once the host has acknowledged it.
+ */
+static KeyboardReport report_queue[REPORT_QUEUE_SIZE];
+static volatile uint32_t report_queue_head;
+static volatile uint32_t report_queue_tail;
+
+/*
+ * Usage queue size (must be a power of two).
+ */
+#define USAGE_QUEUE_SIZE 4
+
+/*
+ * Usage queue, one for consumer and one for system control reports. Each
+ * entry is the usage held in one report, 0 when released. These reports are
+ * sent ahead of the keyboard report queue.
+ */
+typedef struct {
+  uint16_t usages[USAGE_QUEUE_SIZE];
+  volatile uint32_t head;
+  volatile uint32_t tail;
+  uint16_t last;
+} UsageQueue;
+
+static UsageQueue consumer_queue;
+static UsageQueue system_queue;
+
+/*
+ * Report ID of the report being transmitted, 0 if none.
+ */
+static volatile uint8_t report_in_flight;
+
+/*
+ * Last queued report. An identical report is not queued again, the host
+ * gets repeats from the HID class when it sets an idle rate.
+ */
+static KeyboardReport last_report;
+
+/*!
+ * @brief Convert a key to its HID usage and the modifiers it needs.
+ *
+ * @param[in]  key       Key to convert.
+ * @param[out] usage     HID usage (0 for a modifier key).
+ * @param[out] modifiers Modifier bits.
+ * @return     True (1) in case of success, otherwise false (0) if the key is invalid.
+ */
+static int key_to_usage(uint8_t key, uint8_t* usage, uint8_t* modifiers);
+
+/*!
+ * @brief Type one key stroke, sharing a report with the previous one when possible.
+ *
+ * @param[in,out] state  Typing state.
+ * @param[in]     stroke Key stroke.
+ * @return        True (1) in case of success, otherwise false (0).
+ */
+static int type_stroke(TypingState* state, const KeyStroke* stroke);
+
+/*!
+ * @brief Take the keys pressed or released since the last key stroke typed
+ *        into the keys held under the text.
+ * @return None.
+ */
+static void update_held_keys(void);
+
+/*!
+ * @brief Check whether Caps Lock applies to a character.
+ *
+ * @param[in] code_point Unicode code point.
+ * @return    True (1) for a letter with an upper and a lower case, otherwise false (0).
+ */
+static int is_cased_letter(uint32_t code_point);
+
+/*!
+ * @brief Feed one byte to the UTF-8 decoder.
+ *
+ * @param[in,out] decoder    Decoder state.
+ * @param[in]     byte       Next byte.
+ * @param[out]    code_point Decoded code point, when complete.
+ * @return        1 if a code point is complete, 0 if more bytes are needed, -1 if the sequence is invalid.
+ */
+static int utf8_decode(Utf8Decoder* decoder, uint8_t byte, uint32_t* code_point);
+
 /*!
  * @brief Add a key to keyboard report.
  *
@@ -206,7 +240,54 @@ static int remove_key_from_report(uint8_t key);
  */
 static int send_report(void);
 
+/*!
+ * @brief Queue a consumer or system control report.
+ *
+ * @param[in] queue Usage queue.
+ * @param[in] usage Usage held, 0 to release.
+ * @return    True (1) in case of success, otherwise false (0).
+ */
+static int queue_usage(UsageQueue* queue, uint16_t usage);
+
+/*!
+ * @brief Get the number of free slots of a usage queue.
+ *
+ * @param[in] queue Usage queue.
+ * @return    Free slots.
+ */
+static int usage_queue_space(const UsageQueue* queue);
+
+/*!
+ * @brief Build a boot protocol report from the usage bitmap of a report.
+ *
+ * @param[in]  report Report to convert.
+ * @param[out] boot   Boot protocol report.
+ * @return     None.
+ */
+static void build_boot_report(const KeyboardReport* report, BootKeyboardReport* boot);
+
+/*!
+ * @brief Start transmitting the next queued report, if the endpoint is idle.
+ *
+ * Must be called with the USB interrupt masked or from the USB interrupt itself.
+ * @return None.
+ */
+static void transmit_next_report(void);
+
+/*!
+ * @brief Send the usage at the tail of a usage queue.
+ *
+ * @param[in] queue     Usage queue.
+ * @param[in] report_id Report ID of the queue.
+ * @return    None.
+ */
+static void transmit_usage_report(UsageQueue* queue, uint8_t report_id);
+
 int USB_HID_Keyboard_Tap(uint8_t key) {
+  // Both reports must fit, the key would stay pressed otherwise.
+  if (USB_HID_Keyboard_QueueSpace() < 2) {
+    return 0;
+  }
   if (!USB_HID_Keyboard_Press(key)) {
     return 0;
   }
@@ -214,29 +295,16 @@ int USB_HID_Keyboard_Tap(uint8_t key) {
 }
 
 int USB_HID_Keyboard_Press(uint8_t key) {
-  if (key >= NON_PRINTING_KEYS_START) {
-    // Key is a non-printing key.
-    key -= NON_PRINTING_KEYS_START;
-  } else if (key >= MODIFIER_KEYS_START) {
-    // Key is a modifier key. Set proper flag in modifiers byte.
-    keyboard_report.modifiers |= (1 << (key - MODIFIER_KEYS_START));
-    key = 0;
-  } else {
-    // Key is a printing key. Convert from ASCII to HID code.
-    key = ascii_to_hid_map[key];
-    if (!key) {
-      // Invalid key.
-      return 0;
-    }
-    if (key & SHIFT_FLAG) {
-      // Set shift flag in modifiers byte and clear bit used as flag in key value.
-      keyboard_report.modifiers |= KEY_MOD_LSHIFT;
-      key &= ~SHIFT_FLAG;
-    }
+  uint8_t usage;
+  uint8_t modifiers;
+
+  if (!key_to_usage(key, &usage, &modifiers)) {
+    return 0;
   }
 
   // Add key to keyboard report.
-  if (!add_key_to_report(key)) {
+  keyboard_report.modifiers |= modifiers;
+  if (!add_key_to_report(usage)) {
     return 0;
   }
 
@@ -244,29 +312,16 @@ int USB_HID_Keyboard_Press(uint8_t key) {
 }
 
 int USB_HID_Keyboard_Release(uint8_t key) {
-  if (key >= NON_PRINTING_KEYS_START) {
-    // Key is a non-printing key.
-    key -= NON_PRINTING_KEYS_START;
-  } else if (key >= MODIFIER_KEYS_START) {
-    // Key is a modifier key. Clear proper flag in modifiers byte.
-    keyboard_report.modifiers &= ~(1 << (key - MODIFIER_KEYS_START));
-    key = 0;
-  } else {
-    // Key is a printing key. Convert from ASCII to HID code.
-    key = ascii_to_hid_map[key];
-    if (!key) {
-      // Invalid key.
-      return 0;
-    }
-    if (key & SHIFT_FLAG) {
-      // Clear shift flag in modifiers byte and clear bit used as flag in key value.
-      keyboard_report.modifiers &= ~KEY_MOD_LSHIFT;
-      key &= ~SHIFT_FLAG;
-    }
+  uint8_t usage;
+  uint8_t modifiers;
+
+  if (!key_to_usage(key, &usage, &modifiers)) {
+    return 0;
   }
 
   // Remove key from keyboard report.
-  if (!remove_key_from_report(key)) {
+  keyboard_report.modifiers &= ~modifiers;
+  if (!remove_key_from_report(usage)) {
     return 0;
   }
 
@@ -274,71 +329,455 @@ int USB_HID_Keyboard_Release(uint8_t key) {
 }
 
 int USB_HID_Keyboard_ReleaseAll(void) {
-  int i = 0;
-  for (i = 0; i < 6; i++) {
-    keyboard_report.keys[i] = 0;
-  }
+  memset(keyboard_report.keys, 0, sizeof(keyboard_report.keys));
   keyboard_report.modifiers = 0;
-  return send_report();
+  if (!send_report()) {
+    return 0;
+  }
+  typing.pressed = 0;
+  return 1;
 }
 
 int USB_HID_Keyboard_Write(uint8_t* keys, int size) {
+  int typed = USB_HID_Keyboard_WritePart(keys, size);
+
+  // Release the last key. Each character leaves a free slot for it.
+  USB_HID_Keyboard_WriteEnd();
+  return typed;
+}
+
+int USB_HID_Keyboard_WritePart(uint8_t* keys, int size) {
+  Utf8Decoder decoder = {0};
+  KeyStroke strokes[2];
+  uint32_t code_point;
+  int typed = 0;
+  int count;
+  int result;
   int i;
+  int j;
+
+  if (typing.pressed) {
+    // Go on from the previous part, keeping keys pressed since then.
+    update_held_keys();
+  } else {
+    typing.held = keyboard_report;
+  }
+
   for (i = 0; i < size; i++) {
-    if (!USB_HID_Keyboard_Tap(keys[i])) {
+    result = utf8_decode(&decoder, keys[i], &code_point);
+    if (result < 0) {
+      // Invalid UTF-8 sequence.
+      break;
+    }
+    if (result == 0) {
+      continue;
+    }
+
+    count = USB_HID_Keyboard_LayoutLookup(keyboard_layout, code_point, strokes);
+    if (count == 0) {
+      // Invalid key.
+      break;
+    }
+
+    // With Caps Lock on, the host inverts the case of letters typed without
+    // AltGr. Invert shift as well rather than toggling Caps Lock around the text.
+    if ((leds_state & LED_CAPS_LOCK) && is_cased_letter(code_point) &&
+        !(strokes[count - 1].modifiers & KEY_MOD_RALT)) {
+      strokes[count - 1].modifiers ^= KEY_MOD_LSHIFT;
+    }
+
+    // Each stroke takes at most a release and a press report, and a slot must
+    // stay free to release the last key. Stop here rather than wait for the host.
+    if (USB_HID_Keyboard_QueueSpace() < ((2 * count) + 1)) {
       break;
     }
+    for (j = 0; j < count; j++) {
+      if (!type_stroke(&typing, &strokes[j])) {
+        break;
+      }
+    }
+    if (j < count) {
+      break;
+    }
+    typed = i + 1;
   }
-  return i;
+  return typed;
 }
 
-static int add_key_to_report(uint8_t key) {
-  int i;
+int USB_HID_Keyboard_WriteEnd(void) {
+  if (!typing.pressed) {
+    return 1;
+  }
+  update_held_keys();
+  keyboard_report = typing.held;
+  if (!send_report()) {
+    return 0;
+  }
+  typing.pressed = 0;
+  return 1;
+}
 
-  // Check that the key isn't already in the report.
-  for (i = 0; i < 6; i++) {
-    if (keyboard_report.keys[i] == key) {
-      // Key already in report. No action required.
-      return 1;
+int USB_HID_Keyboard_QueueSpace(void) {
+  return REPORT_QUEUE_SIZE - (int) (report_queue_head - report_queue_tail);
+}
+
+int USB_HID_Keyboard_ConsumerPress(uint16_t usage) {
+  return queue_usage(&consumer_queue, usage);
+}
+
+int USB_HID_Keyboard_ConsumerRelease(void) {
+  return queue_usage(&consumer_queue, 0);
+}
+
+int USB_HID_Keyboard_ConsumerTap(uint16_t usage) {
+  if (usage_queue_space(&consumer_queue) < 2) {
+    return 0;
+  }
+  if (!USB_HID_Keyboard_ConsumerPress(usage)) {
+    return 0;
+  }
+  return USB_HID_Keyboard_ConsumerRelease();
+}
+
+int USB_HID_Keyboard_ConsumerQueueSpace(void) {
+  return usage_queue_space(&consumer_queue);
+}
+
+int USB_HID_Keyboard_SystemPress(uint8_t usage) {
+  return queue_usage(&system_queue, usage);
+}
+
+int USB_HID_Keyboard_SystemRelease(void) {
+  return queue_usage(&system_queue, 0);
+}
+
+int USB_HID_Keyboard_SystemTap(uint8_t usage) {
+  if (usage_queue_space(&system_queue) < 2) {
+    return 0;
+  }
+  if (!USB_HID_Keyboard_SystemPress(usage)) {
+    return 0;
+  }
+  return USB_HID_Keyboard_SystemRelease();
+}
+
+int USB_HID_Keyboard_SystemQueueSpace(void) {
+  return usage_queue_space(&system_queue);
+}
+
+uint8_t USB_HID_Keyboard_GetLeds(void) {
+  return leds_state;
+}
+
+__weak void USB_HID_Keyboard_LedsCallback(uint8_t leds) {
+}
+
+int USB_HID_Keyboard_SetLayout(uint8_t layout) {
+  if (layout >= KEYBOARD_LAYOUT_COUNT) {
+    return 0;
+  }
+  keyboard_layout = layout;
+  return 1;
+}
+
+static int key_to_usage(uint8_t key, uint8_t* usage, uint8_t* modifiers) {
+  KeyStroke strokes[2];
+
+  if (key >= NON_PRINTING_KEYS_START) {
+    // Key is a non-printing key.
+    *usage = key - NON_PRINTING_KEYS_START;
+    *modifiers = KEY_MOD_NONE;
+  } else if (key >= MODIFIER_KEYS_START) {
+    // Key is a modifier key. Set proper flag in modifiers byte.
+    *usage = 0;
+    *modifiers = (1 << (key - MODIFIER_KEYS_START));
+  } else {
+    // Key is a printing key. Convert from ASCII to HID code, dead key
+    // sequences can't be held.
+    if (USB_HID_Keyboard_LayoutLookup(keyboard_layout, key, strokes) != 1) {
+      // Invalid key.
+      return 0;
     }
+    *usage = strokes[0].usage;
+    *modifiers = strokes[0].modifiers;
   }
+  return 1;
+}
 
-  // Add key into the first empty slot available.
-  for (i = 0; i < 6; i++) {
-    if (keyboard_report.keys[i] == 0) {
-      keyboard_report.keys[i] = key;
-      return 1;
+static int type_stroke(TypingState* state, const KeyStroke* stroke) {
+  // A different key can replace the previous one in the same report. The
+  // keys are only released in between when the host could not tell the
+  // two presses apart, or could apply the new modifiers to the old key.
+  if (state->pressed && ((stroke->usage == state->last.usage) ||
+                         (stroke->modifiers != state->last.modifiers))) {
+    keyboard_report = state->held;
+    state->pressed = 0;
+    if (!send_report()) {
+      return 0;
     }
   }
 
-  // No empty slot available.
-  return 0;
+  keyboard_report = state->held;
+  keyboard_report.modifiers |= stroke->modifiers;
+  if (!add_key_to_report(stroke->usage) || !send_report()) {
+    return 0;
+  }
+  state->pressed = 1;
+  state->last = *stroke;
+  return 1;
 }
 
-static int remove_key_from_report(uint8_t key) {
-  int i;
+static void update_held_keys(void) {
+  uint8_t usage = typing.last.usage;
+  uint8_t modifiers = typing.last.modifiers & ~typing.held.modifiers;
 
-  if (key == 0) {
+  typing.held = keyboard_report;
+  typing.held.modifiers &= ~modifiers;
+  if ((usage != 0) && (usage < (KEY_BITMAP_SIZE * 8))) {
+    typing.held.keys[usage >> 3] &= ~(1 << (usage & 7));
+  }
+}
+
+static int is_cased_letter(uint32_t code_point) {
+  if (((code_point >= 'a') && (code_point <= 'z')) || ((code_point >= 'A') && (code_point <= 'Z'))) {
     return 1;
   }
+  // Latin-1 letters, except the multiplication and division signs and the
+  // sharp s, which has no upper case.
+  return (code_point >= 0xC0) && (code_point <= 0xFF) &&
+         (code_point != 0xD7) && (code_point != 0xF7) && (code_point != 0xDF);
+}
 
-  for (i = 0; i < 6; i++) {
-    if (keyboard_report.keys[i] == key) {
-      keyboard_report.keys[i] = 0;
+static int utf8_decode(Utf8Decoder* decoder, uint8_t byte, uint32_t* code_point) {
+  if (decoder->remaining == 0) {
+    if (byte < 0x80) {
+      *code_point = byte;
       return 1;
     }
+    if ((byte & 0xE0) == 0xC0) {
+      decoder->code_point = byte & 0x1F;
+      decoder->minimum = 0x80;
+      decoder->remaining = 1;
+    } else if ((byte & 0xF0) == 0xE0) {
+      decoder->code_point = byte & 0x0F;
+      decoder->minimum = 0x800;
+      decoder->remaining = 2;
+    } else if ((byte & 0xF8) == 0xF0) {
+      decoder->code_point = byte & 0x07;
+      decoder->minimum = 0x10000;
+      decoder->remaining = 3;
+    } else {
+      // Continuation byte without a lead byte, or invalid lead byte.
+      return -1;
+    }
+    return 0;
+  }
+
+  if ((byte & 0xC0) != 0x80) {
+    // Truncated sequence.
+    decoder->remaining = 0;
+    return -1;
+  }
+  decoder->code_point = (decoder->code_point << 6) | (byte & 0x3F);
+  if (--decoder->remaining != 0) {
+    return 0;
   }
 
-  // Key not found.
-  return 0;
+  // Reject overlong encodings, surrogates and values beyond Unicode.
+  if ((decoder->code_point < decoder->minimum) || (decoder->code_point > 0x10FFFF) ||
+      ((decoder->code_point >= 0xD800) && (decoder->code_point <= 0xDFFF))) {
+    return -1;
+  }
+  *code_point = decoder->code_point;
+  return 1;
+}
+
+static int add_key_to_report(uint8_t key) {
+  if (key == 0) {
+    // Modifier only. No action required.
+    return 1;
+  }
+  if (key >= (KEY_BITMAP_SIZE * 8)) {
+    // Usage out of the bitmap range.
+    return 0;
+  }
+
+  keyboard_report.keys[key >> 3] |= (1 << (key & 7));
+  return 1;
+}
+
+static int remove_key_from_report(uint8_t key) {
+  if (key == 0) {
+    return 1;
+  }
+  if ((key >= (KEY_BITMAP_SIZE * 8)) || !(keyboard_report.keys[key >> 3] & (1 << (key & 7)))) {
+    // Key not found.
+    return 0;
+  }
+
+  keyboard_report.keys[key >> 3] &= ~(1 << (key & 7));
+  return 1;
 }
 
 static int send_report(void) {
-  if (USBD_HID_SendReport(&hUsbDeviceFS, (uint8_t*) &keyboard_report, sizeof(KeyboardReport)) != HAL_OK) {
+  uint32_t head = report_queue_head;
+
+  if (hUsbDeviceFS.dev_state != USBD_STATE_CONFIGURED) {
+    return 0;
+  }
+  if (memcmp(&keyboard_report, &last_report, sizeof(KeyboardReport)) == 0) {
+    // Nothing changed since the last report.
+    return 1;
+  }
+
+  if ((head - report_queue_tail) >= REPORT_QUEUE_SIZE) {
+    // Reports are produced faster than the host polls. Undo the change rather
+    // than wait for the interrupt to free a slot, which would stall every
+    // other task: the caller retries once USB_HID_Keyboard_QueueSpace() allows.
+    keyboard_report = last_report;
+    return 0;
+  }
+
+  report_queue[head & (REPORT_QUEUE_SIZE - 1)] = keyboard_report;
+  report_queue_head = head + 1;
+  last_report = keyboard_report;
+
+  // Kick the endpoint if it is not already draining the queue.
+  HAL_NVIC_DisableIRQ(USB_LP_CAN1_RX0_IRQn);
+  transmit_next_report();
+  HAL_NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
+  return 1;
+}
+
+static int queue_usage(UsageQueue* queue, uint16_t usage) {
+  uint32_t head = queue->head;
+
+  if (hUsbDeviceFS.dev_state != USBD_STATE_CONFIGURED) {
+    return 0;
+  }
+  if (usage == queue->last) {
+    // Nothing changed since the last report.
+    return 1;
+  }
+
+  if (usage_queue_space(queue) == 0) {
+    // Full, as for keyboard reports the caller retries later.
     return 0;
   }
 
-  // Small delay to avoid communication issues.
-  HAL_Delay(50);
+  queue->usages[head & (USAGE_QUEUE_SIZE - 1)] = usage;
+  queue->head = head + 1;
+  queue->last = usage;
+
+  // Kick the endpoint if it is not already draining the queues.
+  HAL_NVIC_DisableIRQ(USB_LP_CAN1_RX0_IRQn);
+  transmit_next_report();
+  HAL_NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
   return 1;
 }
+
+static int usage_queue_space(const UsageQueue* queue) {
+  return USAGE_QUEUE_SIZE - (int) (queue->head - queue->tail);
+}
+
+static void transmit_next_report(void) {
+  USBD_HID_HandleTypeDef* hhid = (USBD_HID_HandleTypeDef*) hUsbDeviceFS.pClassData;
+  uint32_t tail = report_queue_tail;
+
+  if ((hhid == NULL) || (hhid->state != HID_IDLE)) {
+    return;
+  }
+
+  if (hhid->Protocol == HID_BOOT_PROTOCOL) {
+    // The boot protocol only carries keyboard reports, drop the others.
+    if (report_in_flight != HID_KEYBOARD_REPORT_ID) {
+      report_in_flight = 0;
+    }
+    consumer_queue.tail = consumer_queue.head;
+    system_queue.tail = system_queue.head;
+  }
+
+  // If a report is still marked in flight here, its transfer was aborted by a
+  // bus reset, so the same report is sent again. Otherwise consumer and system
+  // reports go ahead of keyboard reports.
+  if (report_in_flight == 0) {
+    if (consumer_queue.tail != consumer_queue.head) {
+      report_in_flight = HID_CONSUMER_REPORT_ID;
+    } else if (system_queue.tail != system_queue.head) {
+      report_in_flight = HID_SYSTEM_REPORT_ID;
+    } else if (tail != report_queue_head) {
+      report_in_flight = HID_KEYBOARD_REPORT_ID;
+    } else {
+      return;
+    }
+  }
+
+  if (report_in_flight == HID_CONSUMER_REPORT_ID) {
+    transmit_usage_report(&consumer_queue, HID_CONSUMER_REPORT_ID);
+  } else if (report_in_flight == HID_SYSTEM_REPORT_ID) {
+    transmit_usage_report(&system_queue, HID_SYSTEM_REPORT_ID);
+  } else if (hhid->Protocol == HID_BOOT_PROTOCOL) {
+    // The keyboard report is formatted for the protocol selected by the host
+    // at the time it is sent.
+    build_boot_report(&report_queue[tail & (REPORT_QUEUE_SIZE - 1)], &tx_report.boot);
+    USBD_HID_SendReport(&hUsbDeviceFS, (uint8_t*) &tx_report.boot, sizeof(BootKeyboardReport));
+  } else {
+    tx_report.report.report_id = HID_KEYBOARD_REPORT_ID;
+    tx_report.report.keyboard = report_queue[tail & (REPORT_QUEUE_SIZE - 1)];
+    USBD_HID_SendReport(&hUsbDeviceFS, (uint8_t*) &tx_report.report, sizeof(KeyboardIdReport));
+  }
+}
+
+static void transmit_usage_report(UsageQueue* queue, uint8_t report_id) {
+  uint16_t usage = queue->usages[queue->tail & (USAGE_QUEUE_SIZE - 1)];
+
+  tx_report.usage.report_id = report_id;
+  tx_report.usage.usage[0] = (uint8_t) usage;
+  tx_report.usage.usage[1] = (uint8_t) (usage >> 8);
+  USBD_HID_SendReport(&hUsbDeviceFS, (uint8_t*) &tx_report.usage, sizeof(UsageReport));
+}
+
+static void build_boot_report(const KeyboardReport* report, BootKeyboardReport* boot) {
+  int count = 0;
+  int i;
+  int bit;
+
+  memset(boot, 0, sizeof(BootKeyboardReport));
+  boot->modifiers = report->modifiers;
+
+  for (i = 0; i < KEY_BITMAP_SIZE; i++) {
+    if (report->keys[i] == 0) {
+      continue;
+    }
+    for (bit = 0; bit < 8; bit++) {
+      if (!(report->keys[i] & (1 << bit))) {
+        continue;
+      }
+      if (count == BOOT_KEYS) {
+        // Too many keys held, report a rollover error in every slot.
+        memset(boot->keys, KEY_ERROR_ROLLOVER, sizeof(boot->keys));
+        return;
+      }
+      boot->keys[count++] = (uint8_t) ((i << 3) | bit);
+    }
+  }
+}
+
+void USBD_HID_ReportSentCallback(USBD_HandleTypeDef* pdev) {
+  // The report at the tail of its queue has been sent, release its slot.
+  if (report_in_flight == HID_KEYBOARD_REPORT_ID) {
+    report_queue_tail++;
+  } else if (report_in_flight == HID_CONSUMER_REPORT_ID) {
+    consumer_queue.tail++;
+  } else if (report_in_flight == HID_SYSTEM_REPORT_ID) {
+    system_queue.tail++;
+  }
+  report_in_flight = 0;
+  transmit_next_report();
+}
+
+void USBD_HID_OutputReportCallback(USBD_HandleTypeDef* pdev, uint8_t* report, uint16_t len) {
+  // In report protocol the LED states follow the report ID.
+  leds_state = report[len - 1];
+  USB_HID_Keyboard_LedsCallback(leds_state);
+}
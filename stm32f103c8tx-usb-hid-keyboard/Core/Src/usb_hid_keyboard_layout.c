@@ -0,0 +1,465 @@
+/*!
+ * @file   usb_hid_keyboard_layout.c
+ * @brief  Keyboard layouts, mapping Unicode code points to HID key strokes
+ *
+ * Usages are named after the key position on a US keyboard. Layouts follow
+ * the Windows variants of each national layout.
+ */
+#include "usb_hid_keyboard_layout.h"
+
+/*
+ * Modifiers used by the layouts.
+ */
+#define NONE   0x00
+#define SHIFT  0x02
+#define ALTGR  0x40
+
+/*
+ * Dead keys.
+ */
+#define DEAD_NONE        0
+#define DEAD_ACUTE       1
+#define DEAD_GRAVE       2
+#define DEAD_CIRCUMFLEX  3
+#define DEAD_DIAERESIS   4
+#define DEAD_TILDE       5
+#define DEAD_KEY_COUNT   6
+
+/*
+ * Layout. Code points above U+00FF are not indexed, the euro sign is the only
+ * one found on these layouts.
+ */
+typedef struct {
+  KeyStroke keys[256];
+  KeyStroke dead_keys[DEAD_KEY_COUNT];
+  KeyStroke euro;
+} KeyboardLayout;
+
+/*
+ * Layout table entry.
+ */
+#define KEY(code_point, usage, modifiers) [code_point] = {usage, modifiers},
+
+/*
+ * Keys shared by every layout.
+ */
+#define CONTROL_KEYS(K) \
+  K('\b', 0x2A, NONE) \
+  K('\t', 0x2B, NONE) \
+  K('\n', 0x28, NONE) \
+  K(' ',  0x2C, NONE)
+
+/*
+ * Letters, lower and upper case. Only a, m, q, w, y and z move between
+ * layouts.
+ */
+#define LETTER(K, letter, usage) K(letter, usage, NONE) K((letter) - 0x20, usage, SHIFT)
+
+#define LETTERS(K, a, m, q, w, y, z) \
+  LETTER(K, 'a', a)    LETTER(K, 'b', 0x05) LETTER(K, 'c', 0x06) LETTER(K, 'd', 0x07) \
+  LETTER(K, 'e', 0x08) LETTER(K, 'f', 0x09) LETTER(K, 'g', 0x0A) LETTER(K, 'h', 0x0B) \
+  LETTER(K, 'i', 0x0C) LETTER(K, 'j', 0x0D) LETTER(K, 'k', 0x0E) LETTER(K, 'l', 0x0F) \
+  LETTER(K, 'm', m)    LETTER(K, 'n', 0x11) LETTER(K, 'o', 0x12) LETTER(K, 'p', 0x13) \
+  LETTER(K, 'q', q)    LETTER(K, 'r', 0x15) LETTER(K, 's', 0x16) LETTER(K, 't', 0x17) \
+  LETTER(K, 'u', 0x18) LETTER(K, 'v', 0x19) LETTER(K, 'w', w)    LETTER(K, 'x', 0x1B) \
+  LETTER(K, 'y', y)    LETTER(K, 'z', z)
+
+#define QWERTY_LETTERS(K)  LETTERS(K, 0x04, 0x10, 0x14, 0x1A, 0x1C, 0x1D)
+#define QWERTZ_LETTERS(K)  LETTERS(K, 0x04, 0x10, 0x14, 0x1A, 0x1D, 0x1C)
+#define AZERTY_LETTERS(K)  LETTERS(K, 0x14, 0x33, 0x04, 0x1D, 0x1C, 0x1A)
+
+/*
+ * Digits on the top row.
+ */
+#define DIGITS(K, modifiers) \
+  K('1', 0x1E, modifiers) K('2', 0x1F, modifiers) K('3', 0x20, modifiers) \
+  K('4', 0x21, modifiers) K('5', 0x22, modifiers) K('6', 0x23, modifiers) \
+  K('7', 0x24, modifiers) K('8', 0x25, modifiers) K('9', 0x26, modifiers) \
+  K('0', 0x27, modifiers)
+
+/*
+ * US layout.
+ */
+static const KeyboardLayout layout_us = {
+  .keys = {
+    CONTROL_KEYS(KEY)
+    QWERTY_LETTERS(KEY)
+    DIGITS(KEY, NONE)
+    KEY('!',  0x1E, SHIFT)
+    KEY('@',  0x1F, SHIFT)
+    KEY('#',  0x20, SHIFT)
+    KEY('$',  0x21, SHIFT)
+    KEY('%',  0x22, SHIFT)
+    KEY('^',  0x23, SHIFT)
+    KEY('&',  0x24, SHIFT)
+    KEY('*',  0x25, SHIFT)
+    KEY('(',  0x26, SHIFT)
+    KEY(')',  0x27, SHIFT)
+    KEY('-',  0x2D, NONE)
+    KEY('_',  0x2D, SHIFT)
+    KEY('=',  0x2E, NONE)
+    KEY('+',  0x2E, SHIFT)
+    KEY('[',  0x2F, NONE)
+    KEY('{',  0x2F, SHIFT)
+    KEY(']',  0x30, NONE)
+    KEY('}',  0x30, SHIFT)
+    KEY('\\', 0x31, NONE)
+    KEY('|',  0x31, SHIFT)
+    KEY(';',  0x33, NONE)
+    KEY(':',  0x33, SHIFT)
+    KEY('\'', 0x34, NONE)
+    KEY('"',  0x34, SHIFT)
+    KEY('`',  0x35, NONE)
+    KEY('~',  0x35, SHIFT)
+    KEY(',',  0x36, NONE)
+    KEY('<',  0x36, SHIFT)
+    KEY('.',  0x37, NONE)
+    KEY('>',  0x37, SHIFT)
+    KEY('/',  0x38, NONE)
+    KEY('?',  0x38, SHIFT)
+  },
+};
+
+/*
+ * UK layout.
+ */
+static const KeyboardLayout layout_uk = {
+  .keys = {
+    CONTROL_KEYS(KEY)
+    QWERTY_LETTERS(KEY)
+    DIGITS(KEY, NONE)
+    KEY('!',  0x1E, SHIFT)
+    KEY('"',  0x1F, SHIFT)
+    KEY(0xA3, 0x20, SHIFT)          // Pound sign
+    KEY('$',  0x21, SHIFT)
+    KEY('%',  0x22, SHIFT)
+    KEY('^',  0x23, SHIFT)
+    KEY('&',  0x24, SHIFT)
+    KEY('*',  0x25, SHIFT)
+    KEY('(',  0x26, SHIFT)
+    KEY(')',  0x27, SHIFT)
+    KEY('-',  0x2D, NONE)
+    KEY('_',  0x2D, SHIFT)
+    KEY('=',  0x2E, NONE)
+    KEY('+',  0x2E, SHIFT)
+    KEY('[',  0x2F, NONE)
+    KEY('{',  0x2F, SHIFT)
+    KEY(']',  0x30, NONE)
+    KEY('}',  0x30, SHIFT)
+    KEY('#',  0x32, NONE)
+    KEY('~',  0x32, SHIFT)
+    KEY(';',  0x33, NONE)
+    KEY(':',  0x33, SHIFT)
+    KEY('\'', 0x34, NONE)
+    KEY('@',  0x34, SHIFT)
+    KEY('`',  0x35, NONE)
+    KEY(0xAC, 0x35, SHIFT)          // Not sign
+    KEY(0xA6, 0x35, ALTGR)          // Broken bar
+    KEY(',',  0x36, NONE)
+    KEY('<',  0x36, SHIFT)
+    KEY('.',  0x37, NONE)
+    KEY('>',  0x37, SHIFT)
+    KEY('/',  0x38, NONE)
+    KEY('?',  0x38, SHIFT)
+    KEY('\\', 0x64, NONE)
+    KEY('|',  0x64, SHIFT)
+    KEY(0xE1, 0x04, ALTGR)          // a acute
+    KEY(0xC1, 0x04, ALTGR | SHIFT)
+    KEY(0xE9, 0x08, ALTGR)          // e acute
+    KEY(0xC9, 0x08, ALTGR | SHIFT)
+    KEY(0xED, 0x0C, ALTGR)          // i acute
+    KEY(0xCD, 0x0C, ALTGR | SHIFT)
+    KEY(0xF3, 0x12, ALTGR)          // o acute
+    KEY(0xD3, 0x12, ALTGR | SHIFT)
+    KEY(0xFA, 0x18, ALTGR)          // u acute
+    KEY(0xDA, 0x18, ALTGR | SHIFT)
+  },
+  .euro = {0x21, ALTGR},
+};
+
+/*
+ * German layout.
+ */
+static const KeyboardLayout layout_de = {
+  .keys = {
+    CONTROL_KEYS(KEY)
+    QWERTZ_LETTERS(KEY)
+    DIGITS(KEY, NONE)
+    KEY('!',  0x1E, SHIFT)
+    KEY('"',  0x1F, SHIFT)
+    KEY(0xB2, 0x1F, ALTGR)          // Superscript two
+    KEY(0xA7, 0x20, SHIFT)          // Section sign
+    KEY(0xB3, 0x20, ALTGR)          // Superscript three
+    KEY('$',  0x21, SHIFT)
+    KEY('%',  0x22, SHIFT)
+    KEY('&',  0x23, SHIFT)
+    KEY('/',  0x24, SHIFT)
+    KEY('{',  0x24, ALTGR)
+    KEY('(',  0x25, SHIFT)
+    KEY('[',  0x25, ALTGR)
+    KEY(')',  0x26, SHIFT)
+    KEY(']',  0x26, ALTGR)
+    KEY('=',  0x27, SHIFT)
+    KEY('}',  0x27, ALTGR)
+    KEY('@',  0x14, ALTGR)
+    KEY(0xB5, 0x10, ALTGR)          // Micro sign
+    KEY(0xDF, 0x2D, NONE)           // Sharp s
+    KEY('?',  0x2D, SHIFT)
+    KEY('\\', 0x2D, ALTGR)
+    KEY(0xFC, 0x2F, NONE)           // u diaeresis
+    KEY(0xDC, 0x2F, SHIFT)
+    KEY('+',  0x30, NONE)
+    KEY('*',  0x30, SHIFT)
+    KEY('~',  0x30, ALTGR)
+    KEY('#',  0x32, NONE)
+    KEY('\'', 0x32, SHIFT)
+    KEY(0xF6, 0x33, NONE)           // o diaeresis
+    KEY(0xD6, 0x33, SHIFT)
+    KEY(0xE4, 0x34, NONE)           // a diaeresis
+    KEY(0xC4, 0x34, SHIFT)
+    KEY(0xB0, 0x35, SHIFT)          // Degree sign
+    KEY(',',  0x36, NONE)
+    KEY(';',  0x36, SHIFT)
+    KEY('.',  0x37, NONE)
+    KEY(':',  0x37, SHIFT)
+    KEY('-',  0x38, NONE)
+    KEY('_',  0x38, SHIFT)
+    KEY('<',  0x64, NONE)
+    KEY('>',  0x64, SHIFT)
+    KEY('|',  0x64, ALTGR)
+  },
+  .dead_keys = {
+    [DEAD_ACUTE]      = {0x2E, NONE},
+    [DEAD_GRAVE]      = {0x2E, SHIFT},
+    [DEAD_CIRCUMFLEX] = {0x35, NONE},
+  },
+  .euro = {0x08, ALTGR},
+};
+
+/*
+ * French layout.
+ */
+static const KeyboardLayout layout_fr = {
+  .keys = {
+    CONTROL_KEYS(KEY)
+    AZERTY_LETTERS(KEY)
+    DIGITS(KEY, SHIFT)
+    KEY('&',  0x1E, NONE)
+    KEY(0xE9, 0x1F, NONE)           // e acute
+    KEY('"',  0x20, NONE)
+    KEY('#',  0x20, ALTGR)
+    KEY('\'', 0x21, NONE)
+    KEY('{',  0x21, ALTGR)
+    KEY('(',  0x22, NONE)
+    KEY('[',  0x22, ALTGR)
+    KEY('-',  0x23, NONE)
+    KEY('|',  0x23, ALTGR)
+    KEY(0xE8, 0x24, NONE)           // e grave
+    KEY('_',  0x25, NONE)
+    KEY('\\', 0x25, ALTGR)
+    KEY(0xE7, 0x26, NONE)           // c cedilla
+    KEY(0xE0, 0x27, NONE)           // a grave
+    KEY('@',  0x27, ALTGR)
+    KEY(')',  0x2D, NONE)
+    KEY(0xB0, 0x2D, SHIFT)          // Degree sign
+    KEY(']',  0x2D, ALTGR)
+    KEY('=',  0x2E, NONE)
+    KEY('+',  0x2E, SHIFT)
+    KEY('}',  0x2E, ALTGR)
+    KEY('$',  0x30, NONE)
+    KEY(0xA3, 0x30, SHIFT)          // Pound sign
+    KEY(0xA4, 0x30, ALTGR)          // Currency sign
+    KEY('*',  0x32, NONE)
+    KEY(0xB5, 0x32, SHIFT)          // Micro sign
+    KEY(0xF9, 0x34, NONE)           // u grave
+    KEY('%',  0x34, SHIFT)
+    KEY(0xB2, 0x35, NONE)           // Superscript two
+    KEY(',',  0x10, NONE)
+    KEY('?',  0x10, SHIFT)
+    KEY(';',  0x36, NONE)
+    KEY('.',  0x36, SHIFT)
+    KEY(':',  0x37, NONE)
+    KEY('/',  0x37, SHIFT)
+    KEY('!',  0x38, NONE)
+    KEY(0xA7, 0x38, SHIFT)          // Section sign
+    KEY('<',  0x64, NONE)
+    KEY('>',  0x64, SHIFT)
+  },
+  .dead_keys = {
+    [DEAD_GRAVE]      = {0x24, ALTGR},
+    [DEAD_CIRCUMFLEX] = {0x2F, NONE},
+    [DEAD_DIAERESIS]  = {0x2F, SHIFT},
+    [DEAD_TILDE]      = {0x1F, ALTGR},
+  },
+  .euro = {0x08, ALTGR},
+};
+
+/*
+ * Spanish layout.
+ */
+static const KeyboardLayout layout_es = {
+  .keys = {
+    CONTROL_KEYS(KEY)
+    QWERTY_LETTERS(KEY)
+    DIGITS(KEY, NONE)
+    KEY('!',  0x1E, SHIFT)
+    KEY('|',  0x1E, ALTGR)
+    KEY('"',  0x1F, SHIFT)
+    KEY('@',  0x1F, ALTGR)
+    KEY(0xB7, 0x20, SHIFT)          // Middle dot
+    KEY('#',  0x20, ALTGR)
+    KEY('$',  0x21, SHIFT)
+    KEY('%',  0x22, SHIFT)
+    KEY('&',  0x23, SHIFT)
+    KEY(0xAC, 0x23, ALTGR)          // Not sign
+    KEY('/',  0x24, SHIFT)
+    KEY('(',  0x25, SHIFT)
+    KEY(')',  0x26, SHIFT)
+    KEY('=',  0x27, SHIFT)
+    KEY('\'', 0x2D, NONE)
+    KEY('?',  0x2D, SHIFT)
+    KEY(0xA1, 0x2E, NONE)           // Inverted exclamation mark
+    KEY(0xBF, 0x2E, SHIFT)          // Inverted question mark
+    KEY('[',  0x2F, ALTGR)
+    KEY('+',  0x30, NONE)
+    KEY('*',  0x30, SHIFT)
+    KEY(']',  0x30, ALTGR)
+    KEY(0xE7, 0x32, NONE)           // c cedilla
+    KEY(0xC7, 0x32, SHIFT)
+    KEY('}',  0x32, ALTGR)
+    KEY(0xF1, 0x33, NONE)           // n tilde
+    KEY(0xD1, 0x33, SHIFT)
+    KEY('{',  0x34, ALTGR)
+    KEY(0xBA, 0x35, NONE)           // Masculine ordinal indicator
+    KEY(0xAA, 0x35, SHIFT)          // Feminine ordinal indicator
+    KEY('\\', 0x35, ALTGR)
+    KEY(',',  0x36, NONE)
+    KEY(';',  0x36, SHIFT)
+    KEY('.',  0x37, NONE)
+    KEY(':',  0x37, SHIFT)
+    KEY('-',  0x38, NONE)
+    KEY('_',  0x38, SHIFT)
+    KEY('<',  0x64, NONE)
+    KEY('>',  0x64, SHIFT)
+  },
+  .dead_keys = {
+    [DEAD_ACUTE]      = {0x34, NONE},
+    [DEAD_GRAVE]      = {0x2F, NONE},
+    [DEAD_CIRCUMFLEX] = {0x2F, SHIFT},
+    [DEAD_DIAERESIS]  = {0x34, SHIFT},
+    [DEAD_TILDE]      = {0x21, ALTGR},
+  },
+  .euro = {0x08, ALTGR},
+};
+
+static const KeyboardLayout* const layouts[KEYBOARD_LAYOUT_COUNT] = {
+  [KEYBOARD_LAYOUT_US] = &layout_us,
+  [KEYBOARD_LAYOUT_UK] = &layout_uk,
+  [KEYBOARD_LAYOUT_DE] = &layout_de,
+  [KEYBOARD_LAYOUT_FR] = &layout_fr,
+  [KEYBOARD_LAYOUT_ES] = &layout_es,
+};
+
+/*
+ * Characters typed with a dead key followed by a base character, the same
+ * on every layout. A dead key followed by a space types the accent itself.
+ */
+typedef struct {
+  uint8_t dead_key;
+  uint8_t base;
+} Composition;
+
+#define COMPOSE(code_point, dead_key, base) [code_point] = {dead_key, base},
+
+static const Composition compositions[256] = {
+  COMPOSE('`',  DEAD_GRAVE,      ' ')
+  COMPOSE('^',  DEAD_CIRCUMFLEX, ' ')
+  COMPOSE('~',  DEAD_TILDE,      ' ')
+  COMPOSE(0xA8, DEAD_DIAERESIS,  ' ')
+  COMPOSE(0xB4, DEAD_ACUTE,      ' ')
+  COMPOSE(0xC0, DEAD_GRAVE,      'A')
+  COMPOSE(0xC1, DEAD_ACUTE,      'A')
+  COMPOSE(0xC2, DEAD_CIRCUMFLEX, 'A')
+  COMPOSE(0xC3, DEAD_TILDE,      'A')
+  COMPOSE(0xC4, DEAD_DIAERESIS,  'A')
+  COMPOSE(0xC8, DEAD_GRAVE,      'E')
+  COMPOSE(0xC9, DEAD_ACUTE,      'E')
+  COMPOSE(0xCA, DEAD_CIRCUMFLEX, 'E')
+  COMPOSE(0xCB, DEAD_DIAERESIS,  'E')
+  COMPOSE(0xCC, DEAD_GRAVE,      'I')
+  COMPOSE(0xCD, DEAD_ACUTE,      'I')
+  COMPOSE(0xCE, DEAD_CIRCUMFLEX, 'I')
+  COMPOSE(0xCF, DEAD_DIAERESIS,  'I')
+  COMPOSE(0xD1, DEAD_TILDE,      'N')
+  COMPOSE(0xD2, DEAD_GRAVE,      'O')
+  COMPOSE(0xD3, DEAD_ACUTE,      'O')
+  COMPOSE(0xD4, DEAD_CIRCUMFLEX, 'O')
+  COMPOSE(0xD5, DEAD_TILDE,      'O')
+  COMPOSE(0xD6, DEAD_DIAERESIS,  'O')
+  COMPOSE(0xD9, DEAD_GRAVE,      'U')
+  COMPOSE(0xDA, DEAD_ACUTE,      'U')
+  COMPOSE(0xDB, DEAD_CIRCUMFLEX, 'U')
+  COMPOSE(0xDC, DEAD_DIAERESIS,  'U')
+  COMPOSE(0xDD, DEAD_ACUTE,      'Y')
+  COMPOSE(0xE0, DEAD_GRAVE,      'a')
+  COMPOSE(0xE1, DEAD_ACUTE,      'a')
+  COMPOSE(0xE2, DEAD_CIRCUMFLEX, 'a')
+  COMPOSE(0xE3, DEAD_TILDE,      'a')
+  COMPOSE(0xE4, DEAD_DIAERESIS,  'a')
+  COMPOSE(0xE8, DEAD_GRAVE,      'e')
+  COMPOSE(0xE9, DEAD_ACUTE,      'e')
+  COMPOSE(0xEA, DEAD_CIRCUMFLEX, 'e')
+  COMPOSE(0xEB, DEAD_DIAERESIS,  'e')
+  COMPOSE(0xEC, DEAD_GRAVE,      'i')
+  COMPOSE(0xED, DEAD_ACUTE,      'i')
+  COMPOSE(0xEE, DEAD_CIRCUMFLEX, 'i')
+  COMPOSE(0xEF, DEAD_DIAERESIS,  'i')
+  COMPOSE(0xF1, DEAD_TILDE,      'n')
+  COMPOSE(0xF2, DEAD_GRAVE,      'o')
+  COMPOSE(0xF3, DEAD_ACUTE,      'o')
+  COMPOSE(0xF4, DEAD_CIRCUMFLEX, 'o')
+  COMPOSE(0xF5, DEAD_TILDE,      'o')
+  COMPOSE(0xF6, DEAD_DIAERESIS,  'o')
+  COMPOSE(0xF9, DEAD_GRAVE,      'u')
+  COMPOSE(0xFA, DEAD_ACUTE,      'u')
+  COMPOSE(0xFB, DEAD_CIRCUMFLEX, 'u')
+  COMPOSE(0xFC, DEAD_DIAERESIS,  'u')
+  COMPOSE(0xFD, DEAD_ACUTE,      'y')
+  COMPOSE(0xFF, DEAD_DIAERESIS,  'y')
+};
+
+int USB_HID_Keyboard_LayoutLookup(uint8_t layout, uint32_t code_point, KeyStroke* strokes) {
+  const KeyboardLayout* keyboard_layout;
+  const Composition* composition;
+
+  if (layout >= KEYBOARD_LAYOUT_COUNT) {
+    return 0;
+  }
+  keyboard_layout = layouts[layout];
+
+  if (code_point == 0x20AC) {
+    // Euro sign.
+    strokes[0] = keyboard_layout->euro;
+    return (strokes[0].usage != 0) ? 1 : 0;
+  }
+  if (code_point > 0xFF) {
+    return 0;
+  }
+
+  // Key of its own.
+  if (keyboard_layout->keys[code_point].usage != 0) {
+    strokes[0] = keyboard_layout->keys[code_point];
+    return 1;
+  }
+
+  // Dead key followed by the base character.
+  composition = &compositions[code_point];
+  if ((composition->dead_key == DEAD_NONE) ||
+      (keyboard_layout->dead_keys[composition->dead_key].usage == 0) ||
+      (keyboard_layout->keys[composition->base].usage == 0)) {
+    return 0;
+  }
+  strokes[0] = keyboard_layout->dead_keys[composition->dead_key];
+  strokes[1] = keyboard_layout->keys[composition->base];
+  return 2;
+}
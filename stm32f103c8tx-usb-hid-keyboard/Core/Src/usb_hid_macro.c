@@ -0,0 +1,354 @@
+/*!
+ * @file   usb_hid_macro.c
+ * @brief  Keystroke macros, run from a compact bytecode
+ */
+#include "usb_hid_macro.h"
+#include "usb_hid_keyboard.h"
+#include "usb_hid_mouse.h"
+#include "scheduler.h"
+
+#include <stddef.h>
+
+/*
+ * Reports a single key or character may take in the keyboard report queue
+ * (a dead key, its base key and the releases in between).
+ */
+#define REPORTS_PER_KEY 4
+
+/*
+ * Instructions run before yielding to other tasks.
+ */
+#define STEPS_PER_RUN 16
+
+/*
+ * Stored macro image bounds, from the linker script.
+ */
+extern const uint8_t _smacros[];
+extern const uint8_t _emacros[];
+
+/*
+ * Repeated block: position of its first instruction and runs left.
+ */
+typedef struct {
+  uint32_t start;
+  uint16_t remaining;
+} RepeatBlock;
+
+/*
+ * Interpreter state.
+ */
+typedef struct {
+  const uint8_t* code;
+  uint32_t size;
+  uint32_t pc;
+  uint32_t string_offset;
+  RepeatBlock repeats[MACRO_REPEAT_DEPTH];
+  uint8_t depth;
+  uint8_t running;
+} MacroState;
+
+static MacroState macro;
+
+/*
+ * Incremented each time a macro starts or stops, so steps still scheduled for
+ * a previous macro do nothing.
+ */
+static uint32_t macro_generation;
+
+/*!
+ * @brief Operand size of an instruction.
+ *
+ * @param[in] pc Position of the instruction.
+ * @return    Operand size in bytes, otherwise -1 if the instruction is invalid
+ *            or runs past the end of the bytecode.
+ */
+static int operand_size(uint32_t pc);
+
+/*!
+ * @brief Run instructions until the macro waits, yields or ends. Scheduler callback.
+ *
+ * @param[in] arg Generation of the macro the step belongs to.
+ * @return    None.
+ */
+static void macro_step(void* arg);
+
+/*!
+ * @brief Type as much of the current string as the report queue can take. The
+ *        string is typed in parts with its last key held in between, so it
+ *        takes as many reports as typed at once.
+ *
+ * @param[in] text   String operand.
+ * @param[in] length String length in bytes.
+ * @return    1 once the string is typed, 0 to wait for the report queue, -1 on error.
+ */
+static int type_string(const uint8_t* text, uint32_t length);
+
+/*!
+ * @brief Schedule the next step of the running macro.
+ *
+ * @param[in] delay Delay in milliseconds, 0 to run as soon as possible.
+ * @return    None.
+ */
+static void schedule_step(uint32_t delay);
+
+/*!
+ * @brief End the running macro.
+ *
+ * @param[in] release True (1) to release all keys, e.g. when aborted.
+ * @return    None.
+ */
+static void finish(int release);
+
+/*!
+ * @brief Read a 16-bit little endian value.
+ *
+ * @param[in] data Value bytes.
+ * @return    Value.
+ */
+static uint16_t read_u16(const uint8_t* data);
+
+int USB_HID_Macro_Run(const uint8_t* code, uint32_t size) {
+  if (macro.running || (code == NULL) || (size == 0)) {
+    return 0;
+  }
+
+  macro.code = code;
+  macro.size = size;
+  macro.pc = 0;
+  macro.string_offset = 0;
+  macro.depth = 0;
+  macro.running = 1;
+  macro_generation++;
+  schedule_step(0);
+  return 1;
+}
+
+int USB_HID_Macro_RunStored(uint16_t index) {
+  uint32_t image_size = (uint32_t) (_emacros - _smacros);
+  uint32_t magic;
+  uint16_t offset;
+
+  magic = read_u16(&_smacros[0]) | ((uint32_t) read_u16(&_smacros[2]) << 16);
+  if ((magic != MACRO_IMAGE_MAGIC) || (index >= read_u16(&_smacros[4])) ||
+      ((8 + (2 * (uint32_t) index)) > image_size)) {
+    return 0;
+  }
+  offset = read_u16(&_smacros[6 + (2 * index)]);
+  if (offset >= image_size) {
+    return 0;
+  }
+
+  // The macro ends with its MACRO_OP_END, bounded by the image end.
+  return USB_HID_Macro_Run(&_smacros[offset], image_size - offset);
+}
+
+void USB_HID_Macro_Stop(void) {
+  if (macro.running) {
+    finish(1);
+  }
+}
+
+int USB_HID_Macro_IsRunning(void) {
+  return macro.running;
+}
+
+static int operand_size(uint32_t pc) {
+  int size;
+
+  switch (macro.code[pc]) {
+    case MACRO_OP_END:
+    case MACRO_OP_RELEASE_ALL:
+    case MACRO_OP_LOOP:
+      size = 0;
+      break;
+    case MACRO_OP_PRESS:
+    case MACRO_OP_RELEASE:
+    case MACRO_OP_TAP:
+      size = 1;
+      break;
+    case MACRO_OP_STRING:
+      size = ((pc + 1) < macro.size) ? (1 + macro.code[pc + 1]) : 1;
+      break;
+    case MACRO_OP_DELAY:
+    case MACRO_OP_REPEAT:
+      size = 2;
+      break;
+    case MACRO_OP_MOUSE_MOVE:
+      size = 5;
+      break;
+    default:
+      return -1;
+  }
+
+  if ((pc + 1 + size) > macro.size) {
+    return -1;
+  }
+  return size;
+}
+
+static void macro_step(void* arg) {
+  const uint8_t* operands;
+  RepeatBlock* block;
+  uint16_t frames;
+  int steps;
+  int size;
+  int result = 1;
+
+  if (!macro.running || ((uint32_t) (uintptr_t) arg != macro_generation)) {
+    // Stale step of a stopped macro.
+    return;
+  }
+
+  for (steps = 0; steps < STEPS_PER_RUN; steps++) {
+    if ((macro.pc >= macro.size) || ((size = operand_size(macro.pc)) < 0)) {
+      finish(1);
+      return;
+    }
+
+    // Leave room in the keyboard report queue for the worst case, rather than
+    // waiting for the host inside the keyboard module.
+    if ((macro.code[macro.pc] >= MACRO_OP_PRESS) && (macro.code[macro.pc] <= MACRO_OP_STRING) &&
+        (USB_HID_Keyboard_QueueSpace() < REPORTS_PER_KEY)) {
+      schedule_step(1);
+      return;
+    }
+    // Same for the mouse: a move takes a segment when none is pending.
+    if ((macro.code[macro.pc] == MACRO_OP_MOUSE_MOVE) && (USB_HID_Mouse_QueueSpace() == 0)) {
+      schedule_step(1);
+      return;
+    }
+
+    operands = &macro.code[macro.pc + 1];
+    switch (macro.code[macro.pc]) {
+      case MACRO_OP_END:
+        finish(0);
+        return;
+
+      case MACRO_OP_PRESS:
+        result = USB_HID_Keyboard_Press(operands[0]);
+        break;
+
+      case MACRO_OP_RELEASE:
+        result = USB_HID_Keyboard_Release(operands[0]);
+        break;
+
+      case MACRO_OP_TAP:
+        result = USB_HID_Keyboard_Tap(operands[0]);
+        break;
+
+      case MACRO_OP_RELEASE_ALL:
+        result = USB_HID_Keyboard_ReleaseAll();
+        break;
+
+      case MACRO_OP_STRING:
+        result = type_string(&operands[1], operands[0]);
+        if (result == 0) {
+          schedule_step(1);
+          return;
+        }
+        break;
+
+      case MACRO_OP_DELAY:
+        frames = read_u16(operands);
+        if (frames != 0) {
+          // Full speed frames are 1 ms long, as are scheduler ticks.
+          macro.pc += 1 + size;
+          schedule_step(frames);
+          return;
+        }
+        break;
+
+      case MACRO_OP_REPEAT:
+        if ((macro.depth == MACRO_REPEAT_DEPTH) || (read_u16(operands) == 0)) {
+          result = 0;
+          break;
+        }
+        block = &macro.repeats[macro.depth++];
+        block->start = macro.pc + 1 + size;
+        block->remaining = read_u16(operands);
+        break;
+
+      case MACRO_OP_LOOP:
+        if (macro.depth == 0) {
+          result = 0;
+          break;
+        }
+        block = &macro.repeats[macro.depth - 1];
+        if (--block->remaining != 0) {
+          macro.pc = block->start;
+          continue;
+        }
+        macro.depth--;
+        break;
+
+      case MACRO_OP_MOUSE_MOVE:
+        result = USB_HID_Mouse_Move((int16_t) read_u16(&operands[0]),
+                                    (int16_t) read_u16(&operands[2]),
+                                    (int8_t) operands[4]);
+        break;
+    }
+
+    if (result <= 0) {
+      // Invalid instruction, or the device is no longer configured.
+      finish(1);
+      return;
+    }
+    macro.pc += 1 + size;
+  }
+
+  // Let other tasks run before going on.
+  schedule_step(0);
+}
+
+static int type_string(const uint8_t* text, uint32_t length) {
+  int typed;
+
+  if (macro.string_offset < length) {
+    // Stops at the first character the report queue has no room for.
+    typed = USB_HID_Keyboard_WritePart((uint8_t*) &text[macro.string_offset],
+                                       (int) (length - macro.string_offset));
+    if ((typed == 0) && (USB_HID_Keyboard_QueueSpace() > REPORTS_PER_KEY)) {
+      // Nothing typed although any character fit, the text is invalid.
+      return -1;
+    }
+    macro.string_offset += (uint32_t) typed;
+    if (macro.string_offset < length) {
+      return 0;
+    }
+  }
+
+  // Release the last key once the whole string is typed. Its slot was left
+  // free, so this only fails once the device is no longer configured.
+  if (!USB_HID_Keyboard_WriteEnd()) {
+    return -1;
+  }
+  macro.string_offset = 0;
+  return 1;
+}
+
+static void schedule_step(uint32_t delay) {
+  void* arg = (void*) (uintptr_t) macro_generation;
+
+  if (delay == 0) {
+    if (Scheduler_Post(macro_step, arg)) {
+      return;
+    }
+    delay = 1;
+  }
+  if (!Scheduler_PostDelayed(macro_step, arg, delay)) {
+    // No timer left, the macro can't go on.
+    finish(1);
+  }
+}
+
+static void finish(int release) {
+  macro.running = 0;
+  macro_generation++;
+  if (release) {
+    USB_HID_Keyboard_ReleaseAll();
+  }
+}
+
+static uint16_t read_u16(const uint8_t* data) {
+  return (uint16_t) (data[0] | (data[1] << 8));
+}
@@ -0,0 +1,230 @@
+/*!
+ * @file   usb_hid_mouse.c
+ * @brief  Module to use the microcontroller as an USB Mouse
+ * @author Javier Balloffet <javier.balloffet@gmail.com>
+ * @date   Jul 9, 2020
+ *
+ * Note: Based on Arduino's Mouse library (see https://github.com/arduino-libraries/Mouse).
+ */
+#include "usb_hid_mouse.h"
+#include "usbd_hid.h"
+
+/*
+ * USB handler.
+ */
+extern USBD_HandleTypeDef hUsbDeviceFS;
+
+/*
+ * Mouse report structure.
+ */
+typedef struct {
+  uint8_t buttons;
+  int8_t x;
+  int8_t y;
+  int8_t wheel;
+} MouseReport;
+
+/*
+ * Mouse report being transmitted.
+ */
+static MouseReport mouse_report;
+
+/*
+ * Motion segment. Moves made with the same buttons held are summed into one
+ * segment, which is sent in chunks of at most 127 counts per axis.
+ */
+typedef struct {
+  uint8_t buttons;
+  int32_t x;
+  int32_t y;
+  int32_t wheel;
+} MotionSegment;
+
+/*
+ * Segment queue size (must be a power of two).
+ */
+#define SEGMENT_QUEUE_SIZE 8
+
+/*
+ * Segment queue. A new segment is opened each time the buttons change, so
+ * press, drag and release reach the host in order. Every queued segment is
+ * worth at least one report. Both ends are only touched with the USB
+ * interrupt masked or from the USB interrupt itself.
+ */
+static MotionSegment segment_queue[SEGMENT_QUEUE_SIZE];
+static volatile uint32_t segment_queue_head;
+static volatile uint32_t segment_queue_tail;
+
+/*
+ * Buttons currently held.
+ */
+static uint8_t buttons_state;
+
+/*
+ * Motion source pulled when no segment is queued.
+ */
+static USB_HID_Mouse_MotionSource motion_source;
+
+/*!
+ * @brief Queue a motion, opening a new segment if the buttons changed.
+ *
+ * @param[in] buttons Buttons held from this motion on.
+ * @param[in] x       Pointer movement along the x axis.
+ * @param[in] y       Pointer movement along the y axis.
+ * @param[in] wheel   Wheel rotation.
+ * @return    True (1) in case of success, otherwise false (0).
+ */
+static int queue_motion(uint8_t buttons, int32_t x, int32_t y, int32_t wheel);
+
+/*!
+ * @brief Saturate a motion delta to the report range.
+ *
+ * @param[in] delta Accumulated delta.
+ * @return    Delta clamped to [-127, 127].
+ */
+static int8_t saturate(int32_t delta);
+
+/*!
+ * @brief Send the next chunk of the segment at the queue tail, if the endpoint is idle.
+ *
+ * Must be called with the USB interrupt masked or from the USB interrupt itself.
+ * @return None.
+ */
+static void transmit_next_report(void);
+
+int USB_HID_Mouse_Click(uint8_t buttons) {
+  // Both segments must fit, the buttons would stay pressed otherwise.
+  if (USB_HID_Mouse_QueueSpace() < 2) {
+    return 0;
+  }
+  if (!USB_HID_Mouse_Press(buttons)) {
+    return 0;
+  }
+  return USB_HID_Mouse_Release(buttons);
+}
+
+int USB_HID_Mouse_Press(uint8_t buttons) {
+  // Set required buttons' bits.
+  return queue_motion(buttons_state | buttons, 0, 0, 0);
+}
+
+int USB_HID_Mouse_Release(uint8_t buttons) {
+  // Clear required buttons' bits.
+  return queue_motion(buttons_state & ~buttons, 0, 0, 0);
+}
+
+int USB_HID_Mouse_ReleaseAll() {
+  return queue_motion(0, 0, 0, 0);
+}
+
+int USB_HID_Mouse_Move(int32_t x, int32_t y, int32_t wheel) {
+  return queue_motion(buttons_state, x, y, wheel);
+}
+
+int USB_HID_Mouse_QueueSpace(void) {
+  return SEGMENT_QUEUE_SIZE - (int) (segment_queue_head - segment_queue_tail);
+}
+
+void USB_HID_Mouse_SetMotionSource(USB_HID_Mouse_MotionSource source) {
+  HAL_NVIC_DisableIRQ(USB_LP_CAN1_RX0_IRQn);
+  motion_source = source;
+  transmit_next_report();
+  HAL_NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
+}
+
+static int queue_motion(uint8_t buttons, int32_t x, int32_t y, int32_t wheel) {
+  MotionSegment* segment;
+  uint32_t head;
+
+  if (hUsbDeviceFS.dev_state != USBD_STATE_CONFIGURED) {
+    return 0;
+  }
+
+  HAL_NVIC_DisableIRQ(USB_LP_CAN1_RX0_IRQn);
+  head = segment_queue_head;
+  segment = &segment_queue[(head - 1) & (SEGMENT_QUEUE_SIZE - 1)];
+  if ((head != segment_queue_tail) && (segment->buttons == buttons)) {
+    // Same buttons as the last pending segment, coalesce.
+    segment->x += x;
+    segment->y += y;
+    segment->wheel += wheel;
+  } else if ((head == segment_queue_tail) && (buttons == mouse_report.buttons) &&
+             (x == 0) && (y == 0) && (wheel == 0)) {
+    // Nothing changed since the last report.
+  } else {
+    if ((head - segment_queue_tail) >= SEGMENT_QUEUE_SIZE) {
+      // Buttons change faster than the host polls. Leave the buttons and the
+      // pointer as they are rather than wait for the interrupt to free a slot,
+      // which would stall every other task: the caller retries once
+      // USB_HID_Mouse_QueueSpace() allows.
+      HAL_NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
+      return 0;
+    }
+    segment = &segment_queue[head & (SEGMENT_QUEUE_SIZE - 1)];
+    segment->buttons = buttons;
+    segment->x = x;
+    segment->y = y;
+    segment->wheel = wheel;
+    segment_queue_head = head + 1;
+  }
+  buttons_state = buttons;
+
+  // Kick the endpoint if it is not already draining the queue.
+  transmit_next_report();
+  HAL_NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
+  return 1;
+}
+
+static int8_t saturate(int32_t delta) {
+  if (delta > 127) {
+    return 127;
+  }
+  if (delta < -127) {
+    return -127;
+  }
+  return (int8_t) delta;
+}
+
+static void transmit_next_report(void) {
+  USBD_HID_HandleTypeDef* hhid = (USBD_HID_HandleTypeDef*) hUsbDeviceFS.pClassData;
+  MotionSegment* segment;
+  uint32_t tail = segment_queue_tail;
+  int32_t x;
+  int32_t y;
+
+  if ((hhid == NULL) || (hhid->MouseState != HID_IDLE)) {
+    return;
+  }
+  if (tail == segment_queue_head) {
+    // Nothing queued, let the motion source fill this poll.
+    if ((motion_source == NULL) || !motion_source(&x, &y)) {
+      return;
+    }
+    mouse_report.buttons = buttons_state;
+    mouse_report.x = saturate(x);
+    mouse_report.y = saturate(y);
+    mouse_report.wheel = 0;
+    USBD_HID_SendMouseReport(&hUsbDeviceFS, (uint8_t*) &mouse_report, sizeof(MouseReport));
+    return;
+  }
+
+  // Take the largest chunk the report can carry and leave the remainder for
+  // the next poll.
+  segment = &segment_queue[tail & (SEGMENT_QUEUE_SIZE - 1)];
+  mouse_report.buttons = segment->buttons;
+  mouse_report.x = saturate(segment->x);
+  mouse_report.y = saturate(segment->y);
+  mouse_report.wheel = saturate(segment->wheel);
+  segment->x -= mouse_report.x;
+  segment->y -= mouse_report.y;
+  segment->wheel -= mouse_report.wheel;
+  if ((segment->x == 0) && (segment->y == 0) && (segment->wheel == 0)) {
+    segment_queue_tail = tail + 1;
+  }
+
+  USBD_HID_SendMouseReport(&hUsbDeviceFS, (uint8_t*) &mouse_report, sizeof(MouseReport));
+}
+
+void USBD_HID_MouseReportSentCallback(USBD_HandleTypeDef* pdev) {
+  transmit_next_report();
+}
@@ -0,0 +1,298 @@
+/*!
+ * @file   usb_hid_recorder.c
+ * @brief  Recording and frame-accurate replay of the reports sent to the host
+ */
+#include "usb_hid_recorder.h"
+#include "usbd_hid.h"
+
+#define RING_MASK (RECORDER_BUFFER_SIZE - 1)
+
+/*
+ * Flushed recording header: magic number and size.
+ */
+#define HEADER_SIZE 8
+
+/*
+ * Longest frame delta encoding (32 bits, 7 bits per byte).
+ */
+#define DELTA_MAX_SIZE 5
+
+/*
+ * Recording flash region bounds, from the linker script.
+ */
+extern const uint8_t _srecording[];
+extern const uint8_t _erecording[];
+
+/*
+ * Frames elapsed since the device started, counted on each start of frame.
+ */
+static volatile uint32_t frame_count;
+
+/*
+ * RAM ring of recorded reports. Only touched with the USB interrupt masked or
+ * from the USB interrupt itself. When full, the oldest reports are dropped.
+ */
+static uint8_t ring[RECORDER_BUFFER_SIZE];
+static uint32_t ring_head;
+static uint32_t ring_tail;
+static volatile uint8_t recording;
+
+/*
+ * Frame of the last recorded report.
+ */
+static uint32_t last_frame;
+
+/*
+ * Replay state: recorded reports, position of the next report and frames to
+ * wait before sending it.
+ */
+static const uint8_t* replay_data;
+static uint32_t replay_size;
+static uint32_t replay_pos;
+static uint32_t replay_wait;
+static volatile uint8_t replaying;
+
+/*!
+ * @brief Drop the oldest report from the ring.
+ * @return None.
+ */
+static void drop_oldest(void);
+
+/*!
+ * @brief Read the frame delta of the next report to replay.
+ * @return True (1) if a report follows, otherwise false (0) at the end of the recording.
+ */
+static int read_delta(void);
+
+/*!
+ * @brief Send the next report to replay.
+ *
+ * @param[in] pdev USB device.
+ * @return    True (1) if the report was sent, otherwise false (0) if its
+ *            endpoint is busy or the replay ended.
+ */
+static int replay_next(USBD_HandleTypeDef* pdev);
+
+/*!
+ * @brief Read a 32-bit little endian value.
+ *
+ * @param[in] data Value bytes.
+ * @return    Value.
+ */
+static uint32_t read_u32(const uint8_t* data);
+
+int USB_HID_Recorder_Start(void) {
+  if (replaying) {
+    return 0;
+  }
+
+  HAL_NVIC_DisableIRQ(USB_LP_CAN1_RX0_IRQn);
+  ring_head = 0;
+  ring_tail = 0;
+  last_frame = frame_count;
+  recording = 1;
+  HAL_NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
+  return 1;
+}
+
+void USB_HID_Recorder_Stop(void) {
+  recording = 0;
+}
+
+uint32_t USB_HID_Recorder_GetSize(void) {
+  uint32_t size;
+
+  HAL_NVIC_DisableIRQ(USB_LP_CAN1_RX0_IRQn);
+  size = ring_head - ring_tail;
+  HAL_NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
+  return size;
+}
+
+int USB_HID_Recorder_Flush(void) {
+  FLASH_EraseInitTypeDef erase;
+  HAL_StatusTypeDef status;
+  uint32_t address = (uint32_t) _srecording;
+  uint32_t size = ring_head - ring_tail;
+  uint32_t page_error;
+  uint32_t i;
+  uint16_t halfword;
+
+  if (recording || ((HEADER_SIZE + size) > (uint32_t) (_erecording - _srecording))) {
+    return 0;
+  }
+
+  HAL_FLASH_Unlock();
+  erase.TypeErase = FLASH_TYPEERASE_PAGES;
+  erase.Banks = FLASH_BANK_1;
+  erase.PageAddress = address;
+  erase.NbPages = (HEADER_SIZE + size + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+  status = HAL_FLASHEx_Erase(&erase, &page_error);
+
+  // Reports first and header last, so an interrupted flush leaves no recording.
+  for (i = 0; (i < size) && (status == HAL_OK); i += 2) {
+    halfword = ring[(ring_tail + i) & RING_MASK];
+    halfword |= ((i + 1) < size) ? (ring[(ring_tail + i + 1) & RING_MASK] << 8) : 0xFF00;
+    status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, address + HEADER_SIZE + i, halfword);
+  }
+  if (status == HAL_OK) {
+    status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address + 4, size);
+  }
+  if (status == HAL_OK) {
+    status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address, RECORDING_MAGIC);
+  }
+  HAL_FLASH_Lock();
+  return status == HAL_OK;
+}
+
+int USB_HID_Replayer_Start(const uint8_t* data, uint32_t size) {
+  int started = 0;
+
+  HAL_NVIC_DisableIRQ(USB_LP_CAN1_RX0_IRQn);
+  if (!recording && !replaying && (data != NULL)) {
+    replay_data = data;
+    replay_size = size;
+    replay_pos = 0;
+    started = read_delta();
+    replaying = (uint8_t) started;
+  }
+  HAL_NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
+  return started;
+}
+
+int USB_HID_Replayer_StartStored(void) {
+  uint32_t size = read_u32(&_srecording[4]);
+
+  if ((read_u32(&_srecording[0]) != RECORDING_MAGIC) ||
+      (size > (uint32_t) (_erecording - _srecording - HEADER_SIZE))) {
+    return 0;
+  }
+  return USB_HID_Replayer_Start(&_srecording[HEADER_SIZE], size);
+}
+
+void USB_HID_Replayer_Stop(void) {
+  replaying = 0;
+}
+
+int USB_HID_Replayer_IsRunning(void) {
+  return replaying;
+}
+
+static void drop_oldest(void) {
+  // Skip the frame delta, then the endpoint, length and report bytes.
+  while (ring[ring_tail++ & RING_MASK] & 0x80) {
+  }
+  ring_tail++;
+  ring_tail += 1 + ring[ring_tail & RING_MASK];
+}
+
+static int read_delta(void) {
+  uint32_t delta = 0;
+  uint8_t byte;
+  int shift;
+
+  for (shift = 0; shift < (7 * DELTA_MAX_SIZE); shift += 7) {
+    if (replay_pos >= replay_size) {
+      return 0;
+    }
+    byte = replay_data[replay_pos++];
+    delta |= (uint32_t) (byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      replay_wait = delta;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int replay_next(USBD_HandleTypeDef* pdev) {
+  USBD_HID_HandleTypeDef* hhid = (USBD_HID_HandleTypeDef*) pdev->pClassData;
+  uint8_t* report;
+  uint8_t epnum;
+  uint8_t len;
+
+  if ((pdev->dev_state != USBD_STATE_CONFIGURED) || ((replay_pos + 2) > replay_size)) {
+    replaying = 0;
+    return 0;
+  }
+  epnum = replay_data[replay_pos];
+  len = replay_data[replay_pos + 1];
+  report = (uint8_t*) &replay_data[replay_pos + 2];
+  if ((replay_pos + 2 + len) > replay_size) {
+    replaying = 0;
+    return 0;
+  }
+
+  // Wait for the endpoint if the host has not collected the last report yet.
+  if (epnum == (HID_EPIN_ADDR & 0x7F)) {
+    if (hhid->state != HID_IDLE) {
+      return 0;
+    }
+    USBD_HID_SendReport(pdev, report, len);
+  } else if (epnum == (HID_MOUSE_EPIN_ADDR & 0x7F)) {
+    if (hhid->MouseState != HID_IDLE) {
+      return 0;
+    }
+    USBD_HID_SendMouseReport(pdev, report, len);
+  } else {
+    replaying = 0;
+    return 0;
+  }
+
+  replay_pos += 2 + len;
+  if (!read_delta()) {
+    // End of the recording.
+    replaying = 0;
+  }
+  return 1;
+}
+
+static uint32_t read_u32(const uint8_t* data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+void USBD_HID_TransmitCallback(USBD_HandleTypeDef* pdev, uint8_t epnum, uint8_t* report, uint16_t len) {
+  uint32_t delta = frame_count - last_frame;
+  uint32_t size = 2 + len;
+  uint32_t i;
+
+  if (!recording) {
+    return;
+  }
+  for (i = delta; i >= 0x80; i >>= 7) {
+    size++;
+  }
+  size++;
+  if (size > RECORDER_BUFFER_SIZE) {
+    return;
+  }
+  while ((RECORDER_BUFFER_SIZE - (ring_head - ring_tail)) < size) {
+    drop_oldest();
+  }
+
+  // Frame delta, 7 bits per byte with the top bit set on all but the last.
+  for (; delta >= 0x80; delta >>= 7) {
+    ring[ring_head++ & RING_MASK] = (uint8_t) (delta | 0x80);
+  }
+  ring[ring_head++ & RING_MASK] = (uint8_t) delta;
+  ring[ring_head++ & RING_MASK] = epnum;
+  ring[ring_head++ & RING_MASK] = (uint8_t) len;
+  for (i = 0; i < len; i++) {
+    ring[ring_head++ & RING_MASK] = report[i];
+  }
+  last_frame = frame_count;
+}
+
+void USBD_HID_SOFCallback(USBD_HandleTypeDef* pdev) {
+  frame_count++;
+  if (!replaying) {
+    return;
+  }
+
+  // A report is due once its frame delta has elapsed. Reports due in the same
+  // frame on different endpoints are sent together.
+  if (replay_wait > 0) {
+    replay_wait--;
+  }
+  while (replaying && (replay_wait == 0) && replay_next(pdev)) {
+  }
+}
@@ -2820,11 +2820,47 @@ void USB_WritePMA(USB_TypeDef const *USBx, uint8_t *pbUsrBuf, uint16_t wPMABufAd
   uint32_t BaseAddr = (uint32_t)USBx;
   uint32_t count;
   uint16_t WrVal;
+  uint32_t WrWord;
   __IO uint16_t *pdwVal;
   uint8_t *pBuf = pbUsrBuf;
 
   pdwVal = (__IO uint16_t *)(BaseAddr + 0x400U + ((uint32_t)wPMABufAddr * PMA_ACCESS));
 
+  /* Word aligned user buffer: load 32 bits at a time and split them in two
+     PMA half words, 16 bytes per iteration then one word at a time */
+  if (((uint32_t)pBuf & 3U) == 0U)
+  {
+    for (count = n >> 3; count != 0U; count--)
+    {
+      WrWord = __UNALIGNED_UINT32_READ(pBuf);
+      pdwVal[0] = (uint16_t)WrWord;
+      pdwVal[1U * PMA_ACCESS] = (uint16_t)(WrWord >> 16);
+      WrWord = __UNALIGNED_UINT32_READ(pBuf + 4U);
+      pdwVal[2U * PMA_ACCESS] = (uint16_t)WrWord;
+      pdwVal[3U * PMA_ACCESS] = (uint16_t)(WrWord >> 16);
+      WrWord = __UNALIGNED_UINT32_READ(pBuf + 8U);
+      pdwVal[4U * PMA_ACCESS] = (uint16_t)WrWord;
+      pdwVal[5U * PMA_ACCESS] = (uint16_t)(WrWord >> 16);
+      WrWord = __UNALIGNED_UINT32_READ(pBuf + 12U);
+      pdwVal[6U * PMA_ACCESS] = (uint16_t)WrWord;
+      pdwVal[7U * PMA_ACCESS] = (uint16_t)(WrWord >> 16);
+      pdwVal += 8U * PMA_ACCESS;
+      pBuf += 16U;
+    }
+
+    for (count = (n >> 1) & 3U; count != 0U; count--)
+    {
+      WrWord = __UNALIGNED_UINT32_READ(pBuf);
+      pdwVal[0] = (uint16_t)WrWord;
+      pdwVal[1U * PMA_ACCESS] = (uint16_t)(WrWord >> 16);
+      pdwVal += 2U * PMA_ACCESS;
+      pBuf += 4U;
+    }
+
+    /* At most one half word left */
+    n &= 1U;
+  }
+
   for (count = n; count != 0U; count--)
   {
     WrVal = pBuf[0];
@@ -2860,6 +2896,31 @@ void USB_ReadPMA(USB_TypeDef const *USBx, uint8_t *pbUsrBuf, uint16_t wPMABufAdd
 
   pdwVal = (__IO uint16_t *)(BaseAddr + 0x400U + ((uint32_t)wPMABufAddr * PMA_ACCESS));
 
+  /* Word aligned user buffer: combine two PMA half words and store 32 bits
+     at a time, 16 bytes per iteration then one word at a time */
+  if (((uint32_t)pBuf & 3U) == 0U)
+  {
+    for (count = n >> 3; count != 0U; count--)
+    {
+      __UNALIGNED_UINT32_WRITE(pBuf, (uint32_t)pdwVal[0] | ((uint32_t)pdwVal[1U * PMA_ACCESS] << 16));
+      __UNALIGNED_UINT32_WRITE(pBuf + 4U, (uint32_t)pdwVal[2U * PMA_ACCESS] | ((uint32_t)pdwVal[3U * PMA_ACCESS] << 16));
+      __UNALIGNED_UINT32_WRITE(pBuf + 8U, (uint32_t)pdwVal[4U * PMA_ACCESS] | ((uint32_t)pdwVal[5U * PMA_ACCESS] << 16));
+      __UNALIGNED_UINT32_WRITE(pBuf + 12U, (uint32_t)pdwVal[6U * PMA_ACCESS] | ((uint32_t)pdwVal[7U * PMA_ACCESS] << 16));
+      pdwVal += 8U * PMA_ACCESS;
+      pBuf += 16U;
+    }
+
+    for (count = (n >> 1) & 3U; count != 0U; count--)
+    {
+      __UNALIGNED_UINT32_WRITE(pBuf, (uint32_t)pdwVal[0] | ((uint32_t)pdwVal[1U * PMA_ACCESS] << 16));
+      pdwVal += 2U * PMA_ACCESS;
+      pBuf += 4U;
+    }
+
+    /* At most one half word left, plus the odd byte */
+    n &= 1U;
+  }
+
   for (count = n; count != 0U; count--)
   {
     RdVal = *(__IO uint16_t *)pdwVal;
@@ -41,13 +41,30 @@ extern "C" {
 /** @defgroup USBD_HID_Exported_Defines
   * @{
   */
+/* Composite device: keyboard and mouse interfaces, each with its own IN endpoint */
+#define HID_KEYBOARD_INTERFACE        0x00U
+#define HID_MOUSE_INTERFACE           0x01U
+#define HID_INTERFACES                0x02U
+
 #define HID_EPIN_ADDR                 0x81U
-#define HID_EPIN_SIZE                 0x04U
+#define HID_EPIN_SIZE                 0x20U
+#define HID_MOUSE_EPIN_ADDR           0x82U
+#define HID_MOUSE_EPIN_SIZE           0x04U
+
+/* Packet memory needed by the class endpoints: EP(name, address, max packet size, double buffered) */
+#define USBD_HID_PMA_TABLE(EP) \
+  EP(HID_IN, HID_EPIN_ADDR, HID_EPIN_SIZE, 0U) \
+  EP(HID_MOUSE_IN, HID_MOUSE_EPIN_ADDR, HID_MOUSE_EPIN_SIZE, 0U)
 
-#define USB_HID_CONFIG_DESC_SIZ       34U
+#define USB_HID_CONFIG_DESC_SIZ       59U
 #define USB_HID_DESC_SIZ              9U
 #define HID_MOUSE_REPORT_DESC_SIZE    74U
-#define HID_KEYBOARD_REPORT_DESC_SIZE 63U
+#define HID_KEYBOARD_REPORT_DESC_SIZE 115U
+
+/* Report IDs of the keyboard interface. Boot protocol reports carry no ID */
+#define HID_KEYBOARD_REPORT_ID        0x01U
+#define HID_CONSUMER_REPORT_ID        0x02U
+#define HID_SYSTEM_REPORT_ID          0x03U
 
 #define HID_DESCRIPTOR_TYPE           0x21U
 #define HID_REPORT_DESC               0x22U
@@ -60,14 +77,25 @@ extern "C" {
 #define HID_FS_BINTERVAL            0x0AU
 #endif /* HID_FS_BINTERVAL */
 
+/* Full speed interrupt endpoints are polled every bInterval frames of 1 ms */
+#if (HID_FS_BINTERVAL < 1) || (HID_FS_BINTERVAL > 255)
+#error "HID_FS_BINTERVAL must be between 1 and 255 ms"
+#endif /* HID_FS_BINTERVAL */
+
 #define HID_REQ_SET_PROTOCOL          0x0BU
 #define HID_REQ_GET_PROTOCOL          0x03U
 
+#define HID_BOOT_PROTOCOL             0x00U
+#define HID_REPORT_PROTOCOL           0x01U
+
 #define HID_REQ_SET_IDLE              0x0AU
 #define HID_REQ_GET_IDLE              0x02U
 
 #define HID_REQ_SET_REPORT            0x09U
 #define HID_REQ_GET_REPORT            0x01U
+
+/* Largest output report accepted through SET_REPORT (report ID and keyboard LEDs) */
+#define HID_OUT_REPORT_SIZE           0x02U
 /**
   * @}
   */
@@ -90,6 +118,14 @@ typedef struct
   uint32_t             IdleState;
   uint32_t             AltSetting;
   HID_StateTypeDef     state;
+  uint8_t              OutReport[HID_OUT_REPORT_SIZE];
+  uint16_t             OutReportLength;
+  uint8_t              LastReport[HID_EPIN_SIZE];   /* Repeated when the idle period expires */
+  uint16_t             LastReportLength;
+  uint16_t             IdleCount;                   /* Frames since the last report */
+  uint32_t             MouseProtocol;
+  uint32_t             MouseIdleState;
+  HID_StateTypeDef     MouseState;
 }
 USBD_HID_HandleTypeDef;
 /**
@@ -125,6 +161,23 @@ uint8_t USBD_HID_SendReport(USBD_HandleTypeDef *pdev,
 
 uint32_t USBD_HID_GetPollingInterval(USBD_HandleTypeDef *pdev);
 
+void USBD_HID_ReportSentCallback(USBD_HandleTypeDef *pdev);
+
+uint8_t USBD_HID_SendMouseReport(USBD_HandleTypeDef *pdev,
+                                 uint8_t *report,
+                                 uint16_t len);
+
+void USBD_HID_MouseReportSentCallback(USBD_HandleTypeDef *pdev);
+
+void USBD_HID_TransmitCallback(USBD_HandleTypeDef *pdev, uint8_t epnum,
+                               uint8_t *report, uint16_t len);
+
+void USBD_HID_SOFCallback(USBD_HandleTypeDef *pdev);
+
+void USBD_HID_OutputReportCallback(USBD_HandleTypeDef *pdev,
+                                   uint8_t *report,
+                                   uint16_t len);
+
 /**
   * @}
   */
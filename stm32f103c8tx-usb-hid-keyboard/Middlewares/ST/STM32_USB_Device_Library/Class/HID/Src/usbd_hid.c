@@ -108,6 +108,10 @@ static uint8_t  *USBD_HID_GetOtherSpeedCfgDesc(uint16_t *length);
 static uint8_t  *USBD_HID_GetDeviceQualifierDesc(uint16_t *length);
 
 static uint8_t  USBD_HID_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum);
+
+static uint8_t  USBD_HID_EP0_RxReady(USBD_HandleTypeDef *pdev);
+
+static uint8_t  USBD_HID_SOF(USBD_HandleTypeDef *pdev);
 /**
   * @}
   */
@@ -122,10 +126,10 @@ USBD_ClassTypeDef  USBD_HID =
   USBD_HID_DeInit,
   USBD_HID_Setup,
   NULL, /*EP0_TxSent*/
-  NULL, /*EP0_RxReady*/
+  USBD_HID_EP0_RxReady, /*EP0_RxReady*/
   USBD_HID_DataIn, /*DataIn*/
   NULL, /*DataOut*/
-  NULL, /*SOF */
+  USBD_HID_SOF, /*SOF */
   NULL,
   NULL,
   USBD_HID_GetHSCfgDesc,
@@ -142,7 +146,7 @@ __ALIGN_BEGIN static uint8_t USBD_HID_CfgFSDesc[USB_HID_CONFIG_DESC_SIZ]  __ALIG
   USB_HID_CONFIG_DESC_SIZ,
   /* wTotalLength: Bytes returned */
   0x00,
-  0x01,         /*bNumInterfaces: 1 interface*/
+  HID_INTERFACES, /*bNumInterfaces: keyboard and mouse*/
   0x01,         /*bConfigurationValue: Configuration value*/
   0x00,         /*iConfiguration: Index of string descriptor describing
   the configuration*/
@@ -178,10 +182,42 @@ __ALIGN_BEGIN static uint8_t USBD_HID_CfgFSDesc[USB_HID_CONFIG_DESC_SIZ]  __ALIG
 
   HID_EPIN_ADDR,     /*bEndpointAddress: Endpoint Address (IN)*/
   0x03,          /*bmAttributes: Interrupt endpoint*/
-  HID_EPIN_SIZE, /*wMaxPacketSize: 4 Byte max */
+  HID_EPIN_SIZE, /*wMaxPacketSize: 32 Byte max */
   0x00,
   HID_FS_BINTERVAL,          /*bInterval: Polling Interval */
+  /************** Descriptor of Mouse interface ****************/
   /* 34 */
+  0x09,         /*bLength: Interface Descriptor size*/
+  USB_DESC_TYPE_INTERFACE,/*bDescriptorType: Interface descriptor type*/
+  HID_MOUSE_INTERFACE, /*bInterfaceNumber: Number of Interface*/
+  0x00,         /*bAlternateSetting: Alternate setting*/
+  0x01,         /*bNumEndpoints*/
+  0x03,         /*bInterfaceClass: HID*/
+  0x01,         /*bInterfaceSubClass : 1=BOOT, 0=no boot*/
+  0x02,         /*nInterfaceProtocol : 0=none, 1=keyboard, 2=mouse*/
+  0,            /*iInterface: Index of string descriptor*/
+  /******************** Descriptor of Mouse HID ********************/
+  /* 43 */
+  0x09,         /*bLength: HID Descriptor size*/
+  HID_DESCRIPTOR_TYPE, /*bDescriptorType: HID*/
+  0x11,         /*bcdHID: HID Class Spec release number*/
+  0x01,
+  0x00,         /*bCountryCode: Hardware target country*/
+  0x01,         /*bNumDescriptors: Number of HID class descriptors to follow*/
+  0x22,         /*bDescriptorType*/
+  HID_MOUSE_REPORT_DESC_SIZE,/*wItemLength: Total length of Report descriptor*/
+  0x00,
+  /******************** Descriptor of Mouse endpoint ********************/
+  /* 52 */
+  0x07,          /*bLength: Endpoint Descriptor size*/
+  USB_DESC_TYPE_ENDPOINT, /*bDescriptorType:*/
+
+  HID_MOUSE_EPIN_ADDR, /*bEndpointAddress: Endpoint Address (IN)*/
+  0x03,          /*bmAttributes: Interrupt endpoint*/
+  HID_MOUSE_EPIN_SIZE, /*wMaxPacketSize: 4 Byte max */
+  0x00,
+  HID_FS_BINTERVAL,          /*bInterval: Polling Interval */
+  /* 59 */
 };
 
 /* USB HID device HS Configuration Descriptor */
@@ -192,7 +228,7 @@ __ALIGN_BEGIN static uint8_t USBD_HID_CfgHSDesc[USB_HID_CONFIG_DESC_SIZ]  __ALIG
   USB_HID_CONFIG_DESC_SIZ,
   /* wTotalLength: Bytes returned */
   0x00,
-  0x01,         /*bNumInterfaces: 1 interface*/
+  HID_INTERFACES, /*bNumInterfaces: keyboard and mouse*/
   0x01,         /*bConfigurationValue: Configuration value*/
   0x00,         /*iConfiguration: Index of string descriptor describing
   the configuration*/
@@ -228,10 +264,42 @@ __ALIGN_BEGIN static uint8_t USBD_HID_CfgHSDesc[USB_HID_CONFIG_DESC_SIZ]  __ALIG
 
   HID_EPIN_ADDR,     /*bEndpointAddress: Endpoint Address (IN)*/
   0x03,          /*bmAttributes: Interrupt endpoint*/
-  HID_EPIN_SIZE, /*wMaxPacketSize: 4 Byte max */
+  HID_EPIN_SIZE, /*wMaxPacketSize: 32 Byte max */
   0x00,
   HID_HS_BINTERVAL,          /*bInterval: Polling Interval */
+  /************** Descriptor of Mouse interface ****************/
   /* 34 */
+  0x09,         /*bLength: Interface Descriptor size*/
+  USB_DESC_TYPE_INTERFACE,/*bDescriptorType: Interface descriptor type*/
+  HID_MOUSE_INTERFACE, /*bInterfaceNumber: Number of Interface*/
+  0x00,         /*bAlternateSetting: Alternate setting*/
+  0x01,         /*bNumEndpoints*/
+  0x03,         /*bInterfaceClass: HID*/
+  0x01,         /*bInterfaceSubClass : 1=BOOT, 0=no boot*/
+  0x02,         /*nInterfaceProtocol : 0=none, 1=keyboard, 2=mouse*/
+  0,            /*iInterface: Index of string descriptor*/
+  /******************** Descriptor of Mouse HID ********************/
+  /* 43 */
+  0x09,         /*bLength: HID Descriptor size*/
+  HID_DESCRIPTOR_TYPE, /*bDescriptorType: HID*/
+  0x11,         /*bcdHID: HID Class Spec release number*/
+  0x01,
+  0x00,         /*bCountryCode: Hardware target country*/
+  0x01,         /*bNumDescriptors: Number of HID class descriptors to follow*/
+  0x22,         /*bDescriptorType*/
+  HID_MOUSE_REPORT_DESC_SIZE,/*wItemLength: Total length of Report descriptor*/
+  0x00,
+  /******************** Descriptor of Mouse endpoint ********************/
+  /* 52 */
+  0x07,          /*bLength: Endpoint Descriptor size*/
+  USB_DESC_TYPE_ENDPOINT, /*bDescriptorType:*/
+
+  HID_MOUSE_EPIN_ADDR, /*bEndpointAddress: Endpoint Address (IN)*/
+  0x03,          /*bmAttributes: Interrupt endpoint*/
+  HID_MOUSE_EPIN_SIZE, /*wMaxPacketSize: 4 Byte max */
+  0x00,
+  HID_HS_BINTERVAL,          /*bInterval: Polling Interval */
+  /* 59 */
 };
 
 /* USB HID device Other Speed Configuration Descriptor */
@@ -242,7 +310,7 @@ __ALIGN_BEGIN static uint8_t USBD_HID_OtherSpeedCfgDesc[USB_HID_CONFIG_DESC_SIZ]
   USB_HID_CONFIG_DESC_SIZ,
   /* wTotalLength: Bytes returned */
   0x00,
-  0x01,         /*bNumInterfaces: 1 interface*/
+  HID_INTERFACES, /*bNumInterfaces: keyboard and mouse*/
   0x01,         /*bConfigurationValue: Configuration value*/
   0x00,         /*iConfiguration: Index of string descriptor describing
   the configuration*/
@@ -278,10 +346,42 @@ __ALIGN_BEGIN static uint8_t USBD_HID_OtherSpeedCfgDesc[USB_HID_CONFIG_DESC_SIZ]
 
   HID_EPIN_ADDR,     /*bEndpointAddress: Endpoint Address (IN)*/
   0x03,          /*bmAttributes: Interrupt endpoint*/
-  HID_EPIN_SIZE, /*wMaxPacketSize: 4 Byte max */
+  HID_EPIN_SIZE, /*wMaxPacketSize: 32 Byte max */
   0x00,
   HID_FS_BINTERVAL,          /*bInterval: Polling Interval */
+  /************** Descriptor of Mouse interface ****************/
   /* 34 */
+  0x09,         /*bLength: Interface Descriptor size*/
+  USB_DESC_TYPE_INTERFACE,/*bDescriptorType: Interface descriptor type*/
+  HID_MOUSE_INTERFACE, /*bInterfaceNumber: Number of Interface*/
+  0x00,         /*bAlternateSetting: Alternate setting*/
+  0x01,         /*bNumEndpoints*/
+  0x03,         /*bInterfaceClass: HID*/
+  0x01,         /*bInterfaceSubClass : 1=BOOT, 0=no boot*/
+  0x02,         /*nInterfaceProtocol : 0=none, 1=keyboard, 2=mouse*/
+  0,            /*iInterface: Index of string descriptor*/
+  /******************** Descriptor of Mouse HID ********************/
+  /* 43 */
+  0x09,         /*bLength: HID Descriptor size*/
+  HID_DESCRIPTOR_TYPE, /*bDescriptorType: HID*/
+  0x11,         /*bcdHID: HID Class Spec release number*/
+  0x01,
+  0x00,         /*bCountryCode: Hardware target country*/
+  0x01,         /*bNumDescriptors: Number of HID class descriptors to follow*/
+  0x22,         /*bDescriptorType*/
+  HID_MOUSE_REPORT_DESC_SIZE,/*wItemLength: Total length of Report descriptor*/
+  0x00,
+  /******************** Descriptor of Mouse endpoint ********************/
+  /* 52 */
+  0x07,          /*bLength: Endpoint Descriptor size*/
+  USB_DESC_TYPE_ENDPOINT, /*bDescriptorType:*/
+
+  HID_MOUSE_EPIN_ADDR, /*bEndpointAddress: Endpoint Address (IN)*/
+  0x03,          /*bmAttributes: Interrupt endpoint*/
+  HID_MOUSE_EPIN_SIZE, /*wMaxPacketSize: 4 Byte max */
+  0x00,
+  HID_FS_BINTERVAL,          /*bInterval: Polling Interval */
+  /* 59 */
 };
 
 
@@ -300,6 +400,20 @@ __ALIGN_BEGIN static uint8_t USBD_HID_Desc[USB_HID_DESC_SIZ]  __ALIGN_END  =
   0x00,
 };
 
+/* USB HID descriptor of the mouse interface */
+__ALIGN_BEGIN static uint8_t USBD_HID_MouseDesc[USB_HID_DESC_SIZ]  __ALIGN_END  =
+{
+  0x09,         /*bLength: HID Descriptor size*/
+  HID_DESCRIPTOR_TYPE, /*bDescriptorType: HID*/
+  0x11,         /*bcdHID: HID Class Spec release number*/
+  0x01,
+  0x00,         /*bCountryCode: Hardware target country*/
+  0x01,         /*bNumDescriptors: Number of HID class descriptors to follow*/
+  0x22,         /*bDescriptorType*/
+  HID_MOUSE_REPORT_DESC_SIZE,/*wItemLength: Total length of Report descriptor*/
+  0x00,
+};
+
 /* USB Standard Device Descriptor */
 __ALIGN_BEGIN static uint8_t USBD_HID_DeviceQualifierDesc[USB_LEN_DEV_QUALIFIER_DESC]  __ALIGN_END =
 {
@@ -370,6 +484,7 @@ __ALIGN_BEGIN static uint8_t HID_KEYBOARD_ReportDesc[HID_KEYBOARD_REPORT_DESC_SI
   0x05, 0x01,         // USAGE_PAGE (Generic Desktop)
   0x09, 0x06,         // USAGE (Keyboard)
   0xa1, 0x01,         // COLLECTION (Application)
+  0x85, HID_KEYBOARD_REPORT_ID, //   REPORT_ID (1)
   0x05, 0x07,         //   USAGE_PAGE (Keyboard)
   0x19, 0xe0,         //   USAGE_MINIMUM (Keyboard LeftControl)
   0x29, 0xe7,         //   USAGE_MAXIMUM (Keyboard Right GUI)
@@ -390,13 +505,37 @@ __ALIGN_BEGIN static uint8_t HID_KEYBOARD_ReportDesc[HID_KEYBOARD_REPORT_DESC_SI
   0x95, 0x01,         //   REPORT_COUNT (1)
   0x75, 0x03,         //   REPORT_SIZE (3)
   0x91, 0x03,         //   OUTPUT (Cnst,Var,Abs)
-  0x95, 0x06,         //   REPORT_COUNT (6)
-  0x75, 0x08,         //   REPORT_SIZE (8)
+  0x95, 0x80,         //   REPORT_COUNT (128)
+  0x75, 0x01,         //   REPORT_SIZE (1)
   0x15, 0x00,         //   LOGICAL_MINIMUM (0)
-  0x25, 0x65,         //   LOGICAL_MAXIMUM (101)
+  0x25, 0x01,         //   LOGICAL_MAXIMUM (1)
   0x05, 0x07,         //   USAGE_PAGE (Keyboard)
   0x19, 0x00,         //   USAGE_MINIMUM (Reserved (no event indicated))
-  0x29, 0x65,         //   USAGE_MAXIMUM (Keyboard Application)
+  0x29, 0x7f,         //   USAGE_MAXIMUM (127)
+  0x81, 0x02,         //   INPUT (Data,Var,Abs)
+  0xc0,               // END_COLLECTION
+  0x05, 0x0c,         // USAGE_PAGE (Consumer Devices)
+  0x09, 0x01,         // USAGE (Consumer Control)
+  0xa1, 0x01,         // COLLECTION (Application)
+  0x85, HID_CONSUMER_REPORT_ID, //   REPORT_ID (2)
+  0x15, 0x00,         //   LOGICAL_MINIMUM (0)
+  0x26, 0xff, 0x03,   //   LOGICAL_MAXIMUM (1023)
+  0x19, 0x00,         //   USAGE_MINIMUM (Unassigned)
+  0x2a, 0xff, 0x03,   //   USAGE_MAXIMUM (1023)
+  0x75, 0x10,         //   REPORT_SIZE (16)
+  0x95, 0x01,         //   REPORT_COUNT (1)
+  0x81, 0x00,         //   INPUT (Data,Ary,Abs)
+  0xc0,               // END_COLLECTION
+  0x05, 0x01,         // USAGE_PAGE (Generic Desktop)
+  0x09, 0x80,         // USAGE (System Control)
+  0xa1, 0x01,         // COLLECTION (Application)
+  0x85, HID_SYSTEM_REPORT_ID, //   REPORT_ID (3)
+  0x15, 0x01,         //   LOGICAL_MINIMUM (1)
+  0x26, 0xb7, 0x00,   //   LOGICAL_MAXIMUM (183)
+  0x19, 0x01,         //   USAGE_MINIMUM (Pointer)
+  0x2a, 0xb7, 0x00,   //   USAGE_MAXIMUM (System Display LCD Autoscale)
+  0x75, 0x10,         //   REPORT_SIZE (16)
+  0x95, 0x01,         //   REPORT_COUNT (1)
   0x81, 0x00,         //   INPUT (Data,Ary,Abs)
   0xc0                // END_COLLECTION
 };
@@ -422,6 +561,10 @@ static uint8_t  USBD_HID_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
   USBD_LL_OpenEP(pdev, HID_EPIN_ADDR, USBD_EP_TYPE_INTR, HID_EPIN_SIZE);
   pdev->ep_in[HID_EPIN_ADDR & 0xFU].is_used = 1U;
 
+  /* Open mouse EP IN */
+  USBD_LL_OpenEP(pdev, HID_MOUSE_EPIN_ADDR, USBD_EP_TYPE_INTR, HID_MOUSE_EPIN_SIZE);
+  pdev->ep_in[HID_MOUSE_EPIN_ADDR & 0xFU].is_used = 1U;
+
   pdev->pClassData = USBD_malloc(sizeof(USBD_HID_HandleTypeDef));
 
   if (pdev->pClassData == NULL)
@@ -431,6 +574,19 @@ static uint8_t  USBD_HID_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
 
   ((USBD_HID_HandleTypeDef *)pdev->pClassData)->state = HID_IDLE;
 
+  /* Devices start in report protocol, the host selects boot protocol with SET_PROTOCOL */
+  ((USBD_HID_HandleTypeDef *)pdev->pClassData)->Protocol = HID_REPORT_PROTOCOL;
+  ((USBD_HID_HandleTypeDef *)pdev->pClassData)->OutReportLength = 0U;
+
+  /* Reports are only sent on change until the host sets an idle rate */
+  ((USBD_HID_HandleTypeDef *)pdev->pClassData)->IdleState = 0U;
+  ((USBD_HID_HandleTypeDef *)pdev->pClassData)->LastReportLength = 0U;
+  ((USBD_HID_HandleTypeDef *)pdev->pClassData)->IdleCount = 0U;
+
+  ((USBD_HID_HandleTypeDef *)pdev->pClassData)->MouseState = HID_IDLE;
+  ((USBD_HID_HandleTypeDef *)pdev->pClassData)->MouseProtocol = HID_REPORT_PROTOCOL;
+  ((USBD_HID_HandleTypeDef *)pdev->pClassData)->MouseIdleState = 0U;
+
   return USBD_OK;
 }
 
@@ -447,6 +603,8 @@ static uint8_t  USBD_HID_DeInit(USBD_HandleTypeDef *pdev,
   /* Close HID EPs */
   USBD_LL_CloseEP(pdev, HID_EPIN_ADDR);
   pdev->ep_in[HID_EPIN_ADDR & 0xFU].is_used = 0U;
+  USBD_LL_CloseEP(pdev, HID_MOUSE_EPIN_ADDR);
+  pdev->ep_in[HID_MOUSE_EPIN_ADDR & 0xFU].is_used = 0U;
 
   /* FRee allocated memory */
   if (pdev->pClassData != NULL)
@@ -473,26 +631,70 @@ static uint8_t  USBD_HID_Setup(USBD_HandleTypeDef *pdev,
   uint8_t *pbuf = NULL;
   uint16_t status_info = 0U;
   USBD_StatusTypeDef ret = USBD_OK;
+  uint16_t i;
+  uint8_t mouse = (LOBYTE(req->wIndex) == HID_MOUSE_INTERFACE) ? 1U : 0U;
+  uint32_t *protocol = (mouse != 0U) ? &hhid->MouseProtocol : &hhid->Protocol;
+  uint32_t *idle_state = (mouse != 0U) ? &hhid->MouseIdleState : &hhid->IdleState;
 
   switch (req->bmRequest & USB_REQ_TYPE_MASK)
   {
     case USB_REQ_TYPE_CLASS :
+      /* Class requests are addressed to an interface in wIndex */
       switch (req->bRequest)
       {
         case HID_REQ_SET_PROTOCOL:
-          hhid->Protocol = (uint8_t)(req->wValue);
+          *protocol = (uint8_t)(req->wValue);
+          if (mouse == 0U)
+          {
+            /* The last keyboard report has the format of the old protocol,
+               it must not be repeated in the new one */
+            for (i = 0U; i < HID_EPIN_SIZE; i++)
+            {
+              hhid->LastReport[i] = 0U;
+            }
+            hhid->LastReportLength = 0U;
+            hhid->IdleCount = 0U;
+          }
           break;
 
         case HID_REQ_GET_PROTOCOL:
-          USBD_CtlSendData(pdev, (uint8_t *)(void *)&hhid->Protocol, 1U);
+          USBD_CtlSendData(pdev, (uint8_t *)(void *)protocol, 1U);
           break;
 
         case HID_REQ_SET_IDLE:
-          hhid->IdleState = (uint8_t)(req->wValue >> 8);
+          /* Idle duration in units of 4 ms, 0 for infinite. A new rate
+             starts a new idle period. Only keyboard reports are repeated,
+             repeating a relative mouse report would move the pointer. The
+             rate of the consumer and system reports (report ID in the low
+             byte) is accepted but ignored, they are never repeated */
+          if (mouse != 0U)
+          {
+            *idle_state = (uint8_t)(req->wValue >> 8);
+          }
+          else if ((LOBYTE(req->wValue) == 0U) || (LOBYTE(req->wValue) == HID_KEYBOARD_REPORT_ID))
+          {
+            *idle_state = (uint8_t)(req->wValue >> 8);
+            hhid->IdleCount = 0U;
+          }
           break;
 
         case HID_REQ_GET_IDLE:
-          USBD_CtlSendData(pdev, (uint8_t *)(void *)&hhid->IdleState, 1U);
+          USBD_CtlSendData(pdev, (uint8_t *)(void *)idle_state, 1U);
+          break;
+
+        case HID_REQ_SET_REPORT:
+          /* Output report sent on the control endpoint, delivered to the
+             application once the data stage completes */
+          if ((mouse == 0U) && (req->wLength != 0U) && (req->wLength <= HID_OUT_REPORT_SIZE))
+          {
+            hhid->OutReportLength = req->wLength;
+            USBD_CtlPrepareRx(pdev, hhid->OutReport, req->wLength);
+          }
+          else
+          {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+          }
           break;
 
         default:
@@ -517,14 +719,19 @@ static uint8_t  USBD_HID_Setup(USBD_HandleTypeDef *pdev,
           break;
 
         case USB_REQ_GET_DESCRIPTOR:
-          if (req->wValue >> 8 == HID_REPORT_DESC)
+          if ((req->wValue >> 8 == HID_REPORT_DESC) && (mouse != 0U))
+          {
+            len = MIN(HID_MOUSE_REPORT_DESC_SIZE, req->wLength);
+            pbuf = HID_MOUSE_ReportDesc;
+          }
+          else if (req->wValue >> 8 == HID_REPORT_DESC)
           {
             len = MIN(HID_KEYBOARD_REPORT_DESC_SIZE, req->wLength);
             pbuf = HID_KEYBOARD_ReportDesc;
           }
           else if (req->wValue >> 8 == HID_DESCRIPTOR_TYPE)
           {
-            pbuf = USBD_HID_Desc;
+            pbuf = (mouse != 0U) ? USBD_HID_MouseDesc : USBD_HID_Desc;
             len = MIN(USB_HID_DESC_SIZ, req->wLength);
           }
           else
@@ -588,16 +795,61 @@ uint8_t USBD_HID_SendReport(USBD_HandleTypeDef  *pdev,
                             uint16_t len)
 {
   USBD_HID_HandleTypeDef     *hhid = (USBD_HID_HandleTypeDef *)pdev->pClassData;
+  uint16_t i;
 
   if (pdev->dev_state == USBD_STATE_CONFIGURED)
   {
     if (hhid->state == HID_IDLE)
     {
       hhid->state = HID_BUSY;
+
+      /* Keep a copy of keyboard reports to repeat when the idle period
+         expires. Consumer and system reports are not repeated */
+      len = MIN(len, HID_EPIN_SIZE);
+      if ((hhid->Protocol == HID_BOOT_PROTOCOL) || (report[0] == HID_KEYBOARD_REPORT_ID))
+      {
+        for (i = 0U; i < len; i++)
+        {
+          hhid->LastReport[i] = report[i];
+        }
+        hhid->LastReportLength = len;
+        hhid->IdleCount = 0U;
+      }
+
       USBD_LL_Transmit(pdev,
                        HID_EPIN_ADDR,
                        report,
                        len);
+      USBD_HID_TransmitCallback(pdev, HID_EPIN_ADDR & 0x7FU, report, len);
+    }
+  }
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_HID_SendMouseReport
+  *         Send HID Report on the mouse interface
+  * @param  pdev: device instance
+  * @param  buff: pointer to report
+  * @retval status
+  */
+uint8_t USBD_HID_SendMouseReport(USBD_HandleTypeDef  *pdev,
+                                 uint8_t *report,
+                                 uint16_t len)
+{
+  USBD_HID_HandleTypeDef     *hhid = (USBD_HID_HandleTypeDef *)pdev->pClassData;
+
+  if (pdev->dev_state == USBD_STATE_CONFIGURED)
+  {
+    if (hhid->MouseState == HID_IDLE)
+    {
+      hhid->MouseState = HID_BUSY;
+      len = MIN(len, HID_MOUSE_EPIN_SIZE);
+      USBD_LL_Transmit(pdev,
+                       HID_MOUSE_EPIN_ADDR,
+                       report,
+                       len);
+      USBD_HID_TransmitCallback(pdev, HID_MOUSE_EPIN_ADDR & 0x7FU, report, len);
     }
   }
   return USBD_OK;
@@ -620,12 +872,18 @@ uint32_t USBD_HID_GetPollingInterval(USBD_HandleTypeDef *pdev)
      Values between 1..16 are allowed. Values correspond to interval
      of 2 ^ (bInterval-1). This option (8 ms, corresponds to HID_HS_BINTERVAL */
     polling_interval = (((1U << (HID_HS_BINTERVAL - 1U))) / 8U);
+
+    /* Intervals below one frame are reported as 1 ms */
+    if (polling_interval == 0U)
+    {
+      polling_interval = 1U;
+    }
   }
   else   /* LOW and FULL-speed endpoints */
   {
     /* Sets the data transfer polling interval for low and full
     speed transfers */
-    polling_interval =  HID_FS_BINTERVAL;
+    polling_interval = (uint32_t)HID_FS_BINTERVAL;
   }
 
   return ((uint32_t)(polling_interval));
@@ -680,13 +938,167 @@ static uint8_t  *USBD_HID_GetOtherSpeedCfgDesc(uint16_t *length)
 static uint8_t  USBD_HID_DataIn(USBD_HandleTypeDef *pdev,
                                 uint8_t epnum)
 {
+  if (epnum == (HID_MOUSE_EPIN_ADDR & 0x7FU))
+  {
+    ((USBD_HID_HandleTypeDef *)pdev->pClassData)->MouseState = HID_IDLE;
+
+    /* Let the application queue the next mouse report */
+    USBD_HID_MouseReportSentCallback(pdev);
+    return USBD_OK;
+  }
 
   /* Ensure that the FIFO is empty before a new transfer, this condition could
   be caused by  a new transfer before the end of the previous transfer */
   ((USBD_HID_HandleTypeDef *)pdev->pClassData)->state = HID_IDLE;
+
+  /* Let the application queue the next report */
+  USBD_HID_ReportSentCallback(pdev);
   return USBD_OK;
 }
 
+/**
+  * @brief  USBD_HID_EP0_RxReady
+  *         handle the data stage of SET_REPORT
+  * @param  pdev: device instance
+  * @retval status
+  */
+static uint8_t  USBD_HID_EP0_RxReady(USBD_HandleTypeDef *pdev)
+{
+  USBD_HID_HandleTypeDef *hhid = (USBD_HID_HandleTypeDef *)pdev->pClassData;
+
+  if ((hhid != NULL) && (hhid->OutReportLength != 0U))
+  {
+    USBD_HID_OutputReportCallback(pdev, hhid->OutReport, hhid->OutReportLength);
+    hhid->OutReportLength = 0U;
+  }
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_HID_SOF
+  *         Repeat the last report once the idle period has elapsed without
+  *         a new one. Called on every frame (1 ms)
+  * @param  pdev: device instance
+  * @retval status
+  */
+static uint8_t  USBD_HID_SOF(USBD_HandleTypeDef *pdev)
+{
+  USBD_HID_HandleTypeDef *hhid = (USBD_HID_HandleTypeDef *)pdev->pClassData;
+
+  if (hhid == NULL)
+  {
+    return USBD_OK;
+  }
+
+  /* Reports sent by the application here go ahead of idle repeats */
+  USBD_HID_SOFCallback(pdev);
+
+  if ((hhid->IdleState == 0U) || (hhid->LastReportLength == 0U))
+  {
+    return USBD_OK;
+  }
+
+  if (hhid->IdleCount < (hhid->IdleState * 4U))
+  {
+    hhid->IdleCount++;
+  }
+
+  /* Wait for the endpoint if the host has not collected the last report yet */
+  if ((hhid->IdleCount >= (hhid->IdleState * 4U)) && (hhid->state == HID_IDLE))
+  {
+    hhid->state = HID_BUSY;
+    hhid->IdleCount = 0U;
+    USBD_LL_Transmit(pdev,
+                     HID_EPIN_ADDR,
+                     hhid->LastReport,
+                     hhid->LastReportLength);
+  }
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_HID_ReportSentCallback
+  *         Called from the IN completion once the endpoint is free again.
+  *         The application may override it to send the next queued report.
+  * @param  pdev: device instance
+  * @retval None
+  */
+__weak void USBD_HID_ReportSentCallback(USBD_HandleTypeDef *pdev)
+{
+  /* This function should not be modified, when the callback is needed,
+     the USBD_HID_ReportSentCallback could be implemented in the user file */
+  UNUSED(pdev);
+}
+
+/**
+  * @brief  USBD_HID_MouseReportSentCallback
+  *         Same as USBD_HID_ReportSentCallback for the mouse endpoint.
+  * @param  pdev: device instance
+  * @retval None
+  */
+__weak void USBD_HID_MouseReportSentCallback(USBD_HandleTypeDef *pdev)
+{
+  /* This function should not be modified, when the callback is needed,
+     the USBD_HID_MouseReportSentCallback could be implemented in the user file */
+  UNUSED(pdev);
+}
+
+/**
+  * @brief  USBD_HID_TransmitCallback
+  *         Called each time an application report is handed to an IN
+  *         endpoint (idle repeats excluded), e.g. to record it.
+  * @param  pdev: device instance
+  * @param  epnum: endpoint number
+  * @param  report: pointer to the report
+  * @param  len: report length
+  * @retval None
+  */
+__weak void USBD_HID_TransmitCallback(USBD_HandleTypeDef *pdev, uint8_t epnum,
+                                      uint8_t *report, uint16_t len)
+{
+  /* This function should not be modified, when the callback is needed,
+     the USBD_HID_TransmitCallback could be implemented in the user file */
+  UNUSED(pdev);
+  UNUSED(epnum);
+  UNUSED(report);
+  UNUSED(len);
+}
+
+/**
+  * @brief  USBD_HID_SOFCallback
+  *         Called from the USB interrupt at the start of every frame (1 ms),
+  *         e.g. to send reports aligned to frames.
+  * @param  pdev: device instance
+  * @retval None
+  */
+__weak void USBD_HID_SOFCallback(USBD_HandleTypeDef *pdev)
+{
+  /* This function should not be modified, when the callback is needed,
+     the USBD_HID_SOFCallback could be implemented in the user file */
+  UNUSED(pdev);
+}
+
+/**
+  * @brief  USBD_HID_OutputReportCallback
+  *         Called from the USB interrupt with an output report received
+  *         through SET_REPORT (LED states for a keyboard, preceded by the
+  *         report ID in report protocol).
+  * @param  pdev: device instance
+  * @param  report: pointer to the output report
+  * @param  len: output report length
+  * @retval None
+  */
+__weak void USBD_HID_OutputReportCallback(USBD_HandleTypeDef *pdev,
+                                          uint8_t *report,
+                                          uint16_t len)
+{
+  /* This function should not be modified, when the callback is needed,
+     the USBD_HID_OutputReportCallback could be implemented in the user file */
+  UNUSED(pdev);
+  UNUSED(report);
+  UNUSED(len);
+}
+
 
 /**
 * @brief  DeviceQualifierDescriptor
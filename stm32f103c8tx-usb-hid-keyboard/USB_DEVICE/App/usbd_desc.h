@@ -120,6 +120,7 @@ extern USBD_DescriptorsTypeDef FS_Desc;
   */
 
 /* USER CODE BEGIN EXPORTED_FUNCTIONS */
+void USBD_FS_SerialNumInit(void);
 
 /* USER CODE END EXPORTED_FUNCTIONS */
 
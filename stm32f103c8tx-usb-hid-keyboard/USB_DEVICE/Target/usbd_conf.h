@@ -62,7 +62,7 @@
   */
 
 /*---------- -----------*/
-#define USBD_MAX_NUM_INTERFACES     1
+#define USBD_MAX_NUM_INTERFACES     2
 /*---------- -----------*/
 #define USBD_MAX_NUM_CONFIGURATION     1
 /*---------- -----------*/
@@ -72,7 +72,12 @@
 /*---------- -----------*/
 #define USBD_SELF_POWERED     1
 /*---------- -----------*/
-#define HID_FS_BINTERVAL     0xA
+#ifndef HID_FS_BINTERVAL
+#define HID_FS_BINTERVAL     0x1
+#endif
+/*---------- -----------*/
+/* Endpoint buffers laid out in the packet memory by usbd_pma.h */
+#define USBD_PMA_ENDPOINTS(EP)     USBD_PMA_EP0_TABLE(EP) USBD_HID_PMA_TABLE(EP)
 
 /****************************************/
 /* #define for FS and HS identification */
@@ -0,0 +1,75 @@
+/*!
+ * @file   usbd_pma.h
+ * @brief  Compile-time layout of the endpoint buffers in the packet memory
+ *
+ * The endpoints are declared in USBD_PMA_ENDPOINTS (usbd_conf.h) as a list
+ * of EP(name, address, max packet size, double buffered) entries. Buffers
+ * are placed one after the other right behind the buffer descriptor table,
+ * which only spans the endpoint numbers actually used. A layout that does
+ * not fit the packet memory fails the build.
+ *
+ * USBD_PMA_<name> is the offset of the endpoint buffer (of buffer 0 for a
+ * double buffered endpoint) and USBD_PMA_ADDRESS() the value expected by
+ * HAL_PCDEx_PMAConfig().
+ */
+#ifndef __USBD_PMA_H
+#define __USBD_PMA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "usbd_def.h"
+
+/** Size of the packet memory, in bytes */
+#define USBD_PMA_SIZE             512U
+
+/** Control endpoint, always first in USBD_PMA_ENDPOINTS */
+#define USBD_PMA_EP0_TABLE(EP) \
+  EP(EP0_OUT, 0x00U, USB_MAX_EP0_SIZE, 0U) \
+  EP(EP0_IN,  0x80U, USB_MAX_EP0_SIZE, 0U)
+
+/** Buffer size of one endpoint: OUT buffers above 62 bytes are counted in
+  * blocks of 32 bytes by the reception counter, everything else in half words */
+#define USBD_PMA_BUF_SIZE(addr, size) \
+  (((((addr) & 0x80U) == 0U) && ((size) > 62U)) ? \
+   (((size) + 31U) & ~31U) : (((size) + 1U) & ~1U))
+
+/** Endpoint number bitmap of the table */
+#define USBD_PMA_EP_BIT(name, addr, size, dbl)  | (1U << ((addr) & 0x0FU))
+#define USBD_PMA_EP_MASK          (0U USBD_PMA_ENDPOINTS(USBD_PMA_EP_BIT))
+
+/** The buffer descriptor table holds 8 bytes per endpoint number, up to the highest used */
+#define USBD_PMA_BTABLE_SIZE \
+  (8U * ((USBD_PMA_EP_MASK >= 0x80U) ? 8U : (USBD_PMA_EP_MASK >= 0x40U) ? 7U : \
+         (USBD_PMA_EP_MASK >= 0x20U) ? 6U : (USBD_PMA_EP_MASK >= 0x10U) ? 5U : \
+         (USBD_PMA_EP_MASK >= 0x08U) ? 4U : (USBD_PMA_EP_MASK >= 0x04U) ? 3U : \
+         (USBD_PMA_EP_MASK >= 0x02U) ? 2U : 1U))
+
+/** Each buffer starts where the previous one ends */
+#define USBD_PMA_ALLOC(name, addr, size, dbl) \
+  USBD_PMA_##name, \
+  USBD_PMA_##name##_LAST = USBD_PMA_##name + (USBD_PMA_BUF_SIZE(addr, size) * ((dbl) + 1U)) - 1U,
+
+enum
+{
+  USBD_PMA_BTABLE_LAST = USBD_PMA_BTABLE_SIZE - 1U,
+  USBD_PMA_ENDPOINTS(USBD_PMA_ALLOC)
+  USBD_PMA_END
+};
+
+_Static_assert(USBD_PMA_END <= USBD_PMA_SIZE, "USB endpoint buffers do not fit in the packet memory");
+_Static_assert(USBD_PMA_EP_MASK < 0x100U, "The USB peripheral only has 8 endpoints");
+
+/** HAL_PCDEx_PMAConfig() address: buffer 0 in the low half word and, if
+  * double buffered, buffer 1 in the high half word */
+#define USBD_PMA_ADDRESS(name, addr, size, dbl) \
+  (((dbl) != 0U) ? \
+   ((uint32_t)USBD_PMA_##name | ((uint32_t)(USBD_PMA_##name + USBD_PMA_BUF_SIZE(addr, size)) << 16)) : \
+   (uint32_t)USBD_PMA_##name)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USBD_PMA_H */
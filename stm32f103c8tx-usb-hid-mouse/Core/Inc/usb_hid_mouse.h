@@ -9,6 +9,8 @@
 #ifndef INC_USB_HID_MOUSE_H_
 #define INC_USB_HID_MOUSE_H_
 
+#include "usbd_hid.h"
+
 #include <stdint.h>
 
 /*
@@ -18,9 +20,22 @@
 #define BUTTON_RIGHT   0x02
 #define BUTTON_MIDDLE  0x04
 
+/*
+ * Motion source. Called from the USB interrupt when no other motion is queued,
+ * to fill one report, and on every frame while the endpoint is idle. Returns
+ * true (1) with the motion to send, otherwise false (0) when it has nothing
+ * to send.
+ */
+typedef int (*USB_HID_Mouse_MotionSource)(int32_t* x, int32_t* y, int32_t* wheel);
+
 /*!
  * @brief Press and release the given buttons.
  *
+ * The mouse functions never wait for the host: when the segment queue is full
+ * they fail without changing the buttons held, and the caller tries again
+ * later (see USB_HID_Mouse_QueueSpace()). Moves with the same buttons are
+ * added to the last segment and always fit.
+ *
  * @param[in] buttons Buttons to click (buttons bitwise OR combination).
  * @return    True (1) in case of success, otherwise false (0).
  */
@@ -51,11 +66,45 @@ int USB_HID_Mouse_ReleaseAll(void);
 /*!
  * @brief Move mouse pointer and wheel (relative movement from current position).
  *
+ * Moves are accumulated until the host polls and large moves are split over
+ * several reports, so any distance can be given and never blocks.
+ *
  * @param[in] x Indicates the pointer movement along the x axis (Positive values move the pointer to the right).
  * @param[in] y Indicates the pointer movement along the y axis (Positive values move the pointer downwards).
  * @param[in] wheel Indicates the wheel rotation (Positive values rotate the wheel away from the user).
  * @return    True (1) in case of success, otherwise false (0).
  */
-int USB_HID_Mouse_Move(int8_t x, int8_t y, int8_t wheel);
+int USB_HID_Mouse_Move(int32_t x, int32_t y, int32_t wheel);
+
+#if (USBD_HID_MOUSE_ABSOLUTE == 1U)
+/*!
+ * @brief Move mouse pointer to the given position (absolute mode only, see
+ *        USBD_HID_MOUSE_ABSOLUTE in usbd_conf.h).
+ *
+ * The position is scaled by the host to the whole screen, so any point is
+ * reached in a single report. Relative moves continue from this position.
+ *
+ * @param[in] x Position along the x axis (0 for the left edge, 32767 for the right edge).
+ * @param[in] y Position along the y axis (0 for the top edge, 32767 for the bottom edge).
+ * @return    True (1) in case of success, otherwise false (0).
+ */
+int USB_HID_Mouse_MoveTo(int32_t x, int32_t y);
+#endif
+
+/*!
+ * @brief Get the number of button changes that can be queued without waiting
+ *        for the host.
+ * @return Free segment queue slots.
+ */
+int USB_HID_Mouse_QueueSpace(void);
+
+/*!
+ * @brief Set the source pulled for motion whenever the host polls and nothing
+ *        else is queued, and start polling it.
+ *
+ * @param[in] source Motion source, or NULL to remove it.
+ * @return    None.
+ */
+void USB_HID_Mouse_SetMotionSource(USB_HID_Mouse_MotionSource source);
 
 #endif // INC_USB_HID_MOUSE_H_
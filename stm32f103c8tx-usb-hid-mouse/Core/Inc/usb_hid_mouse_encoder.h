@@ -0,0 +1,54 @@
+/*!
+ * @file   usb_hid_mouse_encoder.h
+ * @brief  Quadrature encoder inputs for the mouse pointer and wheel
+ *
+ * The timers count the encoder edges in hardware (encoder mode, both edges of
+ * both channels), so no edge is lost however fast the encoders turn and no
+ * CPU time is spent counting:
+ *
+ *   X axis: TIM2, PA0 (A) and PA1 (B).
+ *   Y axis: TIM3, PA6 (A) and PA7 (B).
+ *   Wheel:  TIM4, PB6 (A) and PB7 (B).
+ *
+ * The counters are sampled once per HID poll and the deltas since the last
+ * sample go straight into the report. Swap A and B to reverse an axis.
+ */
+#ifndef INC_USB_HID_MOUSE_ENCODER_H_
+#define INC_USB_HID_MOUSE_ENCODER_H_
+
+#include <stdint.h>
+
+/**
+ * Encoder counts per reported unit. Counts left over are carried to the next
+ * poll. Mechanical wheel encoders usually give 4 counts per detent.
+ */
+#ifndef ENCODER_COUNTS_PER_STEP
+#define ENCODER_COUNTS_PER_STEP        1
+#endif
+
+#ifndef ENCODER_WHEEL_COUNTS_PER_STEP
+#define ENCODER_WHEEL_COUNTS_PER_STEP  4
+#endif
+
+/**
+ * Input filter of the timer channels (0 to 15, see TIMx_CCMR1 ICxF), to
+ * reject contact bounce.
+ */
+#ifndef ENCODER_INPUT_FILTER
+#define ENCODER_INPUT_FILTER           0x3
+#endif
+
+/*!
+ * @brief Configure the encoder inputs and start feeding the mouse reports.
+ *        Replaces any other motion source, e.g. paths.
+ * @return None.
+ */
+void USB_HID_Mouse_EncoderStart(void);
+
+/*!
+ * @brief Stop feeding the mouse reports from the encoders.
+ * @return None.
+ */
+void USB_HID_Mouse_EncoderStop(void);
+
+#endif // INC_USB_HID_MOUSE_ENCODER_H_
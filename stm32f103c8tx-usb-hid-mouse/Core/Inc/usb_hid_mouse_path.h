@@ -0,0 +1,89 @@
+/*!
+ * @file   usb_hid_mouse_path.h
+ * @brief  Module to draw paths with the USB Mouse, one step per host poll
+ *
+ * Paths are queued and interpolated with integer arithmetic while the host
+ * polls, so the pointer moves smoothly at the poll rate and always lands
+ * exactly on the end point. All coordinates are relative to the pointer
+ * position when the path starts.
+ */
+#ifndef INC_USB_HID_MOUSE_PATH_H_
+#define INC_USB_HID_MOUSE_PATH_H_
+
+#include <stdint.h>
+
+/*
+ * Path point.
+ */
+typedef struct {
+  int32_t x;
+  int32_t y;
+} MousePoint;
+
+/*!
+ * @brief Set the drawing speed of the paths queued afterwards.
+ *
+ * @param[in] speed Maximum movement per axis and per report (1 to 120).
+ * @return    None.
+ */
+void USB_HID_Mouse_PathSpeed(int32_t speed);
+
+/*!
+ * @brief Queue a straight line.
+ *
+ * @param[in] x End point x coordinate.
+ * @param[in] y End point y coordinate.
+ * @return    True (1) in case of success, otherwise false (0) if the queue is full.
+ */
+int USB_HID_Mouse_Line(int32_t x, int32_t y);
+
+/*!
+ * @brief Queue straight lines through the given points.
+ *
+ * @param[in] points Points, relative to the start of the polyline.
+ * @param[in] count  Number of points.
+ * @return    True (1) in case of success, otherwise false (0) if the queue is full.
+ */
+int USB_HID_Mouse_Polyline(const MousePoint* points, int count);
+
+/*!
+ * @brief Queue a quadratic Bezier curve.
+ *
+ * @param[in] cx Control point x coordinate.
+ * @param[in] cy Control point y coordinate.
+ * @param[in] x  End point x coordinate.
+ * @param[in] y  End point y coordinate.
+ * @return    True (1) in case of success, otherwise false (0) if the queue is full.
+ */
+int USB_HID_Mouse_QuadBezier(int32_t cx, int32_t cy, int32_t x, int32_t y);
+
+/*!
+ * @brief Queue a cubic Bezier curve.
+ *
+ * @param[in] c1x First control point x coordinate.
+ * @param[in] c1y First control point y coordinate.
+ * @param[in] c2x Second control point x coordinate.
+ * @param[in] c2y Second control point y coordinate.
+ * @param[in] x   End point x coordinate.
+ * @param[in] y   End point y coordinate.
+ * @return    True (1) in case of success, otherwise false (0) if the queue is full.
+ */
+int USB_HID_Mouse_CubicBezier(int32_t c1x, int32_t c1y, int32_t c2x, int32_t c2y, int32_t x, int32_t y);
+
+/*!
+ * @brief Queue a circular arc around the given center.
+ *
+ * @param[in] cx    Center x coordinate.
+ * @param[in] cy    Center y coordinate.
+ * @param[in] angle Swept angle in degrees (Positive values turn clockwise on screen).
+ * @return    True (1) in case of success, otherwise false (0) if the queue is full.
+ */
+int USB_HID_Mouse_Arc(int32_t cx, int32_t cy, int32_t angle);
+
+/*!
+ * @brief Check whether queued paths are still being drawn.
+ * @return True (1) while drawing, otherwise false (0).
+ */
+int USB_HID_Mouse_PathBusy(void);
+
+#endif // INC_USB_HID_MOUSE_PATH_H_
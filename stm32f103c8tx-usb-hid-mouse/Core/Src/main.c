@@ -1,6 +1,22 @@
 #include "main.h"
 #include "usb_device.h"
 #include "usb_hid_mouse.h"
+#include "usb_hid_mouse_path.h"
+#include "usb_hid_mouse_encoder.h"
+#include "scheduler.h"
+
+// Set to 1 to send a report on every poll, so the achieved report rate and
+// its jitter can be measured on the host from a usbmon capture (e.g. with
+// "cat /sys/kernel/debug/usb/usbmon/<bus>u"). The pointer jiggles in place.
+#ifndef MOUSE_BENCHMARK
+#define MOUSE_BENCHMARK 0
+#endif
+
+// Set to 1 to move the pointer and wheel from quadrature encoders (see
+// usb_hid_mouse_encoder.h) instead of drawing.
+#ifndef MOUSE_ENCODER
+#define MOUSE_ENCODER 0
+#endif
 
 /**
  * @brief System clock configuration.
@@ -15,10 +31,25 @@ void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
 
 /**
- * @brief Simple function to test USB HID mouse behaviour.
+ * @brief Simple function to test USB HID mouse behaviour. Each call runs one
+ *        drawing step and schedules the next one. With MOUSE_BENCHMARK set,
+ *        start streaming reports instead, and with MOUSE_ENCODER set, start
+ *        the encoders.
+ * @param[in] arg Unused.
  * @return None.
  */
-static void test_mouse(void);
+static void test_mouse(void* arg);
+
+#if MOUSE_BENCHMARK
+/**
+ * @brief Motion source moving the pointer back and forth on every poll.
+ * @param[out] x Pointer movement along the x axis.
+ * @param[out] y Pointer movement along the y axis.
+ * @param[out] wheel Wheel rotation.
+ * @return Always true (1).
+ */
+static int benchmark_motion(int32_t* x, int32_t* y, int32_t* wheel);
+#endif
 
 /**
  * @brief Application entry point.
@@ -37,13 +68,9 @@ int main(void) {
   MX_USB_DEVICE_Init();
 
   // Wait 10 seconds before start drawing.
-  HAL_Delay(10000);
-
-  // Infinite loop.
-  while (1) {
-    test_mouse();
-    HAL_Delay(1000);
-  }
+  Scheduler_Init();
+  Scheduler_PostDelayed(test_mouse, NULL, 10000);
+  Scheduler_Run();
 }
 
 void SystemClock_Config(void) {
@@ -94,32 +121,59 @@ void Error_Handler(void) {
   }
 }
 
-static void test_mouse(void) {
+static void test_mouse(void* arg) {
+  static const MousePoint walls[] = {{0, 50}, {100, 50}, {100, 0}};
+  static const MousePoint roof[] = {{-100, 0}, {-50, -25}, {0, 0}};
+  static int step = 0;
+
+#if MOUSE_BENCHMARK
+  USB_HID_Mouse_SetMotionSource(benchmark_motion);
+  return;
+#elif MOUSE_ENCODER
+  USB_HID_Mouse_EncoderStart();
+  return;
+#endif
+
+  // Let the current path finish before moving on.
+  if (USB_HID_Mouse_PathBusy()) {
+    Scheduler_PostDelayed(test_mouse, NULL, 10);
+    return;
+  }
+
   // Draw simple house to test USB HID mouse behaviour.
-  // Draw walls.
-  USB_HID_Mouse_Press(BUTTON_LEFT);
-  HAL_Delay(500);
-  USB_HID_Mouse_Move(0, 50, 0);
-  HAL_Delay(500);
-  USB_HID_Mouse_Move(100, 0, 0);
-  HAL_Delay(500);
-  USB_HID_Mouse_Move(0, -50, 0);
-  HAL_Delay(500);
-  USB_HID_Mouse_Release(BUTTON_LEFT);
-  HAL_Delay(500);
-
-  // Draw roof.
-  USB_HID_Mouse_Press(BUTTON_RIGHT);
-  HAL_Delay(500);
-  USB_HID_Mouse_Move(-100, 0, 0);
-  HAL_Delay(500);
-  USB_HID_Mouse_Move(50, -25, 0);
-  HAL_Delay(500);
-  USB_HID_Mouse_Move(50, 25, 0);
-  HAL_Delay(500);
-  USB_HID_Mouse_Release(BUTTON_RIGHT);
-  HAL_Delay(500);
+  switch (step) {
+    // Draw walls.
+    case 0:
+      USB_HID_Mouse_Press(BUTTON_LEFT);
+      USB_HID_Mouse_Polyline(walls, 3);
+      break;
+    // Draw roof.
+    case 1:
+      USB_HID_Mouse_Release(BUTTON_LEFT);
+      USB_HID_Mouse_Press(BUTTON_RIGHT);
+      USB_HID_Mouse_Polyline(roof, 3);
+      break;
+    default:
+      USB_HID_Mouse_Release(BUTTON_RIGHT);
+      break;
+  }
+
+  // Wait 1.5 seconds once the house is done.
+  step = (step + 1) % 3;
+  Scheduler_PostDelayed(test_mouse, NULL, (step == 0) ? 1500 : 10);
+}
+
+#if MOUSE_BENCHMARK
+static int benchmark_motion(int32_t* x, int32_t* y, int32_t* wheel) {
+  static int32_t direction = 1;
+
+  direction = -direction;
+  *x = direction;
+  *y = 0;
+  *wheel = 0;
+  return 1;
 }
+#endif
 
 #ifdef  USE_FULL_ASSERT
 /**
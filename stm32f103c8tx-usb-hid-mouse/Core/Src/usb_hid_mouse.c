@@ -17,25 +17,116 @@ extern USBD_HandleTypeDef hUsbDeviceFS;
 /*
  * Mouse report structure.
  */
+#if (USBD_HID_MOUSE_ABSOLUTE == 1U)
+typedef struct {
+  uint8_t buttons;
+  int8_t wheel;
+  uint16_t x;
+  uint16_t y;
+} MouseReport;
+#else
 typedef struct {
   uint8_t buttons;
   int8_t x;
   int8_t y;
   int8_t wheel;
 } MouseReport;
+#endif
 
 /*
- * Mouse report.
+ * Mouse report being transmitted.
  */
 static MouseReport mouse_report;
 
+/*
+ * Motion segment. Moves made with the same buttons held are summed into one
+ * segment, which is sent in chunks of at most 127 counts per axis. In absolute
+ * mode x and y hold the pointer position to report instead, and only the wheel
+ * is split.
+ */
+typedef struct {
+  uint8_t buttons;
+  int32_t x;
+  int32_t y;
+  int32_t wheel;
+} MotionSegment;
+
+/*
+ * Segment queue size (must be a power of two).
+ */
+#define SEGMENT_QUEUE_SIZE 8
+
+/*
+ * Segment queue. A new segment is opened each time the buttons change, so
+ * press, drag and release reach the host in order. Every queued segment is
+ * worth at least one report. Both ends are only touched with the USB
+ * interrupt masked or from the USB interrupt itself.
+ */
+static MotionSegment segment_queue[SEGMENT_QUEUE_SIZE];
+static volatile uint32_t segment_queue_head;
+static volatile uint32_t segment_queue_tail;
+
+/*
+ * Buttons currently held.
+ */
+static uint8_t buttons_state;
+
+#if (USBD_HID_MOUSE_ABSOLUTE == 1U)
+/*
+ * Last queued pointer position, starting at the top left corner.
+ */
+static int32_t pointer_x;
+static int32_t pointer_y;
+#endif
+
+/*
+ * Motion source pulled when no segment is queued.
+ */
+static USB_HID_Mouse_MotionSource motion_source;
+
+/*!
+ * @brief Queue a motion, opening a new segment if the buttons changed.
+ *
+ * @param[in] buttons  Buttons held from this motion on.
+ * @param[in] x        Pointer movement along the x axis, or position if absolute.
+ * @param[in] y        Pointer movement along the y axis, or position if absolute.
+ * @param[in] wheel    Wheel rotation.
+ * @param[in] absolute True (1) if x and y are a position (absolute mode only).
+ * @return    True (1) in case of success, otherwise false (0).
+ */
+static int queue_motion(uint8_t buttons, int32_t x, int32_t y, int32_t wheel, int absolute);
+
+#if (USBD_HID_MOUSE_ABSOLUTE == 1U)
+/*!
+ * @brief Clamp a pointer position to the report range.
+ *
+ * @param[in] position Position.
+ * @return    Position clamped to [0, HID_MOUSE_ABSOLUTE_MAX].
+ */
+static int32_t clamp_position(int32_t position);
+#endif
+
+/*!
+ * @brief Saturate a motion delta to the report range.
+ *
+ * @param[in] delta Accumulated delta.
+ * @return    Delta clamped to [-127, 127].
+ */
+static int8_t saturate(int32_t delta);
+
 /*!
- * @brief Send mouse report.
- * @return True (1) in case of success, otherwise false (0).
+ * @brief Send the next chunk of the segment at the queue tail, if the endpoint is idle.
+ *
+ * Must be called with the USB interrupt masked or from the USB interrupt itself.
+ * @return None.
  */
-static int send_report(void);
+static void transmit_next_report(void);
 
 int USB_HID_Mouse_Click(uint8_t buttons) {
+  // Both segments must fit, the buttons would stay pressed otherwise.
+  if (USB_HID_Mouse_QueueSpace() < 2) {
+    return 0;
+  }
   if (!USB_HID_Mouse_Press(buttons)) {
     return 0;
   }
@@ -44,34 +135,189 @@ int USB_HID_Mouse_Click(uint8_t buttons) {
 
 int USB_HID_Mouse_Press(uint8_t buttons) {
   // Set required buttons' bits.
-  mouse_report.buttons |= buttons;
-  return USB_HID_Mouse_Move(0, 0, 0);
+  return queue_motion(buttons_state | buttons, 0, 0, 0, 0);
 }
 
 int USB_HID_Mouse_Release(uint8_t buttons) {
   // Clear required buttons' bits.
-  mouse_report.buttons &= ~buttons;
-  return USB_HID_Mouse_Move(0, 0, 0);
+  return queue_motion(buttons_state & ~buttons, 0, 0, 0, 0);
 }
 
 int USB_HID_Mouse_ReleaseAll() {
-  mouse_report.buttons = 0;
-  return USB_HID_Mouse_Move(0, 0, 0);
+  return queue_motion(0, 0, 0, 0, 0);
+}
+
+int USB_HID_Mouse_Move(int32_t x, int32_t y, int32_t wheel) {
+  return queue_motion(buttons_state, x, y, wheel, 0);
+}
+
+#if (USBD_HID_MOUSE_ABSOLUTE == 1U)
+int USB_HID_Mouse_MoveTo(int32_t x, int32_t y) {
+  return queue_motion(buttons_state, x, y, 0, 1);
+}
+#endif
+
+int USB_HID_Mouse_QueueSpace(void) {
+  return SEGMENT_QUEUE_SIZE - (int) (segment_queue_head - segment_queue_tail);
 }
 
-int USB_HID_Mouse_Move(int8_t x, int8_t y, int8_t wheel) {
-  mouse_report.x = x;
-  mouse_report.y = y;
-  mouse_report.wheel = wheel;
-  return send_report();
+void USB_HID_Mouse_SetMotionSource(USB_HID_Mouse_MotionSource source) {
+  HAL_NVIC_DisableIRQ(USB_LP_CAN1_RX0_IRQn);
+  motion_source = source;
+  transmit_next_report();
+  HAL_NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
 }
 
-static int send_report(void) {
-  if (USBD_HID_SendReport(&hUsbDeviceFS, (uint8_t*) &mouse_report, sizeof(MouseReport)) != HAL_OK) {
+static int queue_motion(uint8_t buttons, int32_t x, int32_t y, int32_t wheel, int absolute) {
+  MotionSegment* segment;
+  uint32_t head;
+
+  if (hUsbDeviceFS.dev_state != USBD_STATE_CONFIGURED) {
     return 0;
   }
 
-  // Small delay to avoid communication issues.
-  HAL_Delay(50);
+  HAL_NVIC_DisableIRQ(USB_LP_CAN1_RX0_IRQn);
+#if (USBD_HID_MOUSE_ABSOLUTE == 1U)
+  // Relative moves start from the last queued position, which the motion
+  // source may advance from the interrupt.
+  x = clamp_position(absolute ? x : (pointer_x + x));
+  y = clamp_position(absolute ? y : (pointer_y + y));
+#else
+  (void) absolute;
+#endif
+  head = segment_queue_head;
+  segment = &segment_queue[(head - 1) & (SEGMENT_QUEUE_SIZE - 1)];
+  if ((head != segment_queue_tail) && (segment->buttons == buttons)) {
+    // Same buttons as the last pending segment, coalesce.
+#if (USBD_HID_MOUSE_ABSOLUTE == 1U)
+    segment->x = x;
+    segment->y = y;
+#else
+    segment->x += x;
+    segment->y += y;
+#endif
+    segment->wheel += wheel;
+#if (USBD_HID_MOUSE_ABSOLUTE == 1U)
+  } else if ((head == segment_queue_tail) && (buttons == mouse_report.buttons) &&
+             (x == mouse_report.x) && (y == mouse_report.y) && (wheel == 0)) {
+#else
+  } else if ((head == segment_queue_tail) && (buttons == mouse_report.buttons) &&
+             (x == 0) && (y == 0) && (wheel == 0)) {
+#endif
+    // Nothing changed since the last report.
+  } else {
+    if ((head - segment_queue_tail) >= SEGMENT_QUEUE_SIZE) {
+      // Buttons change faster than the host polls. Leave the buttons and the
+      // pointer as they are rather than wait for the interrupt to free a slot,
+      // which would stall every other task: the caller retries once
+      // USB_HID_Mouse_QueueSpace() allows.
+      HAL_NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
+      return 0;
+    }
+    segment = &segment_queue[head & (SEGMENT_QUEUE_SIZE - 1)];
+    segment->buttons = buttons;
+    segment->x = x;
+    segment->y = y;
+    segment->wheel = wheel;
+    segment_queue_head = head + 1;
+  }
+  buttons_state = buttons;
+#if (USBD_HID_MOUSE_ABSOLUTE == 1U)
+  pointer_x = x;
+  pointer_y = y;
+#endif
+
+  // Kick the endpoint if it is not already draining the queue.
+  transmit_next_report();
+  HAL_NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
   return 1;
 }
+
+#if (USBD_HID_MOUSE_ABSOLUTE == 1U)
+static int32_t clamp_position(int32_t position) {
+  if (position < 0) {
+    return 0;
+  }
+  if (position > (int32_t) HID_MOUSE_ABSOLUTE_MAX) {
+    return HID_MOUSE_ABSOLUTE_MAX;
+  }
+  return position;
+}
+#endif
+
+static int8_t saturate(int32_t delta) {
+  if (delta > 127) {
+    return 127;
+  }
+  if (delta < -127) {
+    return -127;
+  }
+  return (int8_t) delta;
+}
+
+static void transmit_next_report(void) {
+  USBD_HID_HandleTypeDef* hhid = (USBD_HID_HandleTypeDef*) hUsbDeviceFS.pClassData;
+  MotionSegment* segment;
+  uint32_t tail = segment_queue_tail;
+  int32_t x;
+  int32_t y;
+  int32_t wheel;
+
+  if ((hhid == NULL) || (hhid->state != HID_IDLE)) {
+    return;
+  }
+  if (tail == segment_queue_head) {
+    // Nothing queued, let the motion source fill this poll.
+    if ((motion_source == NULL) || !motion_source(&x, &y, &wheel)) {
+      return;
+    }
+    mouse_report.buttons = buttons_state;
+#if (USBD_HID_MOUSE_ABSOLUTE == 1U)
+    pointer_x = clamp_position(pointer_x + x);
+    pointer_y = clamp_position(pointer_y + y);
+    mouse_report.x = (uint16_t) pointer_x;
+    mouse_report.y = (uint16_t) pointer_y;
+#else
+    mouse_report.x = saturate(x);
+    mouse_report.y = saturate(y);
+#endif
+    mouse_report.wheel = saturate(wheel);
+    USBD_HID_SendReport(&hUsbDeviceFS, (uint8_t*) &mouse_report, sizeof(MouseReport));
+    return;
+  }
+
+  // Take the largest chunk the report can carry and leave the remainder for
+  // the next poll.
+  segment = &segment_queue[tail & (SEGMENT_QUEUE_SIZE - 1)];
+  mouse_report.buttons = segment->buttons;
+#if (USBD_HID_MOUSE_ABSOLUTE == 1U)
+  mouse_report.x = (uint16_t) segment->x;
+  mouse_report.y = (uint16_t) segment->y;
+  mouse_report.wheel = saturate(segment->wheel);
+  segment->wheel -= mouse_report.wheel;
+  if (segment->wheel == 0) {
+#else
+  mouse_report.x = saturate(segment->x);
+  mouse_report.y = saturate(segment->y);
+  mouse_report.wheel = saturate(segment->wheel);
+  segment->x -= mouse_report.x;
+  segment->y -= mouse_report.y;
+  segment->wheel -= mouse_report.wheel;
+  if ((segment->x == 0) && (segment->y == 0) && (segment->wheel == 0)) {
+#endif
+    segment_queue_tail = tail + 1;
+  }
+
+  USBD_HID_SendReport(&hUsbDeviceFS, (uint8_t*) &mouse_report, sizeof(MouseReport));
+}
+
+void USBD_HID_ReportSentCallback(USBD_HandleTypeDef* pdev) {
+  transmit_next_report();
+}
+
+void USBD_HID_SOFCallback(USBD_HandleTypeDef* pdev) {
+  // Poll the motion source again if it had nothing to send last time.
+  if (motion_source != NULL) {
+    transmit_next_report();
+  }
+}
@@ -0,0 +1,129 @@
+/*!
+ * @file   usb_hid_mouse_encoder.c
+ * @brief  Quadrature encoder inputs for the mouse pointer and wheel
+ */
+#include "usb_hid_mouse_encoder.h"
+#include "usb_hid_mouse.h"
+#include "main.h"
+
+/*
+ * Largest movement of a relative report. Faster movements are spread over the
+ * next polls instead of being saturated.
+ */
+#define STEPS_MAX 127
+
+/*
+ * Encoder axis: timer counting its edges, counter value at the last sample and
+ * counts not reported yet.
+ */
+typedef struct {
+  TIM_TypeDef* timer;
+  uint16_t last_count;
+  int32_t pending;
+  int32_t counts_per_step;
+} EncoderAxis;
+
+static EncoderAxis axis_x = {TIM2, 0, 0, ENCODER_COUNTS_PER_STEP};
+static EncoderAxis axis_y = {TIM3, 0, 0, ENCODER_COUNTS_PER_STEP};
+static EncoderAxis axis_wheel = {TIM4, 0, 0, ENCODER_WHEEL_COUNTS_PER_STEP};
+
+/*!
+ * @brief Put a timer in encoder mode and start it.
+ *
+ * @param[in,out] axis Encoder axis.
+ * @return        None.
+ */
+static void start_timer(EncoderAxis* axis);
+
+/*!
+ * @brief Sample an axis.
+ *
+ * @param[in,out] axis Encoder axis.
+ * @return        Steps since the last sample.
+ */
+static int32_t sample_axis(EncoderAxis* axis);
+
+/*!
+ * @brief Motion source reporting the encoder movements.
+ *
+ * @param[out] x     Pointer movement along the x axis.
+ * @param[out] y     Pointer movement along the y axis.
+ * @param[out] wheel Wheel rotation.
+ * @return     True (1) if any encoder moved, otherwise false (0).
+ */
+static int encoder_motion(int32_t* x, int32_t* y, int32_t* wheel);
+
+void USB_HID_Mouse_EncoderStart(void) {
+  GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+  __HAL_RCC_GPIOA_CLK_ENABLE();
+  __HAL_RCC_GPIOB_CLK_ENABLE();
+  __HAL_RCC_TIM2_CLK_ENABLE();
+  __HAL_RCC_TIM3_CLK_ENABLE();
+  __HAL_RCC_TIM4_CLK_ENABLE();
+
+  // Encoder channels, pulled up for open collector and mechanical encoders.
+  GPIO_InitStruct.Pin = GPIO_PIN_0 | GPIO_PIN_1 | GPIO_PIN_6 | GPIO_PIN_7;
+  GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+  GPIO_InitStruct.Pull = GPIO_PULLUP;
+  HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
+  GPIO_InitStruct.Pin = GPIO_PIN_6 | GPIO_PIN_7;
+  HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+  start_timer(&axis_x);
+  start_timer(&axis_y);
+  start_timer(&axis_wheel);
+
+  USB_HID_Mouse_SetMotionSource(encoder_motion);
+}
+
+void USB_HID_Mouse_EncoderStop(void) {
+  USB_HID_Mouse_SetMotionSource(NULL);
+}
+
+static void start_timer(EncoderAxis* axis) {
+  TIM_TypeDef* timer = axis->timer;
+
+  timer->CR1 = 0;
+  timer->PSC = 0;
+  timer->ARR = 0xFFFF;
+  // TI1 on CC1 and TI2 on CC2, filtered, not inverted.
+  timer->CCMR1 = TIM_CCMR1_CC1S_0 | TIM_CCMR1_CC2S_0 |
+                 (ENCODER_INPUT_FILTER << TIM_CCMR1_IC1F_Pos) |
+                 (ENCODER_INPUT_FILTER << TIM_CCMR1_IC2F_Pos);
+  timer->CCER = 0;
+  // Encoder mode 3: count on both edges of both channels.
+  timer->SMCR = TIM_SMCR_SMS_0 | TIM_SMCR_SMS_1;
+  timer->CNT = 0;
+  timer->CR1 = TIM_CR1_CEN;
+
+  axis->last_count = 0;
+  axis->pending = 0;
+}
+
+static int32_t sample_axis(EncoderAxis* axis) {
+  uint16_t count = (uint16_t) axis->timer->CNT;
+  int32_t steps;
+
+  // The 16-bit difference is right across a counter wraparound, as long as
+  // the encoder moves less than 32768 counts between two polls.
+  axis->pending += (int16_t) (uint16_t) (count - axis->last_count);
+  axis->last_count = count;
+
+  // Report whole steps only and carry the remainder, in either direction.
+  steps = axis->pending / axis->counts_per_step;
+  if (steps > STEPS_MAX) {
+    steps = STEPS_MAX;
+  } else if (steps < -STEPS_MAX) {
+    steps = -STEPS_MAX;
+  }
+  axis->pending -= steps * axis->counts_per_step;
+  return steps;
+}
+
+static int encoder_motion(int32_t* x, int32_t* y, int32_t* wheel) {
+  *x = sample_axis(&axis_x);
+  *y = sample_axis(&axis_y);
+  *wheel = sample_axis(&axis_wheel);
+  return (*x != 0) || (*y != 0) || (*wheel != 0);
+}
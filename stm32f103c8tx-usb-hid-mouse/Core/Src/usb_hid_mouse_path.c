@@ -0,0 +1,390 @@
+/*!
+ * @file   usb_hid_mouse_path.c
+ * @brief  Module to draw paths with the USB Mouse, one step per host poll
+ *
+ * Each path is split into steps no longer than the drawing speed. A step
+ * moves to the next interpolated point, computed from the path start with
+ * integer arithmetic, so rounding errors never add up along the path.
+ */
+#include "usb_hid_mouse_path.h"
+#include "usb_hid_mouse.h"
+#include "main.h"
+
+/*
+ * Path queue size (must be a power of two).
+ */
+#define PATH_QUEUE_SIZE 16
+
+/*
+ * Drawing speed limits, in counts per axis and per report. The upper limit
+ * leaves room for rounding within the 8-bit report range.
+ */
+#define PATH_SPEED_DEFAULT 8
+#define PATH_SPEED_MAX     120
+
+/*
+ * Angles are handled in 1/256 degree.
+ */
+#define ANGLE_SCALE 256
+
+/*
+ * Path types.
+ */
+#define PATH_LINE   0
+#define PATH_QUAD   1
+#define PATH_CUBIC  2
+#define PATH_ARC    3
+
+/*
+ * Queued path. Points are relative to the pointer position when the path
+ * starts. Line: end point. Quadratic Bezier: control and end points. Cubic
+ * Bezier: both control points and end point. Arc: center, then swept angle in
+ * the x coordinate of the second point.
+ */
+typedef struct {
+  uint8_t type;
+  MousePoint points[3];
+  int32_t steps;
+  int32_t step;
+  MousePoint position;
+} PathSegment;
+
+/*
+ * Sine of 0 to 90 degrees, in steps of 1 degree, scaled by 32767.
+ */
+static const int16_t sine_table[91] = {
+      0,   572,  1144,  1715,  2286,  2856,  3425,  3993,
+   4560,  5126,  5690,  6252,  6813,  7371,  7927,  8481,
+   9032,  9580, 10126, 10668, 11207, 11743, 12275, 12803,
+  13328, 13848, 14364, 14876, 15383, 15886, 16383, 16876,
+  17364, 17846, 18323, 18794, 19260, 19720, 20173, 20621,
+  21062, 21497, 21925, 22347, 22762, 23170, 23571, 23964,
+  24351, 24730, 25101, 25465, 25821, 26169, 26509, 26841,
+  27165, 27481, 27788, 28087, 28377, 28659, 28932, 29196,
+  29451, 29697, 29934, 30162, 30381, 30591, 30791, 30982,
+  31163, 31335, 31498, 31650, 31794, 31927, 32051, 32165,
+  32269, 32364, 32448, 32523, 32587, 32642, 32687, 32722,
+  32747, 32762, 32767
+};
+
+/*
+ * Path queue. Filled by the application and drawn from the USB interrupt.
+ */
+static PathSegment path_queue[PATH_QUEUE_SIZE];
+static volatile uint32_t path_queue_head;
+static volatile uint32_t path_queue_tail;
+
+/*
+ * Drawing speed.
+ */
+static int32_t path_speed = PATH_SPEED_DEFAULT;
+
+/*!
+ * @brief Queue paths and make sure they are being drawn.
+ *
+ * @param[in] segments Paths to queue.
+ * @param[in] count    Number of paths.
+ * @return    True (1) in case of success, otherwise false (0) if the queue is full.
+ */
+static int queue_paths(const PathSegment* segments, int count);
+
+/*!
+ * @brief Motion source drawing the path at the queue tail.
+ *
+ * @param[out] x     Pointer movement along the x axis.
+ * @param[out] y     Pointer movement along the y axis.
+ * @param[out] wheel Wheel rotation (always 0).
+ * @return     True (1) if a step was produced, otherwise false (0).
+ */
+static int next_step(int32_t* x, int32_t* y, int32_t* wheel);
+
+/*!
+ * @brief Compute the point of a path at the given step.
+ *
+ * @param[in]  segment Path.
+ * @param[in]  step    Step, from 0 to the number of steps of the path.
+ * @param[out] point   Point reached.
+ * @return     None.
+ */
+static void point_at(const PathSegment* segment, int32_t step, MousePoint* point);
+
+/*!
+ * @brief Number of steps needed to cover a distance at the current speed.
+ *
+ * @param[in] distance Distance along the longest axis.
+ * @return    Number of steps (at least 1).
+ */
+static int32_t steps_for(int32_t distance);
+
+/*!
+ * @brief Distance along the longest axis between two points.
+ *
+ * @param[in] x Difference along the x axis.
+ * @param[in] y Difference along the y axis.
+ * @return    Distance.
+ */
+static int32_t axis_distance(int32_t x, int32_t y);
+
+/*!
+ * @brief Sine of an angle.
+ *
+ * @param[in] angle Angle in 1/256 degree.
+ * @return    Sine scaled by 32767.
+ */
+static int32_t sine(int32_t angle);
+
+/*!
+ * @brief Integer square root.
+ *
+ * @param[in] value Value.
+ * @return    Square root, rounded down.
+ */
+static uint32_t square_root(uint64_t value);
+
+/*!
+ * @brief Division rounded to the nearest integer.
+ *
+ * @param[in] num Dividend.
+ * @param[in] den Divisor (positive).
+ * @return    Quotient.
+ */
+static int32_t divide(int64_t num, int64_t den);
+
+void USB_HID_Mouse_PathSpeed(int32_t speed) {
+  if (speed < 1) {
+    speed = 1;
+  } else if (speed > PATH_SPEED_MAX) {
+    speed = PATH_SPEED_MAX;
+  }
+  path_speed = speed;
+}
+
+int USB_HID_Mouse_Line(int32_t x, int32_t y) {
+  PathSegment segment = {0};
+
+  segment.type = PATH_LINE;
+  segment.points[0].x = x;
+  segment.points[0].y = y;
+  segment.steps = steps_for(axis_distance(x, y));
+  return queue_paths(&segment, 1);
+}
+
+int USB_HID_Mouse_Polyline(const MousePoint* points, int count) {
+  PathSegment segments[PATH_QUEUE_SIZE] = {0};
+  MousePoint last = {0, 0};
+  int i;
+
+  if ((count < 1) || (count > PATH_QUEUE_SIZE)) {
+    return 0;
+  }
+
+  for (i = 0; i < count; i++) {
+    segments[i].type = PATH_LINE;
+    segments[i].points[0].x = points[i].x - last.x;
+    segments[i].points[0].y = points[i].y - last.y;
+    segments[i].steps = steps_for(axis_distance(segments[i].points[0].x, segments[i].points[0].y));
+    last = points[i];
+  }
+  return queue_paths(segments, count);
+}
+
+int USB_HID_Mouse_QuadBezier(int32_t cx, int32_t cy, int32_t x, int32_t y) {
+  PathSegment segment = {0};
+  int32_t distance;
+
+  // The speed along the curve never exceeds twice its longest leg.
+  distance = axis_distance(cx, cy);
+  if (axis_distance(x - cx, y - cy) > distance) {
+    distance = axis_distance(x - cx, y - cy);
+  }
+
+  segment.type = PATH_QUAD;
+  segment.points[0].x = cx;
+  segment.points[0].y = cy;
+  segment.points[1].x = x;
+  segment.points[1].y = y;
+  segment.steps = steps_for(2 * distance);
+  return queue_paths(&segment, 1);
+}
+
+int USB_HID_Mouse_CubicBezier(int32_t c1x, int32_t c1y, int32_t c2x, int32_t c2y, int32_t x, int32_t y) {
+  PathSegment segment = {0};
+  int32_t distance;
+
+  // The speed along the curve never exceeds three times its longest leg.
+  distance = axis_distance(c1x, c1y);
+  if (axis_distance(c2x - c1x, c2y - c1y) > distance) {
+    distance = axis_distance(c2x - c1x, c2y - c1y);
+  }
+  if (axis_distance(x - c2x, y - c2y) > distance) {
+    distance = axis_distance(x - c2x, y - c2y);
+  }
+
+  segment.type = PATH_CUBIC;
+  segment.points[0].x = c1x;
+  segment.points[0].y = c1y;
+  segment.points[1].x = c2x;
+  segment.points[1].y = c2y;
+  segment.points[2].x = x;
+  segment.points[2].y = y;
+  segment.steps = steps_for(3 * distance);
+  return queue_paths(&segment, 1);
+}
+
+int USB_HID_Mouse_Arc(int32_t cx, int32_t cy, int32_t angle) {
+  PathSegment segment = {0};
+  uint32_t radius;
+  int32_t length;
+
+  // Arc length, with pi / 180 approximated as 71 / 4068.
+  radius = square_root(((int64_t) cx * cx) + ((int64_t) cy * cy));
+  length = (int32_t) (((int64_t) radius * ((angle < 0) ? -angle : angle) * 71) / 4068);
+
+  segment.type = PATH_ARC;
+  segment.points[0].x = cx;
+  segment.points[0].y = cy;
+  segment.points[1].x = angle;
+  segment.steps = steps_for(length + 1);
+  return queue_paths(&segment, 1);
+}
+
+int USB_HID_Mouse_PathBusy(void) {
+  return path_queue_tail != path_queue_head;
+}
+
+static int queue_paths(const PathSegment* segments, int count) {
+  uint32_t head = path_queue_head;
+  int i;
+
+  if ((head - path_queue_tail) > (uint32_t) (PATH_QUEUE_SIZE - count)) {
+    return 0;
+  }
+
+  for (i = 0; i < count; i++) {
+    path_queue[(head + i) & (PATH_QUEUE_SIZE - 1)] = segments[i];
+  }
+  path_queue_head = head + count;
+
+  USB_HID_Mouse_SetMotionSource(next_step);
+  return 1;
+}
+
+static int next_step(int32_t* x, int32_t* y, int32_t* wheel) {
+  PathSegment* segment;
+  MousePoint point;
+
+  while (path_queue_tail != path_queue_head) {
+    segment = &path_queue[path_queue_tail & (PATH_QUEUE_SIZE - 1)];
+    if (segment->step < segment->steps) {
+      segment->step++;
+      point_at(segment, segment->step, &point);
+      *x = point.x - segment->position.x;
+      *y = point.y - segment->position.y;
+      *wheel = 0;
+      segment->position = point;
+      return 1;
+    }
+
+    // Path done, the next one starts where it ended.
+    path_queue_tail++;
+  }
+  return 0;
+}
+
+static void point_at(const PathSegment* segment, int32_t step, MousePoint* point) {
+  const MousePoint* p = segment->points;
+  int64_t n = segment->steps;
+  int64_t i = step;
+  int64_t a = n - i;
+  int32_t angle;
+  int32_t sine_value;
+  int32_t cosine_value;
+
+  switch (segment->type) {
+    case PATH_LINE:
+      point->x = divide(p[0].x * i, n);
+      point->y = divide(p[0].y * i, n);
+      break;
+    case PATH_QUAD:
+      // B(t) = 2 (1 - t) t C + t^2 P, with t = i / n.
+      point->x = divide((2 * a * i * p[0].x) + (i * i * p[1].x), n * n);
+      point->y = divide((2 * a * i * p[0].y) + (i * i * p[1].y), n * n);
+      break;
+    case PATH_CUBIC:
+      // B(t) = 3 (1 - t)^2 t C1 + 3 (1 - t) t^2 C2 + t^3 P, with t = i / n.
+      point->x = divide((3 * a * a * i * p[0].x) + (3 * a * i * i * p[1].x) + (i * i * i * p[2].x), n * n * n);
+      point->y = divide((3 * a * a * i * p[0].y) + (3 * a * i * i * p[1].y) + (i * i * i * p[2].y), n * n * n);
+      break;
+    default:
+      // Rotate the vector from the center to the start point.
+      angle = (int32_t) ((int64_t) p[1].x * ANGLE_SCALE * i / n);
+      sine_value = sine(angle);
+      cosine_value = sine(angle + (90 * ANGLE_SCALE));
+      point->x = p[0].x + divide(((int64_t) -p[0].x * cosine_value) - ((int64_t) -p[0].y * sine_value), 32767);
+      point->y = p[0].y + divide(((int64_t) -p[0].x * sine_value) + ((int64_t) -p[0].y * cosine_value), 32767);
+      break;
+  }
+}
+
+static int32_t steps_for(int32_t distance) {
+  int32_t steps = (distance + path_speed - 1) / path_speed;
+  return (steps > 0) ? steps : 1;
+}
+
+static int32_t axis_distance(int32_t x, int32_t y) {
+  x = (x < 0) ? -x : x;
+  y = (y < 0) ? -y : y;
+  return (x > y) ? x : y;
+}
+
+static int32_t sine(int32_t angle) {
+  int32_t sign = 1;
+  int32_t index;
+  int32_t fraction;
+
+  angle %= 360 * ANGLE_SCALE;
+  if (angle < 0) {
+    angle += 360 * ANGLE_SCALE;
+  }
+  if (angle >= 180 * ANGLE_SCALE) {
+    angle -= 180 * ANGLE_SCALE;
+    sign = -1;
+  }
+  if (angle > 90 * ANGLE_SCALE) {
+    angle = (180 * ANGLE_SCALE) - angle;
+  }
+
+  // Linear interpolation between whole degrees.
+  index = angle / ANGLE_SCALE;
+  fraction = angle % ANGLE_SCALE;
+  if (index == 90) {
+    return sign * sine_table[90];
+  }
+  return sign * (sine_table[index] + (((sine_table[index + 1] - sine_table[index]) * fraction) / ANGLE_SCALE));
+}
+
+static uint32_t square_root(uint64_t value) {
+  uint64_t root = 0;
+  uint64_t bit = (uint64_t) 1 << 62;
+
+  while (bit > value) {
+    bit >>= 2;
+  }
+  while (bit != 0) {
+    if (value >= root + bit) {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint32_t) root;
+}
+
+static int32_t divide(int64_t num, int64_t den) {
+  if (num < 0) {
+    return (int32_t) -((-num + (den / 2)) / den);
+  }
+  return (int32_t) ((num + (den / 2)) / den);
+}
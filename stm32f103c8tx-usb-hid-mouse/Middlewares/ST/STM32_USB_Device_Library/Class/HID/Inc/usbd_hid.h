@@ -41,12 +41,33 @@ extern "C" {
 /** @defgroup USBD_HID_Exported_Defines
   * @{
   */
+#ifndef USBD_HID_MOUSE_ABSOLUTE
+#define USBD_HID_MOUSE_ABSOLUTE       0U
+#endif /* USBD_HID_MOUSE_ABSOLUTE */
+
 #define HID_EPIN_ADDR                 0x81U
+#if (USBD_HID_MOUSE_ABSOLUTE == 1U)
+/* Absolute pointer: buttons, wheel, then 16-bit X and Y. Not a boot mouse */
+#define HID_EPIN_SIZE                 0x06U
+#define HID_MOUSE_REPORT_DESC_SIZE    64U
+#define HID_MOUSE_SUBCLASS            0x00U
+#define HID_MOUSE_PROTOCOL            0x00U
+#else
 #define HID_EPIN_SIZE                 0x04U
+#define HID_MOUSE_REPORT_DESC_SIZE    74U
+#define HID_MOUSE_SUBCLASS            0x01U
+#define HID_MOUSE_PROTOCOL            0x02U
+#endif /* USBD_HID_MOUSE_ABSOLUTE */
+
+/* Logical range of the absolute X and Y axes */
+#define HID_MOUSE_ABSOLUTE_MAX        0x7FFFU
+
+/* Packet memory needed by the class endpoints: EP(name, address, max packet size, double buffered) */
+#define USBD_HID_PMA_TABLE(EP) \
+  EP(HID_IN, HID_EPIN_ADDR, HID_EPIN_SIZE, 0U)
 
 #define USB_HID_CONFIG_DESC_SIZ       34U
 #define USB_HID_DESC_SIZ              9U
-#define HID_MOUSE_REPORT_DESC_SIZE    74U
 
 #define HID_DESCRIPTOR_TYPE           0x21U
 #define HID_REPORT_DESC               0x22U
@@ -59,6 +80,11 @@ extern "C" {
 #define HID_FS_BINTERVAL            0x0AU
 #endif /* HID_FS_BINTERVAL */
 
+/* Full speed interrupt endpoints are polled every bInterval frames of 1 ms */
+#if (HID_FS_BINTERVAL < 1) || (HID_FS_BINTERVAL > 255)
+#error "HID_FS_BINTERVAL must be between 1 and 255 ms"
+#endif /* HID_FS_BINTERVAL */
+
 #define HID_REQ_SET_PROTOCOL          0x0BU
 #define HID_REQ_GET_PROTOCOL          0x03U
 
@@ -124,6 +150,10 @@ uint8_t USBD_HID_SendReport(USBD_HandleTypeDef *pdev,
 
 uint32_t USBD_HID_GetPollingInterval(USBD_HandleTypeDef *pdev);
 
+void USBD_HID_ReportSentCallback(USBD_HandleTypeDef *pdev);
+
+void USBD_HID_SOFCallback(USBD_HandleTypeDef *pdev);
+
 /**
   * @}
   */
@@ -108,6 +108,8 @@ static uint8_t  *USBD_HID_GetOtherSpeedCfgDesc(uint16_t *length);
 static uint8_t  *USBD_HID_GetDeviceQualifierDesc(uint16_t *length);
 
 static uint8_t  USBD_HID_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum);
+
+static uint8_t  USBD_HID_SOF(USBD_HandleTypeDef *pdev);
 /**
   * @}
   */
@@ -125,7 +127,7 @@ USBD_ClassTypeDef  USBD_HID =
   NULL, /*EP0_RxReady*/
   USBD_HID_DataIn, /*DataIn*/
   NULL, /*DataOut*/
-  NULL, /*SOF */
+  USBD_HID_SOF, /*SOF */
   NULL,
   NULL,
   USBD_HID_GetHSCfgDesc,
@@ -157,8 +159,8 @@ __ALIGN_BEGIN static uint8_t USBD_HID_CfgFSDesc[USB_HID_CONFIG_DESC_SIZ]  __ALIG
   0x00,         /*bAlternateSetting: Alternate setting*/
   0x01,         /*bNumEndpoints*/
   0x03,         /*bInterfaceClass: HID*/
-  0x01,         /*bInterfaceSubClass : 1=BOOT, 0=no boot*/
-  0x02,         /*nInterfaceProtocol : 0=none, 1=keyboard, 2=mouse*/
+  HID_MOUSE_SUBCLASS, /*bInterfaceSubClass : 1=BOOT, 0=no boot*/
+  HID_MOUSE_PROTOCOL, /*nInterfaceProtocol : 0=none, 1=keyboard, 2=mouse*/
   0,            /*iInterface: Index of string descriptor*/
   /******************** Descriptor of Joystick Mouse HID ********************/
   /* 18 */
@@ -178,7 +180,7 @@ __ALIGN_BEGIN static uint8_t USBD_HID_CfgFSDesc[USB_HID_CONFIG_DESC_SIZ]  __ALIG
 
   HID_EPIN_ADDR,     /*bEndpointAddress: Endpoint Address (IN)*/
   0x03,          /*bmAttributes: Interrupt endpoint*/
-  HID_EPIN_SIZE, /*wMaxPacketSize: 4 Byte max */
+  HID_EPIN_SIZE, /*wMaxPacketSize: 4 Byte max, 6 if absolute */
   0x00,
   HID_FS_BINTERVAL,          /*bInterval: Polling Interval */
   /* 34 */
@@ -207,8 +209,8 @@ __ALIGN_BEGIN static uint8_t USBD_HID_CfgHSDesc[USB_HID_CONFIG_DESC_SIZ]  __ALIG
   0x00,         /*bAlternateSetting: Alternate setting*/
   0x01,         /*bNumEndpoints*/
   0x03,         /*bInterfaceClass: HID*/
-  0x01,         /*bInterfaceSubClass : 1=BOOT, 0=no boot*/
-  0x02,         /*nInterfaceProtocol : 0=none, 1=keyboard, 2=mouse*/
+  HID_MOUSE_SUBCLASS, /*bInterfaceSubClass : 1=BOOT, 0=no boot*/
+  HID_MOUSE_PROTOCOL, /*nInterfaceProtocol : 0=none, 1=keyboard, 2=mouse*/
   0,            /*iInterface: Index of string descriptor*/
   /******************** Descriptor of Joystick Mouse HID ********************/
   /* 18 */
@@ -228,7 +230,7 @@ __ALIGN_BEGIN static uint8_t USBD_HID_CfgHSDesc[USB_HID_CONFIG_DESC_SIZ]  __ALIG
 
   HID_EPIN_ADDR,     /*bEndpointAddress: Endpoint Address (IN)*/
   0x03,          /*bmAttributes: Interrupt endpoint*/
-  HID_EPIN_SIZE, /*wMaxPacketSize: 4 Byte max */
+  HID_EPIN_SIZE, /*wMaxPacketSize: 4 Byte max, 6 if absolute */
   0x00,
   HID_HS_BINTERVAL,          /*bInterval: Polling Interval */
   /* 34 */
@@ -257,8 +259,8 @@ __ALIGN_BEGIN static uint8_t USBD_HID_OtherSpeedCfgDesc[USB_HID_CONFIG_DESC_SIZ]
   0x00,         /*bAlternateSetting: Alternate setting*/
   0x01,         /*bNumEndpoints*/
   0x03,         /*bInterfaceClass: HID*/
-  0x01,         /*bInterfaceSubClass : 1=BOOT, 0=no boot*/
-  0x02,         /*nInterfaceProtocol : 0=none, 1=keyboard, 2=mouse*/
+  HID_MOUSE_SUBCLASS, /*bInterfaceSubClass : 1=BOOT, 0=no boot*/
+  HID_MOUSE_PROTOCOL, /*nInterfaceProtocol : 0=none, 1=keyboard, 2=mouse*/
   0,            /*iInterface: Index of string descriptor*/
   /******************** Descriptor of Joystick Mouse HID ********************/
   /* 18 */
@@ -278,7 +280,7 @@ __ALIGN_BEGIN static uint8_t USBD_HID_OtherSpeedCfgDesc[USB_HID_CONFIG_DESC_SIZ]
 
   HID_EPIN_ADDR,     /*bEndpointAddress: Endpoint Address (IN)*/
   0x03,          /*bmAttributes: Interrupt endpoint*/
-  HID_EPIN_SIZE, /*wMaxPacketSize: 4 Byte max */
+  HID_EPIN_SIZE, /*wMaxPacketSize: 4 Byte max, 6 if absolute */
   0x00,
   HID_FS_BINTERVAL,          /*bInterval: Polling Interval */
   /* 34 */
@@ -315,6 +317,47 @@ __ALIGN_BEGIN static uint8_t USBD_HID_DeviceQualifierDesc[USB_LEN_DEV_QUALIFIER_
   0x00,
 };
 
+#if (USBD_HID_MOUSE_ABSOLUTE == 1U)
+__ALIGN_BEGIN static uint8_t HID_MOUSE_ReportDesc[HID_MOUSE_REPORT_DESC_SIZE]  __ALIGN_END =
+{
+  0x05,   0x01,         /* Usage Page (Generic Desktop) */
+  0x09,   0x02,         /* Usage (Mouse) */
+  0xA1,   0x01,         /* Collection (Application) */
+  0x09,   0x01,         /*   Usage (Pointer) */
+  0xA1,   0x00,         /*   Collection (Physical) */
+
+  0x05,   0x09,         /*     Usage Page (Buttons) */
+  0x19,   0x01,         /*     Usage Minimum (1) */
+  0x29,   0x03,         /*     Usage Maximum (3) */
+  0x15,   0x00,         /*     Logical Minimum (0) */
+  0x25,   0x01,         /*     Logical Maximum (1) */
+  0x95,   0x03,         /*     Report Count (3) */
+  0x75,   0x01,         /*     Report Size (1) */
+  0x81,   0x02,         /*     Input (Data, Variable, Absolute) */
+  0x95,   0x01,         /*     Report Count (1) */
+  0x75,   0x05,         /*     Report Size (5) */
+  0x81,   0x01,         /*     Input (Constant) */
+
+  0x05,   0x01,         /*     Usage Page (Generic Desktop) */
+  0x09,   0x38,         /*     Usage (Wheel) */
+  0x15,   0x81,         /*     Logical Minimum (-127) */
+  0x25,   0x7F,         /*     Logical Maximum (127) */
+  0x75,   0x08,         /*     Report Size (8) */
+  0x95,   0x01,         /*     Report Count (1) */
+  0x81,   0x06,         /*     Input (Data, Variable, Relative) */
+
+  0x09,   0x30,         /*     Usage (X) */
+  0x09,   0x31,         /*     Usage (Y) */
+  0x16,   0x00,   0x00, /*     Logical Minimum (0) */
+  0x26,   0xFF,   0x7F, /*     Logical Maximum (32767) */
+  0x75,   0x10,         /*     Report Size (16) */
+  0x95,   0x02,         /*     Report Count (2) */
+  0x81,   0x02,         /*     Input (Data, Variable, Absolute) */
+
+  0xC0,                 /*   End Collection */
+  0xC0                  /* End Collection */
+};
+#else
 __ALIGN_BEGIN static uint8_t HID_MOUSE_ReportDesc[HID_MOUSE_REPORT_DESC_SIZE]  __ALIGN_END =
 {
   0x05,   0x01,
@@ -364,6 +407,7 @@ __ALIGN_BEGIN static uint8_t HID_MOUSE_ReportDesc[HID_MOUSE_REPORT_DESC_SIZE]  _
 
   0x01,   0xc0
 };
+#endif /* USBD_HID_MOUSE_ABSOLUTE */
 
 /**
   * @}
@@ -584,12 +628,18 @@ uint32_t USBD_HID_GetPollingInterval(USBD_HandleTypeDef *pdev)
      Values between 1..16 are allowed. Values correspond to interval
      of 2 ^ (bInterval-1). This option (8 ms, corresponds to HID_HS_BINTERVAL */
     polling_interval = (((1U << (HID_HS_BINTERVAL - 1U))) / 8U);
+
+    /* Intervals below one frame are reported as 1 ms */
+    if (polling_interval == 0U)
+    {
+      polling_interval = 1U;
+    }
   }
   else   /* LOW and FULL-speed endpoints */
   {
     /* Sets the data transfer polling interval for low and full
     speed transfers */
-    polling_interval =  HID_FS_BINTERVAL;
+    polling_interval = (uint32_t)HID_FS_BINTERVAL;
   }
 
   return ((uint32_t)(polling_interval));
@@ -648,9 +698,55 @@ static uint8_t  USBD_HID_DataIn(USBD_HandleTypeDef *pdev,
   /* Ensure that the FIFO is empty before a new transfer, this condition could
   be caused by  a new transfer before the end of the previous transfer */
   ((USBD_HID_HandleTypeDef *)pdev->pClassData)->state = HID_IDLE;
+
+  /* Let the application queue the next report */
+  USBD_HID_ReportSentCallback(pdev);
   return USBD_OK;
 }
 
+/**
+  * @brief  USBD_HID_SOF
+  *         handle start of frame, called on every frame (1 ms)
+  * @param  pdev: device instance
+  * @retval status
+  */
+static uint8_t  USBD_HID_SOF(USBD_HandleTypeDef *pdev)
+{
+  if (pdev->pClassData != NULL)
+  {
+    USBD_HID_SOFCallback(pdev);
+  }
+  return USBD_OK;
+}
+
+/**
+  * @brief  USBD_HID_ReportSentCallback
+  *         Called from the IN completion once the endpoint is free again.
+  *         The application may override it to send the next queued report.
+  * @param  pdev: device instance
+  * @retval None
+  */
+__weak void USBD_HID_ReportSentCallback(USBD_HandleTypeDef *pdev)
+{
+  /* This function should not be modified, when the callback is needed,
+     the USBD_HID_ReportSentCallback could be implemented in the user file */
+  UNUSED(pdev);
+}
+
+/**
+  * @brief  USBD_HID_SOFCallback
+  *         Called from the USB interrupt at the start of every frame (1 ms),
+  *         e.g. to sample inputs once per poll.
+  * @param  pdev: device instance
+  * @retval None
+  */
+__weak void USBD_HID_SOFCallback(USBD_HandleTypeDef *pdev)
+{
+  /* This function should not be modified, when the callback is needed,
+     the USBD_HID_SOFCallback could be implemented in the user file */
+  UNUSED(pdev);
+}
+
 
 /**
 * @brief  DeviceQualifierDescriptor
@@ -89,6 +89,16 @@
 
 /* USER CODE BEGIN PRIVATE_MACRO */
 
+/** Constant string descriptor in flash: the UTF-16 literal built from the
+  * ASCII string gives the descriptor body, without its terminating null. */
+#define USBD_STRING_DESC(name, str) \
+  static const __ALIGN_BEGIN struct \
+  { \
+    uint8_t bLength; \
+    uint8_t bDescriptorType; \
+    uint16_t wString[(sizeof(u"" str) / 2U) - 1U]; \
+  } name __ALIGN_END = { (uint8_t)sizeof(u"" str), USB_DESC_TYPE_STRING, u"" str }
+
 /* USER CODE END PRIVATE_MACRO */
 
 /**
@@ -182,7 +192,7 @@ __ALIGN_BEGIN uint8_t USBD_FS_DeviceDesc[USB_LEN_DEV_DESC] __ALIGN_END =
 #endif /* defined ( __ICCARM__ ) */
 
 /** USB lang identifier descriptor. */
-__ALIGN_BEGIN uint8_t USBD_LangIDDesc[USB_LEN_LANGID_STR_DESC] __ALIGN_END =
+__ALIGN_BEGIN const uint8_t USBD_LangIDDesc[USB_LEN_LANGID_STR_DESC] __ALIGN_END =
 {
      USB_LEN_LANGID_STR_DESC,
      USB_DESC_TYPE_STRING,
@@ -193,8 +203,11 @@ __ALIGN_BEGIN uint8_t USBD_LangIDDesc[USB_LEN_LANGID_STR_DESC] __ALIGN_END =
 #if defined ( __ICCARM__ ) /* IAR Compiler */
   #pragma data_alignment=4
 #endif /* defined ( __ICCARM__ ) */
-/* Internal string descriptor. */
-__ALIGN_BEGIN uint8_t USBD_StrDesc[USBD_MAX_STR_DESC_SIZ] __ALIGN_END;
+/* String descriptors, converted to UTF-16 at compile time. */
+USBD_STRING_DESC(USBD_ManufacturerStrDesc, USBD_MANUFACTURER_STRING);
+USBD_STRING_DESC(USBD_FS_ProductStrDesc, USBD_PRODUCT_STRING_FS);
+USBD_STRING_DESC(USBD_FS_ConfigStrDesc, USBD_CONFIGURATION_STRING_FS);
+USBD_STRING_DESC(USBD_FS_InterfaceStrDesc, USBD_INTERFACE_STRING_FS);
 
 #if defined ( __ICCARM__ ) /*!< IAR Compiler */
   #pragma data_alignment=4
@@ -236,7 +249,7 @@ uint8_t * USBD_FS_LangIDStrDescriptor(USBD_SpeedTypeDef speed, uint16_t *length)
 {
   UNUSED(speed);
   *length = sizeof(USBD_LangIDDesc);
-  return USBD_LangIDDesc;
+  return (uint8_t *)USBD_LangIDDesc;
 }
 
 /**
@@ -247,15 +260,9 @@ uint8_t * USBD_FS_LangIDStrDescriptor(USBD_SpeedTypeDef speed, uint16_t *length)
   */
 uint8_t * USBD_FS_ProductStrDescriptor(USBD_SpeedTypeDef speed, uint16_t *length)
 {
-  if(speed == 0)
-  {
-    USBD_GetString((uint8_t *)USBD_PRODUCT_STRING_FS, USBD_StrDesc, length);
-  }
-  else
-  {
-    USBD_GetString((uint8_t *)USBD_PRODUCT_STRING_FS, USBD_StrDesc, length);
-  }
-  return USBD_StrDesc;
+  UNUSED(speed);
+  *length = sizeof(USBD_FS_ProductStrDesc);
+  return (uint8_t *)&USBD_FS_ProductStrDesc;
 }
 
 /**
@@ -267,8 +274,8 @@ uint8_t * USBD_FS_ProductStrDescriptor(USBD_SpeedTypeDef speed, uint16_t *length
 uint8_t * USBD_FS_ManufacturerStrDescriptor(USBD_SpeedTypeDef speed, uint16_t *length)
 {
   UNUSED(speed);
-  USBD_GetString((uint8_t *)USBD_MANUFACTURER_STRING, USBD_StrDesc, length);
-  return USBD_StrDesc;
+  *length = sizeof(USBD_ManufacturerStrDesc);
+  return (uint8_t *)&USBD_ManufacturerStrDesc;
 }
 
 /**
@@ -282,9 +289,8 @@ uint8_t * USBD_FS_SerialStrDescriptor(USBD_SpeedTypeDef speed, uint16_t *length)
   UNUSED(speed);
   *length = USB_SIZ_STRING_SERIAL;
 
-  /* Update the serial number string descriptor with the data from the unique
-   * ID */
-  Get_SerialNum();
+  /* The serial number string descriptor is built once from the unique ID by
+   * USBD_FS_SerialNumInit() */
   /* USER CODE BEGIN USBD_FS_SerialStrDescriptor */
 
   /* USER CODE END USBD_FS_SerialStrDescriptor */
@@ -299,15 +305,9 @@ uint8_t * USBD_FS_SerialStrDescriptor(USBD_SpeedTypeDef speed, uint16_t *length)
   */
 uint8_t * USBD_FS_ConfigStrDescriptor(USBD_SpeedTypeDef speed, uint16_t *length)
 {
-  if(speed == USBD_SPEED_HIGH)
-  {
-    USBD_GetString((uint8_t *)USBD_CONFIGURATION_STRING_FS, USBD_StrDesc, length);
-  }
-  else
-  {
-    USBD_GetString((uint8_t *)USBD_CONFIGURATION_STRING_FS, USBD_StrDesc, length);
-  }
-  return USBD_StrDesc;
+  UNUSED(speed);
+  *length = sizeof(USBD_FS_ConfigStrDesc);
+  return (uint8_t *)&USBD_FS_ConfigStrDesc;
 }
 
 /**
@@ -318,15 +318,19 @@ uint8_t * USBD_FS_ConfigStrDescriptor(USBD_SpeedTypeDef speed, uint16_t *length)
   */
 uint8_t * USBD_FS_InterfaceStrDescriptor(USBD_SpeedTypeDef speed, uint16_t *length)
 {
-  if(speed == 0)
-  {
-    USBD_GetString((uint8_t *)USBD_INTERFACE_STRING_FS, USBD_StrDesc, length);
-  }
-  else
-  {
-    USBD_GetString((uint8_t *)USBD_INTERFACE_STRING_FS, USBD_StrDesc, length);
-  }
-  return USBD_StrDesc;
+  UNUSED(speed);
+  *length = sizeof(USBD_FS_InterfaceStrDesc);
+  return (uint8_t *)&USBD_FS_InterfaceStrDesc;
+}
+
+/**
+  * @brief  Build the serial number string descriptor from the unique ID.
+  *         Called once before the device is started.
+  * @retval None
+  */
+void USBD_FS_SerialNumInit(void)
+{
+  Get_SerialNum();
 }
 
 /**
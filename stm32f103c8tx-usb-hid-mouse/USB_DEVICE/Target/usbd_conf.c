@@ -26,6 +26,7 @@
 #include "usbd_hid.h"
 
 /* USER CODE BEGIN Includes */
+#include "usbd_pma.h"
 
 /* USER CODE END Includes */
 
@@ -329,11 +330,14 @@ USBD_StatusTypeDef USBD_LL_Init(USBD_HandleTypeDef *pdev)
   HAL_PCD_RegisterIsoInIncpltCallback(&hpcd_USB_FS, PCD_ISOINIncompleteCallback);
 #endif /* USE_HAL_PCD_REGISTER_CALLBACKS */
   /* USER CODE BEGIN EndPoint_Configuration */
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x00 , PCD_SNG_BUF, 0x18);
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x80 , PCD_SNG_BUF, 0x58);
+  /* Buffer offsets come from the endpoint table in usbd_conf.h, see usbd_pma.h */
+#define USBD_PMA_CONFIG(name, addr, size, dbl) \
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , (addr) , \
+                      (((dbl) != 0U) ? PCD_DBL_BUF : PCD_SNG_BUF), USBD_PMA_ADDRESS(name, addr, size, dbl));
+  USBD_PMA_ENDPOINTS(USBD_PMA_CONFIG)
+#undef USBD_PMA_CONFIG
   /* USER CODE END EndPoint_Configuration */
   /* USER CODE BEGIN EndPoint_Configuration_HID */
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x81 , PCD_SNG_BUF, 0x100);
   /* USER CODE END EndPoint_Configuration_HID */
   return USBD_OK;
 }
@@ -72,7 +72,14 @@
 /*---------- -----------*/
 #define USBD_SELF_POWERED     1
 /*---------- -----------*/
-#define HID_FS_BINTERVAL     0xA
+#ifndef HID_FS_BINTERVAL
+#define HID_FS_BINTERVAL     0x1
+#endif
+/*---------- -----------*/
+#define USBD_HID_MOUSE_ABSOLUTE     0
+/*---------- -----------*/
+/* Endpoint buffers laid out in the packet memory by usbd_pma.h */
+#define USBD_PMA_ENDPOINTS(EP)     USBD_PMA_EP0_TABLE(EP) USBD_HID_PMA_TABLE(EP)
 
 /****************************************/
 /* #define for FS and HS identification */
@@ -0,0 +1,70 @@
+/*!
+ * @file   cdc_enumeration_test.c
+ * @brief  Enumeration of the virtual COM port
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "usbd_cdc.h"
+
+#include <string.h>
+
+extern USBD_HandleTypeDef hUsbDeviceFS;
+
+int main(void) {
+  const UsbSimDevice* device = UsbSim_GetDevice();
+  const UsbSimEndpoint* ep;
+  uint8_t buffer[64];
+
+  // Unique device ID, the serial number is built from it.
+  ((uint32_t*) UID_BASE)[0] = 0x12345678;
+  ((uint32_t*) UID_BASE)[1] = 0x9ABCDEF0;
+  ((uint32_t*) UID_BASE)[2] = 0x11111111;
+
+  MX_USB_DEVICE_Init();
+  Sim_Run(10);
+  CHECK(UsbSim_Enumerate());
+  CHECK_EQ(hUsbDeviceFS.dev_state, USBD_STATE_CONFIGURED);
+  CHECK_EQ(hUsbDeviceFS.dev_address, 2);
+
+  // Device descriptor: VID 0483, PID 5740, one configuration.
+  CHECK_EQ(device->device[1], USB_DESC_TYPE_DEVICE);
+  CHECK_EQ(device->device[7], USB_MAX_EP0_SIZE);
+  CHECK_EQ(device->device[8] | (device->device[9] << 8), 0x0483);
+  CHECK_EQ(device->device[10] | (device->device[11] << 8), 0x5740);
+  CHECK_EQ(device->device[17], 1);
+  CHECK(strcmp(device->manufacturer, "STMicroelectronics") == 0);
+  CHECK(strcmp(device->product, "STM32 Virtual ComPort") == 0);
+  CHECK(strcmp(device->serial, "234567899ABC") == 0);
+
+  // Communication and data interfaces, and their endpoints.
+  CHECK_EQ(device->config_length, USB_CDC_CONFIG_DESC_SIZ);
+  CHECK_EQ(device->interface_count, 2);
+  CHECK_EQ(device->interfaces[0].interface_class, 0x02);
+  CHECK_EQ(device->interfaces[0].subclass, 0x02);
+  CHECK_EQ(device->interfaces[1].interface_class, 0x0A);
+  CHECK_EQ(device->endpoint_count, 3);
+  ep = UsbSim_GetEndpoint(CDC_CMD_EP);
+  CHECK((ep != NULL) && ((ep->attributes & 0x03) == USBD_EP_TYPE_INTR));
+  ep = UsbSim_GetEndpoint(CDC_IN_EP);
+  CHECK((ep != NULL) && ((ep->attributes & 0x03) == USBD_EP_TYPE_BULK) && (ep->max_packet == 64));
+  ep = UsbSim_GetEndpoint(CDC_OUT_EP);
+  CHECK((ep != NULL) && ((ep->attributes & 0x03) == USBD_EP_TYPE_BULK) && (ep->max_packet == 64));
+
+  // Unknown string descriptors are stalled, the next request still works.
+  CHECK_EQ(UsbSim_Control(USBSIM_DEVICE_IN, USB_REQ_GET_DESCRIPTOR, (USB_DESC_TYPE_STRING << 8) | 0xEE,
+                          0, sizeof(buffer), buffer), USBSIM_STALL);
+  CHECK_EQ(UsbSim_Control(USBSIM_DEVICE_IN, USB_REQ_GET_STATUS, 0, 0, 2, buffer), 2);
+
+  // Nothing to send: the bulk IN endpoint is polled every frame and NAKs.
+  Sim_Run(100);
+  CHECK_EQ(UsbSim_GetStats(CDC_IN_EP)->packets, 0);
+  CHECK(UsbSim_GetStats(CDC_IN_EP)->naks >= 100);
+
+  // A bus reset takes the device back to the default state.
+  UsbSim_Reset();
+  CHECK_EQ(hUsbDeviceFS.dev_state, USBD_STATE_DEFAULT);
+  CHECK(UsbSim_Enumerate());
+  CHECK_EQ(hUsbDeviceFS.dev_state, USBD_STATE_CONFIGURED);
+  return Sim_Result();
+}
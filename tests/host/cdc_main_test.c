@@ -0,0 +1,62 @@
+/*!
+ * @file   cdc_main_test.c
+ * @brief  The stock main loop of usb-cdc (main.c, built as firmware_main()):
+ *         the host can write far more than the receive ring holds, and gets
+ *         the greeting once per second
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usbd_cdc.h"
+
+#include <string.h>
+
+#define WRITE_SIZE  (16 * 1024)
+#define GREETING    "Hello World!\n"
+
+int firmware_main(void);
+
+static uint8_t data[WRITE_SIZE];
+
+/*
+ * Bytes received by the host on the data IN endpoint.
+ */
+static uint8_t received[256];
+static uint32_t received_length;
+
+static void on_in(uint8_t ep_addr, const uint8_t* packet, uint16_t length) {
+  if ((ep_addr != CDC_IN_EP) || ((received_length + length) > sizeof(received))) {
+    return;
+  }
+  memcpy(&received[received_length], packet, length);
+  received_length += length;
+}
+
+int main(void) {
+  uint32_t start;
+  uint32_t i;
+
+  for (i = 0; i < WRITE_SIZE; i++) {
+    data[i] = (uint8_t) i;
+  }
+
+  Sim_RunMain(firmware_main, 1);
+  CHECK(UsbSim_Enumerate());
+  UsbSim_SetInHandler(on_in);
+
+  // The main loop drains the receive ring: the write doesn't stall once the
+  // ring is full.
+  start = Sim_GetTick();
+  CHECK(UsbSim_Out(CDC_OUT_EP, data, WRITE_SIZE));
+  while ((UsbSim_OutPending(CDC_OUT_EP) > 0) && ((Sim_GetTick() - start) < 1000)) {
+    Sim_RunScheduler(1);
+  }
+  CHECK_EQ(UsbSim_OutPending(CDC_OUT_EP), 0);
+  Sim_Report("host write of 16 KB", Sim_GetTick() - start, "ms");
+
+  // The greeting still goes out once per second.
+  received_length = 0;
+  Sim_RunScheduler(2000);
+  CHECK_EQ(received_length, 2 * strlen(GREETING));
+  CHECK(memcmp(received, GREETING GREETING, 2 * strlen(GREETING)) == 0);
+  return Sim_Result();
+}
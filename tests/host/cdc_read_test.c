@@ -0,0 +1,115 @@
+/*!
+ * @file   cdc_read_test.c
+ * @brief  CDC_Read(): 1 MB sent by the host to a main loop that reads in
+ *         bursts, with pauses, arrives without loss, the host being NAKed
+ *         while the receive ring is full
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "usbd_cdc.h"
+#include "usbd_cdc_if.h"
+
+#define FLOOD_SIZE     (1024 * 1024)
+#define RX_RING_SIZE   1024
+
+/*
+ * The main loop stops reading for PAUSE_FRAMES frames out of PAUSE_PERIOD.
+ */
+#define PAUSE_PERIOD   50
+#define PAUSE_FRAMES   20
+
+static uint8_t flood[FLOOD_SIZE];
+
+static uint32_t bytes_read;
+static uint32_t errors;
+static uint32_t random_state = 1;
+
+static uint32_t next_random(void) {
+  random_state = (random_state * 1103515245) + 12345;
+  return (random_state >> 16) & 0x7FFF;
+}
+
+// Byte at an offset of the stream: shifted or repeated data doesn't match.
+static uint8_t stream_byte(uint32_t offset) {
+  return (uint8_t) ((offset * 7) + (offset >> 8) + (offset >> 16));
+}
+
+static void read_stream(void) {
+  uint8_t buffer[200];
+  uint16_t length;
+  uint16_t i;
+
+  if ((Sim_GetTick() % PAUSE_PERIOD) < PAUSE_FRAMES) {
+    return;
+  }
+  length = CDC_Read(buffer, (uint16_t) (1 + (next_random() % sizeof(buffer))));
+  for (i = 0; i < length; i++) {
+    if (buffer[i] != stream_byte(bytes_read + i)) {
+      errors++;
+    }
+  }
+  bytes_read += length;
+}
+
+int main(void) {
+  const UsbSimStats* stats = UsbSim_GetStats(CDC_OUT_EP);
+  uint8_t buffer[64];
+  uint32_t start;
+  uint32_t frames;
+  uint32_t naks;
+  uint32_t i;
+
+  for (i = 0; i < FLOOD_SIZE; i++) {
+    flood[i] = stream_byte(i);
+  }
+
+  MX_USB_DEVICE_Init();
+  CHECK(UsbSim_Enumerate());
+
+  // Nobody reads: the device takes what the ring holds, then NAKs.
+  CHECK(UsbSim_Out(CDC_OUT_EP, flood, 4096));
+  Sim_Run(20);
+  CHECK_EQ(4096 - UsbSim_OutPending(CDC_OUT_EP), RX_RING_SIZE);
+  CHECK(stats->naks > 0);
+
+  // Reading frees the ring and the rest comes in.
+  while (UsbSim_OutPending(CDC_OUT_EP) > 0) {
+    read_stream();
+    Sim_Step();
+  }
+  while (bytes_read < 4096) {
+    read_stream();
+    Sim_Step();
+  }
+  CHECK_EQ(bytes_read, 4096);
+  CHECK_EQ(CDC_Read(buffer, sizeof(buffer)), 0);
+  CHECK_EQ(errors, 0);
+
+  // Flood: the main loop reads between the bulk transactions.
+  bytes_read = 0;
+  start = Sim_GetTick();
+  naks = stats->naks;
+  CHECK(UsbSim_Out(CDC_OUT_EP, flood, FLOOD_SIZE));
+  UsbSim_SetMainLoop(read_stream);
+  while ((bytes_read < FLOOD_SIZE) && ((Sim_GetTick() - start) < 10000)) {
+    Sim_Step();
+    read_stream();
+  }
+  UsbSim_SetMainLoop(NULL);
+  frames = Sim_GetTick() - start;
+  naks = stats->naks - naks;
+
+  CHECK_EQ(UsbSim_OutPending(CDC_OUT_EP), 0);
+  CHECK_EQ(bytes_read, FLOOD_SIZE);
+  CHECK_EQ(errors, 0);
+  CHECK_EQ(CDC_Read(buffer, sizeof(buffer)), 0);
+  // The pauses filled the ring: the host was held off, not dropped.
+  CHECK(naks > 0);
+
+  Sim_Report("bytes received", bytes_read, "bytes");
+  Sim_Report("time", frames, "frames");
+  Sim_Report("CDC_Read sustained", (double) bytes_read * 1000.0 / frames, "bytes/s");
+  Sim_Report("NAKs while the ring was full", naks, "NAKs");
+  return Sim_Result();
+}
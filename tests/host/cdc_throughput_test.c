@@ -0,0 +1,108 @@
+/*!
+ * @file   cdc_throughput_test.c
+ * @brief  Bulk throughput of the CDC data endpoints, built once per
+ *         USBD_CDC_DOUBLE_BUFFER setting to compare single and double
+ *         buffered endpoints
+ *
+ * The rates are reported, not checked: usb_sim.c does not run the PCD
+ * driver, the gain of double buffering is its assumption (see usb_sim.h).
+ * The pcd_double_buffer test measures the real driver on the register model.
+ * For reference, a single buffered endpoint NAKs while the interrupt
+ * services its last packet, so each packet costs its bus time plus the
+ * service time: that bound is reported with the rates.
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "usbd_cdc.h"
+#include "usbd_cdc_if.h"
+
+#define BENCHMARK_FRAMES  1000
+#define OUT_SIZE          (BENCHMARK_FRAMES * 2000)
+
+/*
+ * Service time of a packet in the USB interrupt.
+ */
+#define SERVICE_BASE_NS      6000
+#define SERVICE_PER_BYTE_NS  100
+
+/*
+ * Bus time of a full packet at 12 Mbit/s, with the token, handshake and
+ * gaps around its data.
+ */
+#define PACKET_BYTES    CDC_DATA_FS_MAX_PACKET_SIZE
+#define PACKET_BUS_NS   (((PACKET_BYTES + 12) * 8 * 1000.0) / 12)
+
+#if (USBD_CDC_DOUBLE_BUFFER == 1)
+#define MODE "double buffered"
+#else
+#define MODE "single buffered"
+#endif
+
+extern PCD_HandleTypeDef hpcd_USB_FS;
+
+static uint8_t out_data[OUT_SIZE];
+static uint64_t bytes_in;
+static uint64_t bytes_out;
+
+static void on_in(uint8_t ep_addr, const uint8_t* data, uint16_t length) {
+  if (ep_addr == CDC_IN_EP) {
+    bytes_in += length;
+  }
+}
+
+static void write_data(void) {
+  static uint8_t buffer[256];
+
+  CDC_Write(buffer, sizeof(buffer));
+}
+
+static void read_data(void) {
+  uint8_t buffer[256];
+  uint16_t length;
+
+  while ((length = CDC_Read(buffer, sizeof(buffer))) > 0) {
+    bytes_out += length;
+  }
+}
+
+// Bytes/s moved in BENCHMARK_FRAMES frames with the given main loop.
+static double run(UsbSimMainLoop main_loop, const uint64_t* bytes) {
+  uint64_t start = *bytes;
+
+  UsbSim_SetMainLoop(main_loop);
+  main_loop();
+  Sim_Run(BENCHMARK_FRAMES);
+  UsbSim_SetMainLoop(NULL);
+  return (double) (*bytes - start) * 1000.0 / BENCHMARK_FRAMES;
+}
+
+int main(void) {
+  double bound = (PACKET_BYTES * 1e9) / (PACKET_BUS_NS + SERVICE_BASE_NS + (PACKET_BYTES * SERVICE_PER_BYTE_NS));
+  double in_rate;
+  double out_rate;
+
+  MX_USB_DEVICE_Init();
+  CHECK(UsbSim_Enumerate());
+  CHECK_EQ(hpcd_USB_FS.IN_ep[CDC_IN_EP & 0x0F].doublebuffer, USBD_CDC_DOUBLE_BUFFER);
+  CHECK_EQ(hpcd_USB_FS.OUT_ep[CDC_OUT_EP & 0x0F].doublebuffer, USBD_CDC_DOUBLE_BUFFER);
+  UsbSim_SetServiceTime(SERVICE_BASE_NS, SERVICE_PER_BYTE_NS);
+  UsbSim_SetInHandler(on_in);
+
+  // Device to host, the main loop keeps the transmit ring full.
+  in_rate = run(write_data, &bytes_in);
+  Sim_Run(10);
+
+  // Host to device, the main loop drains the receive ring.
+  CHECK(UsbSim_Out(CDC_OUT_EP, out_data, OUT_SIZE));
+  out_rate = run(read_data, &bytes_out);
+
+  CHECK(in_rate > 0);
+  CHECK(out_rate > 0);
+
+  printf("%s endpoints\n", MODE);
+  Sim_Report("single buffered bound", bound, "bytes/s");
+  Sim_Report("IN (CDC_Write)", in_rate, "bytes/s");
+  Sim_Report("OUT (CDC_Read)", out_rate, "bytes/s");
+  return Sim_Result();
+}
@@ -0,0 +1,54 @@
+/*!
+ * @file   keyboard_enumeration_test.c
+ * @brief  Enumeration of the keyboard and mouse interfaces
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "usbd_hid.h"
+
+#include <string.h>
+
+extern USBD_HandleTypeDef hUsbDeviceFS;
+
+int main(void) {
+  const UsbSimDevice* device = UsbSim_GetDevice();
+  const UsbSimEndpoint* ep;
+
+  ((uint32_t*) UID_BASE)[0] = 0x12345678;
+  ((uint32_t*) UID_BASE)[1] = 0x9ABCDEF0;
+  ((uint32_t*) UID_BASE)[2] = 0x11111111;
+
+  MX_USB_DEVICE_Init();
+  CHECK(UsbSim_Enumerate());
+  CHECK_EQ(hUsbDeviceFS.dev_state, USBD_STATE_CONFIGURED);
+
+  CHECK_EQ(device->device[8] | (device->device[9] << 8), 0x0483);
+  CHECK_EQ(device->device[10] | (device->device[11] << 8), 0x572B);
+  CHECK(strcmp(device->product, "STM32 Human interface") == 0);
+  CHECK(strcmp(device->serial, "234567899ABC") == 0);
+
+  // Boot keyboard, then boot mouse, each with its report descriptor.
+  CHECK_EQ(device->config_length, USB_HID_CONFIG_DESC_SIZ);
+  CHECK_EQ(device->interface_count, 2);
+  CHECK_EQ(device->interfaces[0].interface_class, 0x03);
+  CHECK_EQ(device->interfaces[0].subclass, 0x01);
+  CHECK_EQ(device->interfaces[0].protocol, 0x01);
+  CHECK_EQ(device->interfaces[0].report_length, HID_KEYBOARD_REPORT_DESC_SIZE);
+  CHECK_EQ(device->interfaces[1].protocol, 0x02);
+  CHECK_EQ(device->interfaces[1].report_length, HID_MOUSE_REPORT_DESC_SIZE);
+  // Report descriptors start with the usage page and usage of their device.
+  CHECK_EQ(device->interfaces[0].report[3], 0x06);
+  CHECK_EQ(device->interfaces[1].report[3], 0x02);
+
+  ep = UsbSim_GetEndpoint(HID_EPIN_ADDR);
+  CHECK((ep != NULL) && (ep->max_packet == HID_EPIN_SIZE) && (ep->interval == HID_FS_BINTERVAL));
+  ep = UsbSim_GetEndpoint(HID_MOUSE_EPIN_ADDR);
+  CHECK((ep != NULL) && (ep->max_packet == HID_MOUSE_EPIN_SIZE) && (ep->interval == HID_FS_BINTERVAL));
+
+  // Both interrupt endpoints are polled once per bInterval, nothing to send.
+  Sim_Run(64);
+  CHECK_EQ(UsbSim_GetStats(HID_EPIN_ADDR)->naks, 64 / HID_FS_BINTERVAL);
+  CHECK_EQ(UsbSim_GetStats(HID_MOUSE_EPIN_ADDR)->naks, 64 / HID_FS_BINTERVAL);
+  return Sim_Result();
+}
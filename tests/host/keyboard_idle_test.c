@@ -0,0 +1,154 @@
+/*!
+ * @file   keyboard_idle_test.c
+ * @brief  Idle repeats of the keyboard report, timed on the frame clock
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "usbd_hid.h"
+#include "usb_hid_keyboard.h"
+
+#include <string.h>
+
+#define IDLE_MS        500
+#define POLL_INTERVAL  HID_FS_BINTERVAL
+
+#define BOOT_REPORT_LENGTH  8
+#define REPORT_LENGTH       19
+
+#define USAGE_A  0x04
+#define USAGE_B  0x05
+
+/*
+ * Keyboard reports received by the host.
+ */
+static uint8_t reports[64][REPORT_LENGTH];
+static uint16_t report_lengths[64];
+static uint32_t report_frames[64];
+static int report_count;
+
+static void on_in(uint8_t ep_addr, const uint8_t* data, uint16_t length) {
+  if ((ep_addr != HID_EPIN_ADDR) || (report_count == (int) (sizeof(reports) / sizeof(reports[0])))) {
+    return;
+  }
+  memcpy(reports[report_count], data, (length < REPORT_LENGTH) ? length : REPORT_LENGTH);
+  report_lengths[report_count] = length;
+  report_frames[report_count] = UsbSim_GetFrame();
+  report_count++;
+}
+
+static int set_idle(uint8_t interface, uint32_t ms) {
+  return UsbSim_Control(USBSIM_CLASS_OUT, HID_REQ_SET_IDLE, (uint16_t) ((ms / 4) << 8), interface, 0, NULL);
+}
+
+// SET_IDLE for a single report of the keyboard interface.
+static int set_report_idle(uint8_t report_id, uint32_t ms) {
+  return UsbSim_Control(USBSIM_CLASS_OUT, HID_REQ_SET_IDLE, (uint16_t) (((ms / 4) << 8) | report_id), 0, 0, NULL);
+}
+
+static int set_protocol(uint8_t interface, uint8_t protocol) {
+  return UsbSim_Control(USBSIM_CLASS_OUT, HID_REQ_SET_PROTOCOL, protocol, interface, 0, NULL);
+}
+
+// Every repeat from index first on is a copy of the report at first, one
+// idle period after the previous one, give or take the polling interval: the
+// repeat is armed on the frame the period ends and sent on the next poll.
+static void check_repeats(int first, int last) {
+  int i;
+
+  for (i = first + 1; i <= last; i++) {
+    CHECK_EQ(report_lengths[i], report_lengths[first]);
+    CHECK(memcmp(reports[i], reports[first], report_lengths[first]) == 0);
+    CHECK(report_frames[i] - report_frames[i - 1] >= IDLE_MS - POLL_INTERVAL);
+    CHECK(report_frames[i] - report_frames[i - 1] <= IDLE_MS + POLL_INTERVAL);
+  }
+}
+
+int main(void) {
+  uint8_t protocol = 0xFF;
+  uint8_t idle = 0;
+  int i;
+
+  MX_USB_DEVICE_Init();
+  CHECK(UsbSim_Enumerate());
+  UsbSim_SetInHandler(on_in);
+
+  // Nothing is repeated before the first report.
+  CHECK_EQ(set_idle(0, IDLE_MS), 0);
+  Sim_Run(2 * IDLE_MS);
+  CHECK_EQ(report_count, 0);
+
+  // A held key is repeated every idle period.
+  CHECK(USB_HID_Keyboard_Press('a'));
+  Sim_Run((3 * IDLE_MS) + POLL_INTERVAL);
+  CHECK_EQ(report_count, 4);
+  CHECK_EQ(report_lengths[0], REPORT_LENGTH);
+  CHECK((reports[0][3] >> USAGE_A) & 0x01);
+  check_repeats(0, report_count - 1);
+  Sim_Report("keyboard idle period", report_frames[3] - report_frames[2], "frames");
+
+  // SET_IDLE on the mouse interface, more often than the keyboard period,
+  // does not hold back the keyboard repeats.
+  report_count = 0;
+  for (i = 0; i < 16; i++) {
+    CHECK_EQ(set_idle(1, 0), 0);
+    Sim_Run(IDLE_MS / 5);
+  }
+  CHECK_EQ(report_count, 3);
+  check_repeats(0, report_count - 1);
+
+  // SET_IDLE for the consumer and system reports is accepted and leaves the
+  // keyboard report's rate and period alone.
+  report_count = 0;
+  for (i = 0; i < 16; i++) {
+    CHECK_EQ(set_report_idle((i & 1) ? HID_SYSTEM_REPORT_ID : HID_CONSUMER_REPORT_ID, (i & 2) ? 0 : 4), 0);
+    Sim_Run(IDLE_MS / 5);
+  }
+  CHECK_EQ(report_count, 3);
+  check_repeats(0, report_count - 1);
+  CHECK_EQ(UsbSim_Control(USBSIM_CLASS_IN, HID_REQ_GET_IDLE, 0, 0, 1, &idle), 1);
+  CHECK_EQ(idle, IDLE_MS / 4);
+
+  // SET_IDLE for the keyboard report by its ID sets the rate.
+  CHECK_EQ(set_report_idle(HID_KEYBOARD_REPORT_ID, 2 * IDLE_MS), 0);
+  CHECK_EQ(UsbSim_Control(USBSIM_CLASS_IN, HID_REQ_GET_IDLE, 0, 0, 1, &idle), 1);
+  CHECK_EQ(idle, (2 * IDLE_MS) / 4);
+
+  // SET_IDLE on the keyboard interface starts a new period.
+  Sim_Run(IDLE_MS / 2);
+  report_count = 0;
+  CHECK_EQ(set_idle(0, IDLE_MS), 0);
+  Sim_Run(IDLE_MS - POLL_INTERVAL);
+  CHECK_EQ(report_count, 0);
+  Sim_Run(2 * POLL_INTERVAL);
+  CHECK_EQ(report_count, 1);
+
+  // After SET_PROTOCOL, the report of the old protocol is not repeated.
+  CHECK_EQ(set_protocol(0, 0), 0);
+  CHECK_EQ(UsbSim_Control(USBSIM_CLASS_IN, HID_REQ_GET_PROTOCOL, 0, 0, 1, &protocol), 1);
+  CHECK_EQ(protocol, 0);
+  report_count = 0;
+  Sim_Run(3 * IDLE_MS);
+  CHECK_EQ(report_count, 0);
+
+  // The next report is in the boot format and is the one repeated.
+  CHECK(USB_HID_Keyboard_Press('b'));
+  Sim_Run((2 * IDLE_MS) + POLL_INTERVAL);
+  CHECK_EQ(report_count, 3);
+  CHECK_EQ(report_lengths[0], BOOT_REPORT_LENGTH);
+  CHECK_EQ(reports[0][2], USAGE_A);
+  CHECK_EQ(reports[0][3], USAGE_B);
+  check_repeats(0, report_count - 1);
+
+  // Back to the report protocol: nothing repeated until the next report.
+  CHECK_EQ(set_protocol(0, 1), 0);
+  report_count = 0;
+  Sim_Run(2 * IDLE_MS);
+  CHECK_EQ(report_count, 0);
+  CHECK(USB_HID_Keyboard_ReleaseAll());
+  Sim_Run(IDLE_MS + POLL_INTERVAL);
+  CHECK_EQ(report_count, 2);
+  CHECK_EQ(report_lengths[0], REPORT_LENGTH);
+  check_repeats(0, report_count - 1);
+  return Sim_Result();
+}
@@ -0,0 +1,360 @@
+/*!
+ * @file   keyboard_layout_test.c
+ * @brief  Keyboard layouts round-trip: every character the host types on a
+ *         layout is typed back by the firmware, and the key strokes the
+ *         firmware sends decode to the character they were looked up for
+ *
+ * The host side is its own keymap of each layout, as the Windows layouts the
+ * firmware follows type them: four levels per key (none, Shift, AltGr,
+ * AltGr+Shift), dead keys composing with the next character. It does not share
+ * anything with the firmware tables.
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "usbd_hid.h"
+#include "usb_hid_keyboard.h"
+#include "usb_hid_keyboard_layout.h"
+
+#include <string.h>
+
+#define REPORT_LENGTH     19
+#define POLL_INTERVAL     HID_FS_BINTERVAL
+#define KEY_BITMAP_BYTES  16
+
+#define MOD_SHIFT  0x22
+#define MOD_ALTGR  0x40
+
+#define EURO       0x20AC
+
+/*
+ * Dead key, by the accent it types on its own.
+ */
+#define DEAD(accent)  (0x8000 | (accent))
+#define IS_DEAD(key)  (((key) & 0x8000) != 0)
+
+#define GRAVE       0x60
+#define ACUTE       0xB4
+#define CIRCUMFLEX  0x5E
+#define DIAERESIS   0xA8
+#define TILDE       0x7E
+
+/*
+ * Key of a host keymap: usage and the character of each level.
+ */
+typedef struct {
+  uint8_t usage;
+  uint16_t levels[4];
+} HostKey;
+
+/*
+ * Host keymap: letters on the usages 0x04 to 0x1D ('.' if that key is not a
+ * letter), then the other keys.
+ */
+typedef struct {
+  const char* name;
+  const char* letters;
+  const HostKey* keys;
+  int key_count;
+} HostKeymap;
+
+#define CONTROL_KEYS \
+  {0x28, {'\n'}}, {0x2A, {'\b'}}, {0x2B, {'\t'}}, {0x2C, {' ', ' '}}
+
+static const HostKey keys_us[] = {
+  CONTROL_KEYS,
+  {0x1E, {'1', '!'}}, {0x1F, {'2', '@'}}, {0x20, {'3', '#'}}, {0x21, {'4', '$'}},
+  {0x22, {'5', '%'}}, {0x23, {'6', '^'}}, {0x24, {'7', '&'}}, {0x25, {'8', '*'}},
+  {0x26, {'9', '('}}, {0x27, {'0', ')'}}, {0x2D, {'-', '_'}}, {0x2E, {'=', '+'}},
+  {0x2F, {'[', '{'}}, {0x30, {']', '}'}}, {0x31, {'\\', '|'}}, {0x33, {';', ':'}},
+  {0x34, {'\'', '"'}}, {0x35, {'`', '~'}}, {0x36, {',', '<'}}, {0x37, {'.', '>'}},
+  {0x38, {'/', '?'}},
+};
+
+static const HostKey keys_uk[] = {
+  CONTROL_KEYS,
+  {0x04, {0, 0, 0xE1, 0xC1}}, {0x08, {0, 0, 0xE9, 0xC9}}, {0x0C, {0, 0, 0xED, 0xCD}},
+  {0x12, {0, 0, 0xF3, 0xD3}}, {0x18, {0, 0, 0xFA, 0xDA}},
+  {0x1E, {'1', '!'}}, {0x1F, {'2', '"'}}, {0x20, {'3', 0xA3}}, {0x21, {'4', '$', EURO}},
+  {0x22, {'5', '%'}}, {0x23, {'6', '^'}}, {0x24, {'7', '&'}}, {0x25, {'8', '*'}},
+  {0x26, {'9', '('}}, {0x27, {'0', ')'}}, {0x2D, {'-', '_'}}, {0x2E, {'=', '+'}},
+  {0x2F, {'[', '{'}}, {0x30, {']', '}'}}, {0x32, {'#', '~'}}, {0x33, {';', ':'}},
+  {0x34, {'\'', '@'}}, {0x35, {'`', 0xAC, 0xA6}}, {0x36, {',', '<'}}, {0x37, {'.', '>'}},
+  {0x38, {'/', '?'}}, {0x64, {'\\', '|'}},
+};
+
+static const HostKey keys_de[] = {
+  CONTROL_KEYS,
+  {0x08, {0, 0, EURO}}, {0x10, {0, 0, 0xB5}}, {0x14, {0, 0, '@'}},
+  {0x1E, {'1', '!'}}, {0x1F, {'2', '"', 0xB2}}, {0x20, {'3', 0xA7, 0xB3}}, {0x21, {'4', '$'}},
+  {0x22, {'5', '%'}}, {0x23, {'6', '&'}}, {0x24, {'7', '/', '{'}}, {0x25, {'8', '(', '['}},
+  {0x26, {'9', ')', ']'}}, {0x27, {'0', '=', '}'}}, {0x2D, {0xDF, '?', '\\'}},
+  {0x2E, {DEAD(ACUTE), DEAD(GRAVE)}}, {0x2F, {0xFC, 0xDC}}, {0x30, {'+', '*', '~'}},
+  {0x32, {'#', '\''}}, {0x33, {0xF6, 0xD6}}, {0x34, {0xE4, 0xC4}}, {0x35, {DEAD(CIRCUMFLEX), 0xB0}},
+  {0x36, {',', ';'}}, {0x37, {'.', ':'}}, {0x38, {'-', '_'}}, {0x64, {'<', '>', '|'}},
+};
+
+static const HostKey keys_fr[] = {
+  CONTROL_KEYS,
+  {0x08, {0, 0, EURO}}, {0x10, {',', '?'}}, {0x33, {'m', 'M'}},
+  {0x1E, {'&', '1'}}, {0x1F, {0xE9, '2', DEAD(TILDE)}}, {0x20, {'"', '3', '#'}},
+  {0x21, {'\'', '4', '{'}}, {0x22, {'(', '5', '['}}, {0x23, {'-', '6', '|'}},
+  {0x24, {0xE8, '7', DEAD(GRAVE)}}, {0x25, {'_', '8', '\\'}}, {0x26, {0xE7, '9', '^'}},
+  {0x27, {0xE0, '0', '@'}}, {0x2D, {')', 0xB0, ']'}}, {0x2E, {'=', '+', '}'}},
+  {0x2F, {DEAD(CIRCUMFLEX), DEAD(DIAERESIS)}}, {0x30, {'$', 0xA3, 0xA4}}, {0x32, {'*', 0xB5}},
+  {0x34, {0xF9, '%'}}, {0x35, {0xB2}}, {0x36, {';', '.'}}, {0x37, {':', '/'}},
+  {0x38, {'!', 0xA7}}, {0x64, {'<', '>'}},
+};
+
+static const HostKey keys_es[] = {
+  CONTROL_KEYS,
+  {0x08, {0, 0, EURO}},
+  {0x1E, {'1', '!', '|'}}, {0x1F, {'2', '"', '@'}}, {0x20, {'3', 0xB7, '#'}},
+  {0x21, {'4', '$', DEAD(TILDE)}}, {0x22, {'5', '%'}}, {0x23, {'6', '&', 0xAC}},
+  {0x24, {'7', '/'}}, {0x25, {'8', '('}}, {0x26, {'9', ')'}}, {0x27, {'0', '='}},
+  {0x2D, {'\'', '?'}}, {0x2E, {0xA1, 0xBF}}, {0x2F, {DEAD(GRAVE), DEAD(CIRCUMFLEX), '['}},
+  {0x30, {'+', '*', ']'}}, {0x32, {0xE7, 0xC7, '}'}}, {0x33, {0xF1, 0xD1}},
+  {0x34, {DEAD(ACUTE), DEAD(DIAERESIS), '{'}}, {0x35, {0xBA, 0xAA, '\\'}},
+  {0x36, {',', ';'}}, {0x37, {'.', ':'}}, {0x38, {'-', '_'}}, {0x64, {'<', '>'}},
+};
+
+#define KEYMAP(name, letters, keys) {name, letters, keys, sizeof(keys) / sizeof(keys[0])}
+
+static const HostKeymap keymaps[KEYBOARD_LAYOUT_COUNT] = {
+  [KEYBOARD_LAYOUT_US] = KEYMAP("US", "abcdefghijklmnopqrstuvwxyz", keys_us),
+  [KEYBOARD_LAYOUT_UK] = KEYMAP("UK", "abcdefghijklmnopqrstuvwxyz", keys_uk),
+  [KEYBOARD_LAYOUT_DE] = KEYMAP("DE", "abcdefghijklmnopqrstuvwxzy", keys_de),
+  [KEYBOARD_LAYOUT_FR] = KEYMAP("FR", "qbcdefghijkl.noparstuvzxyw", keys_fr),
+  [KEYBOARD_LAYOUT_ES] = KEYMAP("ES", "abcdefghijklmnopqrstuvwxyz", keys_es),
+};
+
+/*
+ * Characters composed by the dead keys, on the base characters in order.
+ */
+static const char bases[] = "AEIOUYNaeiouyn";
+
+static const struct {
+  uint16_t accent;
+  uint8_t composed[sizeof(bases) - 1];
+} compositions[] = {
+  {GRAVE,      {0xC0, 0xC8, 0xCC, 0xD2, 0xD9, 0,    0,    0xE0, 0xE8, 0xEC, 0xF2, 0xF9, 0,    0}},
+  {ACUTE,      {0xC1, 0xC9, 0xCD, 0xD3, 0xDA, 0xDD, 0,    0xE1, 0xE9, 0xED, 0xF3, 0xFA, 0xFD, 0}},
+  {CIRCUMFLEX, {0xC2, 0xCA, 0xCE, 0xD4, 0xDB, 0,    0,    0xE2, 0xEA, 0xEE, 0xF4, 0xFB, 0,    0}},
+  {DIAERESIS,  {0xC4, 0xCB, 0xCF, 0xD6, 0xDC, 0,    0,    0xE4, 0xEB, 0xEF, 0xF6, 0xFC, 0xFF, 0}},
+  {TILDE,      {0xC3, 0,    0,    0xD5, 0,    0,    0xD1, 0xE3, 0,    0,    0xF5, 0,    0,    0xF1}},
+};
+
+/*
+ * Host decoding state: layout, keys held in the last report, pending dead
+ * key and decoded text, in UTF-8.
+ */
+static const HostKeymap* keymap;
+static uint8_t held[KEY_BITMAP_BYTES];
+static uint16_t dead_key;
+static char decoded[8192];
+static size_t decoded_length;
+
+// Character of a key at a level, 0 if none.
+static uint16_t host_key(const HostKeymap* map, uint8_t usage, int level) {
+  int i;
+
+  if ((usage >= 0x04) && (usage <= 0x1D) && (level < 2) && (map->letters[usage - 0x04] != '.')) {
+    return (uint16_t) (map->letters[usage - 0x04] - (level ? 0x20 : 0));
+  }
+  for (i = 0; i < map->key_count; i++) {
+    if (map->keys[i].usage == usage) {
+      return map->keys[i].levels[level];
+    }
+  }
+  return 0;
+}
+
+static int level_of(uint8_t modifiers) {
+  return (((modifiers & MOD_ALTGR) != 0) ? 2 : 0) + (((modifiers & MOD_SHIFT) != 0) ? 1 : 0);
+}
+
+// Character a dead key composes with a base character, 0 if none.
+static uint16_t compose(uint16_t accent, uint16_t base) {
+  const char* position = (base < 0x80) ? strchr(bases, base) : NULL;
+  int i;
+
+  if (base == ' ') {
+    return accent;
+  }
+  for (i = 0; i < (int) (sizeof(compositions) / sizeof(compositions[0])); i++) {
+    if ((compositions[i].accent == accent) && (position != NULL) && (base != 0)) {
+      return compositions[i].composed[position - bases];
+    }
+  }
+  return 0;
+}
+
+// Decode a key stroke as the host does, return the character typed, 0 if a
+// dead key is pending, or 0xFFFF if the stroke types nothing.
+static uint16_t host_stroke(const HostKeymap* map, uint16_t* dead, uint8_t usage, uint8_t modifiers) {
+  uint16_t key = host_key(map, usage, level_of(modifiers));
+  uint16_t accent = *dead;
+
+  if (key == 0) {
+    return 0xFFFF;
+  }
+  if (IS_DEAD(key) && (accent == 0)) {
+    *dead = key & 0x7FFF;
+    return 0;
+  }
+  *dead = 0;
+  if (accent != 0) {
+    key = compose(accent, key & 0x7FFF);
+    return (key != 0) ? key : 0xFFFF;
+  }
+  return key;
+}
+
+static size_t utf8_encode(uint32_t code_point, char* out) {
+  if (code_point < 0x80) {
+    out[0] = (char) code_point;
+    return 1;
+  }
+  if (code_point < 0x800) {
+    out[0] = (char) (0xC0 | (code_point >> 6));
+    out[1] = (char) (0x80 | (code_point & 0x3F));
+    return 2;
+  }
+  out[0] = (char) (0xE0 | (code_point >> 12));
+  out[1] = (char) (0x80 | ((code_point >> 6) & 0x3F));
+  out[2] = (char) (0x80 | (code_point & 0x3F));
+  return 3;
+}
+
+static void on_in(uint8_t ep_addr, const uint8_t* data, uint16_t length) {
+  uint16_t code_point;
+  uint8_t usage;
+
+  if ((ep_addr != HID_EPIN_ADDR) || (data[0] != HID_KEYBOARD_REPORT_ID) || (length < REPORT_LENGTH)) {
+    return;
+  }
+  for (usage = 0; usage < (KEY_BITMAP_BYTES * 8); usage++) {
+    int down = (data[3 + (usage >> 3)] >> (usage & 7)) & 0x01;
+    int was_down = (held[usage >> 3] >> (usage & 7)) & 0x01;
+
+    if (!down || was_down || (decoded_length > (sizeof(decoded) - 4))) {
+      continue;
+    }
+    code_point = host_stroke(keymap, &dead_key, usage, data[1]);
+    if (code_point == 0xFFFF) {
+      decoded[decoded_length++] = '?';
+    } else if (code_point != 0) {
+      decoded_length += utf8_encode(code_point, &decoded[decoded_length]);
+    }
+  }
+  memcpy(held, &data[3], sizeof(held));
+}
+
+// Whether the host types a code point on a layout, on a key or composed.
+static int host_types(const HostKeymap* map, uint32_t code_point) {
+  int has_dead[0x100] = {0};
+  uint16_t key;
+  int usage;
+  int level;
+  int i;
+  int j;
+
+  for (usage = 0x04; usage <= 0x64; usage++) {
+    for (level = 0; level < 4; level++) {
+      key = host_key(map, (uint8_t) usage, level);
+      if (IS_DEAD(key)) {
+        has_dead[key & 0xFF] = 1;
+      } else if ((key != 0) && (key == code_point)) {
+        return 1;
+      }
+    }
+  }
+  for (i = 0; i < (int) (sizeof(compositions) / sizeof(compositions[0])); i++) {
+    if (!has_dead[compositions[i].accent]) {
+      continue;
+    }
+    if (code_point == compositions[i].accent) {
+      return 1;
+    }
+    for (j = 0; j < (int) (sizeof(bases) - 1); j++) {
+      if ((compositions[i].composed[j] != 0) && (compositions[i].composed[j] == code_point)) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// Round-trip of a layout without USB, return the code points both sides type.
+static int check_layout(uint8_t layout, char* text) {
+  const HostKeymap* map = &keymaps[layout];
+  KeyStroke strokes[2];
+  uint32_t code_point;
+  uint16_t dead;
+  uint16_t typed;
+  size_t length = 0;
+  int count;
+  int common = 0;
+  int i;
+
+  for (code_point = 0; code_point <= EURO; code_point = (code_point == 0xFF) ? EURO : (code_point + 1)) {
+    count = USB_HID_Keyboard_LayoutLookup(layout, code_point, strokes);
+    if (host_types(map, code_point) && !CHECK(count > 0)) {
+      printf("%s: U+%04X typed by the host, not by the firmware\n", map->name, (unsigned) code_point);
+    }
+    if (count == 0) {
+      continue;
+    }
+    dead = 0;
+    for (i = 0; i < count; i++) {
+      typed = host_stroke(map, &dead, strokes[i].usage, strokes[i].modifiers);
+    }
+    if (!CHECK(typed == code_point)) {
+      printf("%s: U+%04X decoded as U+%04X\n", map->name, (unsigned) code_point, typed);
+    }
+    length += utf8_encode(code_point, &text[length]);
+    common++;
+  }
+  text[length] = '\0';
+  return common;
+}
+
+int main(void) {
+  static char text[2048];
+  uint8_t layout;
+  int common;
+  int typed;
+
+  MX_USB_DEVICE_Init();
+  CHECK(UsbSim_Enumerate());
+  UsbSim_SetInHandler(on_in);
+
+  CHECK(!USB_HID_Keyboard_SetLayout(KEYBOARD_LAYOUT_COUNT));
+
+  for (layout = 0; layout < KEYBOARD_LAYOUT_COUNT; layout++) {
+    common = check_layout(layout, text);
+
+    // The same characters through USB, in one text.
+    keymap = &keymaps[layout];
+    memset(held, 0, sizeof(held));
+    memset(decoded, 0, sizeof(decoded));
+    decoded_length = 0;
+    dead_key = 0;
+    CHECK(USB_HID_Keyboard_SetLayout(layout));
+    typed = 0;
+    while ((text[typed] != '\0') && (Sim_GetTick() < 100000)) {
+      typed += USB_HID_Keyboard_WritePart((uint8_t*) &text[typed], (int) strlen(&text[typed]));
+      Sim_Step();
+    }
+    CHECK(USB_HID_Keyboard_WriteEnd());
+    Sim_Run(40 * POLL_INTERVAL);
+    if (!CHECK(strcmp(decoded, text) == 0)) {
+      printf("%s: typed   \"%s\"\n%s: decoded \"%s\"\n", keymaps[layout].name, text, keymaps[layout].name, decoded);
+    }
+
+    printf("%s layout\n", keymaps[layout].name);
+    Sim_Report("  characters typed", common, "characters");
+  }
+  USB_HID_Keyboard_SetLayout(KEYBOARD_LAYOUT_US);
+  return Sim_Result();
+}
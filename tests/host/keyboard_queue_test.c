@@ -0,0 +1,176 @@
+/*!
+ * @file   keyboard_queue_test.c
+ * @brief  Keyboard report queue: full queue, order of the reports sent and
+ *         latency of matrix keys while text is typed
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "usbd_hid.h"
+#include "scheduler.h"
+#include "matrix.h"
+#include "usb_hid_keyboard.h"
+
+#include <string.h>
+
+#define QUEUE_SIZE     32
+#define REPORT_LENGTH  19
+#define POLL_INTERVAL  HID_FS_BINTERVAL
+
+#define USAGE_A   0x04
+#define USAGE_B   0x05
+#define USAGE_C   0x06
+#define USAGE_F5  0x3E
+
+/*
+ * Keyboard reports received by the host.
+ */
+static uint8_t reports[1024][REPORT_LENGTH];
+static uint32_t report_frames[1024];
+static int report_count;
+
+/*
+ * Matrix key (row 0, column 0) held between these ticks.
+ */
+static uint32_t key_down_tick;
+static uint32_t key_up_tick;
+
+static const uint8_t keymap[MATRIX_ROWS * MATRIX_COLS] = {KEY_F5};
+
+static const char text[] = "the quick brown fox jumps over the lazy dog ";
+static uint32_t text_offset;
+static uint32_t bytes_typed;
+
+static void on_in(uint8_t ep_addr, const uint8_t* data, uint16_t length) {
+  if ((ep_addr != HID_EPIN_ADDR) || (data[0] != HID_KEYBOARD_REPORT_ID) ||
+      (report_count == (int) (sizeof(reports) / sizeof(reports[0])))) {
+    return;
+  }
+  memcpy(reports[report_count], data, (length < REPORT_LENGTH) ? length : REPORT_LENGTH);
+  report_frames[report_count] = UsbSim_GetFrame();
+  report_count++;
+}
+
+static int report_has(int index, uint8_t usage) {
+  return (reports[index][3 + (usage >> 3)] >> (usage & 7)) & 0x01;
+}
+
+static int report_is_empty(int index) {
+  int i;
+
+  for (i = 1; i < REPORT_LENGTH; i++) {
+    if (reports[index][i] != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void scan_matrix(uint32_t tick) {
+  int i;
+
+  // Column 0 reads low on every row, only row 0 has a key in the keymap.
+  GPIOB->IDR = ((tick >= key_down_tick) && (tick < key_up_tick)) ? 0xFFFE : 0xFFFF;
+  for (i = 0; i < (MATRIX_ROW_RATE_HZ / 1000); i++) {
+    Matrix_IRQHandler();
+  }
+}
+
+// Types the text forever, leaving room in the queue like the macros do.
+static void type_text(void* arg) {
+  int typed;
+
+  if (USB_HID_Keyboard_QueueSpace() >= 4) {
+    typed = USB_HID_Keyboard_Write((uint8_t*) &text[text_offset], (int) (sizeof(text) - 1 - text_offset));
+    text_offset = (text_offset + (uint32_t) typed) % (sizeof(text) - 1);
+    bytes_typed += (uint32_t) typed;
+  }
+  Scheduler_PostDelayed(type_text, NULL, 1);
+}
+
+int main(void) {
+  uint32_t start;
+  int pressed;
+  int released;
+  int i;
+
+  MX_USB_DEVICE_Init();
+  CHECK(UsbSim_Enumerate());
+  UsbSim_SetInHandler(on_in);
+
+  // Fill the queue without letting the host poll: the first report is armed
+  // on the endpoint, the others wait in the queue.
+  for (i = 0; i < (QUEUE_SIZE / 2); i++) {
+    CHECK(USB_HID_Keyboard_Tap((i & 1) ? 'b' : 'a'));
+  }
+  CHECK_EQ(USB_HID_Keyboard_QueueSpace(), 0);
+
+  // Full queue: everything fails right away and nothing is held.
+  CHECK(!USB_HID_Keyboard_Press('c'));
+  CHECK(!USB_HID_Keyboard_Tap('c'));
+  CHECK_EQ(USB_HID_Keyboard_Write((uint8_t*) "cd", 2), 0);
+  CHECK_EQ(USB_HID_Keyboard_QueueSpace(), 0);
+
+  // The consumer queue fills up the same way.
+  CHECK(USB_HID_Keyboard_ConsumerTap(CONSUMER_MUTE));
+  CHECK(USB_HID_Keyboard_ConsumerTap(CONSUMER_VOLUME_UP));
+  CHECK(!USB_HID_Keyboard_ConsumerTap(CONSUMER_VOLUME_DOWN));
+  CHECK(!USB_HID_Keyboard_ConsumerPress(CONSUMER_VOLUME_DOWN));
+
+  // The host gets every report, in order, and then the queue is free again.
+  Sim_Run((QUEUE_SIZE + 4 + 1) * POLL_INTERVAL);
+  CHECK_EQ(report_count, QUEUE_SIZE);
+  for (i = 0; i < report_count; i++) {
+    if (i & 1) {
+      CHECK(report_is_empty(i));
+    } else {
+      CHECK(report_has(i, (i & 2) ? USAGE_B : USAGE_A));
+    }
+  }
+  CHECK_EQ(USB_HID_Keyboard_QueueSpace(), QUEUE_SIZE);
+
+  // The key refused while the queue was full is not held: the next report
+  // only has the key pressed now.
+  CHECK(USB_HID_Keyboard_Press('a'));
+  CHECK(USB_HID_Keyboard_Release('a'));
+  Sim_Run(3 * POLL_INTERVAL);
+  CHECK_EQ(report_count, QUEUE_SIZE + 2);
+  CHECK(report_has(QUEUE_SIZE, USAGE_A));
+  CHECK(!report_has(QUEUE_SIZE, USAGE_C));
+
+  // Text keeps the queue full while a matrix key is pressed and released:
+  // the matrix events wait in the scheduler for free slots instead of waiting
+  // for the host, and both reports go out within a few polls.
+  report_count = 0;
+  start = Sim_GetTick();
+  key_down_tick = start + 200;
+  key_up_tick = start + 300;
+  Scheduler_Init();
+  Matrix_Init(keymap);
+  Sim_SetTickHook(scan_matrix);
+  Scheduler_PostDelayed(type_text, NULL, 1);
+  Sim_RunScheduler(800);
+  Sim_SetTickHook(NULL);
+
+  pressed = -1;
+  released = -1;
+  for (i = 0; i < report_count; i++) {
+    if ((pressed < 0) && report_has(i, USAGE_F5)) {
+      pressed = i;
+    }
+    if ((pressed >= 0) && (released < 0) && !report_has(i, USAGE_F5)) {
+      released = i;
+    }
+  }
+  CHECK(bytes_typed > 40);
+  CHECK((pressed >= 0) && (released > pressed));
+  if ((pressed >= 0) && (released > pressed)) {
+    // Debounced after 3 scans, then queued behind at most a full queue.
+    CHECK(report_frames[pressed] < (key_down_tick + ((QUEUE_SIZE + 2) * POLL_INTERVAL)));
+    CHECK(report_frames[released] < (key_up_tick + ((QUEUE_SIZE + 2) * POLL_INTERVAL)));
+    Sim_Report("matrix key press latency", report_frames[pressed] - key_down_tick, "ms");
+    Sim_Report("matrix key release latency", report_frames[released] - key_up_tick, "ms");
+  }
+  Sim_Report("text typed with the queue full", bytes_typed * 1000.0 / 800, "bytes/s");
+  return Sim_Result();
+}
@@ -0,0 +1,366 @@
+/*!
+ * @file   keyboard_report_test.c
+ * @brief  Keyboard interface report descriptor, parsed as the host parses it,
+ *         and the keyboard, consumer control and system control reports
+ *         unpacked with the fields it describes
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "usbd_hid.h"
+#include "usb_hid_keyboard.h"
+
+#include <string.h>
+
+#define POLL_INTERVAL  HID_FS_BINTERVAL
+
+#define MAX_FIELDS       16
+#define MAX_COLLECTIONS  4
+
+/*
+ * Main items, with the tag and type bits only.
+ */
+#define ITEM_INPUT           0x80
+#define ITEM_OUTPUT          0x90
+#define ITEM_COLLECTION      0xA0
+#define ITEM_END_COLLECTION  0xC0
+
+#define FIELD_CONSTANT  0x01
+#define FIELD_VARIABLE  0x02
+
+#define USAGE(page, id)  (((uint32_t) (page) << 16) | (id))
+
+/*
+ * Input or output field of a report.
+ */
+typedef struct {
+  uint8_t item;
+  uint8_t report_id;
+  uint8_t flags;
+  uint16_t usage_page;
+  uint16_t usage_minimum;
+  uint16_t usage_maximum;
+  int32_t logical_minimum;
+  int32_t logical_maximum;
+  uint32_t size;
+  uint32_t count;
+  uint32_t offset;
+  uint32_t collection;
+} Field;
+
+/*
+ * Parsed report descriptor: fields, application collections and the bits of
+ * each input and output report, by report ID.
+ */
+typedef struct {
+  Field fields[MAX_FIELDS];
+  int field_count;
+  uint32_t collections[MAX_COLLECTIONS];
+  int collection_count;
+  uint32_t input_bits[4];
+  uint32_t output_bits[4];
+  int errors;
+} Descriptor;
+
+static Descriptor descriptor;
+
+/*
+ * Reports received by the host on the keyboard endpoint.
+ */
+static uint8_t reports[256][HID_EPIN_SIZE];
+static uint16_t report_lengths[256];
+static int report_count;
+
+// Parse a report descriptor as the host does: global items kept across main
+// items, local items cleared by each main item.
+static void parse(const uint8_t* data, uint16_t length, Descriptor* parsed) {
+  uint16_t usage_page = 0;
+  int32_t logical_minimum = 0;
+  int32_t logical_maximum = 0;
+  uint32_t size = 0;
+  uint32_t count = 0;
+  uint8_t report_id = 0;
+  uint32_t usage = 0;
+  uint32_t usage_minimum = 0;
+  uint32_t usage_maximum = 0;
+  uint32_t collection = 0;
+  int depth = 0;
+  uint16_t i = 0;
+
+  memset(parsed, 0, sizeof(*parsed));
+  while (i < length) {
+    uint8_t prefix = data[i];
+    uint8_t item_size = ((prefix & 0x03) == 3) ? 4 : (prefix & 0x03);
+    uint32_t value = 0;
+    int32_t signed_value;
+    uint8_t j;
+
+    if ((i + 1 + item_size) > length) {
+      parsed->errors++;
+      break;
+    }
+    for (j = 0; j < item_size; j++) {
+      value |= (uint32_t) data[i + 1 + j] << (8 * j);
+    }
+    signed_value = (item_size == 1) ? (int8_t) value : (item_size == 2) ? (int16_t) value : (int32_t) value;
+    i += 1 + item_size;
+
+    switch (prefix & 0xFC) {
+      case 0x04:
+        usage_page = (uint16_t) value;
+        break;
+      case 0x14:
+        logical_minimum = signed_value;
+        break;
+      case 0x24:
+        // Unsigned unless the minimum is negative.
+        logical_maximum = (logical_minimum < 0) ? signed_value : (int32_t) value;
+        break;
+      case 0x74:
+        size = value;
+        break;
+      case 0x84:
+        report_id = (uint8_t) value;
+        if ((report_id == 0) || (report_id > 3)) {
+          parsed->errors++;
+          report_id = 0;
+        }
+        break;
+      case 0x94:
+        count = value;
+        break;
+      case 0x08:
+        usage = value;
+        break;
+      case 0x18:
+        usage_minimum = value;
+        break;
+      case 0x28:
+        usage_maximum = value;
+        break;
+      case ITEM_COLLECTION:
+        if (depth++ == 0) {
+          collection = USAGE(usage_page, usage);
+          if (parsed->collection_count < MAX_COLLECTIONS) {
+            parsed->collections[parsed->collection_count++] = collection;
+          }
+          parsed->errors += (value != 0x01);
+        }
+        usage = usage_minimum = usage_maximum = 0;
+        break;
+      case ITEM_END_COLLECTION:
+        parsed->errors += (depth-- == 0);
+        break;
+      case ITEM_INPUT:
+      case ITEM_OUTPUT: {
+        uint32_t* bits = ((prefix & 0xFC) == ITEM_INPUT) ? parsed->input_bits : parsed->output_bits;
+
+        if (parsed->field_count < MAX_FIELDS) {
+          Field* field = &parsed->fields[parsed->field_count++];
+
+          field->item = prefix & 0xFC;
+          field->report_id = report_id;
+          field->flags = (uint8_t) value;
+          field->usage_page = usage_page;
+          field->usage_minimum = (uint16_t) ((usage != 0) ? usage : usage_minimum);
+          field->usage_maximum = (uint16_t) ((usage != 0) ? usage : usage_maximum);
+          field->logical_minimum = logical_minimum;
+          field->logical_maximum = logical_maximum;
+          field->size = size;
+          field->count = count;
+          field->offset = bits[report_id];
+          field->collection = collection;
+        }
+        bits[report_id] += size * count;
+        usage = usage_minimum = usage_maximum = 0;
+        break;
+      }
+      default:
+        parsed->errors++;
+        break;
+    }
+  }
+  parsed->errors += (depth != 0);
+}
+
+// Data field of a report holding a usage.
+static const Field* find_field(uint8_t item, uint8_t report_id, uint16_t usage_page, uint16_t usage) {
+  int i;
+
+  for (i = 0; i < descriptor.field_count; i++) {
+    const Field* field = &descriptor.fields[i];
+
+    if ((field->item == item) && (field->report_id == report_id) && (field->usage_page == usage_page) &&
+        (usage >= field->usage_minimum) && (usage <= field->usage_maximum) && !(field->flags & FIELD_CONSTANT)) {
+      return field;
+    }
+  }
+  return NULL;
+}
+
+// Value of an element of a field in a report, after its report ID.
+static uint32_t field_value(const Field* field, const uint8_t* report, uint32_t index) {
+  uint32_t offset = field->offset + (index * field->size);
+  uint32_t value = 0;
+  uint32_t bit;
+
+  for (bit = 0; bit < field->size; bit++) {
+    value |= (uint32_t) ((report[1 + ((offset + bit) >> 3)] >> ((offset + bit) & 7)) & 0x01) << bit;
+  }
+  return value;
+}
+
+// Usage of an array field, 0 if out of the logical range (no control).
+static uint32_t array_usage(const Field* field, const uint8_t* report) {
+  int32_t value = (int32_t) field_value(field, report, 0);
+
+  if ((value < field->logical_minimum) || (value > field->logical_maximum)) {
+    return 0;
+  }
+  return field->usage_minimum + (uint32_t) (value - field->logical_minimum);
+}
+
+static int is_pressed(const Field* field, const uint8_t* report, uint16_t usage) {
+  return (usage >= field->usage_minimum) && (usage <= field->usage_maximum) &&
+         (field_value(field, report, usage - field->usage_minimum) != 0);
+}
+
+static void on_in(uint8_t ep_addr, const uint8_t* data, uint16_t length) {
+  if ((ep_addr != HID_EPIN_ADDR) || (report_count == (int) (sizeof(reports) / sizeof(reports[0])))) {
+    return;
+  }
+  memcpy(reports[report_count], data, length);
+  report_lengths[report_count] = length;
+  report_count++;
+}
+
+// Index of the first report with a report ID from an index on, -1 if none.
+static int next_report(int from, uint8_t report_id) {
+  int i;
+
+  for (i = from; i < report_count; i++) {
+    if (reports[i][0] == report_id) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int main(void) {
+  const UsbSimInterface* keyboard;
+  const Field* modifiers;
+  const Field* keys;
+  const Field* leds;
+  const Field* consumer;
+  const Field* system;
+  uint8_t led_report[2] = {HID_KEYBOARD_REPORT_ID, LED_CAPS_LOCK | LED_NUM_LOCK};
+  int keyboard_reports;
+  int index;
+  int i;
+
+  MX_USB_DEVICE_Init();
+  CHECK(UsbSim_Enumerate());
+  UsbSim_SetInHandler(on_in);
+  keyboard = &UsbSim_GetDevice()->interfaces[0];
+
+  // Keyboard, consumer control and system control collections, each with
+  // its report ID.
+  parse(keyboard->report, keyboard->report_length, &descriptor);
+  CHECK_EQ(descriptor.errors, 0);
+  CHECK_EQ(descriptor.collection_count, 3);
+  CHECK_EQ(descriptor.collections[0], USAGE(0x01, 0x06));
+  CHECK_EQ(descriptor.collections[1], USAGE(0x0C, 0x01));
+  CHECK_EQ(descriptor.collections[2], USAGE(0x01, 0x80));
+
+  // Modifiers, a reserved byte and a bitmap of usages 0 to 127.
+  CHECK_EQ(descriptor.input_bits[HID_KEYBOARD_REPORT_ID], 8 * 18);
+  modifiers = find_field(ITEM_INPUT, HID_KEYBOARD_REPORT_ID, 0x07, 0xE0);
+  CHECK((modifiers != NULL) && (modifiers->usage_minimum == 0xE0) && (modifiers->usage_maximum == 0xE7));
+  CHECK((modifiers != NULL) && (modifiers->offset == 0) && (modifiers->size == 1) && (modifiers->count == 8));
+  keys = find_field(ITEM_INPUT, HID_KEYBOARD_REPORT_ID, 0x07, 0x04);
+  CHECK((keys != NULL) && (keys->flags & FIELD_VARIABLE));
+  CHECK((keys != NULL) && (keys->usage_minimum == 0) && (keys->usage_maximum == 127) && (keys->count == 128));
+  CHECK((keys != NULL) && (keys->offset == 16) && (keys->collection == USAGE(0x01, 0x06)));
+
+  // Five LEDs, padded to a byte.
+  CHECK_EQ(descriptor.output_bits[HID_KEYBOARD_REPORT_ID], 8);
+  leds = find_field(ITEM_OUTPUT, HID_KEYBOARD_REPORT_ID, 0x08, 1);
+  CHECK((leds != NULL) && (leds->usage_minimum == 1) && (leds->usage_maximum == 5) && (leds->offset == 0));
+
+  // One 16-bit usage each, arrays covering the usages the firmware sends.
+  CHECK_EQ(descriptor.input_bits[HID_CONSUMER_REPORT_ID], 16);
+  consumer = find_field(ITEM_INPUT, HID_CONSUMER_REPORT_ID, 0x0C, CONSUMER_MUTE);
+  CHECK((consumer != NULL) && !(consumer->flags & FIELD_VARIABLE) && (consumer->size == 16));
+  CHECK((consumer != NULL) && (consumer->usage_maximum >= CONSUMER_VOLUME_DOWN) &&
+        (consumer->logical_maximum >= CONSUMER_VOLUME_DOWN));
+  CHECK_EQ(descriptor.input_bits[HID_SYSTEM_REPORT_ID], 16);
+  system = find_field(ITEM_INPUT, HID_SYSTEM_REPORT_ID, 0x01, SYSTEM_SLEEP);
+  CHECK((system != NULL) && !(system->flags & FIELD_VARIABLE) && (system->size == 16));
+  CHECK((system != NULL) && (system->usage_minimum <= SYSTEM_POWER_DOWN) &&
+        (system->usage_maximum >= SYSTEM_WAKE_UP) && (system->logical_minimum > 0));
+  if ((modifiers == NULL) || (keys == NULL) || (leds == NULL) || (consumer == NULL) || (system == NULL)) {
+    return Sim_Result();
+  }
+
+  // Keyboard report: each report as long as its fields, keys in the bitmap
+  // and the modifiers in their own bits.
+  CHECK(USB_HID_Keyboard_Press(KEY_LEFT_CTRL));
+  CHECK(USB_HID_Keyboard_Press('A'));
+  CHECK(USB_HID_Keyboard_Press(KEY_F5));
+  CHECK(USB_HID_Keyboard_ReleaseAll());
+  Sim_Run(10 * POLL_INTERVAL);
+  CHECK_EQ(report_count, 4);
+  for (i = 0; i < report_count; i++) {
+    CHECK_EQ(reports[i][0], HID_KEYBOARD_REPORT_ID);
+    CHECK_EQ(report_lengths[i], 1 + (descriptor.input_bits[HID_KEYBOARD_REPORT_ID] / 8));
+  }
+  CHECK(is_pressed(modifiers, reports[0], 0xE0));
+  CHECK(!is_pressed(keys, reports[0], 0x04));
+  CHECK(is_pressed(modifiers, reports[1], 0xE0) && is_pressed(modifiers, reports[1], 0xE1));
+  CHECK(is_pressed(keys, reports[1], 0x04));
+  CHECK(is_pressed(keys, reports[2], 0x04) && is_pressed(keys, reports[2], 0x3E));
+  for (i = 0; i < 128; i++) {
+    CHECK(!is_pressed(keys, reports[3], (uint16_t) i));
+  }
+  CHECK_EQ(field_value(modifiers, reports[3], 0), 0);
+
+  // Consumer and system reports: the usage, then no control.
+  report_count = 0;
+  CHECK(USB_HID_Keyboard_ConsumerTap(CONSUMER_VOLUME_UP));
+  CHECK(USB_HID_Keyboard_SystemTap(SYSTEM_SLEEP));
+  Sim_Run(10 * POLL_INTERVAL);
+  CHECK_EQ(report_count, 4);
+  index = next_report(0, HID_CONSUMER_REPORT_ID);
+  CHECK((index >= 0) && (report_lengths[index] == 3) && (array_usage(consumer, reports[index]) == CONSUMER_VOLUME_UP));
+  index = next_report(index + 1, HID_CONSUMER_REPORT_ID);
+  CHECK((index >= 0) && (array_usage(consumer, reports[index]) == 0));
+  index = next_report(0, HID_SYSTEM_REPORT_ID);
+  CHECK((index >= 0) && (report_lengths[index] == 3) && (array_usage(system, reports[index]) == SYSTEM_SLEEP));
+  index = next_report(index + 1, HID_SYSTEM_REPORT_ID);
+  CHECK((index >= 0) && (array_usage(system, reports[index]) == 0));
+
+  // A media key doesn't wait behind a full keyboard queue.
+  report_count = 0;
+  for (i = 0; USB_HID_Keyboard_Tap((i & 1) ? 'b' : 'a'); i++) {
+  }
+  keyboard_reports = 2 * i;
+  CHECK_EQ(USB_HID_Keyboard_QueueSpace(), 0);
+  CHECK(USB_HID_Keyboard_ConsumerTap(CONSUMER_MUTE));
+  Sim_Run((keyboard_reports + 4) * POLL_INTERVAL);
+  CHECK_EQ(report_count, keyboard_reports + 2);
+  index = next_report(0, HID_CONSUMER_REPORT_ID);
+  CHECK((index >= 0) && (index <= 1) && (array_usage(consumer, reports[index]) == CONSUMER_MUTE));
+  index = next_report(index + 1, HID_CONSUMER_REPORT_ID);
+  CHECK((index >= 0) && (index <= 3));
+
+  // LED output report, packed as described.
+  CHECK(UsbSim_Control(USBSIM_CLASS_OUT, 0x09, (0x02 << 8) | HID_KEYBOARD_REPORT_ID, 0,
+                       (uint16_t) (1 + (descriptor.output_bits[HID_KEYBOARD_REPORT_ID] / 8)), led_report) >= 0);
+  Sim_Run(POLL_INTERVAL);
+  CHECK_EQ(USB_HID_Keyboard_GetLeds(), LED_CAPS_LOCK | LED_NUM_LOCK);
+  CHECK(is_pressed(leds, led_report, 1) && is_pressed(leds, led_report, 2) && !is_pressed(leds, led_report, 3));
+
+  Sim_Report("report descriptor", keyboard->report_length, "bytes");
+  Sim_Report("keyboard reports queued ahead of the media key", keyboard_reports, "reports");
+  return Sim_Result();
+}
@@ -0,0 +1,199 @@
+/*!
+ * @file   keyboard_write_test.c
+ * @brief  Text typed by USB_HID_Keyboard_Write() against the same text typed
+ *         one USB_HID_Keyboard_Tap() per character: the host decodes the same
+ *         text from both, with about half the reports
+ *
+ * The host side decodes the reports with its own US keymap, like the host
+ * keyboard driver does: a key typed when its bit appears in a report, with the
+ * modifiers of that report.
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "usbd_hid.h"
+#include "usb_hid_keyboard.h"
+
+#include <string.h>
+
+#define REPORT_LENGTH  19
+#define POLL_INTERVAL  HID_FS_BINTERVAL
+
+#define MOD_SHIFT      0x22
+#define KEY_BITMAP_BYTES  16
+
+/*
+ * US keymap of the host, from usage 0x1E: unshifted and shifted characters.
+ */
+static const char digits[] = "1234567890";
+static const char shifted_digits[] = "!@#$%^&*()";
+static const char punctuation[] = "-=[]\\\0;'`,./";
+static const char shifted_punctuation[] = "_+{}|\0:\"~<>?";
+
+/*
+ * Text decoded by the host, keys held in the last report and reports received.
+ */
+static char decoded[8192];
+static size_t decoded_length;
+static uint8_t held[KEY_BITMAP_BYTES];
+static int report_count;
+
+static char usage_to_char(uint8_t usage, uint8_t modifiers) {
+  int shift = (modifiers & MOD_SHIFT) != 0;
+
+  if ((usage >= 0x04) && (usage <= 0x1D)) {
+    return (char) ((shift ? 'A' : 'a') + (usage - 0x04));
+  }
+  if ((usage >= 0x1E) && (usage <= 0x27)) {
+    return shift ? shifted_digits[usage - 0x1E] : digits[usage - 0x1E];
+  }
+  if ((usage >= 0x2D) && (usage <= 0x38)) {
+    return shift ? shifted_punctuation[usage - 0x2D] : punctuation[usage - 0x2D];
+  }
+  switch (usage) {
+    case 0x28:
+      return '\n';
+    case 0x2A:
+      return '\b';
+    case 0x2B:
+      return '\t';
+    case 0x2C:
+      return ' ';
+    default:
+      return 0;
+  }
+}
+
+static void on_in(uint8_t ep_addr, const uint8_t* data, uint16_t length) {
+  uint8_t usage;
+  char c;
+
+  if ((ep_addr != HID_EPIN_ADDR) || (data[0] != HID_KEYBOARD_REPORT_ID) || (length < REPORT_LENGTH)) {
+    return;
+  }
+  report_count++;
+  for (usage = 0; usage < (KEY_BITMAP_BYTES * 8); usage++) {
+    int down = (data[3 + (usage >> 3)] >> (usage & 7)) & 0x01;
+    int was_down = (held[usage >> 3] >> (usage & 7)) & 0x01;
+
+    if (down && !was_down && (decoded_length < (sizeof(decoded) - 1))) {
+      c = usage_to_char(usage, data[1]);
+      decoded[decoded_length++] = (c != 0) ? c : '?';
+    }
+  }
+  memcpy(held, &data[3], sizeof(held));
+}
+
+static void reset_host(void) {
+  memset(decoded, 0, sizeof(decoded));
+  decoded_length = 0;
+  memset(held, 0, sizeof(held));
+  report_count = 0;
+}
+
+// Type a text in parts as the queue frees up, return the frames it took.
+static uint32_t write_text(const char* text) {
+  uint32_t start = Sim_GetTick();
+  size_t offset = 0;
+  size_t size = strlen(text);
+
+  while ((offset < size) && ((Sim_GetTick() - start) < 60000)) {
+    offset += (size_t) USB_HID_Keyboard_WritePart((uint8_t*) &text[offset], (int) (size - offset));
+    Sim_Step();
+  }
+  CHECK(USB_HID_Keyboard_WriteEnd());
+  Sim_Run(40 * POLL_INTERVAL);
+  return Sim_GetTick() - start;
+}
+
+// Type a text one tap per character, return the frames it took.
+static uint32_t tap_text(const char* text) {
+  uint32_t start = Sim_GetTick();
+  size_t offset = 0;
+  size_t size = strlen(text);
+
+  while ((offset < size) && ((Sim_GetTick() - start) < 60000)) {
+    if (USB_HID_Keyboard_Tap((uint8_t) text[offset])) {
+      offset++;
+    } else {
+      Sim_Step();
+    }
+  }
+  Sim_Run(40 * POLL_INTERVAL);
+  return Sim_GetTick() - start;
+}
+
+// Reports USB_HID_Keyboard_Write() takes for a short text.
+static int write_reports(const char* text) {
+  reset_host();
+  CHECK_EQ(USB_HID_Keyboard_Write((uint8_t*) text, (int) strlen(text)), (int) strlen(text));
+  Sim_Run(40 * POLL_INTERVAL);
+  CHECK(strcmp(decoded, text) == 0);
+  return report_count;
+}
+
+// Type a text both ways, check the host decodes it from both and return the
+// reports it took written and tapped.
+static void compare(const char* text, int* written, int* tapped, uint32_t* write_frames, uint32_t* tap_frames) {
+  reset_host();
+  *write_frames = write_text(text);
+  CHECK(strcmp(decoded, text) == 0);
+  *written = report_count;
+
+  reset_host();
+  *tap_frames = tap_text(text);
+  CHECK(strcmp(decoded, text) == 0);
+  *tapped = report_count;
+  CHECK_EQ(*tapped, 2 * (int) strlen(text));
+}
+
+int main(void) {
+  static const char hello[] = "Hello, world!\n";
+  static const char prose[] =
+    "It was the best of times, it was the worst of times, it was the age of wisdom, it was the age of "
+    "foolishness, it was the epoch of belief, it was the epoch of incredulity, it was the season of "
+    "Light, it was the season of Darkness, it was the spring of hope, it was the winter of despair.\n";
+  static const char symbols[] =
+    "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG! 0123456789 <>?:\"{}|_+ `~ -=[]\\;',./\n"
+    "Bookkeeper Mississippi committee: aa bb cc dd ee ff gg hh, aAaA bBbB.\n";
+  char text[4096];
+  uint32_t write_frames;
+  uint32_t tap_frames;
+  int written;
+  int tapped;
+  int i;
+
+  MX_USB_DEVICE_Init();
+  CHECK(UsbSim_Enumerate());
+  UsbSim_SetInHandler(on_in);
+
+  // Different keys share a report, repeated keys and modifier changes are
+  // released in between, and the last key is released.
+  CHECK_EQ(write_reports("ab"), 3);
+  CHECK_EQ(write_reports("aa"), 4);
+  CHECK_EQ(write_reports("aA"), 4);
+  CHECK_EQ(write_reports("ABC"), 4);
+  CHECK_EQ(write_reports(hello), (int) strlen(hello) + 5);
+
+  // Shifted runs, repeated letters and symbols, through a full queue: the
+  // same text decoded either way.
+  compare(symbols, &written, &tapped, &write_frames, &tap_frames);
+  CHECK(written < tapped);
+
+  // Ordinary text, through a full queue: about half the reports.
+  text[0] = '\0';
+  for (i = 0; i < 8; i++) {
+    strcat(text, prose);
+  }
+  compare(text, &written, &tapped, &write_frames, &tap_frames);
+  CHECK(written < ((tapped * 6) / 10));
+  CHECK(write_frames < tap_frames);
+
+  Sim_Report("characters", strlen(text), "characters");
+  Sim_Report("reports, written", written, "reports");
+  Sim_Report("reports, tapped", tapped, "reports");
+  Sim_Report("reports per character, written", (double) written / strlen(text), "reports");
+  Sim_Report("typing rate, written", strlen(text) * 1000.0 / write_frames, "characters/s");
+  Sim_Report("typing rate, tapped", strlen(text) * 1000.0 / tap_frames, "characters/s");
+  return Sim_Result();
+}
@@ -0,0 +1,306 @@
+/*!
+ * @file   macro_test.c
+ * @brief  A 10 KB macro script, compiled and run from the MACROS region:
+ *         text typed, reports sent and execution time in frames, and mouse
+ *         moves waiting for room in a full mouse queue
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "usbd_hid.h"
+#include "scheduler.h"
+#include "usb_hid_keyboard.h"
+#include "usb_hid_macro.h"
+#include "usb_hid_mouse.h"
+#include "macro_compiler.h"
+
+#include <string.h>
+
+#define POLL_INTERVAL  HID_FS_BINTERVAL
+
+#define USAGE_RETURN   0x28
+#define MOD_SHIFT      0x22
+
+#define SCRIPT_SIZE    (10 * 1024)
+#define TEXT_SIZE      (16 * 1024)
+
+extern uint8_t _smacros[];
+extern uint8_t _emacros[];
+
+static const char* const words[] = {
+  "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "Report", "queue",
+  "USB", "frame", "keyboard", "macro", "(flash)", "[region]", "a+b=c", "100%", "x_y", "@home",
+};
+
+/*
+ * Script, text it types and keyboard reports it takes.
+ */
+static char script[SCRIPT_SIZE + 1024];
+static int script_length;
+static char expected[TEXT_SIZE];
+static int expected_length;
+static int expected_reports;
+static uint32_t delay_frames;
+
+/*
+ * Text typed as seen by the host, from the keyboard reports.
+ */
+static char typed[TEXT_SIZE];
+static int typed_length;
+static int report_count;
+static int mouse_reports;
+static int32_t mouse_x;
+static int32_t mouse_y;
+static uint8_t mouse_buttons;
+static uint32_t timer_tick;
+static uint8_t last_report[HID_EPIN_SIZE];
+static char characters[256][2];
+
+static uint32_t random_state = 1;
+
+static uint32_t next_random(void) {
+  random_state = (random_state * 1103515245) + 12345;
+  return (random_state >> 16) & 0x7FFF;
+}
+
+// Reports a STRING instruction takes: a press per character, a release in
+// between when the key repeats or the modifiers change, and a last release.
+static int string_reports(const char* text, int length) {
+  KeyStroke stroke;
+  KeyStroke last = {0, 0};
+  int reports = 0;
+  int i;
+
+  for (i = 0; i < length; i++) {
+    USB_HID_Keyboard_LayoutLookup(KEYBOARD_LAYOUT_US, (uint8_t) text[i], &stroke);
+    if ((i > 0) && ((stroke.usage == last.usage) || (stroke.modifiers != last.modifiers))) {
+      reports++;
+    }
+    reports++;
+    last = stroke;
+  }
+  return reports + 1;
+}
+
+static void add_line(const char* format, const char* text) {
+  script_length += snprintf(&script[script_length], sizeof(script) - script_length, format, text);
+}
+
+static void add_text(const char* text, int length, int times) {
+  int i;
+
+  for (i = 0; i < times; i++) {
+    memcpy(&expected[expected_length], text, length);
+    expected_length += length;
+  }
+}
+
+// Type text in STRING instructions of at most 255 bytes, like the compiler splits them.
+static void add_string(const char* text, int times) {
+  int length = (int) strlen(text);
+  int offset;
+  int chunk;
+
+  add_line("string \"%s\"\n", text);
+  for (offset = 0; offset < length; offset += chunk) {
+    chunk = ((length - offset) > 255) ? 255 : (length - offset);
+    expected_reports += times * string_reports(&text[offset], chunk);
+  }
+  add_text(text, length, times);
+}
+
+static void build_script(void) {
+  char line[700];
+  int length;
+  int block = 0;
+
+  add_line("# Generated %s test script\n", "10 KB");
+  add_line("macro%s\n", "");
+  while (script_length < SCRIPT_SIZE - 800) {
+    // A sentence of random words, up to about 200 characters.
+    length = 0;
+    while (length < 150) {
+      length += sprintf(&line[length], "%s%s", (length > 0) ? " " : "", words[next_random() % 20]);
+    }
+    length += sprintf(&line[length], ".");
+    add_string(line, 1);
+    add_line("tap %s\n", "RETURN");
+    add_text("\n", 1, 1);
+    expected_reports += 2;
+
+    switch (block++ % 4) {
+      case 0:
+        add_line("repeat %s\n", "3");
+        add_string("echo ", 3);
+        add_line("loop%s\n", "");
+        break;
+      case 1:
+        add_line("delay %s\n", "20");
+        delay_frames += 20;
+        break;
+      case 2:
+        add_line("press %s\n", "LEFT_SHIFT");
+        add_line("string \"%s\"\n", "shifted");
+        add_line("release %s\n", "LEFT_SHIFT");
+        add_text("SHIFTED", 7, 1);
+        expected_reports += string_reports("shifted", 7) + 2;
+        break;
+      default:
+        add_line("mouse_move %s\n", "10 -10 0  # back and forth");
+        add_line("mouse_move %s\n", "-10 10");
+        break;
+    }
+  }
+
+  // A string longer than one instruction takes.
+  length = 0;
+  while (length < 600) {
+    line[length] = (char) ('a' + (length % 26));
+    length++;
+  }
+  line[length] = '\0';
+  add_string(line, 1);
+}
+
+static void on_in(uint8_t ep_addr, const uint8_t* data, uint16_t length) {
+  int i;
+  int bit;
+  uint8_t usage;
+
+  if (ep_addr == HID_MOUSE_EPIN_ADDR) {
+    mouse_reports++;
+    mouse_buttons = data[0];
+    mouse_x += (int8_t) data[1];
+    mouse_y += (int8_t) data[2];
+    return;
+  }
+  if ((data[0] != HID_KEYBOARD_REPORT_ID) || (length < 19)) {
+    return;
+  }
+  report_count++;
+
+  // Keys pressed since the previous report, with the modifiers of this one.
+  for (i = 3; i < 19; i++) {
+    for (bit = 0; bit < 8; bit++) {
+      if ((data[i] & ~last_report[i] & (1 << bit)) && (typed_length < TEXT_SIZE)) {
+        usage = (uint8_t) (((i - 3) << 3) | bit);
+        typed[typed_length++] = characters[usage][(data[1] & MOD_SHIFT) ? 1 : 0];
+      }
+    }
+  }
+  memcpy(last_report, data, 19);
+}
+
+static void on_timer(void* arg) {
+  timer_tick = Sim_GetTick();
+}
+
+int main(void) {
+  // repeat 300 / mouse_move 2 -1 / loop
+  static const uint8_t moves[] = {
+    MACRO_OP_REPEAT, 0x2C, 0x01,
+    MACRO_OP_MOUSE_MOVE, 0x02, 0x00, 0xFF, 0xFF, 0x00,
+    MACRO_OP_LOOP,
+    MACRO_OP_END,
+  };
+  static uint8_t image[16 * 1024];
+  MacroCompilerError error;
+  KeyStroke stroke;
+  uint32_t start;
+  uint32_t frames;
+  uint32_t naks;
+  int size;
+  int c;
+  int i;
+
+  // Characters of the US layout by usage and shift state, as the host sees them.
+  for (c = 0x20; c < 0x7F; c++) {
+    if (USB_HID_Keyboard_LayoutLookup(KEYBOARD_LAYOUT_US, (uint32_t) c, &stroke) == 1) {
+      characters[stroke.usage][(stroke.modifiers & MOD_SHIFT) ? 1 : 0] = (char) c;
+    }
+  }
+  characters[USAGE_RETURN][0] = '\n';
+
+  build_script();
+  CHECK(script_length >= SCRIPT_SIZE - 800);
+  size = MacroCompiler_Compile(script, image, sizeof(image), &error);
+  if (!CHECK(size > 0)) {
+    printf("line %d: %s\n", error.line, error.message);
+    return Sim_Result();
+  }
+  CHECK(size <= (_emacros - _smacros));
+  memcpy(_smacros, image, size);
+
+  // The compiler reports errors with their line.
+  CHECK_EQ(MacroCompiler_Compile("tap 'a'\nrepeat 2\ntap RETURN\n", image, sizeof(image), &error), -1);
+  CHECK_EQ(error.line, 2);
+  CHECK_EQ(MacroCompiler_Compile("\n\nstring \"abc\n", image, sizeof(image), &error), -1);
+  CHECK_EQ(error.line, 3);
+  CHECK_EQ(MacroCompiler_Compile("tap NOKEY", image, sizeof(image), &error), -1);
+  CHECK(strstr(error.message, "NOKEY") != NULL);
+
+  Scheduler_Init();
+  MX_USB_DEVICE_Init();
+  CHECK(UsbSim_Enumerate());
+  UsbSim_SetInHandler(on_in);
+
+  start = Sim_GetTick();
+  naks = UsbSim_GetStats(HID_EPIN_ADDR)->naks;
+  CHECK(USB_HID_Macro_RunStored(0));
+  while (USB_HID_Macro_IsRunning() && ((Sim_GetTick() - start) < 1000000)) {
+    Sim_RunScheduler(1);
+  }
+  CHECK(!USB_HID_Macro_IsRunning());
+  naks = UsbSim_GetStats(HID_EPIN_ADDR)->naks - naks;
+  // Let the host collect the reports still queued.
+  Sim_Run(40 * POLL_INTERVAL);
+  frames = UsbSim_GetStats(HID_EPIN_ADDR)->last_frame - start;
+
+  // The text is typed as written, in as many reports as typed in one go.
+  CHECK_EQ(typed_length, expected_length);
+  CHECK(memcmp(typed, expected, expected_length) == 0);
+  CHECK_EQ(report_count, expected_reports);
+  CHECK(mouse_reports > 0);
+
+  // The macro keeps the queue fed: one report per poll, the endpoint only
+  // idles when a delay outlasts the reports queued before it.
+  CHECK(naks <= (delay_frames / POLL_INTERVAL));
+  CHECK(frames <= ((uint32_t) report_count + naks + 1) * POLL_INTERVAL);
+
+  // Mouse moves with the mouse queue full of button changes: the macro waits
+  // for room instead of failing, and the other tasks keep running.
+  mouse_x = 0;
+  mouse_y = 0;
+  // Timers count from the scheduler's last tick: bring it up to date.
+  Sim_RunScheduler(1);
+  timer_tick = 0;
+  start = Sim_GetTick();
+  CHECK(Scheduler_PostDelayed(on_timer, NULL, 5));
+  for (i = 0; (i < 100) && (USB_HID_Mouse_QueueSpace() > 0); i++) {
+    CHECK((i & 1) ? USB_HID_Mouse_Release(BUTTON_LEFT) : USB_HID_Mouse_Press(BUTTON_LEFT));
+  }
+  CHECK_EQ(USB_HID_Mouse_QueueSpace(), 0);
+  // A further button change fails rather than waiting for the host.
+  CHECK(!USB_HID_Mouse_Press(BUTTON_RIGHT));
+  CHECK(USB_HID_Macro_Run(moves, sizeof(moves)));
+  while (USB_HID_Macro_IsRunning() && ((Sim_GetTick() - start) < 10000)) {
+    Sim_RunScheduler(1);
+  }
+  CHECK(!USB_HID_Macro_IsRunning());
+  Sim_RunScheduler(10);
+  CHECK((timer_tick != 0) && ((timer_tick - start) <= 5));
+  CHECK(USB_HID_Mouse_ReleaseAll());
+  Sim_Run(40 * POLL_INTERVAL);
+  CHECK_EQ(mouse_x, 600);
+  CHECK_EQ(mouse_y, -300);
+  CHECK_EQ(mouse_buttons, 0);
+
+  Sim_Report("script size", script_length, "bytes");
+  Sim_Report("image size", size, "bytes");
+  Sim_Report("text typed", expected_length, "bytes");
+  Sim_Report("keyboard reports", report_count, "reports");
+  Sim_Report("execution time", frames, "frames");
+  Sim_Report("of which delays", delay_frames, "frames");
+  Sim_Report("idle polls while running", naks, "polls");
+  return Sim_Result();
+}
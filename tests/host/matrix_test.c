@@ -0,0 +1,363 @@
+/*!
+ * @file   matrix_test.c
+ * @brief  Key matrix debouncer and events on synthetic bounce waveforms: one
+ *         event per press and release through the contact bounce, none for
+ *         glitches, every key of a full matrix, and the latency from the
+ *         contact to the report the host gets
+ *
+ * The test is the matrix hardware: on each TIM2 interrupt it puts on the
+ * column port (GPIOB->IDR) the keys of the row the scanner strobed one period
+ * before, each key read from its contact waveform at that time.
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "usbd_hid.h"
+#include "scheduler.h"
+#include "matrix.h"
+#include "usb_hid_keyboard.h"
+
+#include <string.h>
+
+#define SCANS_PER_TICK  (MATRIX_ROW_RATE_HZ / 1000)
+#define SCAN_US(scan)   ((uint64_t) (scan) * 1000000 / MATRIX_ROW_RATE_HZ)
+#define ROW_PERIOD_US   (1000000 / (MATRIX_ROW_RATE_HZ / MATRIX_ROWS))
+#define DEBOUNCE_US     (MATRIX_DEBOUNCE_SAMPLES * ROW_PERIOD_US)
+#define BOUNCE_US       2000
+
+#define MAX_CONTACTS  (MATRIX_ROWS * MATRIX_COLS)
+#define MAX_EDGES     64
+#define MAX_EVENTS    1024
+
+#define USAGE_A  0x04
+
+/*
+ * Contact waveform: level changes, in microseconds from the start of the test.
+ * Closed from the first edge to the second, and so on.
+ */
+typedef struct {
+  uint8_t row;
+  uint8_t col;
+  int edge_count;
+  uint64_t edges[MAX_EDGES];
+} Contact;
+
+/*
+ * Key event received by Matrix_KeyCallback().
+ */
+typedef struct {
+  uint8_t row;
+  uint8_t col;
+  int pressed;
+  uint64_t time_us;
+} Event;
+
+static Contact contacts[MAX_CONTACTS];
+static int contact_count;
+static uint64_t scan_count;
+static uint32_t strobe_errors;
+
+static Event events[MAX_EVENTS];
+static int event_count;
+static int press_keys;
+
+static uint32_t random_state = 7;
+
+static const uint8_t keymap[MATRIX_ROWS * MATRIX_COLS] = {'a'};
+
+/*
+ * Keyboard reports with the key of row 0, column 0 received by the host.
+ */
+static uint32_t key_report_frames[16];
+static int key_report_count;
+static int last_key_state;
+
+static uint32_t next_random(uint32_t range) {
+  random_state = (random_state * 1103515245) + 12345;
+  return ((random_state >> 16) & 0x7FFF) % range;
+}
+
+void Matrix_KeyCallback(uint8_t row, uint8_t col, int pressed) {
+  if (event_count < MAX_EVENTS) {
+    events[event_count].row = row;
+    events[event_count].col = col;
+    events[event_count].pressed = pressed;
+    events[event_count].time_us = SCAN_US(scan_count);
+    event_count++;
+  }
+  if (press_keys && (keymap[(row * MATRIX_COLS) + col] != 0)) {
+    if (pressed) {
+      USB_HID_Keyboard_Press(keymap[(row * MATRIX_COLS) + col]);
+    } else {
+      USB_HID_Keyboard_Release(keymap[(row * MATRIX_COLS) + col]);
+    }
+  }
+}
+
+static int is_closed(const Contact* contact, uint64_t time_us) {
+  int closed = 0;
+  int i;
+
+  for (i = 0; (i < contact->edge_count) && (contact->edges[i] <= time_us); i++) {
+    closed = !closed;
+  }
+  return closed;
+}
+
+static void scan(uint32_t tick) {
+  int i;
+  int j;
+
+  for (i = 0; i < SCANS_PER_TICK; i++) {
+    uint8_t row = (uint8_t) (scan_count % MATRIX_ROWS);
+    uint32_t columns = 0;
+
+    // The row read now was strobed (driven low) by the previous interrupt.
+    if ((scan_count > 0) && (GPIOA->BSRR != (1U << (row + 16)))) {
+      strobe_errors++;
+    }
+    for (j = 0; j < contact_count; j++) {
+      if ((contacts[j].row == row) && is_closed(&contacts[j], SCAN_US(scan_count))) {
+        columns |= 1U << contacts[j].col;
+      }
+    }
+    GPIOB->IDR = ~columns & 0xFFFF;
+    Matrix_IRQHandler();
+    scan_count++;
+  }
+}
+
+static void on_in(uint8_t ep_addr, const uint8_t* data, uint16_t length) {
+  int key_state;
+
+  if ((ep_addr != HID_EPIN_ADDR) || (data[0] != HID_KEYBOARD_REPORT_ID)) {
+    return;
+  }
+  key_state = (data[3 + (USAGE_A >> 3)] >> (USAGE_A & 7)) & 0x01;
+  if ((key_state != last_key_state) && (key_report_count < 16)) {
+    key_report_frames[key_report_count++] = UsbSim_GetFrame();
+  }
+  last_key_state = key_state;
+}
+
+static Contact* add_contact(uint8_t row, uint8_t col) {
+  Contact* contact = &contacts[contact_count++];
+
+  memset(contact, 0, sizeof(*contact));
+  contact->row = row;
+  contact->col = col;
+  return contact;
+}
+
+static void add_edge(Contact* contact, uint64_t time_us) {
+  if (contact->edge_count < MAX_EDGES) {
+    contact->edges[contact->edge_count++] = time_us;
+  }
+}
+
+// Change of level at a time, followed by bounce pulses back to the old level
+// for up to bounce_us. Each pulse is shorter than a row period and the pulses
+// are further apart than a row period, like a mechanical contact bounce as the
+// matrix samples it.
+static void add_bouncing_edge(Contact* contact, uint64_t time_us, uint32_t bounce_us) {
+  uint64_t t = time_us;
+
+  add_edge(contact, t);
+  while (bounce_us > 0) {
+    uint64_t gap = ROW_PERIOD_US + 10 + next_random(400);
+    uint64_t width = 20 + next_random(ROW_PERIOD_US - 30);
+
+    if ((t + gap + width) >= (time_us + bounce_us)) {
+      break;
+    }
+    add_edge(contact, t + gap);
+    add_edge(contact, t + gap + width);
+    t += gap + width;
+  }
+}
+
+static uint64_t now_us(void) {
+  return SCAN_US(scan_count);
+}
+
+static void reset(void) {
+  contact_count = 0;
+  event_count = 0;
+}
+
+// Events of a key, checking each press and release is reported once, in order.
+static int key_events(uint8_t row, uint8_t col, int* pairs) {
+  int expected = 1;
+  int count = 0;
+  int i;
+
+  *pairs = 0;
+  for (i = 0; i < event_count; i++) {
+    if ((events[i].row != row) || (events[i].col != col)) {
+      continue;
+    }
+    if (events[i].pressed != expected) {
+      return -1;
+    }
+    *pairs += !expected;
+    expected = !expected;
+    count++;
+  }
+  return count;
+}
+
+int main(void) {
+  Contact* contact;
+  uint64_t start;
+  uint64_t press_us;
+  uint64_t release_us;
+  uint64_t worst_latency = 0;
+  uint32_t first_frame;
+  int pairs;
+  int row;
+  int col;
+  int i;
+  int j;
+
+  MX_USB_DEVICE_Init();
+  CHECK(UsbSim_Enumerate());
+  UsbSim_SetInHandler(on_in);
+  Scheduler_Init();
+  Matrix_Init(keymap);
+  Sim_SetTickHook(scan);
+  first_frame = UsbSim_GetFrame() + 1;
+
+  // Clean press and release: one event each, after the debounce samples.
+  reset();
+  start = now_us();
+  contact = add_contact(2, 5);
+  add_edge(contact, start + 1000);
+  add_edge(contact, start + 21000);
+  Sim_RunScheduler(30);
+  CHECK_EQ(event_count, 2);
+  CHECK(events[0].pressed && (events[0].row == 2) && (events[0].col == 5));
+  CHECK(!events[1].pressed);
+  CHECK(events[0].time_us <= (start + 1000 + DEBOUNCE_US + ROW_PERIOD_US + 1000));
+  CHECK(events[1].time_us <= (start + 21000 + DEBOUNCE_US + ROW_PERIOD_US + 1000));
+
+  // Bouncing presses and releases, 5 ms of bounce on every edge, on keys all
+  // over the matrix: one press and one release each.
+  reset();
+  start = now_us();
+  for (i = 0; i < 100; i++) {
+    contact = add_contact((uint8_t) next_random(MATRIX_ROWS), (uint8_t) next_random(MATRIX_COLS));
+    press_us = start + 1000 + next_random(20000);
+    release_us = press_us + 10000 + next_random(30000);
+    add_bouncing_edge(contact, press_us, 5000);
+    add_bouncing_edge(contact, release_us, 5000);
+    // Press and release a single key at a time: two contacts on one key
+    // would add up.
+    Sim_RunScheduler((uint32_t) ((release_us + 10000 - now_us()) / 1000));
+    CHECK_EQ(key_events(contact->row, contact->col, &pairs), 2);
+    CHECK_EQ(pairs, 1);
+    for (j = 0; j < event_count; j++) {
+      uint64_t edge_us = events[j].pressed ? press_us : release_us;
+
+      // Not before the edge, within the debounce of the last bounce. Events
+      // are timed when the scheduler runs, at the end of the tick.
+      CHECK((events[j].time_us >= edge_us) && (events[j].time_us <= (edge_us + 5000 + DEBOUNCE_US + 1000)));
+    }
+    reset();
+    start = now_us();
+  }
+
+  // Glitches on idle keys and dropouts on a held key, each up to two row
+  // periods: nothing reported.
+  reset();
+  start = now_us();
+  contact = add_contact(0, 0);
+  add_edge(contact, start + 1000);
+  for (i = 0; i < 20; i++) {
+    uint64_t t = start + 20000 + (i * 3000);
+
+    add_edge(contact, t);
+    add_edge(contact, t + 1 + next_random(2 * ROW_PERIOD_US - 10));
+  }
+  for (row = 1; row < MATRIX_ROWS; row++) {
+    contact = add_contact((uint8_t) row, (uint8_t) (row * 2));
+    for (i = 0; i < 20; i++) {
+      uint64_t t = start + 20000 + (i * 3000) + (row * 100);
+
+      add_edge(contact, t);
+      add_edge(contact, t + 1 + next_random(2 * ROW_PERIOD_US - 10));
+    }
+  }
+  add_edge(&contacts[0], start + 90000);
+  Sim_RunScheduler(100);
+  CHECK_EQ(event_count, 2);
+  CHECK(events[0].pressed && (events[0].row == 0) && (events[0].col == 0));
+  CHECK(!events[1].pressed && (events[1].time_us > (start + 90000)));
+
+  // A dropout longer than the debounce is a release and a new press.
+  reset();
+  start = now_us();
+  contact = add_contact(0, 0);
+  add_edge(contact, start + 1000);
+  add_edge(contact, start + 10000);
+  add_edge(contact, start + 10000 + DEBOUNCE_US + ROW_PERIOD_US);
+  add_edge(contact, start + 20000);
+  Sim_RunScheduler(30);
+  CHECK_EQ(event_count, 4);
+  CHECK_EQ(key_events(0, 0, &pairs), 4);
+
+  // The whole matrix at once, more events than the event queue holds: every
+  // press and release still comes through.
+  reset();
+  start = now_us();
+  for (row = 0; row < MATRIX_ROWS; row++) {
+    for (col = 0; col < MATRIX_COLS; col++) {
+      contact = add_contact((uint8_t) row, (uint8_t) col);
+      add_bouncing_edge(contact, start + 1000, 3000);
+      add_bouncing_edge(contact, start + 30000, 3000);
+    }
+  }
+  Sim_RunScheduler(60);
+  CHECK_EQ(event_count, 2 * MATRIX_ROWS * MATRIX_COLS);
+  for (row = 0; row < MATRIX_ROWS; row++) {
+    for (col = 0; col < MATRIX_COLS; col++) {
+      CHECK_EQ(key_events((uint8_t) row, (uint8_t) col, &pairs), 2);
+    }
+  }
+
+  // Latency from the first edge to the report seen by the host, on the frame
+  // clock: frame n starts n ms after the scans started. Bounce pulses the
+  // scan misses don't delay the report, the ones it samples restart the
+  // debounce.
+  press_keys = 1;
+  for (i = 0; i < 8; i++) {
+    reset();
+    key_report_count = 0;
+    start = now_us();
+    contact = add_contact(0, 0);
+    press_us = start + 1000 + next_random(1000);
+    release_us = press_us + 20000;
+    add_bouncing_edge(contact, press_us, BOUNCE_US);
+    add_bouncing_edge(contact, release_us, BOUNCE_US);
+    Sim_RunScheduler(40);
+    CHECK_EQ(key_report_count, 2);
+    if (key_report_count == 2) {
+      uint64_t press_latency = ((uint64_t) (key_report_frames[0] - first_frame) * 1000) - press_us;
+      uint64_t release_latency = ((uint64_t) (key_report_frames[1] - first_frame) * 1000) - release_us;
+
+      if (press_latency > worst_latency) {
+        worst_latency = press_latency;
+      }
+      if (release_latency > worst_latency) {
+        worst_latency = release_latency;
+      }
+    }
+  }
+  // Bounce and debounce, then the report on the next poll.
+  CHECK(worst_latency <= (BOUNCE_US + DEBOUNCE_US + ROW_PERIOD_US + (1000 * HID_FS_BINTERVAL) + 1000));
+  CHECK_EQ(strobe_errors, 0);
+
+  Sim_Report("full matrix scan", ROW_PERIOD_US, "us");
+  Sim_Report("debounce", DEBOUNCE_US, "us");
+  Sim_Report("contact to report, worst", worst_latency, "us");
+  return Sim_Result();
+}
@@ -0,0 +1,207 @@
+/*!
+ * @file   mouse_encoder_test.c
+ * @brief  Quadrature encoder inputs: counter deltas sampled once per poll,
+ *         right across the 16-bit wraparound in both directions, fast turns
+ *         spread over the next polls without losing counts, and the wheel
+ *         counts carried between detents
+ *
+ * The test is the encoders: it moves the counters of TIM2, TIM3 and TIM4 the
+ * way the timers count the edges in encoder mode.
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "usbd_hid.h"
+#include "usb_hid_mouse.h"
+#include "usb_hid_mouse_encoder.h"
+
+#include <stdlib.h>
+
+#define POLL_INTERVAL  HID_FS_BINTERVAL
+
+/*
+ * Counts per millisecond the encoders turn at, from the tick hook.
+ */
+static int32_t speed_x;
+static int32_t speed_y;
+static int32_t speed_wheel;
+
+/*
+ * Reports received by the host, and the pointer position they add up to.
+ */
+static int report_count;
+static int32_t total_x;
+static int32_t total_y;
+static int32_t total_wheel;
+static int32_t largest_step;
+static int empty_reports;
+
+static void on_in(uint8_t ep_addr, const uint8_t* data, uint16_t length) {
+  int i;
+
+  if (ep_addr != HID_EPIN_ADDR) {
+    return;
+  }
+  for (i = 1; i < 4; i++) {
+    if (abs((int8_t) data[i]) > largest_step) {
+      largest_step = abs((int8_t) data[i]);
+    }
+  }
+  empty_reports += (data[1] == 0) && (data[2] == 0) && (data[3] == 0);
+  total_x += (int8_t) data[1];
+  total_y += (int8_t) data[2];
+  total_wheel += (int8_t) data[3];
+  report_count++;
+}
+
+// Counter after a number of counts, wrapping like the 16-bit timer does.
+static void turn(TIM_TypeDef* timer, int32_t counts) {
+  timer->CNT = (uint16_t) (timer->CNT + (uint32_t) counts);
+}
+
+static void spin(uint32_t tick) {
+  (void) tick;
+  turn(TIM2, speed_x);
+  turn(TIM3, speed_y);
+  turn(TIM4, speed_wheel);
+}
+
+static void reset_totals(void) {
+  report_count = 0;
+  total_x = 0;
+  total_y = 0;
+  total_wheel = 0;
+  largest_step = 0;
+  empty_reports = 0;
+}
+
+int main(void) {
+  uint32_t moving_frames;
+  int i;
+
+  MX_USB_DEVICE_Init();
+  CHECK(UsbSim_Enumerate());
+  UsbSim_SetInHandler(on_in);
+  Sim_SetTickHook(spin);
+
+  // Timers in encoder mode on both edges of both channels, counting from 0.
+  USB_HID_Mouse_EncoderStart();
+  CHECK_EQ(TIM2->SMCR & TIM_SMCR_SMS, TIM_SMCR_SMS_0 | TIM_SMCR_SMS_1);
+  CHECK_EQ(TIM3->SMCR & TIM_SMCR_SMS, TIM_SMCR_SMS_0 | TIM_SMCR_SMS_1);
+  CHECK_EQ(TIM4->SMCR & TIM_SMCR_SMS, TIM_SMCR_SMS_0 | TIM_SMCR_SMS_1);
+  CHECK_EQ(TIM2->ARR, 0xFFFF);
+  CHECK(TIM2->CR1 & TIM_CR1_CEN);
+  CHECK_EQ(TIM2->CNT, 0);
+
+  // Still encoders: no reports.
+  Sim_Run(20 * POLL_INTERVAL);
+  CHECK_EQ(report_count, 0);
+
+  // Backwards from 0 wraps the counters to 0xFFFF and down: negative moves.
+  turn(TIM2, -5);
+  turn(TIM3, -100);
+  Sim_Run(4 * POLL_INTERVAL);
+  CHECK_EQ(TIM2->CNT, 0xFFFB);
+  CHECK_EQ(total_x, -5);
+  CHECK_EQ(total_y, -100);
+  CHECK_EQ(report_count, 1);
+
+  // Forwards back across the wraparound: positive moves.
+  reset_totals();
+  turn(TIM2, 25);
+  turn(TIM3, 100);
+  Sim_Run(4 * POLL_INTERVAL);
+  CHECK_EQ(TIM2->CNT, 20);
+  CHECK_EQ(total_x, 25);
+  CHECK_EQ(total_y, 100);
+  CHECK_EQ(report_count, 1);
+
+  // Up to 32767 counts in either direction between two polls come out
+  // right, in report sized steps over the next polls.
+  reset_totals();
+  turn(TIM2, 32767);
+  turn(TIM3, -32767);
+  Sim_Run(300 * POLL_INTERVAL);
+  CHECK_EQ(total_x, 32767);
+  CHECK_EQ(total_y, -32767);
+  CHECK_EQ(report_count, (32767 + 126) / 127);
+  CHECK_EQ(largest_step, 127);
+
+  // Turning faster than the reports carry, across many wraparounds: the
+  // counts pile up and are all reported once the encoders stop.
+  reset_totals();
+  speed_x = 1500;
+  speed_y = -700;
+  for (moving_frames = 0; moving_frames < 200; moving_frames++) {
+    Sim_Step();
+  }
+  speed_x = 0;
+  speed_y = 0;
+  CHECK(total_x < (1500 * 200));
+  Sim_Run(3000);
+  CHECK_EQ(total_x, 1500 * 200);
+  CHECK_EQ(total_y, -700 * 200);
+  CHECK_EQ(largest_step, 127);
+  CHECK_EQ(empty_reports, 0);
+
+  // Slow turning: one report per poll while moving.
+  reset_totals();
+  speed_x = 3;
+  speed_y = -1;
+  Sim_Run(100 * POLL_INTERVAL);
+  speed_x = 0;
+  speed_y = 0;
+  Sim_Run(4 * POLL_INTERVAL);
+  CHECK_EQ(total_x, 3 * 100 * POLL_INTERVAL);
+  CHECK_EQ(total_y, -100 * POLL_INTERVAL);
+  CHECK(abs(report_count - 100) <= 2);
+
+  // The wheel reports whole detents and carries the counts in between, in
+  // both directions.
+  reset_totals();
+  turn(TIM4, 3);
+  Sim_Run(4 * POLL_INTERVAL);
+  CHECK_EQ(report_count, 0);
+  turn(TIM4, 1);
+  Sim_Run(4 * POLL_INTERVAL);
+  CHECK_EQ(total_wheel, 1);
+  turn(TIM4, -6);
+  Sim_Run(4 * POLL_INTERVAL);
+  CHECK_EQ(total_wheel, 0);
+  turn(TIM4, 2);
+  Sim_Run(4 * POLL_INTERVAL);
+  CHECK_EQ(total_wheel, 0);
+  CHECK_EQ(report_count, 2);
+  for (i = 0; i < 50; i++) {
+    turn(TIM4, -ENCODER_WHEEL_COUNTS_PER_STEP);
+    Sim_Run(POLL_INTERVAL);
+  }
+  Sim_Run(4 * POLL_INTERVAL);
+  CHECK_EQ(total_wheel, -50);
+
+  // Stopped: turning the encoders moves nothing, scripted moves still go out.
+  reset_totals();
+  USB_HID_Mouse_EncoderStop();
+  turn(TIM2, 1000);
+  turn(TIM4, 40);
+  Sim_Run(20 * POLL_INTERVAL);
+  CHECK_EQ(report_count, 0);
+  CHECK(USB_HID_Mouse_Move(10, 20, 1));
+  Sim_Run(4 * POLL_INTERVAL);
+  CHECK_EQ(total_x, 10);
+  CHECK_EQ(total_y, 20);
+  CHECK_EQ(total_wheel, 1);
+
+  // Started again: counting from 0, nothing left over from before.
+  reset_totals();
+  USB_HID_Mouse_EncoderStart();
+  Sim_Run(20 * POLL_INTERVAL);
+  CHECK_EQ(report_count, 0);
+  turn(TIM2, -1);
+  Sim_Run(4 * POLL_INTERVAL);
+  CHECK_EQ(total_x, -1);
+
+  Sim_Report("largest counts between polls", 32767, "counts");
+  Sim_Report("fast turn", 1500 * 1000, "counts/s");
+  return Sim_Result();
+}
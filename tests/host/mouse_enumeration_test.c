@@ -0,0 +1,37 @@
+/*!
+ * @file   mouse_enumeration_test.c
+ * @brief  Enumeration of the mouse
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "usbd_hid.h"
+
+extern USBD_HandleTypeDef hUsbDeviceFS;
+
+int main(void) {
+  const UsbSimDevice* device = UsbSim_GetDevice();
+  const UsbSimEndpoint* ep;
+
+  MX_USB_DEVICE_Init();
+  CHECK(UsbSim_Enumerate());
+  CHECK_EQ(hUsbDeviceFS.dev_state, USBD_STATE_CONFIGURED);
+
+  CHECK_EQ(device->config_length, USB_HID_CONFIG_DESC_SIZ);
+  CHECK_EQ(device->interface_count, 1);
+  CHECK_EQ(device->interfaces[0].interface_class, 0x03);
+  CHECK_EQ(device->interfaces[0].protocol, 0x02);
+  CHECK_EQ(device->interfaces[0].report_length, HID_MOUSE_REPORT_DESC_SIZE);
+  CHECK_EQ(device->interfaces[0].report[3], 0x02);
+
+  ep = UsbSim_GetEndpoint(HID_EPIN_ADDR);
+  CHECK((ep != NULL) && (ep->max_packet == HID_EPIN_SIZE) && (ep->interval == HID_FS_BINTERVAL));
+
+  // Device ID left blank: the serial number keeps its placeholder.
+  CHECK_EQ(device->device[16], USBD_IDX_SERIAL_STR);
+
+  Sim_Run(32);
+  CHECK_EQ(UsbSim_GetStats(HID_EPIN_ADDR)->packets, 0);
+  CHECK_EQ(UsbSim_GetStats(HID_EPIN_ADDR)->naks, 32 / HID_FS_BINTERVAL);
+  return Sim_Result();
+}
@@ -0,0 +1,200 @@
+/*!
+ * @file   mouse_motion_test.c
+ * @brief  Mouse motion accumulator: moves coalesced between polls, large
+ *         moves split in saturated chunks, buttons kept in order with the
+ *         motion, and the totals and report count of a random cursor path
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "usbd_hid.h"
+#include "usb_hid_mouse.h"
+
+#include <stdlib.h>
+
+#define POLL_INTERVAL  HID_FS_BINTERVAL
+
+/*
+ * Reports received by the host, and the pointer position they add up to.
+ */
+static uint8_t reports[4096][HID_EPIN_SIZE];
+static int report_count;
+static int32_t total_x;
+static int32_t total_y;
+static int32_t total_wheel;
+static int saturated_errors;
+
+static uint32_t random_state = 1;
+
+static int32_t next_random(int32_t range) {
+  random_state = (random_state * 1103515245) + 12345;
+  return (int32_t) ((random_state >> 16) % (2 * range + 1)) - range;
+}
+
+static void on_in(uint8_t ep_addr, const uint8_t* data, uint16_t length) {
+  int i;
+
+  if ((ep_addr != HID_EPIN_ADDR) || (report_count == (int) (sizeof(reports) / sizeof(reports[0])))) {
+    return;
+  }
+  for (i = 0; i < (int) HID_EPIN_SIZE; i++) {
+    reports[report_count][i] = data[i];
+  }
+  // The report range is symmetric, -128 is never sent.
+  for (i = 1; i < 4; i++) {
+    saturated_errors += ((int8_t) data[i] == -128);
+  }
+  total_x += (int8_t) data[1];
+  total_y += (int8_t) data[2];
+  total_wheel += (int8_t) data[3];
+  report_count++;
+}
+
+static void reset_totals(void) {
+  report_count = 0;
+  total_x = 0;
+  total_y = 0;
+  total_wheel = 0;
+}
+
+// Reports a move needs at least: 127 counts per axis and report.
+static int reports_for(int32_t x, int32_t y, int32_t wheel) {
+  int32_t largest = abs(x);
+
+  if (abs(y) > largest) {
+    largest = abs(y);
+  }
+  if (abs(wheel) > largest) {
+    largest = abs(wheel);
+  }
+  return (largest + 126) / 127;
+}
+
+int main(void) {
+  int32_t path_x = 0;
+  int32_t path_y = 0;
+  int32_t max_x = 0;
+  int32_t max_y = 0;
+  int32_t x;
+  int32_t y;
+  int moving_frames = 0;
+  int move_calls = 0;
+  int empty_reports = 0;
+  int frames;
+  int i;
+
+  MX_USB_DEVICE_Init();
+  CHECK(UsbSim_Enumerate());
+  UsbSim_SetInHandler(on_in);
+
+  // Small moves between two polls go out together. The first one takes the
+  // idle endpoint, the rest are summed behind it.
+  for (i = 0; i < 100; i++) {
+    CHECK(USB_HID_Mouse_Move(1, 2, 0));
+  }
+  Sim_Run(10 * POLL_INTERVAL);
+  CHECK_EQ(total_x, 100);
+  CHECK_EQ(total_y, 200);
+  CHECK_EQ(report_count, 1 + reports_for(99, 198, 0));
+
+  // A move beyond the report range is split, the remainder carried forward.
+  reset_totals();
+  CHECK(USB_HID_Mouse_Move(1000, -300, 5));
+  Sim_Run(20 * POLL_INTERVAL);
+  CHECK_EQ(total_x, 1000);
+  CHECK_EQ(total_y, -300);
+  CHECK_EQ(total_wheel, 5);
+  CHECK_EQ(report_count, reports_for(1000, -300, 5));
+  CHECK_EQ((int8_t) reports[0][1], 127);
+  CHECK_EQ((int8_t) reports[0][2], -127);
+  CHECK_EQ((int8_t) reports[0][3], 5);
+
+  // Press, drag and release: the whole drag is sent with the button held.
+  reset_totals();
+  CHECK(USB_HID_Mouse_Press(BUTTON_LEFT));
+  CHECK(USB_HID_Mouse_Move(300, 0, 0));
+  CHECK(USB_HID_Mouse_Release(BUTTON_LEFT));
+  CHECK(USB_HID_Mouse_Move(-50, 0, 0));
+  Sim_Run(20 * POLL_INTERVAL);
+  CHECK_EQ(total_x, 250);
+  CHECK(report_count >= 5);
+  CHECK_EQ(reports[0][0], BUTTON_LEFT);
+  for (i = 0, x = 0; (i < report_count) && (x < 300); i++) {
+    CHECK_EQ(reports[i][0], BUTTON_LEFT);
+    x += (int8_t) reports[i][1];
+  }
+  CHECK_EQ(x, 300);
+  CHECK_EQ(reports[report_count - 1][0], 0);
+  CHECK_EQ((int8_t) reports[report_count - 1][1], -50);
+
+  // Buttons changing faster than the host polls fill the queue: the next
+  // change fails without touching the buttons held, moves still fit, and
+  // the change goes through once the host has polled.
+  reset_totals();
+  for (i = 0; (i < 100) && (USB_HID_Mouse_QueueSpace() > 0); i++) {
+    CHECK((i & 1) ? USB_HID_Mouse_Release(BUTTON_RIGHT) : USB_HID_Mouse_Press(BUTTON_RIGHT));
+  }
+  CHECK(i > 1);
+  CHECK(!((i & 1) ? USB_HID_Mouse_Release(BUTTON_RIGHT) : USB_HID_Mouse_Press(BUTTON_RIGHT)));
+  CHECK(!USB_HID_Mouse_Click(BUTTON_MIDDLE));
+  CHECK(USB_HID_Mouse_Move(5, -5, 0));
+  Sim_Run(40 * POLL_INTERVAL);
+  CHECK_EQ(report_count, i);
+  CHECK_EQ(total_x, 5);
+  CHECK_EQ(total_y, -5);
+  CHECK_EQ(reports[report_count - 1][0], (i & 1) ? BUTTON_RIGHT : 0);
+  CHECK(USB_HID_Mouse_QueueSpace() > 2);
+  CHECK(USB_HID_Mouse_Click(BUTTON_MIDDLE));
+  CHECK(USB_HID_Mouse_ReleaseAll());
+  Sim_Run(10 * POLL_INTERVAL);
+  CHECK_EQ(reports[report_count - 1][0], 0);
+
+  // Random cursor path: bursts of moves of every size, some frames without.
+  reset_totals();
+  for (frames = 0; frames < 2000; frames++) {
+    int moves = (next_random(2) > 0) ? (int) (next_random(4) + 4) : 0;
+
+    x = 0;
+    y = 0;
+    for (i = 0; i < moves; i++) {
+      int32_t dx = next_random((i == 0) ? 400 : 20);
+      int32_t dy = next_random((i == 0) ? 400 : 20);
+
+      CHECK(USB_HID_Mouse_Move(dx, dy, 0));
+      move_calls++;
+      x += dx;
+      y += dy;
+    }
+    path_x += x;
+    path_y += y;
+    if (abs(path_x - total_x) > max_x) {
+      max_x = abs(path_x - total_x);
+    }
+    if (abs(path_y - total_y) > max_y) {
+      max_y = abs(path_y - total_y);
+    }
+    moving_frames += (x != 0) || (y != 0);
+    Sim_Step();
+  }
+  Sim_Run(100 * POLL_INTERVAL);
+
+  // The pointer ends where the moves add up to, in at most one report per
+  // poll and far fewer reports than moves, without an empty report.
+  CHECK_EQ(total_x, path_x);
+  CHECK_EQ(total_y, path_y);
+  CHECK_EQ(saturated_errors, 0);
+  CHECK(report_count <= (frames + 100));
+  CHECK(report_count < (move_calls / 2));
+  for (i = 0; i < report_count; i++) {
+    empty_reports += (reports[i][1] == 0) && (reports[i][2] == 0);
+  }
+  CHECK_EQ(empty_reports, 0);
+
+  Sim_Report("path frames", frames, "frames");
+  Sim_Report("frames with moves", moving_frames, "frames");
+  Sim_Report("moves", move_calls, "moves");
+  Sim_Report("reports", report_count, "reports");
+  Sim_Report("lag behind the path, worst x", max_x, "counts");
+  Sim_Report("lag behind the path, worst y", max_y, "counts");
+  return Sim_Result();
+}
@@ -0,0 +1,265 @@
+/*!
+ * @file   mouse_path_test.c
+ * @brief  Mouse paths as the host sees them: the reports are rendered to a
+ *         bitmap, each path must follow its curve, land exactly on its end
+ *         point and take one report per poll
+ *
+ *   mouse_path [bitmap.pbm]
+ *
+ * writes the bitmap drawn by all the paths if a file is given.
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "usbd_hid.h"
+#include "usb_hid_mouse.h"
+#include "usb_hid_mouse_path.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POLL_INTERVAL  HID_FS_BINTERVAL
+
+#define BITMAP_SIZE    512
+#define ORIGIN         256
+#define SPEED          8
+#define SAMPLES        4096
+
+/*
+ * Pointer position seen by the host and points drawn by the current path.
+ */
+static int32_t pointer_x;
+static int32_t pointer_y;
+static double points[4096][2];
+static int point_count;
+static int32_t max_step;
+static uint8_t bitmap[BITMAP_SIZE][BITMAP_SIZE];
+
+/*
+ * Ideal curve of the current path, sampled.
+ */
+static double curve[SAMPLES + 1][2];
+
+// Plot the move of a report, as a line from the previous position.
+static void plot(int32_t dx, int32_t dy) {
+  int32_t steps = (abs(dx) > abs(dy)) ? abs(dx) : abs(dy);
+  int32_t i;
+  int32_t x;
+  int32_t y;
+
+  for (i = 1; i <= steps; i++) {
+    x = pointer_x + (int32_t) lround((double) (dx * i) / steps);
+    y = pointer_y + (int32_t) lround((double) (dy * i) / steps);
+    if ((x >= 0) && (x < BITMAP_SIZE) && (y >= 0) && (y < BITMAP_SIZE)) {
+      bitmap[y][x] = 1;
+    }
+  }
+}
+
+static void on_in(uint8_t ep_addr, const uint8_t* data, uint16_t length) {
+  int32_t dx = (int8_t) data[1];
+  int32_t dy = (int8_t) data[2];
+
+  if (ep_addr != HID_EPIN_ADDR) {
+    return;
+  }
+  if (abs(dx) > max_step) {
+    max_step = abs(dx);
+  }
+  if (abs(dy) > max_step) {
+    max_step = abs(dy);
+  }
+  plot(dx, dy);
+  pointer_x += dx;
+  pointer_y += dy;
+  if (point_count < (int) (sizeof(points) / sizeof(points[0]))) {
+    points[point_count][0] = pointer_x;
+    points[point_count][1] = pointer_y;
+    point_count++;
+  }
+}
+
+// Largest distance from a drawn point to the sampled curve.
+static double max_distance(void) {
+  double worst = 0;
+  int i;
+  int j;
+
+  for (i = 0; i < point_count; i++) {
+    double best = 1e9;
+
+    for (j = 0; j <= SAMPLES; j++) {
+      double dx = points[i][0] - curve[j][0];
+      double dy = points[i][1] - curve[j][1];
+      double d = sqrt((dx * dx) + (dy * dy));
+
+      if (d < best) {
+        best = d;
+      }
+    }
+    if (best > worst) {
+      worst = best;
+    }
+  }
+  return worst;
+}
+
+// Sample a cubic Bezier from the pointer position, relative control points.
+static void sample_cubic(double x0, double y0, const double c[3][2]) {
+  int j;
+
+  for (j = 0; j <= SAMPLES; j++) {
+    double t = (double) j / SAMPLES;
+    double a = 1 - t;
+
+    curve[j][0] = (a * a * a * x0) + (3 * a * a * t * (x0 + c[0][0])) + (3 * a * t * t * (x0 + c[1][0])) +
+                  (t * t * t * (x0 + c[2][0]));
+    curve[j][1] = (a * a * a * y0) + (3 * a * a * t * (y0 + c[0][1])) + (3 * a * t * t * (y0 + c[1][1])) +
+                  (t * t * t * (y0 + c[2][1]));
+  }
+}
+
+// Wait for the queued paths to be drawn, return the frames it took. Every
+// poll carries a step.
+static uint32_t draw(void) {
+  uint32_t start = Sim_GetTick();
+  uint32_t frames;
+
+  while (USB_HID_Mouse_PathBusy() && ((Sim_GetTick() - start) < 10000)) {
+    Sim_Step();
+  }
+  frames = Sim_GetTick() - start;
+  // The last step is still on its way to the host.
+  Sim_Run(2 * POLL_INTERVAL);
+  CHECK(frames <= (uint32_t) ((point_count + 1) * POLL_INTERVAL));
+  return frames;
+}
+
+static void start_path(void) {
+  point_count = 0;
+  max_step = 0;
+}
+
+static void write_bitmap(const char* path) {
+  FILE* file = fopen(path, "w");
+  int x;
+  int y;
+
+  if (file == NULL) {
+    perror(path);
+    return;
+  }
+  fprintf(file, "P1\n%d %d\n", BITMAP_SIZE, BITMAP_SIZE);
+  for (y = 0; y < BITMAP_SIZE; y++) {
+    for (x = 0; x < BITMAP_SIZE; x++) {
+      fputc(bitmap[y][x] ? '1' : '0', file);
+    }
+    fputc('\n', file);
+  }
+  fclose(file);
+}
+
+int main(int argc, char** argv) {
+  static const MousePoint house[] = {
+    {0, -100}, {50, -150}, {100, -100}, {0, -100}, {100, 0}, {100, -100}, {0, 0}, {100, 0},
+  };
+  double x0;
+  double y0;
+  uint32_t total_frames = 0;
+  int pixels = 0;
+  int j;
+
+  MX_USB_DEVICE_Init();
+  CHECK(UsbSim_Enumerate());
+  UsbSim_SetInHandler(on_in);
+  pointer_x = ORIGIN;
+  pointer_y = ORIGIN;
+  USB_HID_Mouse_PathSpeed(SPEED);
+
+  // Line: as many reports as the longest axis takes at this speed, one per
+  // poll, within a count of the ideal line.
+  start_path();
+  CHECK(USB_HID_Mouse_Line(203, -77));
+  total_frames += draw();
+  CHECK_EQ(pointer_x, ORIGIN + 203);
+  CHECK_EQ(pointer_y, ORIGIN - 77);
+  CHECK_EQ(point_count, (203 + SPEED - 1) / SPEED);
+  CHECK(max_step <= SPEED);
+  for (j = 0; j <= SAMPLES; j++) {
+    curve[j][0] = ORIGIN + (203.0 * j / SAMPLES);
+    curve[j][1] = ORIGIN - (77.0 * j / SAMPLES);
+  }
+  CHECK(max_distance() <= 1.0);
+
+  // House: the polyline closes on its start point.
+  start_path();
+  x0 = pointer_x;
+  y0 = pointer_y;
+  CHECK(USB_HID_Mouse_Polyline(house, sizeof(house) / sizeof(house[0])));
+  total_frames += draw();
+  CHECK_EQ(pointer_x, (int32_t) x0 + 100);
+  CHECK_EQ(pointer_y, (int32_t) y0);
+  CHECK(max_step <= SPEED);
+
+  // Quadratic Bezier, as the cubic of its degree elevation.
+  start_path();
+  x0 = pointer_x;
+  y0 = pointer_y;
+  {
+    const double c[3][2] = {{-40, -80}, {-80, -80}, {-120, 0}};
+
+    CHECK(USB_HID_Mouse_QuadBezier(-60, -120, -120, 0));
+    total_frames += draw();
+    sample_cubic(x0, y0, c);
+  }
+  CHECK_EQ(pointer_x, (int32_t) x0 - 120);
+  CHECK_EQ(pointer_y, (int32_t) y0);
+  CHECK(max_step <= SPEED);
+  CHECK(max_distance() <= 1.5);
+
+  // Cubic Bezier.
+  start_path();
+  x0 = pointer_x;
+  y0 = pointer_y;
+  {
+    const double c[3][2] = {{40, 150}, {160, -150}, {200, 0}};
+
+    CHECK(USB_HID_Mouse_CubicBezier(40, 150, 160, -150, 200, 0));
+    total_frames += draw();
+    sample_cubic(x0, y0, c);
+  }
+  CHECK_EQ(pointer_x, (int32_t) x0 + 200);
+  CHECK_EQ(pointer_y, (int32_t) y0);
+  CHECK(max_step <= SPEED);
+  CHECK(max_distance() <= 1.5);
+
+  // Full circle: back on the start point, on the circle all the way.
+  start_path();
+  x0 = pointer_x;
+  y0 = pointer_y;
+  CHECK(USB_HID_Mouse_Arc(0, 80, 360));
+  total_frames += draw();
+  CHECK_EQ(pointer_x, (int32_t) x0);
+  CHECK_EQ(pointer_y, (int32_t) y0);
+  CHECK(max_step <= SPEED);
+  for (j = 0; j <= SAMPLES; j++) {
+    double angle = 2 * M_PI * j / SAMPLES;
+
+    curve[j][0] = x0 + (80 * sin(angle));
+    curve[j][1] = y0 + 80 - (80 * cos(angle));
+  }
+  CHECK(max_distance() <= 1.5);
+  CHECK(point_count >= (int) ((2 * M_PI * 80) / (SPEED * M_SQRT2)));
+
+  for (j = 0; j < BITMAP_SIZE * BITMAP_SIZE; j++) {
+    pixels += bitmap[j / BITMAP_SIZE][j % BITMAP_SIZE];
+  }
+  if (argc > 1) {
+    write_bitmap(argv[1]);
+  }
+
+  Sim_Report("frames to draw all paths", total_frames, "frames");
+  Sim_Report("pixels drawn", pixels, "pixels");
+  return Sim_Result();
+}
@@ -0,0 +1,90 @@
+/*!
+ * @file   mouse_rate_test.c
+ * @brief  Mouse report rate with a motion source answering every poll, as
+ *         with MOUSE_BENCHMARK, measured from a usbmon capture of the virtual
+ *         host. Built once per HID_FS_BINTERVAL to check the rate follows it.
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "usbd_hid.h"
+#include "usb_hid_mouse.h"
+#include "usbmon_analyzer.h"
+
+#include <math.h>
+#include <string.h>
+
+#define BENCHMARK_FRAMES  1000
+
+extern USBD_HandleTypeDef hUsbDeviceFS;
+
+/*
+ * Capture of two devices, endpoints of both directions, a submission and an
+ * error around five reports of device 3, whose timestamps wrap around.
+ */
+static const char capture_text[] =
+  "ffff888000008100 4294966000 S Ii:1:003:1 -115:1 4 <\n"
+  "ffff888000008100 4294966296 C Ii:1:003:1 0:1 4 = 01020300\n"
+  "ffff888000008100 4294966300 C Ii:1:002:1 0:1 4 = 01020300\n"
+  "ffff888000000100 4294966400 C Bo:1:003:1 0 64 >\n"
+  "ffff888000008100 4294967196 C Ii:1:003:1 0:1 4 = 01020300\n"
+  "ffff888000008100 4294967200 C Ii:1:003:1 -71:1 0\n"
+  "ffff888000008100 1000 C Ii:1:003:1 0:1 4 = 01020300\n"
+  "ffff888000008100 2000 C Ii:1:003:2 0:1 4 = 01020300\n"
+  "ffff888000008100 2100 C Ii:1:003:1 0:1 4 = 01020300\n"
+  "ffff888000008100 3200 C Ii:1:003:1 0:1 4 = 01020300\n";
+
+static int benchmark_motion(int32_t* x, int32_t* y, int32_t* wheel) {
+  static int32_t direction = 1;
+
+  direction = -direction;
+  *x = direction;
+  *y = 0;
+  *wheel = 0;
+  return 1;
+}
+
+int main(void) {
+  UsbmonStats stats;
+  FILE* capture;
+  double expected_rate = 1000.0 / HID_FS_BINTERVAL;
+
+  // The analyzer on a known capture: intervals of 900, 1100 across the wrap,
+  // 1100 and 1100 us.
+  capture = fmemopen((void*) capture_text, strlen(capture_text), "r");
+  CHECK_EQ(UsbmonAnalyzer_Analyze(capture, 3, 1, &stats), 5);
+  fclose(capture);
+  CHECK_EQ(stats.duration_us, 4200);
+  CHECK_EQ(stats.min_interval_us, 900);
+  CHECK_EQ(stats.max_interval_us, 1100);
+  CHECK_EQ(stats.mean_interval_us, 1050);
+  CHECK(fabs(stats.jitter_us - sqrt(7500)) < 0.01);
+
+  MX_USB_DEVICE_Init();
+  CHECK(UsbSim_Enumerate());
+  CHECK_EQ(UsbSim_GetEndpoint(HID_EPIN_ADDR)->interval, HID_FS_BINTERVAL);
+  CHECK_EQ(USBD_HID_GetPollingInterval(&hUsbDeviceFS), HID_FS_BINTERVAL);
+
+  // Reports back-to-back, captured as usbmon would.
+  capture = tmpfile();
+  UsbSim_Capture(capture);
+  USB_HID_Mouse_SetMotionSource(benchmark_motion);
+  Sim_Run(BENCHMARK_FRAMES);
+  USB_HID_Mouse_SetMotionSource(NULL);
+  UsbSim_Capture(NULL);
+  rewind(capture);
+  UsbmonAnalyzer_Analyze(capture, UsbSim_GetDevice()->address, HID_EPIN_ADDR & 0x7F, &stats);
+  fclose(capture);
+
+  // One report per poll, on the frame clock.
+  CHECK(stats.reports >= (BENCHMARK_FRAMES / HID_FS_BINTERVAL) - 1);
+  CHECK((stats.rate > (expected_rate * 0.99)) && (stats.rate < (expected_rate * 1.01)));
+  CHECK(stats.jitter_us < 10);
+
+  printf("bInterval %u ms\n", (unsigned) HID_FS_BINTERVAL);
+  Sim_Report("reports", stats.reports, "reports");
+  Sim_Report("rate", stats.rate, "reports/s");
+  Sim_Report("mean interval", stats.mean_interval_us, "us");
+  Sim_Report("jitter", stats.jitter_us, "us");
+  return Sim_Result();
+}
@@ -0,0 +1,220 @@
+/*!
+ * @file   pcd_double_buffer_test.c
+ * @brief  The PCD and LL drivers of usb-cdc on the register model: bulk IN
+ *         and OUT streams through single and double buffered endpoints
+ *         arrive intact, whatever the transfer lengths, and double buffering
+ *         moves more data per frame
+ *
+ * The test stands for the USB device library: it opens the endpoints and
+ * starts the next transfer from the PCD callbacks, as the CDC class does.
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_reg_sim.h"
+
+#include <string.h>
+
+#define IN_EP        0x81
+#define OUT_EP       0x02
+#define PACKET_SIZE  64
+
+/*
+ * Packet memory: the buffer descriptor table, then two buffers per endpoint
+ * (the second one only used when double buffered).
+ */
+#define IN_PMA0   0x040
+#define IN_PMA1   0x080
+#define OUT_PMA0  0x0C0
+#define OUT_PMA1  0x100
+
+/*
+ * Receive transfers and the host write, which ends with a short packet: the
+ * device transfers end either on a full transfer or on that packet.
+ */
+#define RX_SIZE     512
+#define WRITE_SIZE  (128 * 1024 - 24)
+
+#define BENCHMARK_FRAMES  200
+
+/*
+ * Service time of a packet in the USB interrupt.
+ */
+#define SERVICE_BASE_NS      6000
+#define SERVICE_PER_BYTE_NS  100
+
+static PCD_HandleTypeDef hpcd;
+
+// Transfer lengths cycled through on the IN endpoint: short, whole packets,
+// single packet, zero length.
+static const uint16_t transfer_lengths[] = {500, 128, 64, 1, 0, 200, 448};
+
+static uint8_t tx_buffer[512];
+static uint32_t tx_offset;
+static uint32_t transfer_index;
+static uint32_t in_transfers;
+static int in_running;
+
+static uint8_t rx_buffer[RX_SIZE];
+static uint32_t rx_offset;
+static uint32_t out_transfers;
+
+static uint8_t host_data[WRITE_SIZE];
+static uint32_t host_received;
+static uint32_t errors;
+
+// Byte at an offset of a stream: shifted or repeated data doesn't match.
+static uint8_t stream_byte(uint32_t offset) {
+  return (uint8_t) ((offset * 7) + (offset >> 8) + (offset >> 16));
+}
+
+static void transmit_next(void) {
+  uint16_t length = transfer_lengths[transfer_index++ % (sizeof(transfer_lengths) / sizeof(transfer_lengths[0]))];
+  uint16_t i;
+
+  for (i = 0; i < length; i++) {
+    tx_buffer[i] = stream_byte(tx_offset + i);
+  }
+  tx_offset += length;
+  HAL_PCD_EP_Transmit(&hpcd, IN_EP, tx_buffer, length);
+}
+
+void HAL_PCD_DataInStageCallback(PCD_HandleTypeDef* pcd, uint8_t epnum) {
+  if (epnum != (IN_EP & EP_ADDR_MSK)) {
+    return;
+  }
+  in_transfers++;
+  if (in_running) {
+    transmit_next();
+  }
+}
+
+void HAL_PCD_DataOutStageCallback(PCD_HandleTypeDef* pcd, uint8_t epnum) {
+  uint32_t count;
+  uint32_t i;
+
+  if (epnum != OUT_EP) {
+    return;
+  }
+  count = HAL_PCD_EP_GetRxCount(pcd, OUT_EP);
+  for (i = 0; i < count; i++) {
+    if (rx_buffer[i] != stream_byte(rx_offset + i)) {
+      errors++;
+    }
+  }
+  rx_offset += count;
+  out_transfers++;
+  HAL_PCD_EP_Receive(pcd, OUT_EP, rx_buffer, RX_SIZE);
+}
+
+static void on_in(uint8_t ep_addr, const uint8_t* data, uint16_t length) {
+  uint16_t i;
+
+  for (i = 0; i < length; i++) {
+    if (data[i] != stream_byte(host_received + i)) {
+      errors++;
+    }
+  }
+  host_received += length;
+}
+
+static void start(int double_buffer) {
+  memset(&hpcd, 0, sizeof(hpcd));
+  hpcd.Instance = USB;
+  hpcd.Init.dev_endpoints = 8;
+  hpcd.Init.speed = PCD_SPEED_FULL;
+  hpcd.Init.low_power_enable = DISABLE;
+  hpcd.Init.lpm_enable = DISABLE;
+  hpcd.Init.battery_charging_enable = DISABLE;
+  CHECK_EQ(HAL_PCD_Init(&hpcd), HAL_OK);
+  if (double_buffer) {
+    HAL_PCDEx_PMAConfig(&hpcd, IN_EP, PCD_DBL_BUF, IN_PMA0 | (IN_PMA1 << 16));
+    HAL_PCDEx_PMAConfig(&hpcd, OUT_EP, PCD_DBL_BUF, OUT_PMA0 | (OUT_PMA1 << 16));
+  } else {
+    HAL_PCDEx_PMAConfig(&hpcd, IN_EP, PCD_SNG_BUF, IN_PMA0);
+    HAL_PCDEx_PMAConfig(&hpcd, OUT_EP, PCD_SNG_BUF, OUT_PMA0);
+  }
+  HAL_PCD_Start(&hpcd);
+  UsbRegSim_Attach(&hpcd);
+  HAL_PCD_EP_Open(&hpcd, IN_EP, PACKET_SIZE, EP_TYPE_BULK);
+  HAL_PCD_EP_Open(&hpcd, OUT_EP, PACKET_SIZE, EP_TYPE_BULK);
+
+  tx_offset = 0;
+  transfer_index = 0;
+  in_transfers = 0;
+  rx_offset = 0;
+  out_transfers = 0;
+  host_received = 0;
+  errors = 0;
+}
+
+// Device to host: bytes/s over BENCHMARK_FRAMES, the next transfer started
+// as soon as the last one completes.
+static double stream_in(void) {
+  uint32_t transfers;
+
+  in_running = 1;
+  transmit_next();
+  Sim_Run(BENCHMARK_FRAMES);
+  in_running = 0;
+  Sim_Run(5);
+
+  transfers = transfer_index;
+  CHECK_EQ(in_transfers, transfers);
+  CHECK_EQ(host_received, tx_offset);
+  CHECK(transfers > 2 * (sizeof(transfer_lengths) / sizeof(transfer_lengths[0])));
+  return (double) host_received * 1000.0 / (BENCHMARK_FRAMES + 5);
+}
+
+// Host to device: bytes/s of one large host write, up to the frame the device
+// has it all.
+static double stream_out(void) {
+  uint32_t first_frame;
+  uint32_t i;
+
+  for (i = 0; i < WRITE_SIZE; i++) {
+    host_data[i] = stream_byte(i);
+  }
+  HAL_PCD_EP_Receive(&hpcd, OUT_EP, rx_buffer, RX_SIZE);
+  first_frame = UsbSim_GetFrame();
+  UsbSim_Out(OUT_EP, host_data, WRITE_SIZE);
+  while ((rx_offset < WRITE_SIZE) && ((UsbSim_GetFrame() - first_frame) < 1000)) {
+    Sim_Step();
+  }
+
+  CHECK_EQ(rx_offset, WRITE_SIZE);
+  CHECK_EQ(out_transfers, (WRITE_SIZE + RX_SIZE - 1) / RX_SIZE);
+  return (double) rx_offset * 1000.0 / (UsbSim_GetFrame() - first_frame);
+}
+
+int main(void) {
+  double in_single;
+  double in_double;
+  double out_single;
+  double out_double;
+
+  UsbSim_SetServiceTime(SERVICE_BASE_NS, SERVICE_PER_BYTE_NS);
+  UsbSim_SetInHandler(on_in);
+
+  start(0);
+  CHECK_EQ(hpcd.IN_ep[IN_EP & EP_ADDR_MSK].doublebuffer, 0);
+  in_single = stream_in();
+  out_single = stream_out();
+  CHECK_EQ(errors, 0);
+
+  start(1);
+  CHECK_EQ(hpcd.IN_ep[IN_EP & EP_ADDR_MSK].doublebuffer, 1);
+  CHECK_EQ(hpcd.OUT_ep[OUT_EP].doublebuffer, 1);
+  in_double = stream_in();
+  out_double = stream_out();
+  CHECK_EQ(errors, 0);
+
+  // Double buffering hands the next buffer over before the packet copy.
+  CHECK(in_double > in_single);
+  CHECK(out_double > out_single);
+
+  Sim_Report("IN single buffered", in_single, "bytes/s");
+  Sim_Report("IN double buffered", in_double, "bytes/s");
+  Sim_Report("OUT single buffered", out_single, "bytes/s");
+  Sim_Report("OUT double buffered", out_double, "bytes/s");
+  return Sim_Result();
+}
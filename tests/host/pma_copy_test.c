@@ -0,0 +1,178 @@
+/*!
+ * @file   pma_copy_test.c
+ * @brief  USB_WritePMA() and USB_ReadPMA() against the byte pair copy they
+ *         replace: same packet memory and user buffer contents for every
+ *         length and alignment, and the copy time of 8, 64 and 512 bytes
+ *
+ * The copy time is measured on the host: it compares the loops, but is not the
+ * cycle count of the target, and is only reported, never checked. Unaligned buffers run the same byte pair loop in
+ * both, their difference on the host comes from code placement.
+ */
+#include "sim.h"
+#include "stm32f1xx_hal.h"
+
+#include <string.h>
+#include <time.h>
+
+#define MAX_LENGTH   520
+#define PMA_OFFSET   0x40
+#define ITERATIONS   200000
+
+/*
+ * User buffers, with room to offset them from a word boundary.
+ */
+static uint8_t source[MAX_LENGTH + 8] __attribute__((aligned(4)));
+static uint8_t destination[MAX_LENGTH + 8] __attribute__((aligned(4)));
+static uint8_t expected[MAX_LENGTH + 8] __attribute__((aligned(4)));
+static uint16_t expected_pma[MAX_LENGTH];
+
+typedef void (*PmaCopy)(USB_TypeDef* USBx, uint8_t* pbUsrBuf, uint16_t wPMABufAddr, uint16_t wNBytes);
+
+// USB_WritePMA() before the word copies, as in the HAL: one byte pair per
+// iteration.
+static void reference_write(USB_TypeDef* USBx, uint8_t* pbUsrBuf, uint16_t wPMABufAddr, uint16_t wNBytes) {
+  uint32_t n = ((uint32_t) wNBytes + 1U) >> 1;
+  uint32_t BaseAddr = (uint32_t) USBx;
+  uint32_t i, temp1, temp2;
+  __IO uint16_t* pdwVal;
+  uint8_t* pBuf = pbUsrBuf;
+
+  pdwVal = (__IO uint16_t*) (BaseAddr + 0x400U + ((uint32_t) wPMABufAddr * PMA_ACCESS));
+
+  for (i = n; i != 0U; i--) {
+    temp1 = *pBuf;
+    pBuf++;
+    temp2 = temp1 | ((uint16_t) ((uint16_t) *pBuf << 8));
+    *pdwVal = (uint16_t) temp2;
+    pdwVal++;
+
+#if PMA_ACCESS > 1U
+    pdwVal++;
+#endif
+
+    pBuf++;
+  }
+}
+
+// USB_ReadPMA() before the word copies.
+static void reference_read(USB_TypeDef* USBx, uint8_t* pbUsrBuf, uint16_t wPMABufAddr, uint16_t wNBytes) {
+  uint32_t n = (uint32_t) wNBytes >> 1;
+  uint32_t BaseAddr = (uint32_t) USBx;
+  uint32_t i, temp;
+  __IO uint16_t* pdwVal;
+  uint8_t* pBuf = pbUsrBuf;
+
+  pdwVal = (__IO uint16_t*) (BaseAddr + 0x400U + ((uint32_t) wPMABufAddr * PMA_ACCESS));
+
+  for (i = n; i != 0U; i--) {
+    temp = *(__IO uint16_t*) pdwVal;
+    pdwVal++;
+    *pBuf = (uint8_t) ((temp >> 0) & 0xFFU);
+    pBuf++;
+    *pBuf = (uint8_t) ((temp >> 8) & 0xFFU);
+    pBuf++;
+
+#if PMA_ACCESS > 1U
+    pdwVal++;
+#endif
+  }
+
+  if ((wNBytes % 2U) != 0U) {
+    temp = *pdwVal;
+    *pBuf = (uint8_t) ((temp >> 0) & 0xFFU);
+  }
+}
+
+static __IO uint16_t* pma(uint16_t address) {
+  return (__IO uint16_t*) ((uint32_t) USB + 0x400U + ((uint32_t) address * PMA_ACCESS));
+}
+
+static void fill_pma(uint16_t value) {
+  int i;
+
+  for (i = 0; i < MAX_LENGTH; i++) {
+    pma(PMA_OFFSET)[i * PMA_ACCESS] = value;
+  }
+}
+
+// Check both copies of a length and alignment against the reference.
+static int check_copy(uint16_t length, int offset) {
+  int passed = 1;
+  int i;
+
+  // Write: the same half words, nothing written past the last one.
+  fill_pma(0xA5A5);
+  reference_write(USB, &source[offset], PMA_OFFSET, length);
+  for (i = 0; i < MAX_LENGTH; i++) {
+    expected_pma[i] = pma(PMA_OFFSET)[i * PMA_ACCESS];
+  }
+  fill_pma(0xA5A5);
+  USB_WritePMA(USB, &source[offset], PMA_OFFSET, length);
+  for (i = 0; i < MAX_LENGTH; i++) {
+    passed &= (pma(PMA_OFFSET)[i * PMA_ACCESS] == expected_pma[i]);
+  }
+
+  // Read: the same bytes, nothing written past the length.
+  memset(expected, 0x5A, sizeof(expected));
+  reference_read(USB, &expected[offset], PMA_OFFSET, length);
+  memset(destination, 0x5A, sizeof(destination));
+  USB_ReadPMA(USB, &destination[offset], PMA_OFFSET, length);
+  passed &= (memcmp(destination, expected, sizeof(destination)) == 0);
+  return passed;
+}
+
+// Time of one copy, in nanoseconds.
+static double copy_time(PmaCopy copy, uint8_t* buffer, uint16_t length) {
+  struct timespec start;
+  struct timespec end;
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < ITERATIONS; i++) {
+    copy(USB, buffer, PMA_OFFSET, length);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (((end.tv_sec - start.tv_sec) * 1e9) + (end.tv_nsec - start.tv_nsec)) / ITERATIONS;
+}
+
+static void benchmark(const char* name, PmaCopy reference, PmaCopy copy) {
+  static const uint16_t lengths[] = {8, 64, 512};
+  char label[64];
+  int i;
+  int offset;
+
+  for (i = 0; i < 3; i++) {
+    for (offset = 0; offset < 2; offset++) {
+      double before = copy_time(reference, &source[offset], lengths[i]);
+      double after = copy_time(copy, &source[offset], lengths[i]);
+
+      snprintf(label, sizeof(label), "%s %u bytes, %s", name, lengths[i], offset ? "unaligned" : "aligned");
+      Sim_Report(label, after, "ns");
+      Sim_Report("  byte pairs", before, "ns");
+    }
+  }
+}
+
+int main(void) {
+  uint16_t length;
+  int offset;
+  int failures = 0;
+  int i;
+
+  for (i = 0; i < (int) sizeof(source); i++) {
+    source[i] = (uint8_t) ((i * 37) + 11);
+  }
+
+  for (length = 0; length <= MAX_LENGTH - 8; length++) {
+    for (offset = 0; offset < 4; offset++) {
+      if (!check_copy(length, offset) && (failures++ < 10)) {
+        printf("length %u, offset %d: copies differ\n", length, offset);
+      }
+    }
+  }
+  CHECK_EQ(failures, 0);
+
+  benchmark("USB_WritePMA", reference_write, USB_WritePMA);
+  benchmark("USB_ReadPMA", reference_read, USB_ReadPMA);
+  return Sim_Result();
+}
@@ -0,0 +1,458 @@
+/*!
+ * @file   ps2_keyboard_test.c
+ * @brief  PS/2 decoder and scan code set 2 translator on recorded scan code
+ *         streams: keys, typematic repeats, E0 and E1 sequences, consumer and
+ *         system keys, full report queues, frame errors, lost bits, queue
+ *         overruns and keyboard resets, and text typed through to the host
+ *
+ * The test is the keyboard: it clocks each scan code out one frame per
+ * millisecond, putting each bit on the data line (PA9) and raising the clock
+ * interrupt (PA8) like a falling clock edge does.
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "usbd_hid.h"
+#include "scheduler.h"
+#include "ps2_keyboard.h"
+#include "usb_hid_keyboard.h"
+
+#include <string.h>
+
+#define CLOCK_PIN  GPIO_PIN_8
+#define DATA_PIN   GPIO_PIN_9
+
+#define MAX_EVENTS  4096
+#define MAX_STREAM  4096
+
+#define KEY_BITMAP_BYTES  16
+
+/*
+ * Frame errors the keyboard can be made to send.
+ */
+#define FRAME_OK         0
+#define FRAME_BAD_PARITY 1
+#define FRAME_BAD_STOP   2
+
+/*
+ * Key event received by PS2_Keyboard_KeyCallback().
+ */
+typedef struct {
+  uint8_t page;
+  uint16_t usage;
+  int pressed;
+} Event;
+
+static Event events[MAX_EVENTS];
+static int event_count;
+
+/*
+ * Scan codes the keyboard sends, one per tick.
+ */
+static uint8_t stream[MAX_STREAM];
+static int stream_length;
+static int stream_offset;
+
+/*
+ * Keys the host got, in the order they were pressed, and the modifiers and
+ * keys held in the last keyboard report.
+ */
+static uint8_t typed[MAX_STREAM];
+static int typed_length;
+static uint8_t modifiers;
+static uint8_t held[KEY_BITMAP_BYTES];
+
+/*
+ * Consumer and system usages the host got, latest last.
+ */
+static uint16_t consumer_usages[64];
+static int consumer_count;
+static uint16_t system_usages[64];
+static int system_count;
+
+/*
+ * Scan codes of set 2 of the letters and of space, and their keyboard usages.
+ */
+static const uint8_t letter_codes[26] = {
+  0x1C, 0x32, 0x21, 0x23, 0x24, 0x2B, 0x34, 0x33, 0x43, 0x3B, 0x42, 0x4B, 0x3A,
+  0x31, 0x44, 0x4D, 0x15, 0x2D, 0x1B, 0x2C, 0x3C, 0x2A, 0x1D, 0x22, 0x35, 0x1A,
+};
+#define SPACE_CODE   0x29
+#define SPACE_USAGE  0x2C
+
+void PS2_Keyboard_KeyCallback(uint8_t page, uint16_t usage, int pressed) {
+  if (event_count < MAX_EVENTS) {
+    events[event_count].page = page;
+    events[event_count].usage = usage;
+    events[event_count].pressed = pressed;
+    event_count++;
+  }
+  // On to the host, like the default callback.
+  switch (page) {
+    case PS2_PAGE_KEYBOARD:
+      if (pressed) {
+        USB_HID_Keyboard_Press((uint8_t) usage);
+      } else {
+        USB_HID_Keyboard_Release((uint8_t) usage);
+      }
+      break;
+    case PS2_PAGE_CONSUMER:
+      if (pressed) {
+        USB_HID_Keyboard_ConsumerPress(usage);
+      } else {
+        USB_HID_Keyboard_ConsumerRelease();
+      }
+      break;
+    case PS2_PAGE_SYSTEM:
+      if (pressed) {
+        USB_HID_Keyboard_SystemPress((uint8_t) usage);
+      } else {
+        USB_HID_Keyboard_SystemRelease();
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+static void on_in(uint8_t ep_addr, const uint8_t* data, uint16_t length) {
+  uint8_t usage;
+
+  if (ep_addr != HID_EPIN_ADDR) {
+    return;
+  }
+  if ((data[0] == HID_CONSUMER_REPORT_ID) && (consumer_count < 64)) {
+    consumer_usages[consumer_count++] = (uint16_t) (data[1] | (data[2] << 8));
+    return;
+  }
+  if ((data[0] == HID_SYSTEM_REPORT_ID) && (system_count < 64)) {
+    system_usages[system_count++] = data[1];
+    return;
+  }
+  if ((data[0] != HID_KEYBOARD_REPORT_ID) || (length < (3 + KEY_BITMAP_BYTES))) {
+    return;
+  }
+  for (usage = 0; usage < (KEY_BITMAP_BYTES * 8); usage++) {
+    int down = (data[3 + (usage >> 3)] >> (usage & 7)) & 0x01;
+    int was_down = (held[usage >> 3] >> (usage & 7)) & 0x01;
+
+    if (down && !was_down && (typed_length < MAX_STREAM)) {
+      typed[typed_length++] = usage;
+    }
+  }
+  modifiers = data[1];
+  memcpy(held, &data[3], sizeof(held));
+}
+
+// One falling clock edge with a bit on the data line.
+static void clock_bit(uint32_t bit) {
+  GPIOA->IDR = bit ? (CLOCK_PIN | DATA_PIN) : CLOCK_PIN;
+  EXTI->PR = CLOCK_PIN;
+  PS2_Keyboard_IRQHandler();
+}
+
+// Clock out the first bits of a frame: start bit, data LSB first, odd parity
+// and stop bit.
+static void clock_frame(uint8_t code, int error, int bits) {
+  uint32_t parity = 1;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    parity ^= (code >> i) & 0x01;
+  }
+  if (error == FRAME_BAD_PARITY) {
+    parity ^= 1;
+  }
+  for (i = 0; i < bits; i++) {
+    if (i == 0) {
+      clock_bit(0);
+    } else if (i <= 8) {
+      clock_bit((code >> (i - 1)) & 0x01);
+    } else if (i == 9) {
+      clock_bit(parity);
+    } else {
+      clock_bit(error != FRAME_BAD_STOP);
+    }
+  }
+}
+
+static void keyboard(uint32_t tick) {
+  (void) tick;
+  if (stream_offset < stream_length) {
+    clock_frame(stream[stream_offset++], FRAME_OK, 11);
+  }
+}
+
+static void reset(void) {
+  event_count = 0;
+  typed_length = 0;
+}
+
+static void add_codes(const uint8_t* codes, int count) {
+  int i;
+
+  for (i = 0; (i < count) && (stream_length < MAX_STREAM); i++) {
+    stream[stream_length++] = codes[i];
+  }
+}
+
+// Send a recorded stream at the keyboard's pace and let it through to the
+// host.
+static void send(const uint8_t* codes, int count) {
+  stream_length = 0;
+  stream_offset = 0;
+  add_codes(codes, count);
+  Sim_RunScheduler((uint32_t) count + 20);
+}
+
+static int has_event(uint8_t page, uint16_t usage, int pressed) {
+  int i;
+
+  for (i = 0; i < event_count; i++) {
+    if ((events[i].page == page) && (events[i].usage == usage) && (events[i].pressed == pressed)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int event_is(int index, uint8_t page, uint16_t usage, int pressed) {
+  return (index < event_count) && (events[index].page == page) && (events[index].usage == usage) &&
+         (events[index].pressed == pressed);
+}
+
+static int keys_held_by_host(void) {
+  int held_count = __builtin_popcount(modifiers);
+  int i;
+
+  for (i = 0; i < KEY_BITMAP_BYTES; i++) {
+    held_count += __builtin_popcount(held[i]);
+  }
+  return held_count;
+}
+
+int main(void) {
+  static const uint8_t hello[] = {
+    0x33, 0xF0, 0x33, 0x24, 0xF0, 0x24, 0x4B, 0xF0, 0x4B, 0x4B, 0xF0, 0x4B, 0x44, 0xF0, 0x44,
+  };
+  static const uint8_t shifted_repeat[] = {0x12, 0x1C, 0x1C, 0x1C, 0x1C, 0xF0, 0x1C, 0xF0, 0x12};
+  static const uint8_t extended[] = {
+    0xE0, 0x75, 0xE0, 0xF0, 0x75,                          // Up arrow
+    0xE0, 0x14, 0x14, 0xE0, 0xF0, 0x14, 0xF0, 0x14,        // Right and left ctrl
+    0xE0, 0x12, 0xE0, 0x7C, 0xE0, 0xF0, 0x7C, 0xE0, 0xF0, 0x12,  // Print Screen
+  };
+  static const uint8_t pause[] = {0xE1, 0x14, 0x77, 0xE1, 0xF0, 0x14, 0xF0, 0x77};
+  static const uint8_t media[] = {
+    0xE0, 0x32, 0xE0, 0xF0, 0x32,  // Volume up
+    0xE0, 0x37, 0xE0, 0xF0, 0x37,  // Power
+  };
+  static const uint8_t hold[] = {0x1C, 0xE0, 0x14};
+  static const uint8_t self_test[] = {0xAA};
+  static const uint8_t replies[] = {0xFA, 0xEE, 0xFE, 0x1B, 0xF0, 0x1B};
+  static const char text[] = "the quick brown fox jumps over the lazy dog pack my box with five dozen liquor jugs";
+  uint8_t codes[MAX_STREAM];
+  uint8_t last;
+  int count;
+  int i;
+
+  MX_USB_DEVICE_Init();
+  CHECK(UsbSim_Enumerate());
+  UsbSim_SetInHandler(on_in);
+  Scheduler_Init();
+  PS2_Keyboard_Init();
+  Sim_SetTickHook(keyboard);
+
+  // Clock edges only count with the EXTI pending bit set.
+  GPIOA->IDR = CLOCK_PIN;
+  EXTI->PR = 0;
+  PS2_Keyboard_IRQHandler();
+  PS2_Keyboard_IRQHandler();
+
+  // Make and break codes: one press and one release per key.
+  reset();
+  send(hello, sizeof(hello));
+  CHECK_EQ(event_count, 10);
+  CHECK(event_is(0, PS2_PAGE_KEYBOARD, KEY_USAGE(0x0B), 1));
+  CHECK(event_is(1, PS2_PAGE_KEYBOARD, KEY_USAGE(0x0B), 0));
+  CHECK(event_is(2, PS2_PAGE_KEYBOARD, KEY_USAGE(0x08), 1));
+  CHECK(event_is(8, PS2_PAGE_KEYBOARD, KEY_USAGE(0x12), 1));
+  CHECK(event_is(9, PS2_PAGE_KEYBOARD, KEY_USAGE(0x12), 0));
+  CHECK_EQ(typed_length, 5);
+  CHECK(memcmp(typed, "\x0B\x08\x0F\x0F\x12", 5) == 0);
+  CHECK_EQ(keys_held_by_host(), 0);
+
+  // Typematic repeats of a held key are dropped.
+  reset();
+  send(shifted_repeat, sizeof(shifted_repeat));
+  CHECK_EQ(event_count, 4);
+  CHECK(event_is(0, PS2_PAGE_KEYBOARD, KEY_LEFT_SHIFT, 1));
+  CHECK(event_is(1, PS2_PAGE_KEYBOARD, KEY_USAGE(0x04), 1));
+  CHECK(event_is(2, PS2_PAGE_KEYBOARD, KEY_USAGE(0x04), 0));
+  CHECK(event_is(3, PS2_PAGE_KEYBOARD, KEY_LEFT_SHIFT, 0));
+
+  // E0 keys are told from the single byte keys with the same code, the
+  // fake shifts around Print Screen are dropped.
+  reset();
+  send(extended, sizeof(extended));
+  CHECK_EQ(event_count, 8);
+  CHECK(event_is(0, PS2_PAGE_KEYBOARD, KEY_UP_ARROW, 1));
+  CHECK(event_is(1, PS2_PAGE_KEYBOARD, KEY_UP_ARROW, 0));
+  CHECK(event_is(2, PS2_PAGE_KEYBOARD, KEY_RIGHT_CTRL, 1));
+  CHECK(event_is(3, PS2_PAGE_KEYBOARD, KEY_LEFT_CTRL, 1));
+  CHECK(event_is(4, PS2_PAGE_KEYBOARD, KEY_RIGHT_CTRL, 0));
+  CHECK(event_is(5, PS2_PAGE_KEYBOARD, KEY_LEFT_CTRL, 0));
+  CHECK(event_is(6, PS2_PAGE_KEYBOARD, KEY_USAGE(0x46), 1));
+  CHECK(event_is(7, PS2_PAGE_KEYBOARD, KEY_USAGE(0x46), 0));
+  CHECK(!has_event(PS2_PAGE_KEYBOARD, KEY_LEFT_SHIFT, 1));
+
+  // The E1 Pause sequence is a press and release of Pause, not of the ctrl
+  // and Num Lock codes inside it.
+  reset();
+  send(pause, sizeof(pause));
+  CHECK_EQ(event_count, 2);
+  CHECK(event_is(0, PS2_PAGE_KEYBOARD, KEY_USAGE(0x48), 1));
+  CHECK(event_is(1, PS2_PAGE_KEYBOARD, KEY_USAGE(0x48), 0));
+  CHECK_EQ(typed_length, 1);
+  CHECK_EQ(typed[0], 0x48);
+  CHECK_EQ(keys_held_by_host(), 0);
+
+  // Media and power keys go to the consumer and system pages.
+  reset();
+  send(media, sizeof(media));
+  CHECK_EQ(event_count, 4);
+  CHECK(event_is(0, PS2_PAGE_CONSUMER, CONSUMER_VOLUME_UP, 1));
+  CHECK(event_is(1, PS2_PAGE_CONSUMER, CONSUMER_VOLUME_UP, 0));
+  CHECK(event_is(2, PS2_PAGE_SYSTEM, SYSTEM_POWER_DOWN, 1));
+  CHECK(event_is(3, PS2_PAGE_SYSTEM, SYSTEM_POWER_DOWN, 0));
+
+  // The same keys arriving while their queue is full wait for room: the
+  // host still gets the press and then the release.
+  consumer_count = 0;
+  for (i = 0; USB_HID_Keyboard_ConsumerQueueSpace() > 0; i++) {
+    CHECK(USB_HID_Keyboard_ConsumerPress((i & 1) ? CONSUMER_MUTE : CONSUMER_VOLUME_DOWN));
+  }
+  for (i = 0; i < 5; i++) {
+    clock_frame(media[i], FRAME_OK, 11);
+  }
+  Sim_RunScheduler(20);
+  CHECK(consumer_count >= 2);
+  CHECK_EQ(consumer_usages[consumer_count - 2], CONSUMER_VOLUME_UP);
+  CHECK_EQ(consumer_usages[consumer_count - 1], 0);
+  system_count = 0;
+  for (i = 0; USB_HID_Keyboard_SystemQueueSpace() > 0; i++) {
+    CHECK(USB_HID_Keyboard_SystemPress((i & 1) ? SYSTEM_SLEEP : SYSTEM_WAKE_UP));
+  }
+  for (i = 5; i < 10; i++) {
+    clock_frame(media[i], FRAME_OK, 11);
+  }
+  Sim_RunScheduler(20);
+  CHECK(system_count >= 2);
+  CHECK_EQ(system_usages[system_count - 2], SYSTEM_POWER_DOWN);
+  CHECK_EQ(system_usages[system_count - 1], 0);
+
+  // Replies to host commands are ignored.
+  reset();
+  send(replies, sizeof(replies));
+  CHECK_EQ(event_count, 2);
+  CHECK(event_is(0, PS2_PAGE_KEYBOARD, KEY_USAGE(0x16), 1));
+
+  // A frame with a parity or stop bit error releases the keys held, the
+  // next frames decode again.
+  for (i = FRAME_BAD_PARITY; i <= FRAME_BAD_STOP; i++) {
+    reset();
+    send(hold, sizeof(hold));
+    CHECK_EQ(event_count, 2);
+    CHECK_EQ(keys_held_by_host(), 2);
+    clock_frame(0xF0, i, 11);
+    Sim_RunScheduler(10);
+    CHECK_EQ(event_count, 4);
+    CHECK(has_event(PS2_PAGE_KEYBOARD, KEY_USAGE(0x04), 0));
+    CHECK(has_event(PS2_PAGE_KEYBOARD, KEY_RIGHT_CTRL, 0));
+    CHECK_EQ(keys_held_by_host(), 0);
+    send(hello, 3);
+    CHECK_EQ(event_count, 6);
+    CHECK(event_is(4, PS2_PAGE_KEYBOARD, KEY_USAGE(0x0B), 1));
+  }
+
+  // Bits lost in the middle of a frame: the frame times out and the next
+  // one decodes from its start bit.
+  reset();
+  clock_frame(0x1C, FRAME_OK, 6);
+  Sim_RunScheduler(3);
+  send(hello, 3);
+  CHECK_EQ(event_count, 2);
+  CHECK(event_is(0, PS2_PAGE_KEYBOARD, KEY_USAGE(0x0B), 1));
+
+  // Idle high data before the start bit is skipped.
+  reset();
+  clock_bit(1);
+  clock_bit(1);
+  clock_frame(0x1C, FRAME_OK, 11);
+  clock_frame(0xF0, FRAME_OK, 11);
+  clock_frame(0x1C, FRAME_OK, 11);
+  Sim_RunScheduler(10);
+  CHECK_EQ(event_count, 2);
+  CHECK(event_is(0, PS2_PAGE_KEYBOARD, KEY_USAGE(0x04), 1));
+
+  // More codes than the queue holds before the scheduler runs: the overrun,
+  // reported ahead of the next code that fits, releases the keys held
+  // instead of leaving one stuck.
+  reset();
+  send(hold, sizeof(hold));
+  for (i = 0; i < 40; i++) {
+    clock_frame((i & 1) ? 0x1B : 0xF0, FRAME_OK, 11);
+  }
+  Sim_RunScheduler(40);
+  send(hello, 3);
+  CHECK(has_event(PS2_PAGE_KEYBOARD, KEY_USAGE(0x04), 0));
+  CHECK(has_event(PS2_PAGE_KEYBOARD, KEY_RIGHT_CTRL, 0));
+  CHECK_EQ(keys_held_by_host(), 0);
+  CHECK(event_is(event_count - 2, PS2_PAGE_KEYBOARD, KEY_USAGE(0x0B), 1));
+  CHECK(event_is(event_count - 1, PS2_PAGE_KEYBOARD, KEY_USAGE(0x0B), 0));
+
+  // The keyboard plugged in again sends its self-test code: keys released.
+  reset();
+  send(hold, sizeof(hold));
+  send(self_test, sizeof(self_test));
+  CHECK_EQ(event_count, 4);
+  CHECK_EQ(keys_held_by_host(), 0);
+
+  // Text typed at the keyboard's pace, overlapping keys like fast typing:
+  // every key reaches the host in order.
+  reset();
+  count = 0;
+  last = 0;
+  for (i = 0; text[i] != '\0'; i++) {
+    uint8_t code = (text[i] == ' ') ? SPACE_CODE : letter_codes[text[i] - 'a'];
+
+    // A key typed twice is released in between, otherwise the previous key
+    // is released after the next one is pressed.
+    if (code == last) {
+      codes[count++] = 0xF0;
+      codes[count++] = last;
+    }
+    codes[count++] = code;
+    if ((last != 0) && (code != last)) {
+      codes[count++] = 0xF0;
+      codes[count++] = last;
+    }
+    last = code;
+  }
+  codes[count++] = 0xF0;
+  codes[count++] = last;
+  send(codes, count);
+  CHECK_EQ(typed_length, (int) strlen(text));
+  for (i = 0; (i < typed_length) && (text[i] != '\0'); i++) {
+    uint8_t usage = (text[i] == ' ') ? SPACE_USAGE : (uint8_t) (0x04 + (text[i] - 'a'));
+
+    if (typed[i] != usage) {
+      CHECK_EQ(typed[i], usage);
+      break;
+    }
+  }
+  CHECK_EQ(keys_held_by_host(), 0);
+
+  Sim_Report("scan codes", count, "codes");
+  Sim_Report("keys typed", typed_length, "keys");
+  return Sim_Result();
+}
@@ -0,0 +1,204 @@
+/*!
+ * @file   recorder_test.c
+ * @brief  Report recorder and replayer: a session of keyboard, media and mouse
+ *         reports is recorded, flushed to flash and replayed, and the host
+ *         gets the same reports on the same frames relative to each other
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "usb_device.h"
+#include "usbd_hid.h"
+#include "usb_hid_keyboard.h"
+#include "usb_hid_mouse.h"
+#include "usb_hid_recorder.h"
+
+#include <string.h>
+
+#define POLL_INTERVAL  HID_FS_BINTERVAL
+#define MAX_REPORTS    4096
+
+extern const uint8_t _srecording[];
+extern const uint8_t _erecording[];
+
+/*
+ * Report received by the host.
+ */
+typedef struct {
+  uint8_t ep_addr;
+  uint8_t length;
+  uint8_t data[HID_EPIN_SIZE];
+  uint32_t frame;
+} Report;
+
+/*
+ * Reports of the session as recorded, and as replayed.
+ */
+static Report recorded[MAX_REPORTS];
+static int recorded_count;
+static Report replayed[MAX_REPORTS];
+static int replayed_count;
+static Report* capture;
+static int* capture_count;
+
+static void on_in(uint8_t ep_addr, const uint8_t* data, uint16_t length) {
+  Report* report;
+
+  if ((capture == NULL) || (*capture_count == MAX_REPORTS)) {
+    return;
+  }
+  report = &capture[(*capture_count)++];
+  report->ep_addr = ep_addr;
+  report->length = (uint8_t) length;
+  memcpy(report->data, data, length);
+  report->frame = UsbSim_GetFrame();
+}
+
+static void start_capture(Report* reports, int* count) {
+  capture = reports;
+  capture_count = count;
+  *count = 0;
+}
+
+// Recorded size of the reports from first on: the frame delta takes one
+// byte below 128 frames, two below 16384.
+static uint32_t recorded_size(const Report* reports, int first, int count) {
+  uint32_t size = 0;
+  uint32_t delta;
+  int i;
+
+  for (i = first; i < count; i++) {
+    delta = (i > first) ? (reports[i].frame - reports[i - 1].frame) : 0;
+    size += ((delta < 128) ? 1 : 2) + 2 + reports[i].length;
+  }
+  return size;
+}
+
+// The replay is the recording from first on: same endpoints, same report
+// bytes, same frames between reports. Return the reports that differ.
+static int compare_replay(int first) {
+  int differences = 0;
+  int i;
+
+  CHECK_EQ(replayed_count, recorded_count - first);
+  for (i = 0; (i < replayed_count) && ((first + i) < recorded_count); i++) {
+    const Report* a = &recorded[first + i];
+    const Report* b = &replayed[i];
+
+    if ((a->ep_addr != b->ep_addr) || (a->length != b->length) || (memcmp(a->data, b->data, a->length) != 0) ||
+        ((i > 0) && ((a->frame - a[-1].frame) != (b->frame - b[-1].frame)))) {
+      if (differences++ < 5) {
+        printf("report %d differs: endpoint %02x/%02x, frame delta %u/%u\n", i, a->ep_addr, b->ep_addr,
+               (unsigned) ((i > 0) ? (a->frame - a[-1].frame) : 0), (unsigned) ((i > 0) ? (b->frame - b[-1].frame) : 0));
+      }
+    }
+  }
+  return differences;
+}
+
+static void replay_stored(void) {
+  start_capture(replayed, &replayed_count);
+  CHECK(USB_HID_Replayer_StartStored());
+  CHECK(USB_HID_Replayer_IsRunning());
+  while (USB_HID_Replayer_IsRunning() && (Sim_GetTick() < 1000000)) {
+    Sim_Step();
+  }
+  Sim_Run(4 * POLL_INTERVAL);
+  capture = NULL;
+}
+
+int main(void) {
+  uint32_t size;
+  uint32_t replay_frames;
+  int session_reports;
+  int first;
+  int i;
+
+  MX_USB_DEVICE_Init();
+  CHECK(UsbSim_Enumerate());
+  UsbSim_SetInHandler(on_in);
+
+  // Nothing stored yet.
+  CHECK(!USB_HID_Replayer_StartStored());
+
+  // Session: typing, a pause longer than 127 frames, a media key, mouse
+  // moves and clicks, keyboard and mouse reports in the same frames.
+  start_capture(recorded, &recorded_count);
+  CHECK(USB_HID_Recorder_Start());
+  CHECK(USB_HID_Keyboard_Write((uint8_t*) "Hello", 5));
+  Sim_Run(20 * POLL_INTERVAL);
+  Sim_Run(300);
+  CHECK(USB_HID_Keyboard_ConsumerTap(CONSUMER_VOLUME_UP));
+  Sim_Run(50);
+  for (i = 0; i < 40; i++) {
+    CHECK(USB_HID_Mouse_Move(3 * i, -i, 0));
+    if ((i % 10) == 0) {
+      CHECK(USB_HID_Keyboard_Tap('x'));
+    }
+    Sim_Run((uint32_t) (1 + (i % 7)));
+  }
+  CHECK(USB_HID_Mouse_Click(BUTTON_LEFT));
+  Sim_Run(1000);
+  CHECK(USB_HID_Keyboard_Write((uint8_t*) "world\n", 6));
+  Sim_Run(20 * POLL_INTERVAL);
+
+  // Can't be flushed or replayed while recording.
+  CHECK(!USB_HID_Recorder_Flush());
+  CHECK(!USB_HID_Replayer_StartStored());
+  USB_HID_Recorder_Stop();
+  capture = NULL;
+
+  // Each report takes its bytes, the endpoint and length, and one byte of
+  // frame delta, two for the long pauses.
+  size = USB_HID_Recorder_GetSize();
+  CHECK_EQ(size, recorded_size(recorded, 0, recorded_count));
+
+  // Flushed behind its header, then replayed from flash.
+  CHECK(USB_HID_Recorder_Flush());
+  CHECK_EQ(_srecording[0] | (_srecording[1] << 8) | (_srecording[2] << 16) | ((uint32_t) _srecording[3] << 24),
+           RECORDING_MAGIC);
+  CHECK(memcmp(&_srecording[4], &size, 4) == 0);
+  replay_stored();
+  CHECK_EQ(compare_replay(0), 0);
+  replay_frames = replayed[replayed_count - 1].frame - replayed[0].frame;
+  CHECK_EQ(replay_frames, recorded[recorded_count - 1].frame - recorded[0].frame);
+
+  // A second replay of the same recording is identical.
+  replay_stored();
+  CHECK_EQ(compare_replay(0), 0);
+  session_reports = recorded_count;
+
+  // A session longer than the ring: the latest reports are kept, the replay
+  // starts with the oldest of them.
+  start_capture(recorded, &recorded_count);
+  CHECK(USB_HID_Recorder_Start());
+  for (i = 0; i < 1000; i++) {
+    CHECK(USB_HID_Mouse_Move((i % 5) - 2, (i % 3) - 1, 0));
+    Sim_Run((uint32_t) (1 + (i % 3)));
+  }
+  Sim_Run(10);
+  USB_HID_Recorder_Stop();
+  capture = NULL;
+  size = USB_HID_Recorder_GetSize();
+  CHECK(size <= RECORDER_BUFFER_SIZE);
+  for (first = recorded_count; (first > 0) && (recorded_size(recorded, first - 1, recorded_count) <= size); first--) {
+  }
+  CHECK_EQ(recorded_size(recorded, first, recorded_count), size);
+  CHECK(USB_HID_Recorder_Flush());
+  replay_stored();
+  CHECK_EQ(compare_replay(first), 0);
+
+  // Replaying blocks recording.
+  CHECK(USB_HID_Replayer_StartStored());
+  CHECK(!USB_HID_Recorder_Start());
+  USB_HID_Replayer_Stop();
+  CHECK(!USB_HID_Replayer_IsRunning());
+  CHECK(USB_HID_Recorder_Start());
+  USB_HID_Recorder_Stop();
+
+  Sim_Report("session reports", session_reports, "reports");
+  Sim_Report("session frames", replay_frames, "frames");
+  Sim_Report("long session reports", recorded_count, "reports");
+  Sim_Report("  kept in the ring", recorded_count - first, "reports");
+  Sim_Report("recorded bytes per mouse report", (double) size / (recorded_count - first), "bytes");
+  return Sim_Result();
+}
@@ -0,0 +1,143 @@
+/*!
+ * @file   scheduler_test.c
+ * @brief  Scheduler timing on the virtual tick: timers on time past the wheel
+ *         size, callbacks posted from interrupts, then a periodic task next
+ *         to a callback that hogs the core, for its jitter, drift and the
+ *         idle ratio
+ */
+#include "sim.h"
+#include "main.h"
+#include "scheduler.h"
+
+#define PERIOD          10
+#define PERIODS         1000
+#define HOG_PERIOD      37
+#define HOG_TIME        3
+
+/*
+ * Ticks at which the callbacks ran.
+ */
+static uint32_t runs[SCHEDULER_MAX_TIMERS + 1];
+static int run_count;
+
+/*
+ * Periodic task: tick of the next run on the ideal schedule and lateness of
+ * the runs against it. Drift would make the lateness grow.
+ */
+static uint32_t periodic_due;
+static int32_t last_jitter;
+static uint32_t periodic_runs;
+static int32_t max_jitter;
+static uint32_t early_runs;
+static int64_t total_jitter;
+
+/*
+ * Ticks that went by with a callback running.
+ */
+static int busy;
+static uint32_t busy_ticks;
+
+static void record(void* arg) {
+  runs[(uintptr_t) arg] = Sim_GetTick();
+  run_count++;
+}
+
+static void periodic(void* arg) {
+  int32_t jitter = (int32_t) (Sim_GetTick() - periodic_due);
+
+  if (jitter < 0) {
+    early_runs++;
+  }
+  if (jitter > max_jitter) {
+    max_jitter = jitter;
+  }
+  total_jitter += jitter;
+  last_jitter = jitter;
+  periodic_runs++;
+  if (periodic_runs < PERIODS) {
+    periodic_due += PERIOD;
+    Scheduler_PostDelayed(periodic, NULL, PERIOD);
+  }
+}
+
+// Work that keeps the core busy, like the HAL_Delay() loops the scheduler
+// replaced.
+static void hog(void* arg) {
+  busy = 1;
+  HAL_Delay(HOG_TIME - 1);
+  busy = 0;
+  if (periodic_runs < PERIODS) {
+    Scheduler_PostDelayed(hog, NULL, HOG_PERIOD);
+  }
+}
+
+// Start the periodic task and the hog, from a posted callback.
+static void start_tasks(void* arg) {
+  periodic_due = Sim_GetTick() + PERIOD;
+  CHECK(Scheduler_PostDelayed(periodic, NULL, PERIOD));
+  CHECK(Scheduler_PostDelayed(hog, NULL, 1));
+}
+
+static void interrupt(uint32_t tick) {
+  if (busy) {
+    busy_ticks++;
+  }
+  if (tick == 5000) {
+    Scheduler_Post(record, (void*) 0);
+  }
+}
+
+int main(void) {
+  static const uint32_t delays[] = {1, 31, 32, 33, 100, 1000};
+  uint32_t start;
+  uint32_t frames;
+  int i;
+
+  Scheduler_Init();
+  start = Sim_GetTick();
+
+  // On time, whether the delays hash to the same slot or take several laps.
+  for (i = 0; i < 6; i++) {
+    CHECK(Scheduler_PostDelayed(record, (void*) (uintptr_t) i, delays[i]));
+  }
+  CHECK(Scheduler_PostDelayed(record, (void*) 6, 2));
+  CHECK(Scheduler_PostDelayed(record, (void*) 7, 2));
+  CHECK(!Scheduler_PostDelayed(record, (void*) 8, 2));
+  Sim_RunScheduler(1100);
+  CHECK_EQ(run_count, 8);
+  for (i = 0; i < 6; i++) {
+    CHECK_EQ(runs[i] - start, delays[i]);
+  }
+  CHECK_EQ(runs[6] - start, 2);
+  CHECK_EQ(runs[7] - start, 2);
+
+  // Posted from an interrupt: runs in the same tick.
+  Sim_SetTickHook(interrupt);
+  Sim_RunScheduler(5000 + 10 - Sim_GetTick());
+  CHECK_EQ(run_count, 9);
+  CHECK_EQ(runs[0], 5000);
+
+  // Periodic task next to the hog: late runs don't delay the next ones.
+  CHECK(Scheduler_Post(start_tasks, NULL));
+  Sim_RunScheduler(1);
+  start = periodic_due - PERIOD;
+  while ((periodic_runs < PERIODS) && ((Sim_GetTick() - start) < (2 * PERIOD * PERIODS))) {
+    Sim_RunScheduler(PERIOD);
+  }
+  Sim_RunScheduler(2 * HOG_PERIOD);
+  frames = Sim_GetTick() - start;
+
+  CHECK_EQ(periodic_runs, PERIODS);
+  CHECK_EQ(periodic_due - start, PERIOD * PERIODS);
+  CHECK_EQ(last_jitter, 0);
+  CHECK_EQ(early_runs, 0);
+  CHECK(max_jitter <= HOG_TIME);
+  CHECK(busy_ticks > 0);
+
+  Sim_Report("periodic runs", periodic_runs, "runs");
+  Sim_Report("lateness of the last run", last_jitter, "ms");
+  Sim_Report("jitter, worst", max_jitter, "ms");
+  Sim_Report("jitter, mean", (double) total_jitter / periodic_runs, "ms");
+  Sim_Report("idle ratio", 100.0 * (frames - busy_ticks) / frames, "%");
+  return Sim_Result();
+}
@@ -0,0 +1,183 @@
+/*!
+ * @file   core_cm3.h
+ * @brief  Host stand-in for the CMSIS Cortex-M3 core header
+ *
+ * Shadows Drivers/CMSIS/Include/core_cm3.h in the host builds. The device
+ * header (stm32f103xb.h) and the HAL headers only need the qualifiers, the
+ * compiler helpers and the core peripheral layout, so this header provides
+ * those and replaces the intrinsics by host equivalents. The interrupt mask
+ * is a plain variable: interrupts are raised synchronously by the simulator,
+ * so nothing can preempt a masked section anyway.
+ *
+ * The core peripherals sit at their usual addresses, mapped by sim_memory.c
+ * like the rest of the peripheral space.
+ */
+#ifndef SIM_CORE_CM3_H_
+#define SIM_CORE_CM3_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Qualifiers and compiler helpers.
+ */
+#define __I      volatile const
+#define __O      volatile
+#define __IO     volatile
+#define __IM     volatile const
+#define __OM     volatile
+#define __IOM    volatile
+
+#define __ASM                  __asm
+#define __INLINE               inline
+#define __STATIC_INLINE        static inline
+#define __STATIC_FORCEINLINE   __attribute__((always_inline)) static inline
+#define __NO_RETURN            __attribute__((__noreturn__))
+#define __USED                 __attribute__((used))
+#define __WEAK                 __attribute__((weak))
+#define __PACKED               __attribute__((packed, aligned(1)))
+#define __PACKED_STRUCT        struct __attribute__((packed, aligned(1)))
+#define __ALIGNED(x)           __attribute__((aligned(x)))
+#define __RESTRICT             __restrict
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpacked"
+#pragma GCC diagnostic ignored "-Wattributes"
+__PACKED_STRUCT T_UINT16_WRITE { uint16_t v; };
+__PACKED_STRUCT T_UINT16_READ { uint16_t v; };
+__PACKED_STRUCT T_UINT32_WRITE { uint32_t v; };
+__PACKED_STRUCT T_UINT32_READ { uint32_t v; };
+#pragma GCC diagnostic pop
+
+#define __UNALIGNED_UINT16_WRITE(addr, val)  (void)((((struct T_UINT16_WRITE *)(void *)(addr))->v) = (val))
+#define __UNALIGNED_UINT16_READ(addr)        (((const struct T_UINT16_READ *)(const void *)(addr))->v)
+#define __UNALIGNED_UINT32_WRITE(addr, val)  (void)((((struct T_UINT32_WRITE *)(void *)(addr))->v) = (val))
+#define __UNALIGNED_UINT32_READ(addr)        (((const struct T_UINT32_READ *)(const void *)(addr))->v)
+
+/**
+ * Interrupt mask and core instructions.
+ */
+extern volatile uint32_t sim_primask;
+
+void Sim_WaitForInterrupt(void);
+
+__STATIC_INLINE void __enable_irq(void) {
+  sim_primask = 0U;
+}
+
+__STATIC_INLINE void __disable_irq(void) {
+  sim_primask = 1U;
+}
+
+__STATIC_INLINE uint32_t __get_PRIMASK(void) {
+  return sim_primask;
+}
+
+__STATIC_INLINE void __set_PRIMASK(uint32_t primask) {
+  sim_primask = primask & 1U;
+}
+
+#define __WFI()  Sim_WaitForInterrupt()
+#define __WFE()  Sim_WaitForInterrupt()
+#define __NOP()  do { } while (0)
+#define __SEV()  do { } while (0)
+#define __DSB()  __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define __DMB()  __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define __ISB()  __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+/**
+ * Nested vectored interrupt controller.
+ */
+typedef struct {
+  __IOM uint32_t ISER[8U];
+  uint32_t RESERVED0[24U];
+  __IOM uint32_t ICER[8U];
+  uint32_t RESERVED1[24U];
+  __IOM uint32_t ISPR[8U];
+  uint32_t RESERVED2[24U];
+  __IOM uint32_t ICPR[8U];
+  uint32_t RESERVED3[24U];
+  __IOM uint32_t IABR[8U];
+  uint32_t RESERVED4[56U];
+  __IOM uint8_t  IP[240U];
+  uint32_t RESERVED5[644U];
+  __OM  uint32_t STIR;
+} NVIC_Type;
+
+/**
+ * System control block.
+ */
+typedef struct {
+  __IM  uint32_t CPUID;
+  __IOM uint32_t ICSR;
+  __IOM uint32_t VTOR;
+  __IOM uint32_t AIRCR;
+  __IOM uint32_t SCR;
+  __IOM uint32_t CCR;
+  __IOM uint8_t  SHP[12U];
+  __IOM uint32_t SHCSR;
+  __IOM uint32_t CFSR;
+  __IOM uint32_t HFSR;
+  __IOM uint32_t DFSR;
+  __IOM uint32_t MMFAR;
+  __IOM uint32_t BFAR;
+  __IOM uint32_t AFSR;
+  __IM  uint32_t PFR[2U];
+  __IM  uint32_t DFR;
+  __IM  uint32_t ADR;
+  __IM  uint32_t MMFR[4U];
+  __IM  uint32_t ISAR[5U];
+  uint32_t RESERVED0[5U];
+  __IOM uint32_t CPACR;
+} SCB_Type;
+
+#define SCB_SCR_SEVONPEND_Pos       4U
+#define SCB_SCR_SEVONPEND_Msk       (1UL << SCB_SCR_SEVONPEND_Pos)
+#define SCB_SCR_SLEEPDEEP_Pos       2U
+#define SCB_SCR_SLEEPDEEP_Msk       (1UL << SCB_SCR_SLEEPDEEP_Pos)
+#define SCB_SCR_SLEEPONEXIT_Pos     1U
+#define SCB_SCR_SLEEPONEXIT_Msk     (1UL << SCB_SCR_SLEEPONEXIT_Pos)
+
+#define SCB_SHCSR_USGFAULTENA_Pos   18U
+#define SCB_SHCSR_USGFAULTENA_Msk   (1UL << SCB_SHCSR_USGFAULTENA_Pos)
+#define SCB_SHCSR_BUSFAULTENA_Pos   17U
+#define SCB_SHCSR_BUSFAULTENA_Msk   (1UL << SCB_SHCSR_BUSFAULTENA_Pos)
+#define SCB_SHCSR_MEMFAULTENA_Pos   16U
+#define SCB_SHCSR_MEMFAULTENA_Msk   (1UL << SCB_SHCSR_MEMFAULTENA_Pos)
+
+/**
+ * System timer.
+ */
+typedef struct {
+  __IOM uint32_t CTRL;
+  __IOM uint32_t LOAD;
+  __IOM uint32_t VAL;
+  __IM  uint32_t CALIB;
+} SysTick_Type;
+
+#define SysTick_CTRL_COUNTFLAG_Pos  16U
+#define SysTick_CTRL_COUNTFLAG_Msk  (1UL << SysTick_CTRL_COUNTFLAG_Pos)
+#define SysTick_CTRL_CLKSOURCE_Pos  2U
+#define SysTick_CTRL_CLKSOURCE_Msk  (1UL << SysTick_CTRL_CLKSOURCE_Pos)
+#define SysTick_CTRL_TICKINT_Pos    1U
+#define SysTick_CTRL_TICKINT_Msk    (1UL << SysTick_CTRL_TICKINT_Pos)
+#define SysTick_CTRL_ENABLE_Pos     0U
+#define SysTick_CTRL_ENABLE_Msk     (1UL)
+
+#define SCS_BASE      (0xE000E000UL)
+#define SysTick_BASE  (SCS_BASE + 0x0010UL)
+#define NVIC_BASE     (SCS_BASE + 0x0100UL)
+#define SCB_BASE      (SCS_BASE + 0x0D00UL)
+
+#define SCB      ((SCB_Type*) SCB_BASE)
+#define SysTick  ((SysTick_Type*) SysTick_BASE)
+#define NVIC     ((NVIC_Type*) NVIC_BASE)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SIM_CORE_CM3_H_
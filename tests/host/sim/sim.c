@@ -0,0 +1,100 @@
+/*!
+ * @file   sim.c
+ * @brief  Virtual time and test checks
+ */
+#include "sim.h"
+#include "usb_sim.h"
+#include "scheduler.h"
+
+#include <setjmp.h>
+
+volatile uint32_t sim_primask;
+
+static uint32_t tick;
+static SimTickHook tick_hook;
+
+// Return point and end tick of Sim_RunScheduler().
+static jmp_buf scheduler_exit;
+static int scheduler_running;
+static uint32_t scheduler_end;
+
+static int checks;
+static int failures;
+
+void Sim_Step(void) {
+  tick++;
+  UsbSim_Frame();
+  if (tick_hook != NULL) {
+    tick_hook(tick);
+  }
+}
+
+void Sim_Run(uint32_t ms) {
+  while (ms-- > 0) {
+    Sim_Step();
+  }
+}
+
+void Sim_WaitForInterrupt(void) {
+  // The next interrupt is at the latest the tick (and the USB frame).
+  Sim_Step();
+  if (scheduler_running && ((int32_t) (tick - scheduler_end) >= 0)) {
+    longjmp(scheduler_exit, 1);
+  }
+}
+
+static int run_scheduler(void) {
+  Scheduler_Run();
+  return 0;
+}
+
+void Sim_RunScheduler(uint32_t ms) {
+  Sim_RunMain(run_scheduler, ms);
+}
+
+void Sim_RunMain(int (*entry)(void), uint32_t ms) {
+  scheduler_end = tick + ms;
+  if (setjmp(scheduler_exit) == 0) {
+    scheduler_running = 1;
+    entry();
+  }
+  // Left from the idle hook, which runs with interrupts masked.
+  scheduler_running = 0;
+  sim_primask = 0;
+}
+
+uint32_t Sim_GetTick(void) {
+  return tick;
+}
+
+void Sim_SetTickHook(SimTickHook hook) {
+  tick_hook = hook;
+}
+
+int Sim_Check(int passed, const char* file, int line, const char* text) {
+  checks++;
+  if (!passed) {
+    failures++;
+    printf("%s:%d: check failed: %s\n", file, line, text);
+  }
+  return passed;
+}
+
+int Sim_CheckEqual(long long actual, long long expected, const char* file, int line, const char* text) {
+  checks++;
+  if (actual != expected) {
+    failures++;
+    printf("%s:%d: check failed: %s is %lld, expected %lld\n", file, line, text, actual, expected);
+    return 0;
+  }
+  return 1;
+}
+
+void Sim_Report(const char* name, double value, const char* unit) {
+  printf("%-40s %12.1f %s\n", name, value, unit);
+}
+
+int Sim_Result(void) {
+  printf("%d checks, %d failed\n", checks, failures);
+  return (failures == 0) ? 0 : 1;
+}
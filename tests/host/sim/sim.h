@@ -0,0 +1,116 @@
+/*!
+ * @file   sim.h
+ * @brief  Host simulation of the STM32F103 for the firmware tests
+ *
+ * The firmware sources are built for the host against the real device and HAL
+ * headers. The memory map is reproduced by sim_memory.c, the HAL functions the
+ * firmware calls outside the USB driver are emulated by sim_hal.c and the USB
+ * driver itself by the virtual host in usb_sim.c.
+ *
+ * Time is virtual: the millisecond tick only moves when the test steps it or
+ * when the firmware waits (HAL_Delay(), WFI in the scheduler). Every step runs
+ * the millisecond handlers: the USB frame, then the test's own hook.
+ */
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Flash memory, erased when the test starts.
+ */
+#define SIM_FLASH_BASE  0x08000000
+#define SIM_FLASH_SIZE  0x10000
+
+/**
+ * Handler run on each tick, after the USB frame.
+ */
+typedef void (*SimTickHook)(uint32_t tick);
+
+/*!
+ * @brief Advance the virtual time by one millisecond.
+ * @return None.
+ */
+void Sim_Step(void);
+
+/*!
+ * @brief Advance the virtual time.
+ *
+ * @param[in] ms Number of milliseconds.
+ * @return    None.
+ */
+void Sim_Run(uint32_t ms);
+
+/*!
+ * @brief Run Scheduler_Run() for the given virtual time, then return.
+ *
+ * @param[in] ms Number of milliseconds.
+ * @return    None.
+ */
+void Sim_RunScheduler(uint32_t ms);
+
+/*!
+ * @brief Run a firmware main() for the given virtual time, then return. The
+ *        main() must end in Scheduler_Run(), which goes on afterwards with
+ *        Sim_RunScheduler().
+ *
+ * @param[in] entry The firmware main(), built under another name.
+ * @param[in] ms    Number of milliseconds.
+ * @return    None.
+ */
+void Sim_RunMain(int (*entry)(void), uint32_t ms);
+
+/*!
+ * @brief Get the virtual time.
+ * @return Milliseconds since the start of the test.
+ */
+uint32_t Sim_GetTick(void);
+
+/*!
+ * @brief Set the handler run on each tick.
+ *
+ * @param[in] hook Handler, NULL for none.
+ * @return    None.
+ */
+void Sim_SetTickHook(SimTickHook hook);
+
+/**
+ * Test checks. A failed check is reported and the test goes on, the result
+ * of the test is returned by Sim_Result().
+ */
+#define CHECK(cond) \
+  Sim_Check((cond) != 0, __FILE__, __LINE__, #cond)
+
+#define CHECK_EQ(actual, expected) \
+  Sim_CheckEqual((long long) (actual), (long long) (expected), __FILE__, __LINE__, #actual)
+
+/*!
+ * @brief Record a check.
+ * @return True (1) if the check passed, otherwise false (0).
+ */
+int Sim_Check(int passed, const char* file, int line, const char* text);
+
+/*!
+ * @brief Record a check of a value.
+ * @return True (1) if the value is the expected one, otherwise false (0).
+ */
+int Sim_CheckEqual(long long actual, long long expected, const char* file, int line, const char* text);
+
+/*!
+ * @brief Print a measurement, for the benchmarks.
+ *
+ * @param[in] name  Name of the measurement.
+ * @param[in] value Value.
+ * @param[in] unit  Unit.
+ * @return    None.
+ */
+void Sim_Report(const char* name, double value, const char* unit);
+
+/*!
+ * @brief Result of the test, to be returned from main().
+ * @return 0 if all checks passed, otherwise 1.
+ */
+int Sim_Result(void);
+
+#endif // SIM_H_
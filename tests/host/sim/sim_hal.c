@@ -0,0 +1,140 @@
+/*!
+ * @file   sim_hal.c
+ * @brief  HAL functions used by the firmware outside the USB driver
+ *
+ * The tick is the virtual time, waiting steps it. GPIO and NVIC setup have no
+ * effect: the tests drive the input data registers and call the interrupt
+ * handlers themselves. The flash behaves like the real one: programming only
+ * clears bits of an erased half word, and only while the flash is unlocked.
+ * Clock setup has no effect either, so a firmware main() runs as it is.
+ */
+#include "sim.h"
+#include "main.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static int flash_locked = 1;
+
+uint32_t HAL_GetTick(void) {
+  return Sim_GetTick();
+}
+
+void HAL_Delay(uint32_t Delay) {
+  Sim_Run(Delay + 1);
+}
+
+// Weak: a firmware main.c built into a test brings its own.
+__WEAK void Error_Handler(void) {
+  fprintf(stderr, "sim: Error_Handler() called\n");
+  abort();
+}
+
+HAL_StatusTypeDef HAL_Init(void) {
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef* RCC_OscInitStruct) {
+  (void) RCC_OscInitStruct;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef* RCC_ClkInitStruct, uint32_t FLatency) {
+  (void) RCC_ClkInitStruct;
+  (void) FLatency;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RCCEx_PeriphCLKConfig(RCC_PeriphCLKInitTypeDef* PeriphClkInit) {
+  (void) PeriphClkInit;
+  return HAL_OK;
+}
+
+void HAL_GPIO_Init(GPIO_TypeDef* GPIOx, GPIO_InitTypeDef* GPIO_Init) {
+  (void) GPIOx;
+  (void) GPIO_Init;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState) {
+  (void) GPIOx;
+  (void) GPIO_Pin;
+  (void) PinState;
+}
+
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority) {
+  (void) IRQn;
+  (void) PreemptPriority;
+  (void) SubPriority;
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn) {
+  (void) IRQn;
+}
+
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn) {
+  (void) IRQn;
+}
+
+uint32_t HAL_RCC_GetHCLKFreq(void) {
+  return 72000000;
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void) {
+  return 36000000;
+}
+
+uint32_t HAL_RCC_GetPCLK2Freq(void) {
+  return 72000000;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void) {
+  flash_locked = 0;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void) {
+  flash_locked = 1;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data) {
+  int halfwords = (TypeProgram == FLASH_TYPEPROGRAM_HALFWORD) ? 1 :
+                  (TypeProgram == FLASH_TYPEPROGRAM_WORD) ? 2 : 4;
+  int i;
+
+  if (flash_locked || ((Address & 1) != 0) || (Address < SIM_FLASH_BASE) ||
+      ((Address + (2 * halfwords)) > (SIM_FLASH_BASE + SIM_FLASH_SIZE))) {
+    return HAL_ERROR;
+  }
+  for (i = 0; i < halfwords; i++) {
+    volatile uint16_t* cell = (volatile uint16_t*) (uintptr_t) (Address + (2 * i));
+    uint16_t value = (uint16_t) (Data >> (16 * i));
+
+    // Only an erased half word can be programmed (or any half word cleared).
+    if ((*cell != 0xFFFF) && (value != 0)) {
+      return HAL_ERROR;
+    }
+    *cell = value;
+  }
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef* pEraseInit, uint32_t* PageError) {
+  uint32_t start = SIM_FLASH_BASE;
+  uint32_t size = SIM_FLASH_SIZE;
+
+  *PageError = 0xFFFFFFFF;
+  if (flash_locked) {
+    return HAL_ERROR;
+  }
+  if (pEraseInit->TypeErase == FLASH_TYPEERASE_PAGES) {
+    start = pEraseInit->PageAddress & ~(FLASH_PAGE_SIZE - 1);
+    size = pEraseInit->NbPages * FLASH_PAGE_SIZE;
+    if ((start < SIM_FLASH_BASE) || ((start + size) > (SIM_FLASH_BASE + SIM_FLASH_SIZE))) {
+      *PageError = start;
+      return HAL_ERROR;
+    }
+  }
+  memset((void*) (uintptr_t) start, 0xFF, size);
+  return HAL_OK;
+}
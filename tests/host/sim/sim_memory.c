@@ -0,0 +1,51 @@
+/*!
+ * @file   sim_memory.c
+ * @brief  Memory map of the STM32F103 on the host
+ *
+ * The firmware addresses the flash, the device ID and the peripherals through
+ * fixed addresses (GPIOA->IDR, TIM2->CNT, the USB packet memory...). The same
+ * ranges are mapped here as plain memory before main() runs, so the firmware
+ * sources build unchanged and the tests drive the "hardware" by writing the
+ * registers directly. The host builds are linked without PIE, which keeps the
+ * executable well below these addresses.
+ */
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/**
+ * Mapped range.
+ */
+typedef struct {
+  uintptr_t base;
+  size_t size;
+  uint8_t fill;
+} Region;
+
+static const Region regions[] = {
+  {SIM_FLASH_BASE, SIM_FLASH_SIZE, 0xFF},  // Erased flash.
+  {0x1FFFF000, 0x1000, 0x00},              // System memory, device ID.
+  {0x40000000, 0x24000, 0x00},             // APB1, APB2 and AHB peripherals.
+  {0xE000E000, 0x1000, 0x00},              // System control space.
+};
+
+/*!
+ * @brief Map the regions, before any constructor of the tests runs.
+ * @return None.
+ */
+__attribute__((constructor(101))) static void map_regions(void) {
+  size_t i;
+
+  for (i = 0; i < sizeof(regions) / sizeof(regions[0]); i++) {
+    void* p = mmap((void*) regions[i].base, regions[i].size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (p != (void*) regions[i].base) {
+      fprintf(stderr, "sim: cannot map 0x%08lx\n", (unsigned long) regions[i].base);
+      exit(2);
+    }
+    memset(p, regions[i].fill, regions[i].size);
+  }
+}
@@ -0,0 +1,523 @@
+/*!
+ * @file   usb_reg_sim.c
+ * @brief  Register level model of the USB peripheral and virtual host
+ */
+#include "usb_reg_sim.h"
+#include "usb_sim.h"
+#include "sim.h"
+
+#include <string.h>
+
+#define FRAME_NS  1000000ULL
+
+/*
+ * Bus time in bytes at 12 Mbit/s, as in usb_sim.c.
+ */
+#define SOF_BYTES       6
+#define PACKET_OVERHEAD 12
+#define NAK_BYTES       8
+#define EOF_BYTES       16
+
+#define EP_COUNT  8
+
+/*
+ * Endpoint register bits by access type: read/write, toggled by writing 1,
+ * cleared by writing 0.
+ */
+#define EP_RW_BITS      (USB_EP_T_FIELD | USB_EP_KIND | USB_EPADDR_FIELD)
+#define EP_TOGGLE_BITS  (USB_EP_DTOG_RX | USB_EPRX_STAT | USB_EP_DTOG_TX | USB_EPTX_STAT)
+#define EP_CTR_BITS     (USB_EP_CTR_RX | USB_EP_CTR_TX)
+
+/*
+ * Half words of an entry of the buffer descriptor table. A double buffered
+ * endpoint uses the TX pair for its buffer 0 and the RX pair for buffer 1.
+ */
+#define BD_ADDR_TX   0
+#define BD_COUNT_TX  1
+#define BD_ADDR_RX   2
+#define BD_COUNT_RX  3
+
+#define COUNT_MASK   0x03FF
+
+/**
+ * Host side of an endpoint direction.
+ */
+typedef struct {
+  uint64_t ready_ns;  // NAK until then: the interrupt has not freed a buffer.
+  const uint8_t* host_data;
+  uint32_t host_length;
+  uint32_t host_sent;
+  UsbSimStats stats;
+} Pipe;
+
+/**
+ * USB interrupt in progress. The code runs at once, its register writes take
+ * effect at the time they would on the target.
+ */
+typedef struct {
+  int active;
+  int copied;         // The driver has copied a packet to or from the PMA.
+  uint64_t entry_ns;  // Interrupt entered.
+  uint64_t end_ns;    // Packet copied.
+} Service;
+
+static PCD_HandleTypeDef* pcd;
+
+static Pipe in_pipes[EP_COUNT];
+static Pipe out_pipes[EP_COUNT];
+
+// Bus time and end of the interrupt servicing the last packet.
+static uint64_t now_ns;
+static uint64_t service_end_ns;
+static uint32_t service_base_ns = 6000;
+static uint32_t service_byte_ns = 100;
+static Service service;
+
+static UsbSimInHandler in_handler;
+
+/*!
+ * @brief Get an endpoint register.
+ *
+ * @param[in] ep_num Endpoint register number.
+ * @return    Register.
+ */
+static volatile uint16_t* endpoint_register(uint8_t ep_num);
+
+/*!
+ * @brief Get a half word of the buffer descriptor table.
+ *
+ * @param[in] ep_num Endpoint register number.
+ * @param[in] field  BD_ADDR_TX, BD_COUNT_TX, BD_ADDR_RX or BD_COUNT_RX.
+ * @return    Half word in the packet memory.
+ */
+static volatile uint16_t* descriptor(uint8_t ep_num, uint8_t field);
+
+/*!
+ * @brief Copy between the packet memory and a host buffer.
+ *
+ * @param[in]     address Packet memory address, as seen by the USB peripheral.
+ * @param[in,out] data    Host buffer.
+ * @param[in]     length  Number of bytes.
+ * @return        None.
+ */
+static void pma_read(uint16_t address, uint8_t* data, uint32_t length);
+static void pma_write(uint16_t address, const uint8_t* data, uint32_t length);
+
+/*!
+ * @brief Tell whether an endpoint register selects double buffering.
+ *
+ * @param[in] value Register value.
+ * @return    True (1) for a double buffered bulk endpoint, otherwise false (0).
+ */
+static int double_buffered(uint16_t value);
+
+/*!
+ * @brief Tell whether the peripheral has a buffer for the next transaction.
+ *        A double buffered endpoint has one while DTOG differs from SW_BUF
+ *        (the DTOG bit of the other direction).
+ *
+ * @param[in] value Register value.
+ * @return    True (1) if the endpoint accepts the next transaction, otherwise
+ *            false (0).
+ */
+static int tx_ready(uint16_t value);
+static int rx_ready(uint16_t value);
+
+/*!
+ * @brief Update the CTR, DIR and EP_ID bits of ISTR from the endpoint
+ *        registers: the lowest endpoint with a CTR bit set is reported.
+ * @return None.
+ */
+static void update_istr(void);
+
+/*!
+ * @brief Get the time a register write of the driver takes effect.
+ * @return Time in nanoseconds.
+ */
+static uint64_t write_time(void);
+
+/*!
+ * @brief Entry hook of the functions of stm32f1xx_ll_usb.c, built with
+ *        -finstrument-functions: notes the packet memory copies.
+ *
+ * @param[in] this_fn   Function entered.
+ * @param[in] call_site Caller.
+ * @return    None.
+ */
+void __cyg_profile_func_enter(void* this_fn, void* call_site) __attribute__((no_instrument_function));
+void __cyg_profile_func_exit(void* this_fn, void* call_site) __attribute__((no_instrument_function));
+
+/*!
+ * @brief Get the time a number of bytes take on the bus.
+ *
+ * @param[in] bytes Number of bytes.
+ * @return    Time in nanoseconds.
+ */
+static uint64_t bus_ns(uint32_t bytes);
+
+/*!
+ * @brief Run one transaction on a bulk endpoint at the current bus time, and
+ *        advance the bus time.
+ *
+ * @param[in] ep_addr Endpoint address.
+ * @return    True (1) if data was transferred, false (0) if the endpoint
+ *            answered NAK or STALL.
+ */
+static int transaction(uint8_t ep_addr);
+
+/*!
+ * @brief Run the USB interrupt for a completed transaction.
+ *
+ * @param[in] ep_addr Endpoint address.
+ * @param[in] length  Length of the packet.
+ * @return    None.
+ */
+static void interrupt(uint8_t ep_addr, uint32_t length);
+
+/*
+ * Peripheral.
+ */
+
+void UsbRegSim_WriteEndpoint(uint8_t ep_num, uint16_t value) {
+  volatile uint16_t* reg = endpoint_register(ep_num);
+  uint16_t old = *reg;
+  uint16_t new_value;
+
+  new_value = (uint16_t) ((value & EP_RW_BITS) | ((old ^ value) & EP_TOGGLE_BITS) |
+                          (old & value & EP_CTR_BITS) | (old & USB_EP_SETUP));
+  *reg = new_value;
+  if (!tx_ready(old) && tx_ready(new_value)) {
+    in_pipes[ep_num].ready_ns = write_time();
+  }
+  if (!rx_ready(old) && rx_ready(new_value)) {
+    out_pipes[ep_num].ready_ns = write_time();
+  }
+  update_istr();
+}
+
+void __cyg_profile_func_enter(void* this_fn, void* call_site) {
+  if ((this_fn == (void*) USB_WritePMA) || (this_fn == (void*) USB_ReadPMA)) {
+    service.copied = 1;
+  }
+}
+
+void __cyg_profile_func_exit(void* this_fn, void* call_site) {
+}
+
+void UsbRegSim_Attach(PCD_HandleTypeDef* hpcd) {
+  uint8_t i;
+
+  // Bus reset: the endpoints are disabled until the driver opens them.
+  for (i = 0; i < EP_COUNT; i++) {
+    *endpoint_register(i) = 0;
+  }
+  update_istr();
+  pcd = hpcd;
+  memset(in_pipes, 0, sizeof(in_pipes));
+  memset(out_pipes, 0, sizeof(out_pipes));
+  service_end_ns = 0;
+}
+
+/*
+ * Virtual host.
+ */
+
+void UsbSim_Frame(void) {
+  static uint32_t round_robin;
+  uint32_t frame = Sim_GetTick();
+  uint64_t frame_end;
+  uint8_t bulk[2 * EP_COUNT];
+  int bulk_count = 0;
+  uint8_t i;
+
+  if (pcd == NULL) {
+    return;
+  }
+  now_ns = (uint64_t) frame * FRAME_NS;
+  frame_end = now_ns + FRAME_NS - bus_ns(EOF_BYTES);
+  now_ns += bus_ns(SOF_BYTES);
+
+  for (i = 1; i < EP_COUNT; i++) {
+    uint16_t value = *endpoint_register(i);
+
+    if ((value & USB_EP_T_FIELD) != USB_EP_BULK) {
+      continue;
+    }
+    if ((value & USB_EPTX_STAT) != USB_EP_TX_DIS) {
+      bulk[bulk_count++] = (uint8_t) (i | 0x80);
+    }
+    if (((value & USB_EPRX_STAT) != USB_EP_RX_DIS) && (out_pipes[i].host_sent < out_pipes[i].host_length)) {
+      bulk[bulk_count++] = i;
+    }
+  }
+
+  while (bulk_count > 0) {
+    uint64_t next_ready = UINT64_MAX;
+    int moved = 0;
+    int k;
+
+    for (k = 0; k < bulk_count; k++) {
+      uint8_t ep_addr = bulk[(round_robin + k) % bulk_count];
+      uint8_t ep_num = ep_addr & EP_ADDR_MSK;
+      Pipe* pipe = ((ep_addr & 0x80) != 0) ? &in_pipes[ep_num] : &out_pipes[ep_num];
+      uint16_t value;
+
+      if (((ep_addr & 0x80) == 0) && (pipe->host_sent >= pipe->host_length)) {
+        continue;
+      }
+      if ((now_ns + bus_ns(64 + PACKET_OVERHEAD)) > frame_end) {
+        return;
+      }
+      moved |= transaction(ep_addr);
+      value = *endpoint_register(ep_num);
+      if ((((ep_addr & 0x80) != 0) ? tx_ready(value) : rx_ready(value)) && (pipe->ready_ns < next_ready)) {
+        next_ready = (pipe->ready_ns > now_ns) ? pipe->ready_ns : now_ns;
+      }
+    }
+    round_robin++;
+    if (!moved) {
+      // Everything answered NAK: nothing changes before the interrupt frees
+      // a buffer.
+      if (next_ready >= frame_end) {
+        return;
+      }
+      now_ns = next_ready;
+    }
+  }
+}
+
+uint32_t UsbSim_GetFrame(void) {
+  return Sim_GetTick();
+}
+
+void UsbSim_SetInHandler(UsbSimInHandler handler) {
+  in_handler = handler;
+}
+
+int UsbSim_Out(uint8_t ep_addr, const uint8_t* data, uint32_t length) {
+  Pipe* pipe = &out_pipes[ep_addr & EP_ADDR_MSK];
+
+  if (pipe->host_sent < pipe->host_length) {
+    return 0;
+  }
+  pipe->host_data = data;
+  pipe->host_length = length;
+  pipe->host_sent = 0;
+  return 1;
+}
+
+uint32_t UsbSim_OutPending(uint8_t ep_addr) {
+  Pipe* pipe = &out_pipes[ep_addr & EP_ADDR_MSK];
+
+  return pipe->host_length - pipe->host_sent;
+}
+
+const UsbSimStats* UsbSim_GetStats(uint8_t ep_addr) {
+  return ((ep_addr & 0x80) != 0) ? &in_pipes[ep_addr & EP_ADDR_MSK].stats
+                                 : &out_pipes[ep_addr & EP_ADDR_MSK].stats;
+}
+
+void UsbSim_SetServiceTime(uint32_t base_ns, uint32_t per_byte_ns) {
+  service_base_ns = base_ns;
+  service_byte_ns = per_byte_ns;
+}
+
+static volatile uint16_t* endpoint_register(uint8_t ep_num) {
+  return &USB->EP0R + (ep_num * 2U);
+}
+
+static volatile uint16_t* descriptor(uint8_t ep_num, uint8_t field) {
+  uint16_t address = (uint16_t) (USB->BTABLE + (ep_num * 8U) + (field * 2U));
+
+  return (volatile uint16_t*) (USB_PMAADDR + ((uint32_t) address * PMA_ACCESS));
+}
+
+static void pma_read(uint16_t address, uint8_t* data, uint32_t length) {
+  uint32_t i;
+
+  for (i = 0; i < length; i++) {
+    uint32_t byte = address + i;
+    uint16_t word = *(volatile uint16_t*) (USB_PMAADDR + ((byte & ~1U) * PMA_ACCESS));
+
+    data[i] = (uint8_t) (((byte & 1U) != 0) ? (word >> 8) : word);
+  }
+}
+
+static void pma_write(uint16_t address, const uint8_t* data, uint32_t length) {
+  uint32_t i;
+
+  for (i = 0; i < length; i++) {
+    uint32_t byte = address + i;
+    volatile uint16_t* word = (volatile uint16_t*) (USB_PMAADDR + ((byte & ~1U) * PMA_ACCESS));
+
+    if ((byte & 1U) != 0) {
+      *word = (uint16_t) ((*word & 0x00FF) | (data[i] << 8));
+    } else {
+      *word = (uint16_t) ((*word & 0xFF00) | data[i]);
+    }
+  }
+}
+
+static int double_buffered(uint16_t value) {
+  return ((value & USB_EP_T_FIELD) == USB_EP_BULK) && ((value & USB_EP_KIND) != 0);
+}
+
+static int tx_ready(uint16_t value) {
+  if ((value & USB_EPTX_STAT) != USB_EP_TX_VALID) {
+    return 0;
+  }
+  return !double_buffered(value) || (((value & USB_EP_DTOG_TX) != 0) != ((value & USB_EP_DTOG_RX) != 0));
+}
+
+static int rx_ready(uint16_t value) {
+  if ((value & USB_EPRX_STAT) != USB_EP_RX_VALID) {
+    return 0;
+  }
+  return !double_buffered(value) || (((value & USB_EP_DTOG_RX) != 0) != ((value & USB_EP_DTOG_TX) != 0));
+}
+
+static void update_istr(void) {
+  uint16_t istr = (uint16_t) (USB->ISTR & ~(USB_ISTR_CTR | USB_ISTR_DIR | USB_ISTR_EP_ID));
+  uint8_t i;
+
+  for (i = 0; i < EP_COUNT; i++) {
+    uint16_t value = *endpoint_register(i);
+
+    if ((value & EP_CTR_BITS) != 0) {
+      istr |= (uint16_t) (USB_ISTR_CTR | i | (((value & USB_EP_CTR_RX) != 0) ? USB_ISTR_DIR : 0));
+      break;
+    }
+  }
+  USB->ISTR = istr;
+}
+
+static uint64_t write_time(void) {
+  if (!service.active) {
+    return now_ns;
+  }
+  // What the driver writes before it copies the packet is done right after
+  // the interrupt entry.
+  return service.copied ? service.end_ns : service.entry_ns;
+}
+
+static uint64_t bus_ns(uint32_t bytes) {
+  return ((uint64_t) bytes * 2000) / 3;
+}
+
+static int transaction(uint8_t ep_addr) {
+  uint8_t ep_num = ep_addr & EP_ADDR_MSK;
+  volatile uint16_t* reg = endpoint_register(ep_num);
+  uint16_t value = *reg;
+  Pipe* pipe = ((ep_addr & 0x80) != 0) ? &in_pipes[ep_num] : &out_pipes[ep_num];
+  uint8_t data[64];
+  uint8_t buffer;
+  uint16_t address;
+  uint16_t count;
+  uint32_t capacity;
+  uint32_t size;
+  int refused;
+
+  if ((ep_addr & 0x80) != 0) {
+    if (((value & USB_EPTX_STAT) == USB_EP_TX_STALL) || !tx_ready(value) || (pipe->ready_ns > now_ns)) {
+      if ((value & USB_EPTX_STAT) == USB_EP_TX_STALL) {
+        pipe->stats.stalls++;
+      } else {
+        pipe->stats.naks++;
+      }
+      now_ns += bus_ns(NAK_BYTES);
+      return 0;
+    }
+    buffer = (double_buffered(value) && ((value & USB_EP_DTOG_TX) != 0)) ? BD_ADDR_RX : BD_ADDR_TX;
+    address = *descriptor(ep_num, buffer);
+    size = *descriptor(ep_num, buffer + 1) & COUNT_MASK;
+    if (size > sizeof(data)) {
+      Sim_Check(0, __FILE__, __LINE__, "IN packet larger than 64 bytes");
+      size = sizeof(data);
+    }
+    pma_read(address, data, size);
+    now_ns += bus_ns(size + PACKET_OVERHEAD);
+    if (in_handler != NULL) {
+      in_handler(ep_addr, data, (uint16_t) size);
+    }
+
+    // Acknowledged: the peripheral moves on to the other buffer, or NAKs
+    // until the single buffer is filled again.
+    value ^= USB_EP_DTOG_TX;
+    if (!double_buffered(value)) {
+      value = (uint16_t) ((value & ~USB_EPTX_STAT) | USB_EP_TX_NAK);
+    }
+    *reg = (uint16_t) (value | USB_EP_CTR_TX);
+    update_istr();
+
+    pipe->stats.packets++;
+    pipe->stats.bytes += size;
+    pipe->stats.last_frame = Sim_GetTick();
+    if (size < pcd->IN_ep[ep_num].maxpacket) {
+      pipe->stats.transfers++;
+    }
+    interrupt(ep_addr, size);
+    return 1;
+  }
+
+  size = pipe->host_length - pipe->host_sent;
+  if (size > pcd->OUT_ep[ep_num].maxpacket) {
+    size = pcd->OUT_ep[ep_num].maxpacket;
+  }
+  // The endpoint state at the token decides, but the data packet goes on the
+  // bus even if the device then refuses it.
+  refused = ((value & USB_EPRX_STAT) == USB_EP_RX_STALL) || !rx_ready(value) || (pipe->ready_ns > now_ns);
+  now_ns += bus_ns(size + PACKET_OVERHEAD);
+  if (refused) {
+    if ((value & USB_EPRX_STAT) == USB_EP_RX_STALL) {
+      pipe->stats.stalls++;
+    } else {
+      pipe->stats.naks++;
+    }
+    return 0;
+  }
+  if (double_buffered(value)) {
+    buffer = ((value & USB_EP_DTOG_RX) != 0) ? BD_ADDR_RX : BD_ADDR_TX;
+  } else {
+    buffer = BD_ADDR_RX;
+  }
+  address = *descriptor(ep_num, buffer);
+  count = *descriptor(ep_num, buffer + 1);
+  // BL_SIZE selects blocks of 32 bytes (NUM_BLOCK + 1 of them) or 2 bytes.
+  capacity = ((count & 0x8000) != 0) ? ((((count >> 10) & 0x1F) + 1U) * 32U) : (((count >> 10) & 0x1F) * 2U);
+  if (size > capacity) {
+    Sim_Check(0, __FILE__, __LINE__, "OUT packet larger than the receive buffer");
+    size = capacity;
+  }
+  pma_write(address, &pipe->host_data[pipe->host_sent], size);
+  *descriptor(ep_num, buffer + 1) = (uint16_t) ((count & ~COUNT_MASK) | size);
+  pipe->host_sent += size;
+
+  value ^= USB_EP_DTOG_RX;
+  if (!double_buffered(value)) {
+    value = (uint16_t) ((value & ~USB_EPRX_STAT) | USB_EP_RX_NAK);
+  }
+  *reg = (uint16_t) (value | USB_EP_CTR_RX);
+  update_istr();
+
+  pipe->stats.packets++;
+  pipe->stats.bytes += size;
+  pipe->stats.last_frame = Sim_GetTick();
+  if (size < pcd->OUT_ep[ep_num].maxpacket) {
+    pipe->stats.transfers++;
+  }
+  interrupt(ep_addr, size);
+  return 1;
+}
+
+static void interrupt(uint8_t ep_addr, uint32_t length) {
+  uint64_t start = (service_end_ns > now_ns) ? service_end_ns : now_ns;
+
+  // The interrupt services the packets one after the other.
+  service.copied = 0;
+  service.entry_ns = start + service_base_ns;
+  service.end_ns = service.entry_ns + ((uint64_t) length * service_byte_ns);
+  service.active = 1;
+  service_end_ns = service.end_ns;
+  HAL_PCD_IRQHandler(pcd);
+  service.active = 0;
+}
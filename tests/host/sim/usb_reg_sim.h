@@ -0,0 +1,53 @@
+/*!
+ * @file   usb_reg_sim.h
+ * @brief  Register level model of the STM32F103 USB peripheral
+ *
+ * Stands in for usb_sim.c in the builds that run the real PCD and LL USB
+ * drivers (stm32f1xx_hal_pcd.c, stm32f1xx_ll_usb.c). The virtual host moves
+ * packets through the endpoint registers, the buffer descriptor table and
+ * the packet memory, and raises the USB interrupt as the peripheral does.
+ * Only bulk endpoints are served, there is no enumeration: the test opens
+ * the endpoints and handles the PCD callbacks itself.
+ *
+ * The driver sources are built with this header forced in first (-include),
+ * so their endpoint register writes go through the model: writing EPnR only
+ * toggles the DTOG and STAT bits and only clears the CTR bits, as in the
+ * hardware. The other registers and the packet memory are plain memory.
+ * The drivers are also built with -finstrument-functions, so the model
+ * knows when the interrupt copies a packet: register writes made before the
+ * copy take effect right after the interrupt entry, later ones only once the
+ * copy is done.
+ *
+ * usb_sim.h declares the host side: UsbSim_Frame(), UsbSim_GetFrame(),
+ * UsbSim_SetInHandler(), UsbSim_Out(), UsbSim_OutPending(),
+ * UsbSim_GetStats() and UsbSim_SetServiceTime() are provided here.
+ */
+#ifndef USB_REG_SIM_H_
+#define USB_REG_SIM_H_
+
+#include "stm32f1xx_hal.h"
+
+#undef PCD_SET_ENDPOINT
+#define PCD_SET_ENDPOINT(USBx, bEpNum, wRegValue) \
+  UsbRegSim_WriteEndpoint((uint8_t) (bEpNum), (uint16_t) (wRegValue))
+
+/*!
+ * @brief Write an endpoint register, with the access types of its bits.
+ *
+ * @param[in] ep_num Endpoint register number.
+ * @param[in] value  Value written.
+ * @return    None.
+ */
+void UsbRegSim_WriteEndpoint(uint8_t ep_num, uint16_t value);
+
+/*!
+ * @brief Attach the driver: the USB interrupt runs HAL_PCD_IRQHandler() on
+ *        this handle. Resets the bus, the endpoints are disabled until the
+ *        driver opens them.
+ *
+ * @param[in] hpcd PCD handle, initialized and started by the test.
+ * @return    None.
+ */
+void UsbRegSim_Attach(PCD_HandleTypeDef* hpcd);
+
+#endif // USB_REG_SIM_H_
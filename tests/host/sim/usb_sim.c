@@ -0,0 +1,791 @@
+/*!
+ * @file   usb_sim.c
+ * @brief  Virtual USB host and device controller
+ */
+#include "usb_sim.h"
+#include "sim.h"
+#include "main.h"
+#include "usbd_def.h"
+
+#include <string.h>
+
+#define FRAME_NS  1000000ULL
+
+/*
+ * Bus time in bytes at 12 Mbit/s: start of frame, the sync, PID, CRC and gaps
+ * around the data of a transaction (token, data and handshake packets), a
+ * transaction answered by NAK or STALL, and the end of frame guard.
+ */
+#define SOF_BYTES       6
+#define PACKET_OVERHEAD 12
+#define NAK_BYTES       8
+#define EOF_BYTES       16
+
+// Address the enumeration assigns to the device.
+#define DEVICE_ADDRESS  2
+
+/**
+ * Endpoint state kept next to the PCD one.
+ */
+typedef struct {
+  int open;
+  int armed;
+  uint64_t ready_ns;  // Busy (NAK) until then, serviced by the device.
+  const uint8_t* host_data;
+  uint32_t host_length;
+  uint32_t host_sent;
+  UsbSimStats stats;
+} Pipe;
+
+static PCD_HandleTypeDef* pcd;
+static int started;
+static int bus_active;
+
+static Pipe in_pipes[8];
+static Pipe out_pipes[8];
+
+// Bus time and end of the device interrupt servicing the last packet.
+static uint64_t now_ns;
+static uint64_t service_end_ns;
+static uint32_t service_base_ns = 6000;
+static uint32_t service_byte_ns = 100;
+
+static UsbSimDevice device;
+static UsbSimInHandler in_handler;
+static UsbSimMainLoop main_loop;
+static FILE* capture;
+
+/*!
+ * @brief Get the PCD state of an endpoint.
+ *
+ * @param[in] ep_addr Endpoint address.
+ * @return    Endpoint.
+ */
+static PCD_EPTypeDef* endpoint(uint8_t ep_addr);
+
+/*!
+ * @brief Get the simulator state of an endpoint.
+ *
+ * @param[in] ep_addr Endpoint address.
+ * @return    Endpoint.
+ */
+static Pipe* pipe_of(uint8_t ep_addr);
+
+/*!
+ * @brief Get the time a number of bytes take on the bus.
+ *
+ * @param[in] bytes Number of bytes.
+ * @return    Time in nanoseconds.
+ */
+static uint64_t bus_ns(uint32_t bytes);
+
+/*!
+ * @brief Run one transaction on an interrupt or bulk endpoint at the current
+ *        bus time, and advance the bus time.
+ *
+ * @param[in] ep_addr Endpoint address.
+ * @return    True (1) if data was transferred, false (0) if the endpoint
+ *            answered NAK or STALL.
+ */
+static int transaction(uint8_t ep_addr);
+
+/*!
+ * @brief Account for the device interrupt servicing a packet.
+ *
+ * @param[in] ep_addr Endpoint address.
+ * @param[in] length  Length of the packet.
+ * @return    None.
+ */
+static void service(uint8_t ep_addr, uint32_t length);
+
+/*!
+ * @brief Write a completed packet to the capture.
+ *
+ * @param[in] ep_addr Endpoint address.
+ * @param[in] data    Data of the packet.
+ * @param[in] length  Length of the packet.
+ * @return    None.
+ */
+static void capture_packet(uint8_t ep_addr, const uint8_t* data, uint32_t length);
+
+/*!
+ * @brief Get the polling interval of an interrupt endpoint, in frames.
+ *
+ * @param[in] ep_addr Endpoint address.
+ * @return    Interval.
+ */
+static uint32_t interval_of(uint8_t ep_addr);
+
+/*!
+ * @brief Read a string descriptor as ASCII.
+ *
+ * @param[in]  index    Index of the string, 0 for none.
+ * @param[in]  language Language ID.
+ * @param[out] string   String, 64 characters at most.
+ * @return     True (1) on success, otherwise false (0).
+ */
+static int read_string(uint8_t index, uint16_t language, char* string);
+
+/*!
+ * @brief Parse the interfaces and endpoints of the configuration descriptor.
+ * @return True (1) if the descriptor is well formed, otherwise false (0).
+ */
+static int parse_config(void);
+
+/*
+ * HAL PCD driver.
+ */
+
+HAL_StatusTypeDef HAL_PCD_Init(PCD_HandleTypeDef* hpcd) {
+  uint8_t i;
+
+  pcd = hpcd;
+  HAL_PCD_MspInit(hpcd);
+  for (i = 0; i < 8; i++) {
+    hpcd->IN_ep[i].is_in = 1;
+    hpcd->IN_ep[i].num = i;
+    hpcd->IN_ep[i].type = EP_TYPE_CTRL;
+    hpcd->IN_ep[i].maxpacket = 0;
+    hpcd->IN_ep[i].xfer_buff = NULL;
+    hpcd->IN_ep[i].xfer_len = 0;
+    hpcd->OUT_ep[i].is_in = 0;
+    hpcd->OUT_ep[i].num = i;
+    hpcd->OUT_ep[i].type = EP_TYPE_CTRL;
+    hpcd->OUT_ep[i].maxpacket = 0;
+    hpcd->OUT_ep[i].xfer_buff = NULL;
+    hpcd->OUT_ep[i].xfer_len = 0;
+  }
+  hpcd->USB_Address = 0;
+  hpcd->State = HAL_PCD_STATE_READY;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_DeInit(PCD_HandleTypeDef* hpcd) {
+  HAL_PCD_MspDeInit(hpcd);
+  started = 0;
+  hpcd->State = HAL_PCD_STATE_RESET;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_Start(PCD_HandleTypeDef* hpcd) {
+  HAL_PCDEx_SetConnectionState(hpcd, 1);
+  started = 1;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_Stop(PCD_HandleTypeDef* hpcd) {
+  HAL_PCDEx_SetConnectionState(hpcd, 0);
+  started = 0;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_SetAddress(PCD_HandleTypeDef* hpcd, uint8_t address) {
+  // Applied once the status stage of SET_ADDRESS is complete.
+  hpcd->USB_Address = address;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Open(PCD_HandleTypeDef* hpcd, uint8_t ep_addr, uint16_t ep_mps, uint8_t ep_type) {
+  PCD_EPTypeDef* ep = endpoint(ep_addr);
+  Pipe* pipe = pipe_of(ep_addr);
+
+  (void) hpcd;
+  ep->is_in = ((ep_addr & 0x80) != 0);
+  ep->num = ep_addr & EP_ADDR_MSK;
+  ep->maxpacket = ep_mps;
+  ep->type = ep_type;
+  ep->is_stall = 0;
+  pipe->open = 1;
+  pipe->armed = 0;
+  pipe->ready_ns = 0;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Close(PCD_HandleTypeDef* hpcd, uint8_t ep_addr) {
+  Pipe* pipe = pipe_of(ep_addr);
+
+  (void) hpcd;
+  pipe->open = 0;
+  pipe->armed = 0;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Receive(PCD_HandleTypeDef* hpcd, uint8_t ep_addr, uint8_t* pBuf, uint32_t len) {
+  PCD_EPTypeDef* ep = endpoint(ep_addr & EP_ADDR_MSK);
+
+  (void) hpcd;
+  ep->xfer_buff = pBuf;
+  ep->xfer_len = len;
+  ep->xfer_count = 0;
+  pipe_of(ep_addr & EP_ADDR_MSK)->armed = 1;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Transmit(PCD_HandleTypeDef* hpcd, uint8_t ep_addr, uint8_t* pBuf, uint32_t len) {
+  PCD_EPTypeDef* ep = endpoint(ep_addr | 0x80);
+
+  (void) hpcd;
+  ep->xfer_buff = pBuf;
+  ep->xfer_len = len;
+  ep->xfer_count = 0;
+  pipe_of(ep_addr | 0x80)->armed = 1;
+  return HAL_OK;
+}
+
+uint32_t HAL_PCD_EP_GetRxCount(SIM_PCD_CONST PCD_HandleTypeDef* hpcd, uint8_t ep_addr) {
+  return hpcd->OUT_ep[ep_addr & EP_ADDR_MSK].xfer_count;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_SetStall(PCD_HandleTypeDef* hpcd, uint8_t ep_addr) {
+  (void) hpcd;
+  endpoint(ep_addr)->is_stall = 1;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_ClrStall(PCD_HandleTypeDef* hpcd, uint8_t ep_addr) {
+  (void) hpcd;
+  endpoint(ep_addr)->is_stall = 0;
+  if ((ep_addr & 0x80) != 0) {
+    // The IN endpoint answers NAK until the next transfer.
+    pipe_of(ep_addr)->armed = 0;
+  }
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCD_EP_Flush(PCD_HandleTypeDef* hpcd, uint8_t ep_addr) {
+  (void) hpcd;
+  (void) ep_addr;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PCDEx_PMAConfig(PCD_HandleTypeDef* hpcd, uint16_t ep_addr, uint16_t ep_kind,
+                                      uint32_t pmaadress) {
+  PCD_EPTypeDef* ep = endpoint((uint8_t) ep_addr);
+
+  (void) hpcd;
+  if (ep_kind == PCD_SNG_BUF) {
+    ep->doublebuffer = 0;
+    ep->pmaadress = (uint16_t) pmaadress;
+  } else {
+    ep->doublebuffer = 1;
+    ep->pmaaddr0 = (uint16_t) (pmaadress & 0xFFFF);
+    ep->pmaaddr1 = (uint16_t) (pmaadress >> 16);
+  }
+  return HAL_OK;
+}
+
+/*
+ * Virtual host.
+ */
+
+void UsbSim_Reset(void) {
+  uint8_t i;
+
+  memset(in_pipes, 0, sizeof(in_pipes));
+  memset(out_pipes, 0, sizeof(out_pipes));
+  for (i = 0; i < 8; i++) {
+    pcd->IN_ep[i].is_stall = 0;
+    pcd->OUT_ep[i].is_stall = 0;
+  }
+  pcd->USB_Address = 0;
+  device.address = 0;
+  service_end_ns = 0;
+  bus_active = 1;
+  HAL_PCD_ResetCallback(pcd);
+}
+
+int UsbSim_Control(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+                   uint16_t length, uint8_t* data) {
+  PCD_EPTypeDef* in = &pcd->IN_ep[0];
+  PCD_EPTypeDef* out = &pcd->OUT_ep[0];
+  int done = 0;
+  uint32_t size;
+
+  // A SETUP packet is accepted whatever the state of the endpoint.
+  in->is_stall = 0;
+  out->is_stall = 0;
+  in_pipes[0].armed = 0;
+  out_pipes[0].armed = 0;
+  pcd->Setup[0] = request_type | (request << 8) | ((uint32_t) value << 16);
+  pcd->Setup[1] = index | ((uint32_t) length << 16);
+  HAL_PCD_SetupStageCallback(pcd);
+
+  if ((length > 0) && ((request_type & 0x80) != 0)) {
+    // Data stage IN, one packet per transmission (the device library
+    // continues the transfer from its data stage callback).
+    for (;;) {
+      if (in->is_stall) {
+        return USBSIM_STALL;
+      }
+      if (!in_pipes[0].armed) {
+        return USBSIM_NO_REPLY;
+      }
+      size = (in->xfer_len < in->maxpacket) ? in->xfer_len : in->maxpacket;
+      if ((done + size) > length) {
+        Sim_Check(0, __FILE__, __LINE__, "device sent more than wLength");
+        size = length - done;
+      }
+      memcpy(&data[done], in->xfer_buff, size);
+      done += size;
+      in->xfer_count = size;
+      in->xfer_buff += size;
+      in->xfer_len -= size;
+      in_pipes[0].armed = 0;
+      HAL_PCD_DataInStageCallback(pcd, 0);
+      if ((size < in->maxpacket) || (done >= length)) {
+        break;
+      }
+    }
+    // Status stage: zero-length OUT packet, not reported by the driver.
+    if (out->is_stall) {
+      return USBSIM_STALL;
+    }
+    if (!out_pipes[0].armed) {
+      return USBSIM_NO_REPLY;
+    }
+    out_pipes[0].armed = 0;
+    out->xfer_count = 0;
+    return done;
+  }
+
+  // Data stage OUT.
+  while (done < length) {
+    if (out->is_stall) {
+      return USBSIM_STALL;
+    }
+    if (!out_pipes[0].armed) {
+      return USBSIM_NO_REPLY;
+    }
+    size = ((uint32_t) (length - done) < out->maxpacket) ? (uint32_t) (length - done) : out->maxpacket;
+    memcpy(out->xfer_buff, &data[done], size);
+    done += size;
+    out->xfer_count = size;
+    out->xfer_buff += size;
+    out_pipes[0].armed = 0;
+    HAL_PCD_DataOutStageCallback(pcd, 0);
+  }
+
+  // Status stage: zero-length IN packet.
+  if (in->is_stall) {
+    return USBSIM_STALL;
+  }
+  if (!in_pipes[0].armed || (in->xfer_len != 0)) {
+    return USBSIM_NO_REPLY;
+  }
+  in_pipes[0].armed = 0;
+  in->xfer_count = 0;
+  HAL_PCD_DataInStageCallback(pcd, 0);
+  if (pcd->USB_Address > 0) {
+    device.address = pcd->USB_Address;
+    pcd->USB_Address = 0;
+  }
+  return done;
+}
+
+int UsbSim_Enumerate(void) {
+  uint8_t buffer[256];
+  uint16_t language;
+  int i;
+
+  memset(&device, 0, sizeof(device));
+
+  // First device descriptor read, at address 0, then reset again.
+  UsbSim_Reset();
+  if (UsbSim_Control(USBSIM_DEVICE_IN, USB_REQ_GET_DESCRIPTOR, USB_DESC_TYPE_DEVICE << 8, 0, 64,
+                     buffer) < 8) {
+    return 0;
+  }
+  UsbSim_Reset();
+  if ((UsbSim_Control(USBSIM_DEVICE_OUT, USB_REQ_SET_ADDRESS, DEVICE_ADDRESS, 0, 0, NULL) != 0) ||
+      (device.address != DEVICE_ADDRESS)) {
+    return 0;
+  }
+
+  if ((UsbSim_Control(USBSIM_DEVICE_IN, USB_REQ_GET_DESCRIPTOR, USB_DESC_TYPE_DEVICE << 8, 0,
+                      sizeof(device.device), device.device) != sizeof(device.device)) ||
+      (UsbSim_Control(USBSIM_DEVICE_IN, USB_REQ_GET_DESCRIPTOR, USB_DESC_TYPE_CONFIGURATION << 8, 0, 9,
+                      buffer) != 9)) {
+    return 0;
+  }
+  device.config_length = buffer[2] | (buffer[3] << 8);
+  if ((device.config_length > sizeof(device.config)) ||
+      (UsbSim_Control(USBSIM_DEVICE_IN, USB_REQ_GET_DESCRIPTOR, USB_DESC_TYPE_CONFIGURATION << 8, 0,
+                      device.config_length, device.config) != device.config_length)) {
+    return 0;
+  }
+
+  if (UsbSim_Control(USBSIM_DEVICE_IN, USB_REQ_GET_DESCRIPTOR, USB_DESC_TYPE_STRING << 8, 0, 255,
+                     buffer) < 4) {
+    return 0;
+  }
+  language = buffer[2] | (buffer[3] << 8);
+  if (!read_string(device.device[15], language, device.product) ||
+      !read_string(device.device[14], language, device.manufacturer) ||
+      !read_string(device.device[16], language, device.serial)) {
+    return 0;
+  }
+
+  if (!parse_config() ||
+      (UsbSim_Control(USBSIM_DEVICE_OUT, USB_REQ_SET_CONFIGURATION, device.config[5], 0, 0, NULL) != 0)) {
+    return 0;
+  }
+
+  for (i = 0; i < device.interface_count; i++) {
+    UsbSimInterface* interface = &device.interfaces[i];
+
+    if (interface->interface_class == 0x03) {
+      // usbhid: SET_IDLE(0), which the device may stall, then the report
+      // descriptor.
+      UsbSim_Control(USBSIM_CLASS_OUT, 0x0A, 0, interface->number, 0, NULL);
+      if (UsbSim_Control(USBSIM_INTERFACE_IN, USB_REQ_GET_DESCRIPTOR, 0x22 << 8, interface->number,
+                         interface->report_length, interface->report) != interface->report_length) {
+        return 0;
+      }
+    } else if ((interface->interface_class == 0x02) && (interface->subclass == 0x02)) {
+      // cdc_acm, port opened: 115200 8N1, DTR and RTS set.
+      uint8_t line_coding[7] = {0x00, 0xC2, 0x01, 0x00, 0, 0, 8};
+
+      if ((UsbSim_Control(USBSIM_CLASS_OUT, 0x20, 0, interface->number, sizeof(line_coding),
+                          line_coding) != sizeof(line_coding)) ||
+          (UsbSim_Control(USBSIM_CLASS_OUT, 0x22, 0x0003, interface->number, 0, NULL) != 0)) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+const UsbSimDevice* UsbSim_GetDevice(void) {
+  return &device;
+}
+
+const UsbSimEndpoint* UsbSim_GetEndpoint(uint8_t ep_addr) {
+  int i;
+
+  for (i = 0; i < device.endpoint_count; i++) {
+    if (device.endpoints[i].address == ep_addr) {
+      return &device.endpoints[i];
+    }
+  }
+  return NULL;
+}
+
+void UsbSim_Frame(void) {
+  static uint32_t round_robin;
+  uint32_t frame = Sim_GetTick();
+  uint64_t frame_end;
+  uint8_t bulk[16];
+  int bulk_count = 0;
+  uint8_t i;
+
+  if ((pcd == NULL) || !started || !bus_active) {
+    return;
+  }
+  now_ns = (uint64_t) frame * FRAME_NS;
+  frame_end = now_ns + FRAME_NS - bus_ns(EOF_BYTES);
+  now_ns += bus_ns(SOF_BYTES);
+  HAL_PCD_SOFCallback(pcd);
+
+  // Periodic transfers first, then the bulk transfers share what is left.
+  for (i = 1; i < 8; i++) {
+    uint8_t addresses[2] = {(uint8_t) (i | 0x80), i};
+    int j;
+
+    for (j = 0; j < 2; j++) {
+      uint8_t ep_addr = addresses[j];
+      Pipe* pipe = pipe_of(ep_addr);
+
+      if (!pipe->open || (((ep_addr & 0x80) == 0) && (pipe->host_sent >= pipe->host_length))) {
+        continue;
+      }
+      if (endpoint(ep_addr)->type == EP_TYPE_INTR) {
+        if ((frame % interval_of(ep_addr)) == 0) {
+          transaction(ep_addr);
+        }
+      } else if (endpoint(ep_addr)->type == EP_TYPE_BULK) {
+        bulk[bulk_count++] = ep_addr;
+      }
+    }
+  }
+
+  while (bulk_count > 0) {
+    uint64_t next_ready = UINT64_MAX;
+    int moved = 0;
+    int k;
+
+    for (k = 0; k < bulk_count; k++) {
+      uint8_t ep_addr = bulk[(round_robin + k) % bulk_count];
+      Pipe* pipe = pipe_of(ep_addr);
+
+      if (((ep_addr & 0x80) == 0) && (pipe->host_sent >= pipe->host_length)) {
+        continue;
+      }
+      if ((now_ns + bus_ns(endpoint(ep_addr)->maxpacket + PACKET_OVERHEAD)) > frame_end) {
+        return;
+      }
+      moved |= transaction(ep_addr);
+      if (main_loop != NULL) {
+        main_loop();
+      }
+      if (pipe->armed && (pipe->ready_ns < next_ready)) {
+        // Already serviced while an OUT packet was being refused: the host
+        // sends it again right away.
+        next_ready = (pipe->ready_ns > now_ns) ? pipe->ready_ns : now_ns;
+      }
+    }
+    round_robin++;
+    if (!moved) {
+      // Everything answered NAK: the host keeps polling, nothing changes
+      // before an endpoint is serviced.
+      if (next_ready >= frame_end) {
+        return;
+      }
+      now_ns = next_ready;
+    }
+  }
+}
+
+uint32_t UsbSim_GetFrame(void) {
+  return Sim_GetTick();
+}
+
+void UsbSim_SetInHandler(UsbSimInHandler handler) {
+  in_handler = handler;
+}
+
+void UsbSim_SetMainLoop(UsbSimMainLoop function) {
+  main_loop = function;
+}
+
+int UsbSim_Out(uint8_t ep_addr, const uint8_t* data, uint32_t length) {
+  Pipe* pipe = pipe_of(ep_addr);
+
+  if (pipe->host_sent < pipe->host_length) {
+    return 0;
+  }
+  pipe->host_data = data;
+  pipe->host_length = length;
+  pipe->host_sent = 0;
+  return 1;
+}
+
+uint32_t UsbSim_OutPending(uint8_t ep_addr) {
+  Pipe* pipe = pipe_of(ep_addr);
+
+  return pipe->host_length - pipe->host_sent;
+}
+
+const UsbSimStats* UsbSim_GetStats(uint8_t ep_addr) {
+  return &pipe_of(ep_addr)->stats;
+}
+
+void UsbSim_SetServiceTime(uint32_t base_ns, uint32_t per_byte_ns) {
+  service_base_ns = base_ns;
+  service_byte_ns = per_byte_ns;
+}
+
+void UsbSim_Capture(FILE* file) {
+  capture = file;
+}
+
+static PCD_EPTypeDef* endpoint(uint8_t ep_addr) {
+  return ((ep_addr & 0x80) != 0) ? &pcd->IN_ep[ep_addr & 0x07] : &pcd->OUT_ep[ep_addr & 0x07];
+}
+
+static Pipe* pipe_of(uint8_t ep_addr) {
+  return ((ep_addr & 0x80) != 0) ? &in_pipes[ep_addr & 0x07] : &out_pipes[ep_addr & 0x07];
+}
+
+static uint64_t bus_ns(uint32_t bytes) {
+  return ((uint64_t) bytes * 2000) / 3;
+}
+
+static int transaction(uint8_t ep_addr) {
+  PCD_EPTypeDef* ep = endpoint(ep_addr);
+  Pipe* pipe = pipe_of(ep_addr);
+  uint32_t size;
+  int refused;
+
+  if ((ep_addr & 0x80) != 0) {
+    if (ep->is_stall || !pipe->armed || (pipe->ready_ns > now_ns)) {
+      if (ep->is_stall) {
+        pipe->stats.stalls++;
+      } else {
+        pipe->stats.naks++;
+      }
+      now_ns += bus_ns(NAK_BYTES);
+      return 0;
+    }
+    size = (ep->xfer_len < ep->maxpacket) ? ep->xfer_len : ep->maxpacket;
+    now_ns += bus_ns(size + PACKET_OVERHEAD);
+    capture_packet(ep_addr, ep->xfer_buff, size);
+    if (in_handler != NULL) {
+      in_handler(ep_addr, ep->xfer_buff, (uint16_t) size);
+    }
+    ep->xfer_buff += size;
+    ep->xfer_count += size;
+    ep->xfer_len -= size;
+    service(ep_addr, size);
+    if (ep->xfer_len == 0) {
+      pipe->armed = 0;
+      pipe->stats.transfers++;
+      HAL_PCD_DataInStageCallback(pcd, ep->num);
+    }
+    return 1;
+  }
+
+  size = pipe->host_length - pipe->host_sent;
+  if (size > ep->maxpacket) {
+    size = ep->maxpacket;
+  }
+  // The endpoint state at the token decides, but the data packet goes on the
+  // bus even if the device then refuses it.
+  refused = ep->is_stall || !pipe->armed || (pipe->ready_ns > now_ns);
+  now_ns += bus_ns(size + PACKET_OVERHEAD);
+  if (refused) {
+    if (ep->is_stall) {
+      pipe->stats.stalls++;
+    } else {
+      pipe->stats.naks++;
+    }
+    return 0;
+  }
+  if (size > ep->xfer_len) {
+    Sim_Check(0, __FILE__, __LINE__, "OUT packet larger than the receive buffer");
+    size = ep->xfer_len;
+  }
+  memcpy(ep->xfer_buff, &pipe->host_data[pipe->host_sent], size);
+  capture_packet(ep_addr, ep->xfer_buff, size);
+  pipe->host_sent += size;
+  ep->xfer_buff += size;
+  ep->xfer_count += size;
+  ep->xfer_len -= size;
+  service(ep_addr, size);
+  if ((ep->xfer_len == 0) || (size < ep->maxpacket)) {
+    pipe->armed = 0;
+    pipe->stats.transfers++;
+    HAL_PCD_DataOutStageCallback(pcd, ep->num);
+  }
+  return 1;
+}
+
+static void service(uint8_t ep_addr, uint32_t length) {
+  Pipe* pipe = pipe_of(ep_addr);
+  uint64_t start = (service_end_ns > now_ns) ? service_end_ns : now_ns;
+
+  pipe->stats.packets++;
+  pipe->stats.bytes += length;
+  pipe->stats.last_frame = Sim_GetTick();
+
+  // The interrupt services the packets one after the other. Until it has, a
+  // single buffered endpoint has no free buffer, a double buffered one is
+  // assumed to have its other buffer.
+  service_end_ns = start + service_base_ns + ((uint64_t) length * service_byte_ns);
+  pipe->ready_ns = endpoint(ep_addr)->doublebuffer ? start : service_end_ns;
+}
+
+static void capture_packet(uint8_t ep_addr, const uint8_t* data, uint32_t length) {
+  PCD_EPTypeDef* ep = endpoint(ep_addr);
+  int interrupt = (ep->type == EP_TYPE_INTR);
+  uint32_t i;
+
+  if (capture == NULL) {
+    return;
+  }
+  fprintf(capture, "ffff888000%06x %u C %c%c:1:%03u:%u ",
+          (unsigned) ep_addr << 8, (unsigned) (now_ns / 1000), interrupt ? 'I' : 'B',
+          ((ep_addr & 0x80) != 0) ? 'i' : 'o', device.address, ep_addr & EP_ADDR_MSK);
+  if (interrupt) {
+    fprintf(capture, "0:%u %u", (unsigned) interval_of(ep_addr), (unsigned) length);
+  } else {
+    fprintf(capture, "0 %u", (unsigned) length);
+  }
+  if ((ep_addr & 0x80) == 0) {
+    fprintf(capture, " >\n");
+    return;
+  }
+  if (length > 0) {
+    // usbmon shows the first 32 bytes, in groups of 4.
+    fprintf(capture, " =");
+    for (i = 0; (i < length) && (i < 32); i++) {
+      fprintf(capture, "%s%02x", ((i % 4) == 0) ? " " : "", data[i]);
+    }
+  }
+  fprintf(capture, "\n");
+}
+
+static uint32_t interval_of(uint8_t ep_addr) {
+  const UsbSimEndpoint* descriptor = UsbSim_GetEndpoint(ep_addr);
+  uint32_t interval = 1;
+
+  // Rounded down to a power of two, as the Linux host controller drivers do.
+  if ((descriptor != NULL) && (descriptor->interval > 0)) {
+    while ((interval * 2) <= descriptor->interval) {
+      interval *= 2;
+    }
+  }
+  return interval;
+}
+
+static int read_string(uint8_t index, uint16_t language, char* string) {
+  uint8_t buffer[255];
+  int length;
+  int i;
+
+  string[0] = '\0';
+  if (index == 0) {
+    return 1;
+  }
+  length = UsbSim_Control(USBSIM_DEVICE_IN, USB_REQ_GET_DESCRIPTOR, (USB_DESC_TYPE_STRING << 8) | index,
+                          language, sizeof(buffer), buffer);
+  if ((length < 2) || (buffer[0] != length) || (buffer[1] != USB_DESC_TYPE_STRING)) {
+    return 0;
+  }
+  for (i = 0; ((2 + (2 * i)) < length) && (i < 63); i++) {
+    string[i] = (char) buffer[2 + (2 * i)];
+  }
+  string[i] = '\0';
+  return 1;
+}
+
+static int parse_config(void) {
+  UsbSimInterface* interface = NULL;
+  uint16_t offset = 0;
+
+  while (offset < device.config_length) {
+    const uint8_t* descriptor = &device.config[offset];
+
+    if ((descriptor[0] < 2) || ((offset + descriptor[0]) > device.config_length)) {
+      return 0;
+    }
+    if ((descriptor[1] == USB_DESC_TYPE_INTERFACE) && (descriptor[3] == 0)) {
+      if (device.interface_count == USBSIM_MAX_INTERFACES) {
+        return 0;
+      }
+      interface = &device.interfaces[device.interface_count++];
+      interface->number = descriptor[2];
+      interface->interface_class = descriptor[5];
+      interface->subclass = descriptor[6];
+      interface->protocol = descriptor[7];
+    } else if ((descriptor[1] == USB_DESC_TYPE_ENDPOINT) && (interface != NULL)) {
+      UsbSimEndpoint* ep;
+
+      if (device.endpoint_count == USBSIM_MAX_ENDPOINTS) {
+        return 0;
+      }
+      ep = &device.endpoints[device.endpoint_count++];
+      ep->address = descriptor[2];
+      ep->attributes = descriptor[3];
+      ep->max_packet = descriptor[4] | (descriptor[5] << 8);
+      ep->interval = descriptor[6];
+      ep->interface = interface->number;
+    } else if ((descriptor[1] == 0x21) && (interface != NULL) && (descriptor[0] >= 9)) {
+      interface->report_length = descriptor[7] | (descriptor[8] << 8);
+      if (interface->report_length > USBSIM_MAX_REPORT) {
+        return 0;
+      }
+    }
+    offset += descriptor[0];
+  }
+  return device.interface_count > 0;
+}
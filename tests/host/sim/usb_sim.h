@@ -0,0 +1,234 @@
+/*!
+ * @file   usb_sim.h
+ * @brief  Virtual USB host and device controller
+ *
+ * Replaces the HAL PCD driver (stm32f1xx_hal_pcd.c) below the unchanged
+ * usbd_conf.c, USB device library and class drivers. The driver calls
+ * (HAL_PCD_EP_Transmit(), HAL_PCD_EP_Receive()...) arm the endpoints and the
+ * virtual host completes the transfers by calling back into usbd_conf.c, the
+ * same way the USB interrupt does on the target.
+ *
+ * Control transfers run immediately from UsbSim_Control(). Everything else
+ * runs frame by frame, one frame per millisecond tick: the SOF, the interrupt
+ * endpoints due in this frame (every bInterval frames), then the bulk
+ * endpoints round-robin for the rest of the frame. Each transaction takes its
+ * time on the 12 Mbit/s bus, and after each packet the endpoint stays busy for
+ * the time the device interrupt needs to service it: a single buffered
+ * endpoint NAKs until then, a double buffered one accepts the next packet in
+ * its other buffer right away. That is what the PCD driver's double buffering
+ * is meant to do, this stand-in does not run it: usb_reg_sim.c runs the real
+ * driver on a register model, see the pcd_double_buffer test.
+ */
+#ifndef USB_SIM_H_
+#define USB_SIM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * UsbSim_Control() errors.
+ */
+#define USBSIM_STALL    (-1)  // The device stalled the request.
+#define USBSIM_NO_REPLY (-2)  // The device did not arm endpoint 0.
+
+/**
+ * Standard request types.
+ */
+#define USBSIM_DEVICE_IN     0x80
+#define USBSIM_DEVICE_OUT    0x00
+#define USBSIM_INTERFACE_IN  0x81
+#define USBSIM_INTERFACE_OUT 0x01
+#define USBSIM_CLASS_IN      0xA1
+#define USBSIM_CLASS_OUT     0x21
+
+/**
+ * Limits of the parsed configuration.
+ */
+#define USBSIM_MAX_INTERFACES  4
+#define USBSIM_MAX_ENDPOINTS   8
+#define USBSIM_MAX_REPORT      256
+
+/**
+ * Endpoint of the configuration.
+ */
+typedef struct {
+  uint8_t address;
+  uint8_t attributes;
+  uint16_t max_packet;
+  uint8_t interval;
+  uint8_t interface;
+} UsbSimEndpoint;
+
+/**
+ * Interface of the configuration, with its HID report descriptor if any.
+ */
+typedef struct {
+  uint8_t number;
+  uint8_t interface_class;
+  uint8_t subclass;
+  uint8_t protocol;
+  uint16_t report_length;
+  uint8_t report[USBSIM_MAX_REPORT];
+} UsbSimInterface;
+
+/**
+ * Device as seen by the host after the enumeration.
+ */
+typedef struct {
+  uint8_t address;
+  uint8_t device[18];
+  uint8_t config[512];
+  uint16_t config_length;
+  char manufacturer[64];
+  char product[64];
+  char serial[64];
+  int interface_count;
+  UsbSimInterface interfaces[USBSIM_MAX_INTERFACES];
+  int endpoint_count;
+  UsbSimEndpoint endpoints[USBSIM_MAX_ENDPOINTS];
+} UsbSimDevice;
+
+/**
+ * Traffic of one endpoint.
+ */
+typedef struct {
+  uint32_t packets;
+  uint64_t bytes;
+  uint32_t naks;
+  uint32_t stalls;
+  uint32_t transfers;
+  uint32_t last_frame;
+} UsbSimStats;
+
+/**
+ * Handler of the packets received by the host on IN endpoints.
+ */
+typedef void (*UsbSimInHandler)(uint8_t ep_addr, const uint8_t* data, uint16_t length);
+
+/**
+ * Application code run between the bulk transactions of a frame, standing for
+ * the main loop running while the USB interrupt is idle.
+ */
+typedef void (*UsbSimMainLoop)(void);
+
+/*!
+ * @brief Reset the bus: the device is back to the default state, all the
+ *        endpoints are disarmed.
+ * @return None.
+ */
+void UsbSim_Reset(void);
+
+/*!
+ * @brief Run a control transfer on endpoint 0: setup, data and status stages.
+ *
+ * @param[in]     request_type bmRequestType, the direction of the data stage
+ *                             is taken from bit 7.
+ * @param[in]     request      bRequest.
+ * @param[in]     value        wValue.
+ * @param[in]     index        wIndex.
+ * @param[in]     length       wLength.
+ * @param[in,out] data         Data stage, received or sent.
+ * @return        Length of the data stage, or USBSIM_STALL or USBSIM_NO_REPLY.
+ */
+int UsbSim_Control(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index,
+                   uint16_t length, uint8_t* data);
+
+/*!
+ * @brief Enumerate the device like the Linux host does: reset, device
+ *        descriptor, address, configuration and string descriptors, then
+ *        SET_CONFIGURATION. HID interfaces then get SET_IDLE(0) and their
+ *        report descriptor is read.
+ * @return True (1) if the device is configured, otherwise false (0).
+ */
+int UsbSim_Enumerate(void);
+
+/*!
+ * @brief Get the device as parsed by the enumeration.
+ * @return Device.
+ */
+const UsbSimDevice* UsbSim_GetDevice(void);
+
+/*!
+ * @brief Get an endpoint of the configuration.
+ *
+ * @param[in] ep_addr Endpoint address.
+ * @return    Endpoint, NULL if the configuration has no such endpoint.
+ */
+const UsbSimEndpoint* UsbSim_GetEndpoint(uint8_t ep_addr);
+
+/*!
+ * @brief Run one frame. Called on each tick by Sim_Step().
+ * @return None.
+ */
+void UsbSim_Frame(void);
+
+/*!
+ * @brief Get the current frame number.
+ * @return Frame number.
+ */
+uint32_t UsbSim_GetFrame(void);
+
+/*!
+ * @brief Set the handler of the packets received on IN endpoints.
+ *
+ * @param[in] handler Handler, NULL for none.
+ * @return    None.
+ */
+void UsbSim_SetInHandler(UsbSimInHandler handler);
+
+/*!
+ * @brief Set the application code run between bulk transactions.
+ *
+ * @param[in] function Function to run, NULL for none.
+ * @return    None.
+ */
+void UsbSim_SetMainLoop(UsbSimMainLoop function);
+
+/*!
+ * @brief Queue data for an OUT endpoint. The data is sent in full packets,
+ *        and a short last packet, over the next frames. The buffer must stay
+ *        valid until UsbSim_OutPending() returns 0.
+ *
+ * @param[in] ep_addr Endpoint address.
+ * @param[in] data    Data.
+ * @param[in] length  Length of the data.
+ * @return    True (1) if queued, false (0) if data is still pending.
+ */
+int UsbSim_Out(uint8_t ep_addr, const uint8_t* data, uint32_t length);
+
+/*!
+ * @brief Get the number of bytes queued and not sent yet on an OUT endpoint.
+ *
+ * @param[in] ep_addr Endpoint address.
+ * @return    Number of bytes.
+ */
+uint32_t UsbSim_OutPending(uint8_t ep_addr);
+
+/*!
+ * @brief Get the traffic of an endpoint.
+ *
+ * @param[in] ep_addr Endpoint address.
+ * @return    Traffic since the last reset.
+ */
+const UsbSimStats* UsbSim_GetStats(uint8_t ep_addr);
+
+/*!
+ * @brief Set the time the device interrupt takes to service a packet.
+ *
+ * @param[in] base_ns     Fixed time, in nanoseconds.
+ * @param[in] per_byte_ns Time per byte of the packet, in nanoseconds.
+ * @return    None.
+ */
+void UsbSim_SetServiceTime(uint32_t base_ns, uint32_t per_byte_ns);
+
+/*!
+ * @brief Write the completed transfers to a file in the usbmon text format
+ *        (Documentation/usb/usbmon.rst), as "cat /sys/kernel/debug/usb/usbmon/1u"
+ *        would on a real host.
+ *
+ * @param[in] file File, NULL to stop.
+ * @return    None.
+ */
+void UsbSim_Capture(FILE* file);
+
+#endif // USB_SIM_H_
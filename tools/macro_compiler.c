@@ -0,0 +1,554 @@
+/*!
+ * @file   macro_compiler.c
+ * @brief  Compiler from macro scripts to the macro image of the keyboard
+ */
+#include "macro_compiler.h"
+#include "usb_hid_keyboard.h"
+#include "usb_hid_macro.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Image header: magic (32 bits) and macro count (16 bits), followed by the
+ * offset of each macro (16 bits).
+ */
+#define IMAGE_HEADER_SIZE  6
+
+/*
+ * Longest text of a MACRO_OP_STRING instruction.
+ */
+#define STRING_MAX_LENGTH  255
+
+/*
+ * Named key.
+ */
+typedef struct {
+  const char* name;
+  uint8_t key;
+} KeyName;
+
+static const KeyName key_names[] = {
+  {"LEFT_CTRL", KEY_LEFT_CTRL}, {"LEFT_SHIFT", KEY_LEFT_SHIFT},
+  {"LEFT_ALT", KEY_LEFT_ALT}, {"LEFT_GUI", KEY_LEFT_GUI},
+  {"RIGHT_CTRL", KEY_RIGHT_CTRL}, {"RIGHT_SHIFT", KEY_RIGHT_SHIFT},
+  {"RIGHT_ALT", KEY_RIGHT_ALT}, {"RIGHT_GUI", KEY_RIGHT_GUI},
+  {"RIGHT_ARROW", KEY_RIGHT_ARROW}, {"LEFT_ARROW", KEY_LEFT_ARROW},
+  {"DOWN_ARROW", KEY_DOWN_ARROW}, {"UP_ARROW", KEY_UP_ARROW},
+  {"RETURN", KEY_RETURN}, {"ESC", KEY_ESC}, {"BACKSPACE", KEY_BACKSPACE},
+  {"TAB", KEY_TAB}, {"INSERT", KEY_INSERT}, {"DELETE", KEY_DELETE},
+  {"PAGE_UP", KEY_PAGE_UP}, {"PAGE_DOWN", KEY_PAGE_DOWN}, {"HOME", KEY_HOME},
+  {"END", KEY_END}, {"CAPS_LOCK", KEY_CAPS_LOCK},
+  {"F1", KEY_F1}, {"F2", KEY_F2}, {"F3", KEY_F3}, {"F4", KEY_F4},
+  {"F5", KEY_F5}, {"F6", KEY_F6}, {"F7", KEY_F7}, {"F8", KEY_F8},
+  {"F9", KEY_F9}, {"F10", KEY_F10}, {"F11", KEY_F11}, {"F12", KEY_F12},
+  {"F13", KEY_F13}, {"F14", KEY_F14}, {"F15", KEY_F15}, {"F16", KEY_F16},
+  {"F17", KEY_F17}, {"F18", KEY_F18}, {"F19", KEY_F19}, {"F20", KEY_F20},
+  {"F21", KEY_F21}, {"F22", KEY_F22}, {"F23", KEY_F23}, {"F24", KEY_F24},
+};
+
+/*
+ * Compiler state. Macros are compiled one after the other into the code
+ * buffer, the image header goes in front of them at the end.
+ */
+typedef struct {
+  const char* p;
+  int line;
+  uint8_t* code;
+  uint32_t code_size;
+  uint32_t length;
+  uint32_t offsets[MACRO_COMPILER_MAX_MACROS];
+  int count;
+  int open;
+  int depth;
+  int repeat_lines[MACRO_REPEAT_DEPTH];
+  MacroCompilerError* error;
+} Compiler;
+
+/*!
+ * @brief Record an error at the current line.
+ *
+ * @param[in,out] c      Compiler.
+ * @param[in]     format printf() format of the message.
+ * @return        False (0).
+ */
+static int fail(Compiler* c, const char* format, ...);
+
+/*!
+ * @brief Compile one line.
+ *
+ * @param[in,out] c Compiler, at the start of the line.
+ * @return        True (1) in case of success, otherwise false (0).
+ */
+static int compile_line(Compiler* c);
+
+/*!
+ * @brief Start a macro.
+ *
+ * @param[in,out] c Compiler.
+ * @return        True (1) in case of success, otherwise false (0).
+ */
+static int begin_macro(Compiler* c);
+
+/*!
+ * @brief End the open macro with MACRO_OP_END.
+ *
+ * @param[in,out] c Compiler.
+ * @return        True (1) in case of success, otherwise false (0).
+ */
+static int end_macro(Compiler* c);
+
+/*!
+ * @brief Append bytes to the code of the open macro.
+ *
+ * @param[in,out] c      Compiler.
+ * @param[in]     data   Bytes.
+ * @param[in]     length Number of bytes.
+ * @return        True (1) in case of success, otherwise false (0) if the image is full.
+ */
+static int emit(Compiler* c, const uint8_t* data, uint32_t length);
+
+/*!
+ * @brief Read a word (letters, digits and underscores).
+ *
+ * @param[in,out] c    Compiler.
+ * @param[out]    word Word, NUL terminated.
+ * @param[in]     size Word buffer size.
+ * @return        Word length, 0 if there is none.
+ */
+static int read_word(Compiler* c, char* word, int size);
+
+/*!
+ * @brief Read a number within a range.
+ *
+ * @param[in,out] c     Compiler.
+ * @param[in]     min   Minimum value.
+ * @param[in]     max   Maximum value.
+ * @param[out]    value Number.
+ * @return        True (1) in case of success, otherwise false (0).
+ */
+static int read_number(Compiler* c, long min, long max, long* value);
+
+/*!
+ * @brief Read a key operand.
+ *
+ * @param[in,out] c   Compiler.
+ * @param[out]    key Key (see usb_hid_keyboard.h).
+ * @return        True (1) in case of success, otherwise false (0).
+ */
+static int read_key(Compiler* c, uint8_t* key);
+
+/*!
+ * @brief Read one character of a quoted string or character, with its escape.
+ *
+ * @param[in,out] c     Compiler, on the character.
+ * @param[out]    value Byte.
+ * @return        True (1) in case of success, otherwise false (0).
+ */
+static int read_char(Compiler* c, uint8_t* value);
+
+/*!
+ * @brief Compile a string operand into MACRO_OP_STRING instructions.
+ *
+ * @param[in,out] c Compiler.
+ * @return        True (1) in case of success, otherwise false (0).
+ */
+static int compile_string(Compiler* c);
+
+/*!
+ * @brief Skip spaces and tabs.
+ *
+ * @param[in,out] c Compiler.
+ * @return        None.
+ */
+static void skip_spaces(Compiler* c);
+
+/*!
+ * @brief Check that nothing but a comment is left on the line.
+ *
+ * @param[in,out] c Compiler.
+ * @return        True (1) at the end of the line, otherwise false (0).
+ */
+static int at_end_of_line(Compiler* c);
+
+int MacroCompiler_Compile(const char* script, uint8_t* image, uint32_t size, MacroCompilerError* error) {
+  Compiler c;
+  uint32_t header;
+  uint32_t offset;
+  int i;
+
+  memset(&c, 0, sizeof(c));
+  c.p = script;
+  c.line = 1;
+  c.code_size = size;
+  c.code = malloc(size);
+  c.error = error;
+  error->line = 0;
+  error->message[0] = '\0';
+  if (c.code == NULL) {
+    return fail(&c, "out of memory") - 1;
+  }
+
+  for (;;) {
+    if (!compile_line(&c)) {
+      free(c.code);
+      return -1;
+    }
+    while ((*c.p != '\0') && (*c.p != '\n')) {
+      c.p++;
+    }
+    if (*c.p == '\0') {
+      break;
+    }
+    c.p++;
+    c.line++;
+  }
+  if (c.open && !end_macro(&c)) {
+    free(c.code);
+    return -1;
+  }
+
+  header = IMAGE_HEADER_SIZE + (2 * (uint32_t) c.count);
+  if ((header + c.length) > size) {
+    free(c.code);
+    return fail(&c, "image of %u bytes too large", (unsigned) (header + c.length)) - 1;
+  }
+  memmove(&image[header], c.code, c.length);
+  free(c.code);
+
+  image[0] = (uint8_t) MACRO_IMAGE_MAGIC;
+  image[1] = (uint8_t) (MACRO_IMAGE_MAGIC >> 8);
+  image[2] = (uint8_t) (MACRO_IMAGE_MAGIC >> 16);
+  image[3] = (uint8_t) (MACRO_IMAGE_MAGIC >> 24);
+  image[4] = (uint8_t) c.count;
+  image[5] = (uint8_t) (c.count >> 8);
+  for (i = 0; i < c.count; i++) {
+    offset = header + c.offsets[i];
+    if (offset > 0xFFFF) {
+      c.line = 0;
+      return fail(&c, "macro %d starts beyond 64 KB", i) - 1;
+    }
+    image[IMAGE_HEADER_SIZE + (2 * i)] = (uint8_t) offset;
+    image[IMAGE_HEADER_SIZE + (2 * i) + 1] = (uint8_t) (offset >> 8);
+  }
+  return (int) (header + c.length);
+}
+
+static int fail(Compiler* c, const char* format, ...) {
+  va_list args;
+
+  // Keep the first error.
+  if (c->error->message[0] != '\0') {
+    return 0;
+  }
+  c->error->line = c->line;
+  va_start(args, format);
+  vsnprintf(c->error->message, sizeof(c->error->message), format, args);
+  va_end(args);
+  return 0;
+}
+
+static int compile_line(Compiler* c) {
+  char word[16];
+  uint8_t code[6];
+  long value;
+  long x;
+  long y;
+  long wheel = 0;
+
+  skip_spaces(c);
+  if (at_end_of_line(c)) {
+    return 1;
+  }
+  if (read_word(c, word, sizeof(word)) == 0) {
+    return fail(c, "instruction expected");
+  }
+
+  if (strcmp(word, "macro") == 0) {
+    if (c->open && !end_macro(c)) {
+      return 0;
+    }
+    if (!begin_macro(c)) {
+      return 0;
+    }
+    return at_end_of_line(c) || fail(c, "unexpected text after macro");
+  }
+  if (!c->open && !begin_macro(c)) {
+    return 0;
+  }
+
+  if ((strcmp(word, "press") == 0) || (strcmp(word, "release") == 0) || (strcmp(word, "tap") == 0)) {
+    code[0] = (word[0] == 'p') ? MACRO_OP_PRESS : (word[0] == 'r') ? MACRO_OP_RELEASE : MACRO_OP_TAP;
+    if (!read_key(c, &code[1]) || !emit(c, code, 2)) {
+      return 0;
+    }
+  } else if (strcmp(word, "release_all") == 0) {
+    code[0] = MACRO_OP_RELEASE_ALL;
+    if (!emit(c, code, 1)) {
+      return 0;
+    }
+  } else if (strcmp(word, "string") == 0) {
+    if (!compile_string(c)) {
+      return 0;
+    }
+  } else if ((strcmp(word, "delay") == 0) || (strcmp(word, "repeat") == 0)) {
+    code[0] = (word[0] == 'd') ? MACRO_OP_DELAY : MACRO_OP_REPEAT;
+    if (!read_number(c, (code[0] == MACRO_OP_DELAY) ? 0 : 1, 0xFFFF, &value)) {
+      return 0;
+    }
+    if (code[0] == MACRO_OP_REPEAT) {
+      if (c->depth == MACRO_REPEAT_DEPTH) {
+        return fail(c, "more than %d nested repeat blocks", MACRO_REPEAT_DEPTH);
+      }
+      c->repeat_lines[c->depth++] = c->line;
+    }
+    code[1] = (uint8_t) value;
+    code[2] = (uint8_t) (value >> 8);
+    if (!emit(c, code, 3)) {
+      return 0;
+    }
+  } else if (strcmp(word, "loop") == 0) {
+    if (c->depth == 0) {
+      return fail(c, "loop without repeat");
+    }
+    c->depth--;
+    code[0] = MACRO_OP_LOOP;
+    if (!emit(c, code, 1)) {
+      return 0;
+    }
+  } else if (strcmp(word, "mouse_move") == 0) {
+    if (!read_number(c, -32768, 32767, &x) || !read_number(c, -32768, 32767, &y)) {
+      return 0;
+    }
+    skip_spaces(c);
+    if (!at_end_of_line(c) && !read_number(c, -128, 127, &wheel)) {
+      return 0;
+    }
+    code[0] = MACRO_OP_MOUSE_MOVE;
+    code[1] = (uint8_t) x;
+    code[2] = (uint8_t) ((uint16_t) x >> 8);
+    code[3] = (uint8_t) y;
+    code[4] = (uint8_t) ((uint16_t) y >> 8);
+    code[5] = (uint8_t) wheel;
+    if (!emit(c, code, 6)) {
+      return 0;
+    }
+  } else {
+    return fail(c, "unknown instruction '%s'", word);
+  }
+
+  return at_end_of_line(c) || fail(c, "unexpected text after %s", word);
+}
+
+static int begin_macro(Compiler* c) {
+  if (c->count == MACRO_COMPILER_MAX_MACROS) {
+    return fail(c, "more than %d macros", MACRO_COMPILER_MAX_MACROS);
+  }
+  c->offsets[c->count++] = c->length;
+  c->open = 1;
+  c->depth = 0;
+  return 1;
+}
+
+static int end_macro(Compiler* c) {
+  uint8_t end = MACRO_OP_END;
+
+  if (c->depth != 0) {
+    c->line = c->repeat_lines[c->depth - 1];
+    return fail(c, "repeat without loop");
+  }
+  c->open = 0;
+  return emit(c, &end, 1);
+}
+
+static int emit(Compiler* c, const uint8_t* data, uint32_t length) {
+  if ((c->length + length) > c->code_size) {
+    return fail(c, "image full");
+  }
+  memcpy(&c->code[c->length], data, length);
+  c->length += length;
+  return 1;
+}
+
+static int read_word(Compiler* c, char* word, int size) {
+  int length = 0;
+
+  skip_spaces(c);
+  while (isalnum((unsigned char) *c->p) || (*c->p == '_')) {
+    if (length < (size - 1)) {
+      word[length] = *c->p;
+    }
+    length++;
+    c->p++;
+  }
+  word[(length < size) ? length : (size - 1)] = '\0';
+  return length;
+}
+
+static int read_number(Compiler* c, long min, long max, long* value) {
+  char* end;
+
+  skip_spaces(c);
+  *value = strtol(c->p, &end, 0);
+  if (end == c->p) {
+    return fail(c, "number expected");
+  }
+  c->p = end;
+  if ((*value < min) || (*value > max)) {
+    return fail(c, "%ld out of range (%ld to %ld)", *value, min, max);
+  }
+  return 1;
+}
+
+static int read_key(Compiler* c, uint8_t* key) {
+  char word[16];
+  long value;
+  uint32_t i;
+
+  skip_spaces(c);
+  if (*c->p == '\'') {
+    // Printing key, typed with the keyboard layout.
+    c->p++;
+    if ((*c->p == '\'') || !read_char(c, key) || (*c->p != '\'')) {
+      return fail(c, "one character expected in quotes");
+    }
+    c->p++;
+    // Key codes from 0x80 up are modifier and non-printing keys.
+    if ((*key < 0x20) || (*key >= KEY_LEFT_CTRL)) {
+      return fail(c, "character 0x%02X can't be pressed", *key);
+    }
+    return 1;
+  }
+  if (isdigit((unsigned char) *c->p)) {
+    if (!read_number(c, 1, 0xFF, &value)) {
+      return 0;
+    }
+    *key = (uint8_t) value;
+    return 1;
+  }
+
+  read_word(c, word, sizeof(word));
+  if (strcmp(word, "USAGE") == 0) {
+    skip_spaces(c);
+    if (*c->p++ != '(') {
+      return fail(c, "USAGE(n) expected");
+    }
+    if (!read_number(c, 0x04, 0x77, &value)) {
+      return 0;
+    }
+    skip_spaces(c);
+    if (*c->p++ != ')') {
+      return fail(c, "USAGE(n) expected");
+    }
+    *key = (uint8_t) KEY_USAGE(value);
+    return 1;
+  }
+  for (i = 0; i < (sizeof(key_names) / sizeof(key_names[0])); i++) {
+    if (strcmp(word, key_names[i].name) == 0) {
+      *key = key_names[i].key;
+      return 1;
+    }
+  }
+  return fail(c, "unknown key '%s'", word);
+}
+
+static int read_char(Compiler* c, uint8_t* value) {
+  int digits;
+
+  if ((*c->p == '\0') || (*c->p == '\n')) {
+    return fail(c, "missing closing quote");
+  }
+  if (*c->p != '\\') {
+    *value = (uint8_t) *c->p++;
+    return 1;
+  }
+
+  c->p++;
+  switch (*c->p) {
+    case 'n':
+      *value = '\n';
+      break;
+    case 't':
+      *value = '\t';
+      break;
+    case '\\':
+    case '"':
+    case '\'':
+      *value = (uint8_t) *c->p;
+      break;
+    case 'x':
+      *value = 0;
+      for (digits = 0; (digits < 2) && isxdigit((unsigned char) c->p[1]); digits++) {
+        c->p++;
+        *value = (uint8_t) ((*value << 4) | (isdigit((unsigned char) *c->p) ? (*c->p - '0') :
+                                             ((tolower((unsigned char) *c->p) - 'a') + 10)));
+      }
+      if (digits == 0) {
+        return fail(c, "\\x without hexadecimal digits");
+      }
+      break;
+    default:
+      return fail(c, "unknown escape sequence");
+  }
+  c->p++;
+  return 1;
+}
+
+static int compile_string(Compiler* c) {
+  uint8_t text[2 + STRING_MAX_LENGTH + 4];
+  uint32_t length = 0;
+  uint32_t split;
+
+  skip_spaces(c);
+  if (*c->p != '"') {
+    return fail(c, "string expected in double quotes");
+  }
+  c->p++;
+
+  text[0] = MACRO_OP_STRING;
+  while (*c->p != '"') {
+    if (!read_char(c, &text[2 + length])) {
+      return 0;
+    }
+    length++;
+    if (length < (STRING_MAX_LENGTH + 1)) {
+      continue;
+    }
+
+    // Full: emit up to the last whole UTF-8 character, keep the rest.
+    split = STRING_MAX_LENGTH;
+    while ((split > 0) && ((text[2 + split] & 0xC0) == 0x80)) {
+      split--;
+    }
+    if (split == 0) {
+      return fail(c, "invalid UTF-8 text");
+    }
+    text[1] = (uint8_t) split;
+    if (!emit(c, text, 2 + split)) {
+      return 0;
+    }
+    length -= split;
+    memmove(&text[2], &text[2 + split], length);
+  }
+  c->p++;
+
+  if (length > 0) {
+    text[1] = (uint8_t) length;
+    return emit(c, text, 2 + length);
+  }
+  return 1;
+}
+
+static void skip_spaces(Compiler* c) {
+  while ((*c->p == ' ') || (*c->p == '\t') || (*c->p == '\r')) {
+    c->p++;
+  }
+}
+
+static int at_end_of_line(Compiler* c) {
+  skip_spaces(c);
+  return (*c->p == '\0') || (*c->p == '\n') || (*c->p == '#');
+}
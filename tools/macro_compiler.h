@@ -0,0 +1,54 @@
+/*!
+ * @file   macro_compiler.h
+ * @brief  Compiler from macro scripts to the macro image of the keyboard
+ *
+ * A script is a list of macros, one instruction per line (see usb_hid_macro.h
+ * for the bytecode). Everything after a '#' outside quotes is a comment.
+ *
+ *   macro                   Start the next macro (the first one needs none).
+ *   press KEY               Press a key.
+ *   release KEY             Release a key.
+ *   tap KEY                 Press and release a key.
+ *   release_all             Release all keys.
+ *   string "TEXT"           Type UTF-8 text, with the C escapes \n \t \\ \" \xHH.
+ *   delay FRAMES            Wait for the given number of USB frames (1 ms).
+ *   repeat COUNT            Run the lines up to the matching "loop" COUNT times.
+ *   loop                    End of a repeated block.
+ *   mouse_move X Y [WHEEL]  Move the mouse pointer and wheel.
+ *
+ * KEY is a character in single quotes ('a'), typed with the layout of the
+ * keyboard, a key name of usb_hid_keyboard.h without its KEY_ prefix
+ * (LEFT_CTRL, RETURN, F5...), USAGE(n) for any HID usage, or a number.
+ * Strings longer than an instruction takes are split.
+ */
+#ifndef MACRO_COMPILER_H_
+#define MACRO_COMPILER_H_
+
+#include <stdint.h>
+
+/**
+ * Maximum number of macros in an image.
+ */
+#define MACRO_COMPILER_MAX_MACROS  256
+
+/**
+ * Compilation error.
+ */
+typedef struct {
+  int line;
+  char message[128];
+} MacroCompilerError;
+
+/*!
+ * @brief Compile a script to a macro image, ready to be flashed at the start
+ *        of the MACROS region.
+ *
+ * @param[in]  script Script text, NUL terminated.
+ * @param[out] image  Macro image.
+ * @param[in]  size   Image buffer size in bytes (at most the region size).
+ * @param[out] error  Line and cause of the first error, in case of failure.
+ * @return     Image size in bytes, otherwise -1 in case of error.
+ */
+int MacroCompiler_Compile(const char* script, uint8_t* image, uint32_t size, MacroCompilerError* error);
+
+#endif // MACRO_COMPILER_H_
@@ -0,0 +1,87 @@
+/*!
+ * @file   macro_compiler_main.c
+ * @brief  Command line macro compiler
+ *
+ *   macro_compiler <script> <image>
+ *
+ * Compiles the script (see macro_compiler.h) to a macro image, to be flashed
+ * at the start of the MACROS region of the keyboard, e.g.:
+ *
+ *   st-flash write image.bin 0x800C000
+ */
+#include "macro_compiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Size of the MACROS region (see the linker script).
+ */
+#define MACROS_REGION_SIZE  (16 * 1024)
+
+/*!
+ * @brief Read a whole file.
+ *
+ * @param[in] path File path.
+ * @return    File contents, NUL terminated, NULL in case of error.
+ */
+static char* read_file(const char* path);
+
+int main(int argc, char** argv) {
+  static uint8_t image[MACROS_REGION_SIZE];
+  MacroCompilerError error;
+  char* script;
+  FILE* file;
+  int size;
+
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s <script> <image>\n", argv[0]);
+    return 2;
+  }
+  script = read_file(argv[1]);
+  if (script == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  size = MacroCompiler_Compile(script, image, sizeof(image), &error);
+  free(script);
+  if (size < 0) {
+    fprintf(stderr, "%s:%d: %s\n", argv[1], error.line, error.message);
+    return 1;
+  }
+
+  file = fopen(argv[2], "wb");
+  if ((file == NULL) || (fwrite(image, 1, (size_t) size, file) != (size_t) size) || (fclose(file) != 0)) {
+    perror(argv[2]);
+    return 1;
+  }
+  printf("%s: %d of %d bytes\n", argv[2], size, MACROS_REGION_SIZE);
+  return 0;
+}
+
+static char* read_file(const char* path) {
+  FILE* file = fopen(path, "rb");
+  char* data = NULL;
+  size_t length = 0;
+  size_t read;
+
+  if (file == NULL) {
+    return NULL;
+  }
+  do {
+    char* grown = realloc(data, length + 4096 + 1);
+
+    if (grown == NULL) {
+      free(data);
+      fclose(file);
+      return NULL;
+    }
+    data = grown;
+    read = fread(&data[length], 1, 4096, file);
+    length += read;
+  } while (read == 4096);
+  fclose(file);
+  data[length] = '\0';
+  return data;
+}
@@ -0,0 +1,96 @@
+/*!
+ * @file   usbmon_analyzer.c
+ * @brief  Report rate and jitter of an IN endpoint from a usbmon text capture
+ */
+#include "usbmon_analyzer.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*!
+ * @brief Parse a usbmon line.
+ *
+ * @param[in]  line      Text line.
+ * @param[out] timestamp Timestamp in microseconds.
+ * @param[out] device    Device address.
+ * @param[out] endpoint  Endpoint address, with the direction bit.
+ * @param[out] length    Data length.
+ * @return     True (1) for the completion of a successful transfer, otherwise false (0).
+ */
+static int parse_line(const char* line, uint32_t* timestamp, int* device, int* endpoint, uint32_t* length);
+
+uint32_t UsbmonAnalyzer_Analyze(FILE* file, int device, int endpoint, UsbmonStats* stats) {
+  char line[512];
+  uint32_t timestamp;
+  uint32_t last = 0;
+  uint32_t length;
+  uint32_t intervals = 0;
+  double interval;
+  double mean = 0;
+  double m2 = 0;
+  double delta;
+  int line_device;
+  int line_endpoint;
+
+  memset(stats, 0, sizeof(*stats));
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (!parse_line(line, &timestamp, &line_device, &line_endpoint, &length) ||
+        (line_endpoint != (endpoint | 0x80)) || (length == 0) ||
+        ((device != USBMON_ANY_DEVICE) && (line_device != device))) {
+      continue;
+    }
+    if (stats->reports > 0) {
+      // The 32-bit timestamps wrap around after about 71 minutes.
+      interval = (double) (uint32_t) (timestamp - last);
+      stats->duration_us += interval;
+      if ((intervals == 0) || (interval < stats->min_interval_us)) {
+        stats->min_interval_us = interval;
+      }
+      if (interval > stats->max_interval_us) {
+        stats->max_interval_us = interval;
+      }
+      // Running mean and variance (Welford).
+      intervals++;
+      delta = interval - mean;
+      mean += delta / intervals;
+      m2 += delta * (interval - mean);
+    }
+    last = timestamp;
+    stats->reports++;
+  }
+
+  if (intervals > 0) {
+    stats->mean_interval_us = mean;
+    stats->jitter_us = sqrt(m2 / intervals);
+    stats->rate = (intervals * 1e6) / stats->duration_us;
+  }
+  return stats->reports;
+}
+
+static int parse_line(const char* line, uint32_t* timestamp, int* device, int* endpoint, uint32_t* length) {
+  unsigned long time;
+  char event;
+  char type;
+  char direction;
+  unsigned bus;
+  unsigned address;
+  unsigned number;
+  char status[32];
+  unsigned data_length;
+
+  // URB tag, timestamp, event, address (Ii:1:002:1), status and length.
+  if (sscanf(line, "%*s %lu %c %c%c:%u:%u:%u %31s %u", &time, &event, &type, &direction, &bus, &address,
+             &number, status, &data_length) != 9) {
+    return 0;
+  }
+  // Interrupt transfers show the interval after the status, "0:1".
+  if ((event != 'C') || (direction != 'i') || (strtol(status, NULL, 10) != 0)) {
+    return 0;
+  }
+  *timestamp = (uint32_t) time;
+  *device = (int) address;
+  *endpoint = (int) (number | 0x80);
+  *length = data_length;
+  return 1;
+}
@@ -0,0 +1,46 @@
+/*!
+ * @file   usbmon_analyzer.h
+ * @brief  Report rate and jitter of an IN endpoint from a usbmon text capture
+ *
+ * Reads the text format of the Linux usbmon (Documentation/usb/usbmon.rst),
+ * e.g. "cat /sys/kernel/debug/usb/usbmon/1u > capture.txt" while the device
+ * streams reports. Every completed IN transfer carrying data counts as a
+ * report, its timestamp is the completion time in microseconds.
+ */
+#ifndef USBMON_ANALYZER_H_
+#define USBMON_ANALYZER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Match any device address.
+ */
+#define USBMON_ANY_DEVICE  (-1)
+
+/**
+ * Reports of one endpoint.
+ */
+typedef struct {
+  uint32_t reports;
+  double duration_us;       // First to last report.
+  double rate;              // Reports per second.
+  double mean_interval_us;
+  double jitter_us;         // Standard deviation of the intervals.
+  double min_interval_us;
+  double max_interval_us;
+} UsbmonStats;
+
+/*!
+ * @brief Analyze the reports of an IN endpoint in a usbmon text capture.
+ *        Lines of other endpoints, submissions and errors are skipped.
+ *
+ * @param[in]  file     Capture.
+ * @param[in]  device   Device address, USBMON_ANY_DEVICE for any.
+ * @param[in]  endpoint Endpoint number, without the direction bit.
+ * @param[out] stats    Reports found, rate and intervals.
+ * @return     Number of reports.
+ */
+uint32_t UsbmonAnalyzer_Analyze(FILE* file, int device, int endpoint, UsbmonStats* stats);
+
+#endif // USBMON_ANALYZER_H_
@@ -0,0 +1,41 @@
+/*!
+ * @file   usbmon_analyzer_main.c
+ * @brief  Command line usbmon analyzer
+ *
+ *   usbmon_analyzer <endpoint> [device] < capture.txt
+ *
+ * Prints the report rate and the jitter of an IN endpoint (number without
+ * the direction bit, 1 for the HID endpoints) from a usbmon text capture,
+ * e.g. while the mouse streams with MOUSE_BENCHMARK set:
+ *
+ *   cat /sys/kernel/debug/usb/usbmon/1u | head -n 10000 | usbmon_analyzer 1
+ */
+#include "usbmon_analyzer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char** argv) {
+  UsbmonStats stats;
+  int device = USBMON_ANY_DEVICE;
+
+  if ((argc < 2) || (argc > 3)) {
+    fprintf(stderr, "usage: %s <endpoint> [device] < capture\n", argv[0]);
+    return 2;
+  }
+  if (argc == 3) {
+    device = atoi(argv[2]);
+  }
+
+  if (UsbmonAnalyzer_Analyze(stdin, device, atoi(argv[1]), &stats) < 2) {
+    fprintf(stderr, "%s: not enough reports\n", argv[0]);
+    return 1;
+  }
+  printf("reports   %u\n", (unsigned) stats.reports);
+  printf("duration  %.3f ms\n", stats.duration_us / 1000);
+  printf("rate      %.1f reports/s\n", stats.rate);
+  printf("interval  %.1f us mean, %.1f us min, %.1f us max\n", stats.mean_interval_us,
+         stats.min_interval_us, stats.max_interval_us);
+  printf("jitter    %.1f us\n", stats.jitter_us);
+  return 0;
+}
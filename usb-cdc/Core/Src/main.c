@@ -7,6 +7,14 @@
 #include "main.h"
 #include "usb_device.h"
 #include "usbd_cdc_if.h"
+#include "scheduler.h"
+
+// Set to 1 to stream data as fast as the CDC endpoints allow. Throughput is
+// measured on the host (e.g. "cat /dev/ttyACM0 | pv > /dev/null" and
+// "pv /dev/zero > /dev/ttyACM0"), with USBD_CDC_DOUBLE_BUFFER set to 0 or 1.
+#ifndef CDC_BENCHMARK
+#define CDC_BENCHMARK 0
+#endif
 
 /*!
  * @brief System clock configuration.
@@ -20,6 +28,15 @@ void SystemClock_Config(void);
  */
 static void MX_GPIO_Init(void);
 
+/*!
+ * @brief Send a greeting over the USB CDC Device and discard what the host
+ *        sends, or with CDC_BENCHMARK set keep both directions busy.
+ *        Reschedules itself.
+ * @param[in] arg Unused.
+ * @return None.
+ */
+static void cdc_task(void* arg);
+
 /*!
  * @brief Application entry point.
  * @return Execution final status.
@@ -36,12 +53,43 @@ int main(void) {
   MX_GPIO_Init();
   MX_USB_DEVICE_Init();
 
-  // Infinite loop.
-  while (1) {
-    // Send string using STM32 as a USB CDC Device, at 1 Hz.
-    CDC_Transmit_FS((uint8_t *) "Hello World!\n", 13);
-    HAL_Delay(1000);
+  Scheduler_Init();
+  Scheduler_Post(cdc_task, NULL);
+  Scheduler_Run();
+}
+
+static void cdc_task(void* arg) {
+  static uint8_t sink[256];
+#if CDC_BENCHMARK
+  static uint8_t pattern[256];
+  static int initialized = 0;
+
+  if (!initialized) {
+    for (uint32_t i = 0; i < sizeof(pattern); i++) {
+      pattern[i] = (uint8_t) i;
+    }
+    initialized = 1;
+  }
+
+  // Keep the transmit ring full and drain everything received.
+  CDC_Write(pattern, sizeof(pattern));
+  CDC_Read(sink, sizeof(sink));
+  Scheduler_Post(cdc_task, NULL);
+#else
+  static uint32_t greeting_tick = 0;
+
+  // Drain the receive ring, otherwise the host is NAKed forever once it is
+  // full.
+  while (CDC_Read(sink, sizeof(sink)) > 0) {
+  }
+
+  // Send string using STM32 as a USB CDC Device, at 1 Hz.
+  if ((HAL_GetTick() - greeting_tick) >= 1000) {
+    greeting_tick = HAL_GetTick();
+    CDC_Write((const uint8_t *) "Hello World!\n", 13);
   }
+  Scheduler_PostDelayed(cdc_task, NULL, 1);
+#endif
 }
 
 void SystemClock_Config(void) {
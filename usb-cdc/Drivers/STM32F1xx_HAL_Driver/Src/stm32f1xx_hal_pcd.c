@@ -1998,6 +1998,7 @@ static HAL_StatusTypeDef PCD_EP_ISR_Handler(PCD_HandleTypeDef *hpcd)
 {
   PCD_EPTypeDef *ep;
   uint16_t count;
+  uint16_t pmabuffer;
   uint16_t wIstr;
   uint16_t wEPVal;
   uint8_t epindex;
@@ -2117,26 +2118,41 @@ static HAL_StatusTypeDef PCD_EP_ISR_Handler(PCD_HandleTypeDef *hpcd)
         }
         else
         {
-          if ((PCD_GET_ENDPOINT(hpcd->Instance, ep->num) & USB_EP_DTOG_RX) != 0U)
+          /* The filled buffer is the one not selected by SW_BUF (DTOG_TX) */
+          if ((PCD_GET_ENDPOINT(hpcd->Instance, ep->num) & USB_EP_DTOG_TX) != 0U)
           {
-            /*read from endpoint BUF0Addr buffer*/
             count = (uint16_t)PCD_GET_EP_DBUF0_CNT(hpcd->Instance, ep->num);
-            if (count != 0U)
-            {
-              USB_ReadPMA(hpcd->Instance, ep->xfer_buff, ep->pmaaddr0, count);
-            }
+            pmabuffer = ep->pmaaddr0;
           }
           else
           {
-            /*read from endpoint BUF1Addr buffer*/
             count = (uint16_t)PCD_GET_EP_DBUF1_CNT(hpcd->Instance, ep->num);
-            if (count != 0U)
-            {
-              USB_ReadPMA(hpcd->Instance, ep->xfer_buff, ep->pmaaddr1, count);
-            }
+            pmabuffer = ep->pmaaddr1;
+          }
+
+          if (count > ep->xfer_len)
+          {
+            count = (uint16_t)ep->xfer_len;
+          }
+          ep->xfer_len -= count;
+
+          if ((ep->xfer_len == 0U) || (count < ep->maxpacket))
+          {
+            /* Last packet: keep its buffer so the host is NAKed until the
+               next transfer is started */
+            ep->xfer_fill_db = 1U;
+          }
+          else
+          {
+            /* free EP OUT Buffer first, the next packet can then be received
+               while this one is copied */
+            PCD_FreeUserBuffer(hpcd->Instance, ep->num, 0U);
+          }
+
+          if (count != 0U)
+          {
+            USB_ReadPMA(hpcd->Instance, ep->xfer_buff, pmabuffer, count);
           }
-          /* free EP OUT Buffer */
-          PCD_FreeUserBuffer(hpcd->Instance, ep->num, 0U);
         }
         /*multi-packet on the NON control OUT endpoint*/
         ep->xfer_count += count;
@@ -2151,9 +2167,14 @@ static HAL_StatusTypeDef PCD_EP_ISR_Handler(PCD_HandleTypeDef *hpcd)
           HAL_PCD_DataOutStageCallback(hpcd, ep->num);
 #endif /* USE_HAL_PCD_REGISTER_CALLBACKS */
         }
+        else if (ep->doublebuffer == 0U)
+        {
+          /* Keep xfer_count, the transfer continues with the next packet */
+          (void)USB_EPStartXfer(hpcd->Instance, ep);
+        }
         else
         {
-          (void)HAL_PCD_EP_Receive(hpcd, ep->num, ep->xfer_buff, ep->xfer_len);
+          /* The next packet is already being received in the other buffer */
         }
 
       } /* if((wEPVal & EP_CTR_RX) */
@@ -2165,23 +2186,61 @@ static HAL_StatusTypeDef PCD_EP_ISR_Handler(PCD_HandleTypeDef *hpcd)
         /* clear int flag */
         PCD_CLEAR_TX_EP_CTR(hpcd->Instance, epindex);
 
-        /*multi-packet on the NON control IN endpoint*/
-        ep->xfer_count = PCD_GET_EP_TX_CNT(hpcd->Instance, ep->num);
-        ep->xfer_buff += ep->xfer_count;
-
-        /* Zero Length Packet? */
-        if (ep->xfer_len == 0U)
+        if (ep->doublebuffer != 0U)
         {
-          /* TX COMPLETE */
+          /* The acknowledged buffer is the one DTOG_TX just moved away from */
+          if ((PCD_GET_ENDPOINT(hpcd->Instance, ep->num) & USB_EP_DTOG_TX) != 0U)
+          {
+            ep->xfer_count += PCD_GET_EP_DBUF0_CNT(hpcd->Instance, ep->num);
+          }
+          else
+          {
+            ep->xfer_count += PCD_GET_EP_DBUF1_CNT(hpcd->Instance, ep->num);
+          }
+          ep->xfer_fill_db--;
+
+          if (ep->xfer_fill_db != 0U)
+          {
+            /* Hand the prefilled buffer over first, then refill the one
+               that was just sent */
+            PCD_FreeUserBuffer(hpcd->Instance, ep->num, 1U);
+
+            if (ep->xfer_len > 0U)
+            {
+              USB_EPWriteDBuf(hpcd->Instance, ep,
+                              PCD_GET_ENDPOINT(hpcd->Instance, ep->num) & USB_EP_DTOG_RX);
+            }
+          }
+          else
+          {
+            /* TX COMPLETE */
 #if (USE_HAL_PCD_REGISTER_CALLBACKS == 1U)
-          hpcd->DataInStageCallback(hpcd, ep->num);
+            hpcd->DataInStageCallback(hpcd, ep->num);
 #else
-          HAL_PCD_DataInStageCallback(hpcd, ep->num);
+            HAL_PCD_DataInStageCallback(hpcd, ep->num);
 #endif /* USE_HAL_PCD_REGISTER_CALLBACKS */
+          }
         }
         else
         {
-          (void)HAL_PCD_EP_Transmit(hpcd, ep->num, ep->xfer_buff, ep->xfer_len);
+          /*multi-packet on the NON control IN endpoint*/
+          ep->xfer_count = PCD_GET_EP_TX_CNT(hpcd->Instance, ep->num);
+          ep->xfer_buff += ep->xfer_count;
+
+          /* Zero Length Packet? */
+          if (ep->xfer_len == 0U)
+          {
+            /* TX COMPLETE */
+#if (USE_HAL_PCD_REGISTER_CALLBACKS == 1U)
+            hpcd->DataInStageCallback(hpcd, ep->num);
+#else
+            HAL_PCD_DataInStageCallback(hpcd, ep->num);
+#endif /* USE_HAL_PCD_REGISTER_CALLBACKS */
+          }
+          else
+          {
+            (void)HAL_PCD_EP_Transmit(hpcd, ep->num, ep->xfer_buff, ep->xfer_len);
+          }
         }
       }
     }
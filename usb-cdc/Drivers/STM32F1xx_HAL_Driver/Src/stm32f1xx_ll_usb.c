@@ -2014,6 +2014,7 @@ HAL_StatusTypeDef USB_ActivateEndpoint(USB_TypeDef *USBx, USB_EPTypeDef *ep)
   {
     /* Set the endpoint as double buffered */
     PCD_SET_EP_DBUF(USBx, ep->num);
+    ep->xfer_fill_db = 0U;
     /* Set buffer address for double buffered mode */
     PCD_SET_EP_DBUF_ADDR(USBx, ep->num, ep->pmaaddr0, ep->pmaaddr1);
 
@@ -2115,75 +2116,92 @@ HAL_StatusTypeDef USB_DeactivateEndpoint(USB_TypeDef *USBx, USB_EPTypeDef *ep)
   */
 HAL_StatusTypeDef USB_EPStartXfer(USB_TypeDef *USBx, USB_EPTypeDef *ep)
 {
-  uint16_t pmabuffer;
+  uint16_t wEPVal;
   uint32_t len;
 
   /* IN endpoint */
   if (ep->is_in == 1U)
   {
-    /*Multi packet transfer*/
-    if (ep->xfer_len > ep->maxpacket)
-    {
-      len = ep->maxpacket;
-      ep->xfer_len -= len;
-    }
-    else
-    {
-      len = ep->xfer_len;
-      ep->xfer_len = 0U;
-    }
-
     /* configure and validate Tx endpoint */
     if (ep->doublebuffer == 0U)
     {
+      /*Multi packet transfer*/
+      if (ep->xfer_len > ep->maxpacket)
+      {
+        len = ep->maxpacket;
+        ep->xfer_len -= len;
+      }
+      else
+      {
+        len = ep->xfer_len;
+        ep->xfer_len = 0U;
+      }
+
       USB_WritePMA(USBx, ep->xfer_buff, ep->pmaadress, (uint16_t)len);
       PCD_SET_EP_TX_CNT(USBx, ep->num, len);
     }
     else
     {
-      /* Write the data to the USB endpoint */
-      if ((PCD_GET_ENDPOINT(USBx, ep->num) & USB_EP_DTOG_TX) != 0U)
+      /* The peripheral sends from the buffer selected by DTOG_TX while the
+         application owns the one selected by SW_BUF (DTOG_RX) */
+      ep->xfer_fill_db = 0U;
+      wEPVal = PCD_GET_ENDPOINT(USBx, ep->num);
+
+      if (((wEPVal & USB_EP_DTOG_TX) != 0U) == ((wEPVal & USB_EP_DTOG_RX) != 0U))
       {
-        /* Set the Double buffer counter for pmabuffer1 */
-        PCD_SET_EP_DBUF1_CNT(USBx, ep->num, ep->is_in, len);
-        pmabuffer = ep->pmaaddr1;
+        /* Idle: fill the application buffer and hand it over */
+        USB_EPWriteDBuf(USBx, ep, wEPVal & USB_EP_DTOG_RX);
+        PCD_FreeUserBuffer(USBx, ep->num, 1U);
       }
       else
       {
-        /* Set the Double buffer counter for pmabuffer0 */
-        PCD_SET_EP_DBUF0_CNT(USBx, ep->num, ep->is_in, len);
-        pmabuffer = ep->pmaaddr0;
+        /* Right after activation the peripheral already owns a buffer */
+        USB_EPWriteDBuf(USBx, ep, wEPVal & USB_EP_DTOG_TX);
+      }
+
+      /* Prefill the other buffer, it is handed over as soon as the first
+         packet is acknowledged */
+      if (ep->xfer_len > 0U)
+      {
+        USB_EPWriteDBuf(USBx, ep, PCD_GET_ENDPOINT(USBx, ep->num) & USB_EP_DTOG_RX);
       }
-      USB_WritePMA(USBx, ep->xfer_buff, pmabuffer, (uint16_t)len);
-      PCD_FreeUserBuffer(USBx, ep->num, ep->is_in);
     }
 
     PCD_SET_EP_TX_STATUS(USBx, ep->num, USB_EP_TX_VALID);
   }
   else /* OUT endpoint */
   {
-    /* Multi packet transfer*/
-    if (ep->xfer_len > ep->maxpacket)
-    {
-      len = ep->maxpacket;
-      ep->xfer_len -= len;
-    }
-    else
-    {
-      len = ep->xfer_len;
-      ep->xfer_len = 0U;
-    }
-
     /* configure and validate Rx endpoint */
     if (ep->doublebuffer == 0U)
     {
+      /* Multi packet transfer*/
+      if (ep->xfer_len > ep->maxpacket)
+      {
+        len = ep->maxpacket;
+        ep->xfer_len -= len;
+      }
+      else
+      {
+        len = ep->xfer_len;
+        ep->xfer_len = 0U;
+      }
+
       /*Set RX buffer count*/
       PCD_SET_EP_RX_CNT(USBx, ep->num, len);
     }
     else
     {
-      /*Set the Double buffer counter*/
-      PCD_SET_EP_DBUF_CNT(USBx, ep->num, ep->is_in, len);
+      /* Both buffers take a full packet, the remaining length is tracked by
+         the interrupt handler */
+      PCD_SET_EP_DBUF_CNT(USBx, ep->num, ep->is_in, ep->maxpacket);
+
+      if (ep->xfer_fill_db != 0U)
+      {
+        /* The last packet of the previous transfer kept its buffer to NAK
+           the host, give it back now that there is room again */
+        ep->xfer_fill_db = 0U;
+        PCD_FreeUserBuffer(USBx, ep->num, 0U);
+      }
     }
 
     PCD_SET_EP_RX_STATUS(USBx, ep->num, USB_EP_RX_VALID);
@@ -2192,6 +2210,47 @@ HAL_StatusTypeDef USB_EPStartXfer(USB_TypeDef *USBx, USB_EPTypeDef *ep)
   return HAL_OK;
 }
 
+/**
+  * @brief  USB_EPWriteDBuf : write the next packet of an IN transfer into one
+  *         of the buffers of a double buffered endpoint
+  * @param  USBx : Selected device
+  * @param  ep: pointer to endpoint structure
+  * @param  buf: buffer to fill, 0 for buffer 0 and any other value for buffer 1
+  * @retval None
+  */
+void USB_EPWriteDBuf(USB_TypeDef *USBx, USB_EPTypeDef *ep, uint32_t buf)
+{
+  uint16_t pmabuffer;
+  uint32_t len;
+
+  if (ep->xfer_len > ep->maxpacket)
+  {
+    len = ep->maxpacket;
+  }
+  else
+  {
+    len = ep->xfer_len;
+  }
+
+  if (buf != 0U)
+  {
+    /* Set the Double buffer counter for pmabuffer1 */
+    PCD_SET_EP_DBUF1_CNT(USBx, ep->num, ep->is_in, len);
+    pmabuffer = ep->pmaaddr1;
+  }
+  else
+  {
+    /* Set the Double buffer counter for pmabuffer0 */
+    PCD_SET_EP_DBUF0_CNT(USBx, ep->num, ep->is_in, len);
+    pmabuffer = ep->pmaaddr0;
+  }
+
+  USB_WritePMA(USBx, ep->xfer_buff, pmabuffer, (uint16_t)len);
+  ep->xfer_buff += len;
+  ep->xfer_len -= len;
+  ep->xfer_fill_db++;
+}
+
 /**
   * @brief  USB_WritePacket : Writes a packet into the Tx FIFO associated
   *         with the EP/channel
@@ -2518,6 +2577,41 @@ void USB_WritePMA(USB_TypeDef *USBx, uint8_t *pbUsrBuf, uint16_t wPMABufAddr, ui
 
   pdwVal = (__IO uint16_t *)(BaseAddr + 0x400U + ((uint32_t)wPMABufAddr * PMA_ACCESS));
 
+  /* Word aligned user buffer: load 32 bits at a time and split them in two
+     PMA half words, 16 bytes per iteration then one word at a time */
+  if (((uint32_t)pBuf & 3U) == 0U)
+  {
+    for (i = n >> 3; i != 0U; i--)
+    {
+      temp1 = __UNALIGNED_UINT32_READ(pBuf);
+      pdwVal[0] = (uint16_t)temp1;
+      pdwVal[1U * PMA_ACCESS] = (uint16_t)(temp1 >> 16);
+      temp1 = __UNALIGNED_UINT32_READ(pBuf + 4U);
+      pdwVal[2U * PMA_ACCESS] = (uint16_t)temp1;
+      pdwVal[3U * PMA_ACCESS] = (uint16_t)(temp1 >> 16);
+      temp1 = __UNALIGNED_UINT32_READ(pBuf + 8U);
+      pdwVal[4U * PMA_ACCESS] = (uint16_t)temp1;
+      pdwVal[5U * PMA_ACCESS] = (uint16_t)(temp1 >> 16);
+      temp1 = __UNALIGNED_UINT32_READ(pBuf + 12U);
+      pdwVal[6U * PMA_ACCESS] = (uint16_t)temp1;
+      pdwVal[7U * PMA_ACCESS] = (uint16_t)(temp1 >> 16);
+      pdwVal += 8U * PMA_ACCESS;
+      pBuf += 16U;
+    }
+
+    for (i = (n >> 1) & 3U; i != 0U; i--)
+    {
+      temp1 = __UNALIGNED_UINT32_READ(pBuf);
+      pdwVal[0] = (uint16_t)temp1;
+      pdwVal[1U * PMA_ACCESS] = (uint16_t)(temp1 >> 16);
+      pdwVal += 2U * PMA_ACCESS;
+      pBuf += 4U;
+    }
+
+    /* At most one half word left */
+    n &= 1U;
+  }
+
   for (i = n; i != 0U; i--)
   {
     temp1 = *pBuf;
@@ -2552,6 +2646,31 @@ void USB_ReadPMA(USB_TypeDef *USBx, uint8_t *pbUsrBuf, uint16_t wPMABufAddr, uin
 
   pdwVal = (__IO uint16_t *)(BaseAddr + 0x400U + ((uint32_t)wPMABufAddr * PMA_ACCESS));
 
+  /* Word aligned user buffer: combine two PMA half words and store 32 bits
+     at a time, 16 bytes per iteration then one word at a time */
+  if (((uint32_t)pBuf & 3U) == 0U)
+  {
+    for (i = n >> 3; i != 0U; i--)
+    {
+      __UNALIGNED_UINT32_WRITE(pBuf, (uint32_t)pdwVal[0] | ((uint32_t)pdwVal[1U * PMA_ACCESS] << 16));
+      __UNALIGNED_UINT32_WRITE(pBuf + 4U, (uint32_t)pdwVal[2U * PMA_ACCESS] | ((uint32_t)pdwVal[3U * PMA_ACCESS] << 16));
+      __UNALIGNED_UINT32_WRITE(pBuf + 8U, (uint32_t)pdwVal[4U * PMA_ACCESS] | ((uint32_t)pdwVal[5U * PMA_ACCESS] << 16));
+      __UNALIGNED_UINT32_WRITE(pBuf + 12U, (uint32_t)pdwVal[6U * PMA_ACCESS] | ((uint32_t)pdwVal[7U * PMA_ACCESS] << 16));
+      pdwVal += 8U * PMA_ACCESS;
+      pBuf += 16U;
+    }
+
+    for (i = (n >> 1) & 3U; i != 0U; i--)
+    {
+      __UNALIGNED_UINT32_WRITE(pBuf, (uint32_t)pdwVal[0] | ((uint32_t)pdwVal[1U * PMA_ACCESS] << 16));
+      pdwVal += 2U * PMA_ACCESS;
+      pBuf += 4U;
+    }
+
+    /* At most one half word left, plus the odd byte */
+    n &= 1U;
+  }
+
   for (i = n; i != 0U; i--)
   {
     temp = *(__IO uint16_t *)pdwVal;
@@ -41,8 +41,18 @@ extern "C" {
 /** @defgroup usbd_cdc_Exported_Defines
   * @{
   */
+#ifndef USBD_CDC_DOUBLE_BUFFER
+#define USBD_CDC_DOUBLE_BUFFER                      0U
+#endif /* USBD_CDC_DOUBLE_BUFFER */
+
 #define CDC_IN_EP                                   0x81U  /* EP1 for data IN */
+#if (USBD_CDC_DOUBLE_BUFFER == 1U)
+/* A double buffered endpoint uses both buffers of its endpoint register, so
+   data IN and data OUT can't share EP1 */
+#define CDC_OUT_EP                                  0x03U  /* EP3 for data OUT */
+#else
 #define CDC_OUT_EP                                  0x01U  /* EP1 for data OUT */
+#endif /* USBD_CDC_DOUBLE_BUFFER */
 #define CDC_CMD_EP                                  0x82U  /* EP2 for CDC commands */
 
 #ifndef CDC_HS_BINTERVAL
@@ -65,6 +75,12 @@ extern "C" {
 #define CDC_DATA_FS_IN_PACKET_SIZE                  CDC_DATA_FS_MAX_PACKET_SIZE
 #define CDC_DATA_FS_OUT_PACKET_SIZE                 CDC_DATA_FS_MAX_PACKET_SIZE
 
+/* Packet memory needed by the class endpoints: EP(name, address, max packet size, double buffered) */
+#define USBD_CDC_PMA_TABLE(EP) \
+  EP(CDC_IN,  CDC_IN_EP,  CDC_DATA_FS_IN_PACKET_SIZE,  USBD_CDC_DOUBLE_BUFFER) \
+  EP(CDC_OUT, CDC_OUT_EP, CDC_DATA_FS_OUT_PACKET_SIZE, USBD_CDC_DOUBLE_BUFFER) \
+  EP(CDC_CMD, CDC_CMD_EP, CDC_CMD_PACKET_SIZE,         0U)
+
 /*---------------------------------------------------------------------*/
 /*  CDC definitions                                                    */
 /*---------------------------------------------------------------------*/
@@ -104,6 +120,7 @@ typedef struct _USBD_CDC_Itf
   int8_t (* DeInit)(void);
   int8_t (* Control)(uint8_t cmd, uint8_t *pbuf, uint16_t length);
   int8_t (* Receive)(uint8_t *Buf, uint32_t *Len);
+  int8_t (* TransmitCplt)(uint8_t *Buf, uint32_t *Len, uint8_t epnum);
 
 } USBD_CDC_ItfTypeDef;
 
@@ -115,6 +132,7 @@ typedef struct
   uint8_t  CmdLength;
   uint8_t  *RxBuffer;
   uint8_t  *TxBuffer;
+  uint32_t RxBufferSize;
   uint32_t RxLength;
   uint32_t TxLength;
 
@@ -156,6 +174,9 @@ uint8_t  USBD_CDC_SetTxBuffer(USBD_HandleTypeDef   *pdev,
 uint8_t  USBD_CDC_SetRxBuffer(USBD_HandleTypeDef   *pdev,
                               uint8_t  *pbuff);
 
+uint8_t  USBD_CDC_SetRxBufferSize(USBD_HandleTypeDef   *pdev,
+                                  uint32_t size);
+
 uint8_t  USBD_CDC_ReceivePacket(USBD_HandleTypeDef *pdev);
 
 uint8_t  USBD_CDC_TransmitPacket(USBD_HandleTypeDef *pdev);
@@ -516,6 +516,9 @@ static uint8_t  USBD_CDC_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
   {
     hcdc = (USBD_CDC_HandleTypeDef *) pdev->pClassData;
 
+    /* Receive one packet at a time unless the interface asks for more */
+    hcdc->RxBufferSize = CDC_DATA_FS_OUT_PACKET_SIZE;
+
     /* Init  physical Interface components */
     ((USBD_CDC_ItfTypeDef *)pdev->pUserData)->Init();
 
@@ -533,7 +536,7 @@ static uint8_t  USBD_CDC_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
     {
       /* Prepare Out endpoint to receive next packet */
       USBD_LL_PrepareReceive(pdev, CDC_OUT_EP, hcdc->RxBuffer,
-                             CDC_DATA_FS_OUT_PACKET_SIZE);
+                             (uint16_t)hcdc->RxBufferSize);
     }
   }
   return ret;
@@ -678,21 +681,31 @@ static uint8_t  USBD_CDC_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
 {
   USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef *)pdev->pClassData;
   PCD_HandleTypeDef *hpcd = pdev->pData;
+  uint8_t zlp;
 
   if (pdev->pClassData != NULL)
   {
-    if ((pdev->ep_in[epnum].total_length > 0U) && ((pdev->ep_in[epnum].total_length % hpcd->IN_ep[epnum].maxpacket) == 0U))
+    zlp = (uint8_t)((pdev->ep_in[epnum].total_length > 0U) &&
+                    ((pdev->ep_in[epnum].total_length % hpcd->IN_ep[epnum].maxpacket) == 0U));
+
+    /* Update the packet total length */
+    pdev->ep_in[epnum].total_length = 0U;
+    hcdc->TxState = 0U;
+
+    /* Give the application a chance to chain the next transfer */
+    if (((USBD_CDC_ItfTypeDef *)pdev->pUserData)->TransmitCplt != NULL)
     {
-      /* Update the packet total length */
-      pdev->ep_in[epnum].total_length = 0U;
+      ((USBD_CDC_ItfTypeDef *)pdev->pUserData)->TransmitCplt(hcdc->TxBuffer, &hcdc->TxLength, epnum);
+    }
+
+    /* A ZLP is only needed to end the transfer when no more data follows */
+    if ((zlp != 0U) && (hcdc->TxState == 0U))
+    {
+      hcdc->TxState = 1U;
 
       /* Send ZLP */
       USBD_LL_Transmit(pdev, epnum, NULL, 0U);
     }
-    else
-    {
-      hcdc->TxState = 0U;
-    }
     return USBD_OK;
   }
   else
@@ -856,6 +869,25 @@ uint8_t  USBD_CDC_SetRxBuffer(USBD_HandleTypeDef   *pdev,
   return USBD_OK;
 }
 
+/**
+  * @brief  USBD_CDC_SetRxBufferSize
+  *         Set how many bytes the next reception may take. Larger sizes let
+  *         the endpoint receive several packets before the interface is
+  *         called, and should be a multiple of the packet size.
+  * @param  pdev: device instance
+  * @param  size: Rx Buffer size
+  * @retval status
+  */
+uint8_t  USBD_CDC_SetRxBufferSize(USBD_HandleTypeDef   *pdev,
+                                  uint32_t size)
+{
+  USBD_CDC_HandleTypeDef   *hcdc = (USBD_CDC_HandleTypeDef *) pdev->pClassData;
+
+  hcdc->RxBufferSize = size;
+
+  return USBD_OK;
+}
+
 /**
   * @brief  USBD_CDC_TransmitPacket
   *         Transmit packet on IN endpoint
@@ -921,7 +953,7 @@ uint8_t  USBD_CDC_ReceivePacket(USBD_HandleTypeDef *pdev)
       USBD_LL_PrepareReceive(pdev,
                              CDC_OUT_EP,
                              hcdc->RxBuffer,
-                             CDC_DATA_FS_OUT_PACKET_SIZE);
+                             (uint16_t)hcdc->RxBufferSize);
     }
     return USBD_OK;
   }
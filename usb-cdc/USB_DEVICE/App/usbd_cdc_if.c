@@ -23,6 +23,7 @@
 #include "usbd_cdc_if.h"
 
 /* USER CODE BEGIN INCLUDE */
+#include <string.h>
 
 /* USER CODE END INCLUDE */
 
@@ -65,8 +66,21 @@
 /* USER CODE BEGIN PRIVATE_DEFINES */
 /* Define size for the receive and transmit buffer over CDC */
 /* It's up to user to redefine and/or remove those define */
-#define APP_RX_DATA_SIZE  1000
-#define APP_TX_DATA_SIZE  1000
+#define APP_RX_DATA_SIZE  1024
+#define APP_TX_DATA_SIZE  1024
+
+/* The receive buffer is split in packet sized slots, so the OUT endpoint can
+   always be armed on a whole slot */
+#define APP_RX_SLOT_SIZE  CDC_DATA_FS_OUT_PACKET_SIZE
+#define APP_RX_SLOTS      (APP_RX_DATA_SIZE / APP_RX_SLOT_SIZE)
+
+/* A transfer takes at most half of the transmit ring, in whole packets, so
+   CDC_Write() can refill the other half while it is sent */
+#define APP_TX_CHUNK_SIZE (((APP_TX_DATA_SIZE / 2) / CDC_DATA_FS_IN_PACKET_SIZE) * CDC_DATA_FS_IN_PACKET_SIZE)
+
+/* A transfer that runs up to the end of the ring must still end on a packet
+   boundary, otherwise every wrap costs a short packet */
+_Static_assert((APP_TX_DATA_SIZE % CDC_DATA_FS_IN_PACKET_SIZE) == 0U, "APP_TX_DATA_SIZE must be a multiple of the IN packet size");
 /* USER CODE END PRIVATE_DEFINES */
 
 /**
@@ -99,6 +113,24 @@ uint8_t UserRxBufferFS[APP_RX_DATA_SIZE];
 uint8_t UserTxBufferFS[APP_TX_DATA_SIZE];
 
 /* USER CODE BEGIN PRIVATE_VARIABLES */
+/** UserTxBufferFS is used as a single producer / single consumer ring:
+  * CDC_Write() only moves the head, the IN completion only moves the tail. */
+static volatile uint32_t TxHeadFS = 0;
+static volatile uint32_t TxTailFS = 0;
+
+/** Length of the ring chunk currently owned by the IN endpoint */
+static volatile uint32_t TxChunkFS = 0;
+
+/** UserRxBufferFS is used as a ring of packet slots: the OUT endpoint fills
+  * the slot at the head, CDC_Read() drains the slot at the tail. Both are
+  * free running slot counters. */
+static volatile uint32_t RxHeadFS = 0;
+static volatile uint32_t RxTailFS = 0;
+static uint32_t RxLenFS[APP_RX_SLOTS];
+static uint32_t RxOffsetFS = 0;
+
+/** Set when the ring is full and the OUT endpoint is left NAKing */
+static volatile uint8_t RxPausedFS = 0;
 
 /* USER CODE END PRIVATE_VARIABLES */
 
@@ -130,8 +162,11 @@ static int8_t CDC_Init_FS(void);
 static int8_t CDC_DeInit_FS(void);
 static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length);
 static int8_t CDC_Receive_FS(uint8_t* pbuf, uint32_t *Len);
+static int8_t CDC_TransmitCplt_FS(uint8_t *pbuf, uint32_t *Len, uint8_t epnum);
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_DECLARATION */
+static void CDC_TxKick_FS(void);
+static void CDC_RxArm_FS(void);
 
 /* USER CODE END PRIVATE_FUNCTIONS_DECLARATION */
 
@@ -144,7 +179,8 @@ USBD_CDC_ItfTypeDef USBD_Interface_fops_FS =
   CDC_Init_FS,
   CDC_DeInit_FS,
   CDC_Control_FS,
-  CDC_Receive_FS
+  CDC_Receive_FS,
+  CDC_TransmitCplt_FS
 };
 
 /* Private functions ---------------------------------------------------------*/
@@ -157,7 +193,15 @@ static int8_t CDC_Init_FS(void)
   /* USER CODE BEGIN 3 */
   /* Set Application Buffers */
   USBD_CDC_SetTxBuffer(&hUsbDeviceFS, UserTxBufferFS, 0);
+  /* Unread data from a previous configuration is dropped */
+  RxHeadFS = 0;
+  RxTailFS = 0;
+  RxOffsetFS = 0;
+  RxPausedFS = 0;
   USBD_CDC_SetRxBuffer(&hUsbDeviceFS, UserRxBufferFS);
+
+  /* A chunk in flight across a bus reset is sent again from the tail */
+  TxChunkFS = 0;
   return (USBD_OK);
   /* USER CODE END 3 */
 }
@@ -251,10 +295,9 @@ static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length)
   *         through this function.
   *
   *         @note
-  *         This function will block any OUT packet reception on USB endpoint
-  *         untill exiting this function. If you exit this function before transfer
-  *         is complete on CDC interface (ie. using DMA controller) it will result
-  *         in receiving more data while previous ones are still not sent.
+  *         The transfer is left in the receive ring for CDC_Read(), one
+  *         packet per slot. The endpoint is only re-armed while a free slot
+  *         remains; otherwise the host is NAKed until CDC_Read() frees one.
   *
   * @param  Buf: Buffer of data to be received
   * @param  Len: Number of data received (in bytes)
@@ -263,8 +306,27 @@ static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length)
 static int8_t CDC_Receive_FS(uint8_t* Buf, uint32_t *Len)
 {
   /* USER CODE BEGIN 6 */
-  USBD_CDC_SetRxBuffer(&hUsbDeviceFS, &Buf[0]);
-  USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+  uint32_t remaining = *Len;
+
+  UNUSED(Buf);
+
+  /* A transfer may span several slots, only its last packet can be short.
+     Zero length packets carry no data, the same slot is armed again */
+  while (remaining != 0)
+  {
+    RxLenFS[RxHeadFS % APP_RX_SLOTS] = (remaining < APP_RX_SLOT_SIZE) ? remaining : APP_RX_SLOT_SIZE;
+    remaining -= RxLenFS[RxHeadFS % APP_RX_SLOTS];
+    RxHeadFS++;
+  }
+
+  if ((RxHeadFS - RxTailFS) < APP_RX_SLOTS)
+  {
+    CDC_RxArm_FS();
+  }
+  else
+  {
+    RxPausedFS = 1;
+  }
   return (USBD_OK);
   /* USER CODE END 6 */
 }
@@ -294,7 +356,177 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)
   return result;
 }
 
+/**
+  * @brief  CDC_TransmitCplt_FS
+  *         Data transmitted callback
+  *
+  *         @note
+  *         This function is IN transfer complete callback used to inform user that
+  *         the submitted Data is successfully sent over USB.
+  *
+  * @param  Buf: Buffer of data that was sent
+  * @param  Len: Number of data sent (in bytes)
+  * @param  epnum: Endpoint number
+  * @retval Result of the operation: USBD_OK if all operations are OK else USBD_FAIL
+  */
+static int8_t CDC_TransmitCplt_FS(uint8_t *Buf, uint32_t *Len, uint8_t epnum)
+{
+  uint8_t result = USBD_OK;
+  /* USER CODE BEGIN 13 */
+  UNUSED(Buf);
+  UNUSED(Len);
+  UNUSED(epnum);
+
+  /* Release the chunk the host just acknowledged and chain the next one */
+  if (TxChunkFS != 0)
+  {
+    TxTailFS = (TxTailFS + TxChunkFS) % APP_TX_DATA_SIZE;
+    TxChunkFS = 0;
+  }
+  CDC_TxKick_FS();
+  /* USER CODE END 13 */
+  return result;
+}
+
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
+/**
+  * @brief  CDC_Write
+  *         Queue data to be sent over USB IN endpoint. The data is copied
+  *         into the transmit ring and sent in the background, as large
+  *         multi-packet transfers, so this function never waits for the host.
+  *
+  * @param  Buf: Buffer of data to be sent
+  * @param  Len: Number of data to be sent (in bytes)
+  * @retval Number of bytes queued, lower than Len when the ring is full
+  */
+uint16_t CDC_Write(const uint8_t* Buf, uint16_t Len)
+{
+  uint32_t head = TxHeadFS;
+  uint32_t space = (TxTailFS + APP_TX_DATA_SIZE - head - 1U) % APP_TX_DATA_SIZE;
+  uint32_t count = (Len < space) ? Len : space;
+  uint32_t first = APP_TX_DATA_SIZE - head;
+  USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+
+  if (hcdc == NULL)
+  {
+    return 0;
+  }
+
+  /* Copy in at most two pieces around the end of the ring */
+  if (first > count)
+  {
+    first = count;
+  }
+  memcpy(&UserTxBufferFS[head], Buf, first);
+  memcpy(&UserTxBufferFS[0], &Buf[first], count - first);
+  TxHeadFS = (head + count) % APP_TX_DATA_SIZE;
+
+  /* Start the endpoint if it is not already draining the ring */
+  HAL_NVIC_DisableIRQ(USB_LP_CAN1_RX0_IRQn);
+  CDC_TxKick_FS();
+  HAL_NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
+
+  return (uint16_t)count;
+}
+
+/**
+  * @brief  CDC_Read
+  *         Read data received over USB OUT endpoint. Reading frees slots of
+  *         the receive ring and resumes reception if the host was being NAKed.
+  *
+  * @param  Buf: Buffer to store the received data
+  * @param  Len: Size of Buf (in bytes)
+  * @retval Number of bytes read, 0 if no data is available
+  */
+uint16_t CDC_Read(uint8_t* Buf, uint16_t Len)
+{
+  uint32_t count = 0;
+  uint32_t slot;
+  uint32_t n;
+
+  while ((count < Len) && (RxTailFS != RxHeadFS))
+  {
+    slot = RxTailFS % APP_RX_SLOTS;
+    n = RxLenFS[slot] - RxOffsetFS;
+    if (n > (Len - count))
+    {
+      n = Len - count;
+    }
+    memcpy(&Buf[count], &UserRxBufferFS[(slot * APP_RX_SLOT_SIZE) + RxOffsetFS], n);
+    count += n;
+    RxOffsetFS += n;
+
+    if (RxOffsetFS == RxLenFS[slot])
+    {
+      /* Slot fully consumed, hand it back to the endpoint */
+      RxOffsetFS = 0;
+      RxTailFS++;
+
+      HAL_NVIC_DisableIRQ(USB_LP_CAN1_RX0_IRQn);
+      if (RxPausedFS != 0)
+      {
+        RxPausedFS = 0;
+        CDC_RxArm_FS();
+      }
+      HAL_NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
+    }
+  }
+
+  return (uint16_t)count;
+}
+
+/**
+  * @brief  CDC_RxArm_FS
+  *         Arm the OUT endpoint on the free slots following the head of the
+  *         receive ring, up to the end of the buffer, so that consecutive
+  *         packets are taken without returning here. Must run from the USB
+  *         interrupt or with it masked.
+  * @retval None
+  */
+static void CDC_RxArm_FS(void)
+{
+  uint32_t slot = RxHeadFS % APP_RX_SLOTS;
+  uint32_t n = APP_RX_SLOTS - (RxHeadFS - RxTailFS);
+
+  if (hUsbDeviceFS.pClassData == NULL)
+  {
+    return;
+  }
+  if (n > (APP_RX_SLOTS - slot))
+  {
+    n = APP_RX_SLOTS - slot;
+  }
+  USBD_CDC_SetRxBuffer(&hUsbDeviceFS, &UserRxBufferFS[slot * APP_RX_SLOT_SIZE]);
+  USBD_CDC_SetRxBufferSize(&hUsbDeviceFS, n * APP_RX_SLOT_SIZE);
+  USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+}
+
+/**
+  * @brief  CDC_TxKick_FS
+  *         Start sending the longest contiguous chunk of the transmit ring,
+  *         up to APP_TX_CHUNK_SIZE, if the IN endpoint is idle. Must run from the USB interrupt or
+  *         with it masked.
+  * @retval None
+  */
+static void CDC_TxKick_FS(void)
+{
+  USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+  uint32_t head = TxHeadFS;
+  uint32_t tail = TxTailFS;
+
+  if ((hcdc == NULL) || (hcdc->TxState != 0) || (TxChunkFS != 0) || (head == tail))
+  {
+    return;
+  }
+
+  TxChunkFS = (head > tail) ? (head - tail) : (APP_TX_DATA_SIZE - tail);
+  if (TxChunkFS > APP_TX_CHUNK_SIZE)
+  {
+    TxChunkFS = APP_TX_CHUNK_SIZE;
+  }
+  USBD_CDC_SetTxBuffer(&hUsbDeviceFS, &UserTxBufferFS[tail], (uint16_t)TxChunkFS);
+  USBD_CDC_TransmitPacket(&hUsbDeviceFS);
+}
 
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
@@ -74,6 +74,13 @@
 #define USBD_SELF_POWERED     1
 /*---------- -----------*/
 #define MAX_STATIC_ALLOC_SIZE     512
+/*---------- -----------*/
+#ifndef USBD_CDC_DOUBLE_BUFFER
+#define USBD_CDC_DOUBLE_BUFFER     0
+#endif
+/*---------- -----------*/
+/* Endpoint buffers laid out in the packet memory by usbd_pma.h */
+#define USBD_PMA_ENDPOINTS(EP)     USBD_PMA_EP0_TABLE(EP) USBD_CDC_PMA_TABLE(EP)
 
 /****************************************/
 /* #define for FS and HS identification */